@@ -14,49 +14,90 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "mm_manager.h"
 
-#define TELCO_ID_REGION_CODE "\"%c%c\",\"%c%c%c\""
+#define TELCO_ID_REGION_CODE        "?,?"
+#define TELCO_ID_REGION_CODE_ARGS(telco) \
+    (const char *)(telco)->id, (int)sizeof((telco)->id), \
+    (const char *)(telco)->region_code, (int)sizeof((telco)->region_code)
 
 #ifdef MYSQL_DB
 #define AUTO_INCREMENT  "AUTO_INCREMENT"
 #define SQL_IGNORE      "IGNORE "
 #else
 #define AUTO_INCREMENT "AUTOINCREMENT"
-#define SQL_IGNORE      ""
+#define SQL_IGNORE      "OR IGNORE "
 #endif /* MYSQL */
 
+/* Dates and times are stored as the numbers YYYYMMDD and HHMMSS. */
+static int timestamp_to_db_date(const uint8_t *timestamp) {
+    return (timestamp[0] + 1900) * 10000 + timestamp[1] * 100 + timestamp[2];
+}
+
+static int timestamp_to_db_time(const uint8_t *timestamp) {
+    return timestamp[3] * 10000 + timestamp[4] * 100 + timestamp[5];
+}
+
+static void received_time_to_db(int *date, int *time_of_day) {
+    time_t rawtime;
+    struct tm ptm = { 0 };
+
+    time(&rawtime);
+    localtime_r(&rawtime, &ptm);
+    *date = (ptm.tm_year + 1900) * 10000 + (ptm.tm_mon + 1) * 100 + ptm.tm_mday;
+    *time_of_day = ptm.tm_hour * 10000 + ptm.tm_min * 100 + ptm.tm_sec;
+}
+
 
 int mm_acct_save_TALARM(void *db, mm_telco_t *telco, char *terminal_id, dlog_mt_alarm_t *alarm) {
-    char sql[512] = { 0 };
+    static const char sql_insert[] = "INSERT " SQL_IGNORE "INTO TALARM ( TERMINAL_ID, RECEIVED_DATE, RECEIVED_TIME, START_DATE, START_TIME, ALARM_ID, TELCO_ID, REGION_CODE,ALARM ) VALUES ( "
+        "?,?,?,?,?,?," TELCO_ID_REGION_CODE ",?);";
     char timestamp_str[20] = { 0 };
-    char received_time_str[16] = { 0 };
+    int received_date, received_time;
 
     printf("\t\tAlarm: %s: Type: %d (0x%02x) - %s\n",
             timestamp_to_string(alarm->timestamp, timestamp_str, sizeof(timestamp_str)),
             alarm->alarm_id, alarm->alarm_id,
             alarm_id_to_string(alarm->alarm_id));
 
-    snprintf(sql, sizeof(sql), "INSERT " SQL_IGNORE "INTO TALARM ( TERMINAL_ID, RECEIVED_DATE, RECEIVED_TIME, START_DATE, START_TIME, ALARM_ID, TELCO_ID, REGION_CODE,ALARM ) VALUES ( " \
-                               " \"%s\",%s,%s,%d," TELCO_ID_REGION_CODE ",\"%s\");",
+    received_time_to_db(&received_date, &received_time);
+
+    return mm_sql_exec_stmt(db, sql_insert, "siiiiiSSs",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
-        timestamp_to_db_string(alarm->timestamp, timestamp_str, sizeof(timestamp_str)),
+        received_date, received_time,
+        timestamp_to_db_date(alarm->timestamp), timestamp_to_db_time(alarm->timestamp),
         alarm->alarm_id,
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2],
+        TELCO_ID_REGION_CODE_ARGS(telco),
         alarm_id_to_string(alarm->alarm_id));
-
-    return mm_sql_exec(db, sql);
 }
 
 int mm_acct_save_TAUTH(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_funf_card_auth_t* auth_request) {
-    char sql[512] = { 0 };
+    static const char sql_insert[] = "INSERT " SQL_IGNORE "INTO TAUTH ( TERMINAL_ID, RECEIVED_DATE, RECEIVED_TIME,"
+        "INTERNATIONAL_CALL_IND,"
+        "CALLED_TELEPHONE_NO,"
+        "CARRIER_XREF_NUMBER,"
+        "CARD_NUMBER,"
+        "SERVICE_CODE,"
+        "CARD_EXPIRY_DATE,"
+        "INITIAL_DATE,"
+        "DISCRETIONARY,"
+        "SPARE_FORMATTED,"
+        "CARD_DATA,"
+        "PIN,"
+        "CALL_TYPE,"
+        "CARD_REF_NO,"
+        "SEQUENCE_NO,"
+        "FOLLOW_ON_IND,"
+        "TELCO_ID, REGION_CODE"
+        ") VALUES ( "
+        "?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?," TELCO_ID_REGION_CODE ");";
     char phone_number_string[21] = { 0 };
     char card_number_string[25] = { 0 };
     char call_type_str[38] = { 0 };
-    char received_time_str[16] = { 0 };
+    char card_expiry_str[16] = { 0 };
+    int received_date, received_time;
     int exp_year;
 
     phone_num_to_string(phone_number_string, sizeof(phone_number_string), auth_request->phone_number,
@@ -97,36 +138,20 @@ int mm_acct_save_TAUTH(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_f
         auth_request->unknown2);
 
 
-    snprintf(sql, sizeof(sql), "INSERT " SQL_IGNORE "INTO TAUTH ( TERMINAL_ID, RECEIVED_DATE, RECEIVED_TIME,"
-        "INTERNATIONAL_CALL_IND,"
-        "CALLED_TELEPHONE_NO,"
-        "CARRIER_XREF_NUMBER,"
-        "CARD_NUMBER,"
-        "SERVICE_CODE,"
-        "CARD_EXPIRY_DATE,"
-        "INITIAL_DATE,"
-        "DISCRETIONARY,"
-        "SPARE_FORMATTED,"
-        "CARD_DATA,"
-        "PIN,"
-        "CALL_TYPE,"
-        "CARD_REF_NO,"
-        "SEQUENCE_NO,"
-        "FOLLOW_ON_IND,"
-        "TELCO_ID, REGION_CODE"
-        ") VALUES ( " \
-        " \"%s\",%s,%d,\"%s\",%d,\"%s\",%d,%04x%02x,%04x%02x,%d,%d,%d,%d,%d,%d,%d,%d," TELCO_ID_REGION_CODE ");",
+    /* The expiry date is stored as the number formed by its BCD digits, YYYYMM. */
+    snprintf(card_expiry_str, sizeof(card_expiry_str), "%04x%02x", exp_year, auth_request->exp_mm);
+    received_time_to_db(&received_date, &received_time);
+
+    return mm_sql_exec_stmt(db, sql_insert, "siiisisiIiiiiiiiiiSS",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
+        received_date, received_time,
         0,
         phone_number_string,
         auth_request->carrier_ref,
         card_number_string,
         auth_request->service_code,
-        exp_year,
-        auth_request->exp_mm,
-        0, //auth_request->init_yy + 0x2000,
-        0, //auth_request->init_mm,
+        (int64_t)strtoll(card_expiry_str, NULL, 10),
+        0, //auth_request->init_yy + 0x2000, auth_request->init_mm,
         auth_request->control_flag,
         0,
         0,
@@ -135,10 +160,7 @@ int mm_acct_save_TAUTH(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_f
         auth_request->card_ref_num,
         auth_request->seq,
         (auth_request->control_flag & TAUTH_FOLLOW_ON_IND) ? 1 : 0,
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2]);
-
-    return mm_sql_exec(db, sql);
+        TELCO_ID_REGION_CODE_ARGS(telco));
 }
 
 const char* str_tcdr_flags[] = {
@@ -164,9 +186,10 @@ const char* str_tcdr_rate_flags[] = {
 };
 
 int mm_acct_save_TCDR(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_call_details_t *cdr) {
-    char sql[512] = { 0 };
+    static const char sql_insert[] = "INSERT " SQL_IGNORE "INTO TCDR ( TERMINAL_ID,RECEIVED_DATE,RECEIVED_TIME,SEQ,START_DATE,START_TIME,CALL_DURATION,CD_CALL_TYPE,CD_CALL_TYPE_STR,DIALED_NUM,CARD,REQUESTED,COLLECTED,CARRIER,RATE,TELCO_ID,REGION_CODE) VALUES ( "
+        "?,?,?,?,?,?,?,?,?,?,?,?,?,?,?," TELCO_ID_REGION_CODE ");";
     char timestamp_str[20] = { 0 };
-    char received_time_str[16] = { 0 };
+    int received_date, received_time;
     char phone_number_string[21];
     char card_number_string[21];
     char call_type_str[38];
@@ -199,68 +222,29 @@ int mm_acct_save_TCDR(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_ca
     printf("\n\t\t\tDLOG_MT_CALL_DETAILS Auth code: %" PRIu64 "\n", cdr->auth_code);
 #endif /* CDR_DEBUG */
 
-    snprintf(sql, sizeof(sql), "INSERT " SQL_IGNORE "INTO TCDR ( TERMINAL_ID,RECEIVED_DATE,RECEIVED_TIME,SEQ,START_DATE,START_TIME,CALL_DURATION,CD_CALL_TYPE,CD_CALL_TYPE_STR,DIALED_NUM,CARD,REQUESTED,COLLECTED,CARRIER,RATE,TELCO_ID,REGION_CODE) VALUES ( " \
-                               " \"%s\",%s,%d,%s,%d,%d,\"%s\",\"%s\",\"%s\",\"%6.2f\",\"%6.2f\",%d,%d," TELCO_ID_REGION_CODE ");",
+    received_time_to_db(&received_date, &received_time);
+
+    return mm_sql_exec_stmt(db, sql_insert, "siiiiiiisssddiiSS",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
+        received_date, received_time,
         cdr->seq,
-        timestamp_to_db_string(cdr->start_timestamp, timestamp_str, sizeof(timestamp_str)),
+        timestamp_to_db_date(cdr->start_timestamp), timestamp_to_db_time(cdr->start_timestamp),
         cdr->call_duration[0] * 3600 +
         cdr->call_duration[1] * 60 +
         cdr->call_duration[2],
         cdr->call_type,
-        call_type_to_string(cdr->call_type & (~FLAG_CDR_IXL), call_type_str, sizeof(call_type_str)),
-        phone_num_to_string(phone_number_string, sizeof(phone_number_string), cdr->called_num,
-                            sizeof(cdr->called_num)),
-        phone_num_to_string(card_number_string,  sizeof(card_number_string),  cdr->card_num,
-                            sizeof(cdr->card_num)),
-        (float)cdr->call_cost[1] / 100,
-        (float)cdr->call_cost[0] / 100,
+        call_type_str,
+        phone_number_string,
+        card_number_string,
+        (double)cdr->call_cost[1] / 100,
+        (double)cdr->call_cost[0] / 100,
         cdr->carrier_code,
         cdr->rate_type,
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2]);
-
-    return mm_sql_exec(db, sql);
+        TELCO_ID_REGION_CODE_ARGS(telco));
 }
 
 int mm_acct_save_TCALLST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_summary_call_stats_t* summary_call_stats) {
-    char sql[1024] = { 0 };
-    char received_time_str[16] = { 0 };
-    char timestamp_str[20] = { 0 };
-    char timestamp2_str[20] = { 0 };
-    char timestamp3_str[20] = { 0 };
-    char timestamp4_str[20] = { 0 };
-
-    printf("\t\t\tSummary Call Statistics: From: %s, to: %s:\n",
-        timestamp_to_string(summary_call_stats->start_timestamp, timestamp_str, sizeof(timestamp_str)),
-        timestamp_to_string(summary_call_stats->end_timestamp, timestamp2_str, sizeof(timestamp2_str)));
-
-    for (int j = 0; j < 16; j++) {
-        printf("\t\t\t\t%s: %5d\n", TCALSTE_stats_to_str(j), summary_call_stats->stats[j]);
-    }
-    printf("\n\t\t\t\tRep Dialer Peg Counts:\t");
-
-    for (int j = 0; j < 10; j++) {
-        if (j == 5) {
-            printf("\n\t\t\t\t\t\t\t");
-        }
-        printf("%d, ", summary_call_stats->rep_dialer_peg_count[j]);
-    }
-
-    seconds_to_ddhhmmss_string(timestamp3_str, sizeof(timestamp3_str), summary_call_stats->total_call_duration);
-    printf("\n\t\t\t\tTotal Call duration: %s (%us)\n",
-        timestamp3_str, summary_call_stats->total_call_duration);
-
-    seconds_to_ddhhmmss_string(timestamp4_str, sizeof(timestamp4_str), summary_call_stats->total_time_off_hook);
-    printf("\t\t\t\tTotal Off-hook duration: %s (%us)\n", timestamp4_str, summary_call_stats->total_time_off_hook);
-
-    printf("\t\t\t\tFree Feature B Call Count: %d\n", summary_call_stats->free_featb_call_count);
-    printf("\t\t\t\tCompleted 1-800 billable Count: %d\n", summary_call_stats->completed_1800_billable_count);
-    printf("\t\t\t\tDatajack calls attempted: %d\n", summary_call_stats->datajack_calls_attempt_count);
-    printf("\t\t\t\tDatajack calls completed: %d\n", summary_call_stats->datajack_calls_complete_count);
-
-    snprintf(sql, sizeof(sql), "INSERT " SQL_IGNORE "INTO TCALLST("
+    static const char sql_insert[] = "INSERT " SQL_IGNORE "INTO TCALLST("
         "TERMINAL_ID,"
         "RECEIVED_DATE, RECEIVED_TIME,"
         "SUMMARY_PERIOD_START_DATE,SUMMARY_PERIOD_START_TIME,"
@@ -295,16 +279,53 @@ int mm_acct_save_TCALLST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
         "TOTAL_TIME_OFF_HOOK,"
         "TELCO_ID, REGION_CODE"
         ") VALUES ( "
-        "\"%s\",%s,"
-        "%s, %s,"
-        "%d,%d,%d,%d,%d,%d,%d,%d,"
-        "%d,%d,%d,%d,%d,%d,%d,%d,"
-        "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,"    /* Rep dialer peg counts */
-        "\"%s\", \"%s\"," TELCO_ID_REGION_CODE ");",
+        "?,?,?,"
+        "?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,?,?,"    /* Rep dialer peg counts */
+        "?,?," TELCO_ID_REGION_CODE ");";
+    int received_date, received_time;
+    char timestamp_str[20] = { 0 };
+    char timestamp2_str[20] = { 0 };
+    char timestamp3_str[20] = { 0 };
+    char timestamp4_str[20] = { 0 };
+
+    printf("\t\t\tSummary Call Statistics: From: %s, to: %s:\n",
+        timestamp_to_string(summary_call_stats->start_timestamp, timestamp_str, sizeof(timestamp_str)),
+        timestamp_to_string(summary_call_stats->end_timestamp, timestamp2_str, sizeof(timestamp2_str)));
+
+    for (int j = 0; j < 16; j++) {
+        printf("\t\t\t\t%s: %5d\n", TCALSTE_stats_to_str(j), summary_call_stats->stats[j]);
+    }
+    printf("\n\t\t\t\tRep Dialer Peg Counts:\t");
+
+    for (int j = 0; j < 10; j++) {
+        if (j == 5) {
+            printf("\n\t\t\t\t\t\t\t");
+        }
+        printf("%d, ", summary_call_stats->rep_dialer_peg_count[j]);
+    }
+
+    seconds_to_ddhhmmss_string(timestamp3_str, sizeof(timestamp3_str), summary_call_stats->total_call_duration);
+    printf("\n\t\t\t\tTotal Call duration: %s (%us)\n",
+        timestamp3_str, summary_call_stats->total_call_duration);
+
+    seconds_to_ddhhmmss_string(timestamp4_str, sizeof(timestamp4_str), summary_call_stats->total_time_off_hook);
+    printf("\t\t\t\tTotal Off-hook duration: %s (%us)\n", timestamp4_str, summary_call_stats->total_time_off_hook);
+
+    printf("\t\t\t\tFree Feature B Call Count: %d\n", summary_call_stats->free_featb_call_count);
+    printf("\t\t\t\tCompleted 1-800 billable Count: %d\n", summary_call_stats->completed_1800_billable_count);
+    printf("\t\t\t\tDatajack calls attempted: %d\n", summary_call_stats->datajack_calls_attempt_count);
+    printf("\t\t\t\tDatajack calls completed: %d\n", summary_call_stats->datajack_calls_complete_count);
+
+    received_time_to_db(&received_date, &received_time);
+
+    return mm_sql_exec_stmt(db, sql_insert, "siiiiii" "iiiiiiii" "iiiiiiii" "iiiiiiiiii" "ssSS",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
-        timestamp_to_db_string(summary_call_stats->start_timestamp, timestamp_str, sizeof(timestamp_str)),
-        timestamp_to_db_string(summary_call_stats->end_timestamp, timestamp2_str, sizeof(timestamp2_str)),
+        received_date, received_time,
+        timestamp_to_db_date(summary_call_stats->start_timestamp), timestamp_to_db_time(summary_call_stats->start_timestamp),
+        timestamp_to_db_date(summary_call_stats->end_timestamp), timestamp_to_db_time(summary_call_stats->end_timestamp),
         summary_call_stats->stats[0], summary_call_stats->stats[1], summary_call_stats->stats[2], summary_call_stats->stats[3],
         summary_call_stats->stats[4], summary_call_stats->stats[5], summary_call_stats->stats[6], summary_call_stats->stats[7],
         summary_call_stats->stats[8], summary_call_stats->stats[9], summary_call_stats->stats[10], summary_call_stats->stats[11],
@@ -316,10 +337,7 @@ int mm_acct_save_TCALLST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
         summary_call_stats->rep_dialer_peg_count[8], summary_call_stats->rep_dialer_peg_count[9],
         timestamp3_str,
         timestamp4_str,
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2]);
-
-    return mm_sql_exec(db, sql);
+        TELCO_ID_REGION_CODE_ARGS(telco));
 }
 
 int mm_acct_load_TCASHST(void *db, char* terminal_id, cashbox_status_univ_t* cashbox_status) {
@@ -345,9 +363,16 @@ int mm_acct_load_TCASHST(void *db, char* terminal_id, cashbox_status_univ_t* cas
 }
 
 int mm_acct_save_TCASHST(void *db, mm_telco_t *telco, char* terminal_id, cashbox_status_univ_t* cashbox_status) {
-    char sql[512] = { 0 };
-    char received_time_str[16] = { 0 };
+    static const char sql_insert[] = "REPLACE INTO TCASHST ( "
+        "TERMINAL_ID,RECEIVED_DATE,RECEIVED_TIME,START_DATE,START_TIME, CASH_BOX_STATUS, PERCENT_FULL, CURRENCY_VALUE,"
+        "NUMBER_OF_CDN_NICKELS, NUMBER_OF_CDN_DIMES, NUMBER_OF_CDN_QUARTERS, NUMBER_OF_CDN_DOLLARS,"
+        "NUMBER_OF_US_NICKELS,  NUMBER_OF_US_DIMES,  NUMBER_OF_US_QUARTERS,  NUMBER_OF_US_DOLLARS,"
+        "TELCO_ID, REGION_CODE"
+        ") VALUES ( "
+        "?,?,?,?,?,?,?,?, "
+        "?,?,?,?,?,?,?,?, " TELCO_ID_REGION_CODE ");";
     char timestamp_str[20];
+    int received_date, received_time;
 
     printf("\t\tCashbox status: %s: Total: $%6.2f (%3d%% full): CA N:%d D:%d Q:%d $:%d - US N:%d D:%d Q:%d $:%d\n",
         timestamp_to_string(cashbox_status->timestamp, timestamp_str, sizeof(timestamp_str)),
@@ -362,20 +387,16 @@ int mm_acct_save_TCASHST(void *db, mm_telco_t *telco, char* terminal_id, cashbox
         cashbox_status->coin_count[COIN_COUNT_US_QUARTERS],
         cashbox_status->coin_count[COIN_COUNT_US_DOLLARS]);
 
-    snprintf(sql, sizeof(sql), "REPLACE INTO TCASHST ( "
-        "TERMINAL_ID,RECEIVED_DATE,RECEIVED_TIME,START_DATE,START_TIME, CASH_BOX_STATUS, PERCENT_FULL, CURRENCY_VALUE,"
-        "NUMBER_OF_CDN_NICKELS, NUMBER_OF_CDN_DIMES, NUMBER_OF_CDN_QUARTERS, NUMBER_OF_CDN_DOLLARS,"
-        "NUMBER_OF_US_NICKELS,  NUMBER_OF_US_DIMES,  NUMBER_OF_US_QUARTERS,  NUMBER_OF_US_DOLLARS,"
-        "TELCO_ID, REGION_CODE"
-        ") VALUES ( "
-        "\"%s\",%s,%s,%d,%d,\"%6.2f\", "
-        "%d, %d, %d, %d, %d, %d, %d, %d, " TELCO_ID_REGION_CODE ");",
+    received_time_to_db(&received_date, &received_time);
+
+    /* Note: PERCENT_FULL and CASH_BOX_STATUS are swapped here and in mm_sql_load_TCASHST(). */
+    return mm_sql_exec_stmt(db, sql_insert, "siiiiiid" "iiiiiiii" "SS",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
-        timestamp_to_db_string(cashbox_status->timestamp, timestamp_str, sizeof(timestamp_str)),
+        received_date, received_time,
+        timestamp_to_db_date(cashbox_status->timestamp), timestamp_to_db_time(cashbox_status->timestamp),
         cashbox_status->percent_full,
         cashbox_status->status,
-        (float)cashbox_status->currency_value / 100,
+        (double)cashbox_status->currency_value / 100,
         cashbox_status->coin_count[COIN_COUNT_CA_NICKELS],
         cashbox_status->coin_count[COIN_COUNT_CA_DIMES],
         cashbox_status->coin_count[COIN_COUNT_CA_QUARTERS],
@@ -384,16 +405,20 @@ int mm_acct_save_TCASHST(void *db, mm_telco_t *telco, char* terminal_id, cashbox
         cashbox_status->coin_count[COIN_COUNT_US_DIMES],
         cashbox_status->coin_count[COIN_COUNT_US_QUARTERS],
         cashbox_status->coin_count[COIN_COUNT_US_DOLLARS],
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2]);
-
-    return mm_sql_exec(db, sql);
+        TELCO_ID_REGION_CODE_ARGS(telco));
 }
 
 int mm_acct_save_TCOLLST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_cash_box_collection_t* cash_box_collection) {
-    char sql[512] = { 0 };
-    char received_time_str[16] = { 0 };
+    static const char sql_insert[] = "INSERT " SQL_IGNORE "INTO TCOLLST ( "
+        "TERMINAL_ID,RECEIVED_DATE,RECEIVED_TIME,COLLECTION_DATE,COLLECTION_TIME,"
+        "CASH_BOX_STATUS, PERCENT_FULL, CURRENCY_VALUE,"
+        "NUMBER_OF_CDN_NICKELS, NUMBER_OF_CDN_DIMES, NUMBER_OF_CDN_QUARTERS, NUMBER_OF_CDN_DOLLARS,"
+        "NUMBER_OF_US_NICKELS,  NUMBER_OF_US_DIMES,  NUMBER_OF_US_QUARTERS,  NUMBER_OF_US_DOLLARS, "
+        "TELCO_ID, REGION_CODE ) VALUES ( "
+        "?,?,?,?,?,?,?,?, "
+        "?,?,?,?,?,?,?,?," TELCO_ID_REGION_CODE ")";
     char timestamp_str[20];
+    int received_date, received_time;
 
     printf("\t\tCashbox Collection: %s: Total: $%6.2f (%3d%% full): CA N:%d D:%d Q:%d $:%d - US N:%d D:%d Q:%d $:%d\n",
         timestamp_to_string(cash_box_collection->timestamp, timestamp_str, sizeof(timestamp_str)),
@@ -419,20 +444,15 @@ int mm_acct_save_TCOLLST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
     dump_hex(cash_box_collection->spare, sizeof(cash_box_collection->spare));
 #endif /* CASHBOX_DEBUG */
 
-    snprintf(sql, sizeof(sql), "INSERT " SQL_IGNORE "INTO TCOLLST ( "
-        "TERMINAL_ID,RECEIVED_DATE,RECEIVED_TIME,COLLECTION_DATE,COLLECTION_TIME,"
-        "CASH_BOX_STATUS, PERCENT_FULL, CURRENCY_VALUE,"
-        "NUMBER_OF_CDN_NICKELS, NUMBER_OF_CDN_DIMES, NUMBER_OF_CDN_QUARTERS, NUMBER_OF_CDN_DOLLARS,"
-        "NUMBER_OF_US_NICKELS,  NUMBER_OF_US_DIMES,  NUMBER_OF_US_QUARTERS,  NUMBER_OF_US_DOLLARS, "
-        "TELCO_ID, REGION_CODE ) VALUES ( "
-        "\"%s\",%s,%s,%d,%d,\"%6.2f\", "
-        "%d, %d, %d, %d, %d, %d, %d, %d," TELCO_ID_REGION_CODE ")",
+    received_time_to_db(&received_date, &received_time);
+
+    return mm_sql_exec_stmt(db, sql_insert, "siiiiiid" "iiiiiiii" "SS",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
-        timestamp_to_db_string(cash_box_collection->timestamp, timestamp_str, sizeof(timestamp_str)),
+        received_date, received_time,
+        timestamp_to_db_date(cash_box_collection->timestamp), timestamp_to_db_time(cash_box_collection->timestamp),
         cash_box_collection->percent_full,
         cash_box_collection->status,
-        (float)cash_box_collection->currency_value / 100,
+        (double)cash_box_collection->currency_value / 100,
         cash_box_collection->coin_count[COIN_COUNT_CA_NICKELS],
         cash_box_collection->coin_count[COIN_COUNT_CA_DIMES],
         cash_box_collection->coin_count[COIN_COUNT_CA_QUARTERS],
@@ -441,39 +461,33 @@ int mm_acct_save_TCOLLST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
         cash_box_collection->coin_count[COIN_COUNT_US_DIMES],
         cash_box_collection->coin_count[COIN_COUNT_US_QUARTERS],
         cash_box_collection->coin_count[COIN_COUNT_US_DOLLARS],
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2]);
-
-    return mm_sql_exec(db, sql);
+        TELCO_ID_REGION_CODE_ARGS(telco));
 }
 
 int mm_acct_save_TOPCODE(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_maint_req_t *maint) {
-    char sql[256] = { 0 };
-    char received_time_str[16] = { 0 };
+    static const char sql_insert[] = "INSERT INTO TOPCODE ( TERMINAL_ID,RECEIVED_DATE,RECEIVED_TIME,OP_CODE,PIN,TELCO_ID,REGION_CODE ) VALUES ( "
+        "?,?,?,?,?, " TELCO_ID_REGION_CODE ")";
+    char pin_str[8] = { 0 };
+    int received_date, received_time;
 
     printf("\t\tMaintenance Type: %d (0x%03x) Access PIN: %02x%02x%01x\n",
         maint->type, maint->type,
         maint->access_pin[0], maint->access_pin[1], (maint->access_pin[2] & 0xF0) >> 4);
 
-    snprintf(sql, sizeof(sql), "INSERT INTO TOPCODE ( TERMINAL_ID,RECEIVED_DATE,RECEIVED_TIME,OP_CODE,PIN,TELCO_ID,REGION_CODE ) VALUES ( " \
-                               " \"%s\",%s,%d,\" %02x%02x%01x\", " TELCO_ID_REGION_CODE ")",
+    snprintf(pin_str, sizeof(pin_str), " %02x%02x%01x",
+        maint->access_pin[0], maint->access_pin[1], (maint->access_pin[2] & 0xF0) >> 4);
+    received_time_to_db(&received_date, &received_time);
+
+    return mm_sql_exec_stmt(db, sql_insert, "siiisSS",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
+        received_date, received_time,
         maint->type,
-        maint->access_pin[0], maint->access_pin[1], (maint->access_pin[2] & 0xF0) >> 4,
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2]);
-
-    return mm_sql_exec(db, sql);
+        pin_str,
+        TELCO_ID_REGION_CODE_ARGS(telco));
 }
 
 int mm_acct_save_TPERFST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_perf_stats_record_t* perf_stats) {
-    char sql[1536] = { 0 };
-    char received_time_str[16] = { 0 };
-    char timestamp_str[20];
-    char timestamp2_str[20];
-
-    snprintf(sql, sizeof(sql), "INSERT " SQL_IGNORE "INTO TPERFST("
+    static const char sql_insert[] = "INSERT " SQL_IGNORE "INTO TPERFST("
         "TERMINAL_ID,"
         "RECEIVED_DATE, RECEIVED_TIME,"
         "SUMMARY_PERIOD_START_DATE,"
@@ -525,18 +539,25 @@ int mm_acct_save_TPERFST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
         "SPARE3,"
         "TELCO_ID, REGION_CODE"
         ") VALUES ( "
-        "\"%s\",%s,"
-        "%s, %s,"
-        "%d,%d,%d,%d,%d,%d,%d,%d,"
-        "%d,%d,%d,%d,%d,%d,%d,%d,"
-        "%d,%d,%d,%d,%d,%d,%d,%d,"
-        "%d,%d,%d,%d,%d,%d,%d,%d,"
-        "%d,%d,%d,%d,%d,%d,%d,%d,"
-        "%d,%d,%d," TELCO_ID_REGION_CODE ");",
+        "?,?,?,"
+        "?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?," TELCO_ID_REGION_CODE ");";
+    int received_date, received_time;
+    char timestamp_str[20];
+    char timestamp2_str[20];
+
+    received_time_to_db(&received_date, &received_time);
+
+    mm_sql_exec_stmt(db, sql_insert, "siiiiii" "iiiiiiii" "iiiiiiii" "iiiiiiii" "iiiiiiii" "iiiiiiii" "iiiSS",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
-        timestamp_to_db_string(perf_stats->timestamp, timestamp_str, sizeof(timestamp_str)),
-        timestamp_to_db_string(perf_stats->timestamp2, timestamp2_str, sizeof(timestamp2_str)),
+        received_date, received_time,
+        timestamp_to_db_date(perf_stats->timestamp), timestamp_to_db_time(perf_stats->timestamp),
+        timestamp_to_db_date(perf_stats->timestamp2), timestamp_to_db_time(perf_stats->timestamp2),
         perf_stats->stats[0], perf_stats->stats[1], perf_stats->stats[2], perf_stats->stats[3],
         perf_stats->stats[4], perf_stats->stats[5], perf_stats->stats[6], perf_stats->stats[7],
         perf_stats->stats[8], perf_stats->stats[9], perf_stats->stats[10], perf_stats->stats[11],
@@ -548,10 +569,7 @@ int mm_acct_save_TPERFST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
         perf_stats->stats[32], perf_stats->stats[33], perf_stats->stats[34], perf_stats->stats[35],
         perf_stats->stats[36], perf_stats->stats[37], perf_stats->stats[38], perf_stats->stats[39],
         perf_stats->stats[40], perf_stats->stats[41], perf_stats->stats[42],
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2]);
-
-    mm_sql_exec(db, sql);
+        TELCO_ID_REGION_CODE_ARGS(telco));
 
     printf("\t\tPerformance Statistics Record: From: %s, to: %s:\n",
         timestamp_to_string(perf_stats->timestamp, timestamp_str, sizeof(timestamp_str)),
@@ -565,7 +583,61 @@ int mm_acct_save_TPERFST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
 }
 
 int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_term_status_t* dlog_mt_term_status) {
-    char sql[1536] = { 0 };
+    static const char sql_insert[] = "INSERT INTO TSTATUS ( "
+        "TERMINAL_ID,"
+        "RECEIVED_DATE, RECEIVED_TIME,"
+        "SERIAL_NO,"
+        "STATUS_WORD,"
+        "HANDSET_DISCONT_IND,"
+        "TELEPHONY_STATUS_IND,"
+        "EPM_SAM_NOT_RESPONDING,"
+        "EPM_SAM_LOCKED_OUT,"
+        "EPM_SAM_EXPIRED,"
+        "EPM_SAM_REACHING_TRANS_LIMIT,"
+        "UNABLE_REACH_PRIM_COL_SYS,"
+        "TELEPHONY_STATUS_BIT_7,"
+        "POWER_FAIL_IND,"
+        "DISPLAY_RESPONSE_IND,"
+        "VOICE_SYNTHESIS_RESPONSE_IND,"
+        "UNABLE_REACH_SECOND_COL_SYS,"
+        "CARD_READER_BLOCKED_ALARM,"
+        "MANDATORY_TABLE_ALARM,"
+        "DATAJACK_PORT_BLOCKED,"
+        "CTRL_HW_STATUS_BIT_7,"
+        "CDR_CHECKSUM_ERR_IND,"
+        "STATISTICS_CHECKSUM_ERR_IND,"
+        "TERMINAL_TBL_CHECKSUM_ERR_IND,"
+        "OTHER_DATA_CHECKSUM_ERR_IND,"
+        "CDR_LIST_FULL_ERR_IND,"
+        "BAD_EEPROM_ERR_IND,"
+        "MEMORY_LOST_ERROR_IND,"
+        "MEMORY_BAD_ERR_IND,"
+        "ACCESS_COVER_IND,"
+        "KEY_MATRIX_MALFUNC_IND,"
+        "SET_REMOVAL_IND,"
+        "THRESHOLD_MET_EXCEEDED_IND,"
+        "CASH_BOX_COVER_OPEN_IND,"
+        "CASH_BOX_REMOVED_IND,"
+        "COIN_BOX_FULL_IND,"
+        "COIN_JAM_COIN_CHUTE_IND,"
+        "ESCROW_JAM_IND,"
+        "VAL_HARDWARE_FAIL_IND,"
+        "CO_LINE_CHECK_FAIL_IND,"
+        "DIALOG_FAILURE_IND,"
+        "CASH_BOX_ELECTRONIC_LOCK_IND,"
+        "DIALOG_FAILURE_WITH_COL_SYS,"
+        "CODE_SERVE_CONNECTION_FAILURE,"
+        "CODE_SERVER_ABORTED,"
+        "TELCO_ID, REGION_CODE"
+        ") VALUES ( "
+        "?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        "?,?,?,?,?,?,?,?,"
+        TELCO_ID_REGION_CODE ")";
+    char sql[128] = { 0 };
     uint8_t  serial_number[11] = { 0 };
     uint64_t term_status_word;
     uint64_t last_status_word = 0LL;
@@ -594,66 +666,16 @@ int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
     last_status_word = mm_sql_read_uint64(db, sql);
 
     if (term_status_word != last_status_word) {
-        char received_time_str[16] = { 0 };
-
-        snprintf(sql, sizeof(sql), "INSERT INTO TSTATUS ( "
-            "TERMINAL_ID,"
-            "RECEIVED_DATE, RECEIVED_TIME,"
-            "SERIAL_NO,"
-            "STATUS_WORD,"
-            "HANDSET_DISCONT_IND,"
-            "TELEPHONY_STATUS_IND,"
-            "EPM_SAM_NOT_RESPONDING,"
-            "EPM_SAM_LOCKED_OUT,"
-            "EPM_SAM_EXPIRED,"
-            "EPM_SAM_REACHING_TRANS_LIMIT,"
-            "UNABLE_REACH_PRIM_COL_SYS,"
-            "TELEPHONY_STATUS_BIT_7,"
-            "POWER_FAIL_IND,"
-            "DISPLAY_RESPONSE_IND,"
-            "VOICE_SYNTHESIS_RESPONSE_IND,"
-            "UNABLE_REACH_SECOND_COL_SYS,"
-            "CARD_READER_BLOCKED_ALARM,"
-            "MANDATORY_TABLE_ALARM,"
-            "DATAJACK_PORT_BLOCKED,"
-            "CTRL_HW_STATUS_BIT_7,"
-            "CDR_CHECKSUM_ERR_IND,"
-            "STATISTICS_CHECKSUM_ERR_IND,"
-            "TERMINAL_TBL_CHECKSUM_ERR_IND,"
-            "OTHER_DATA_CHECKSUM_ERR_IND,"
-            "CDR_LIST_FULL_ERR_IND,"
-            "BAD_EEPROM_ERR_IND,"
-            "MEMORY_LOST_ERROR_IND,"
-            "MEMORY_BAD_ERR_IND,"
-            "ACCESS_COVER_IND,"
-            "KEY_MATRIX_MALFUNC_IND,"
-            "SET_REMOVAL_IND,"
-            "THRESHOLD_MET_EXCEEDED_IND,"
-            "CASH_BOX_COVER_OPEN_IND,"
-            "CASH_BOX_REMOVED_IND,"
-            "COIN_BOX_FULL_IND,"
-            "COIN_JAM_COIN_CHUTE_IND,"
-            "ESCROW_JAM_IND,"
-            "VAL_HARDWARE_FAIL_IND,"
-            "CO_LINE_CHECK_FAIL_IND,"
-            "DIALOG_FAILURE_IND,"
-            "CASH_BOX_ELECTRONIC_LOCK_IND,"
-            "DIALOG_FAILURE_WITH_COL_SYS,"
-            "CODE_SERVE_CONNECTION_FAILURE,"
-            "CODE_SERVER_ABORTED,"
-            "TELCO_ID, REGION_CODE"
-            ") VALUES ( "
-            "\"%s\",%s,\"%s\",%" PRIu64 ","
-            "%d,%d,%d,%d,%d,%d,%d,%d,"
-            "%d,%d,%d,%d,%d,%d,%d,%d,"
-            "%d,%d,%d,%d,%d,%d,%d,%d,"
-            "%d,%d,%d,%d,%d,%d,%d,%d,"
-            "%d,%d,%d,%d,%d,%d,%d,%d,"
-            TELCO_ID_REGION_CODE ")",
+        int received_date, received_time;
+        int rc;
+
+        received_time_to_db(&received_date, &received_time);
+
+        rc = mm_sql_exec_stmt(db, sql_insert, "siisI" "iiiiiiii" "iiiiiiii" "iiiiiiii" "iiiiiiii" "iiiiiiii" "SS",
             terminal_id,
-            received_time_to_db_string(received_time_str, sizeof(received_time_str)),
+            received_date, received_time,
             serial_number,
-            term_status_word,
+            (int64_t)term_status_word,
             (term_status_word & TSTATUS_HANDSET_DISCONT_IND) ? 1 : 0,
             (term_status_word & TSTATUS_TELEPHONY_STATUS_IND) ? 1 : 0,
             (term_status_word & TSTATUS_EPM_SAM_NOT_RESPONDING) ? 1 : 0,
@@ -694,10 +716,9 @@ int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
             (term_status_word & TSTATUS_DIALOG_FAILURE_WITH_COL_SYS) ? 1 : 0,
             (term_status_word & TSTATUS_CODE_SERVE_CONNECTION_FAILURE) ? 1 : 0,
             (term_status_word & TSTATUS_CODE_SERVER_ABORTED) ? 1 : 0,
-            telco->id[0], telco->id[1],
-            telco->region_code[0], telco->region_code[1], telco->region_code[2]);
+            TELCO_ID_REGION_CODE_ARGS(telco));
 
-        if (mm_sql_exec(db, sql) != 0) {
+        if (rc != 0) {
             fprintf(stderr, "%s: Failed to save TSTATUS.", __func__);
             return 1;
         }
@@ -714,8 +735,14 @@ int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
 }
 
 int mm_acct_save_TSWVERS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_sw_version_t* dlog_mt_sw_version, uint8_t *terminal_type) {
-    char sql[512] = { 0 };
-    char received_time_str[16] = { 0 };
+    static const char sql_insert[] = "INSERT " SQL_IGNORE "INTO TSWVERS ( "
+        "TERMINAL_ID,EFFECTIVE_DATE,EFFECTIVE_TIME,"
+        "CONTROL_ROM_EDITION,CONTROL_VERSION_NO,TELEPHONY_ROM_EDITION,TELEPHONY_VERSION_NO,"
+        "FEATURE_TERMINAL_TYPE,TERMINAL_TYPE,VALIDATOR_SOFTWARE_VERS,VALIDATOR_HARDWARE_VERS,"
+        "TELCO_ID, REGION_CODE"
+        " ) VALUES ( "
+        "?,?,?,?,?,?,?,?,?,?,?," TELCO_ID_REGION_CODE ")";
+    int received_date, received_time;
 
     char control_rom_edition[sizeof(dlog_mt_sw_version->control_rom_edition) + 1] = { 0 };
     char control_version[sizeof(dlog_mt_sw_version->control_version) + 1] = { 0 };
@@ -756,15 +783,11 @@ int mm_acct_save_TSWVERS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
     printf("\t\t\tValidator Hardware Version: %s\n", validator_hw_ver);
     printf("\t\t\tValidator Software Version: %s\n", validator_sw_ver);
 
-    snprintf(sql, sizeof(sql), "INSERT " SQL_IGNORE "INTO TSWVERS ( "
-        "TERMINAL_ID,EFFECTIVE_DATE,EFFECTIVE_TIME,"
-        "CONTROL_ROM_EDITION,CONTROL_VERSION_NO,TELEPHONY_ROM_EDITION,TELEPHONY_VERSION_NO,"
-        "FEATURE_TERMINAL_TYPE,TERMINAL_TYPE,VALIDATOR_SOFTWARE_VERS,VALIDATOR_HARDWARE_VERS,"
-        "TELCO_ID, REGION_CODE"
-        " ) VALUES ( "
-        "\"%s\",%s,\"%s\",\"%s\",\"%s\",\"%s\",%d,%d,\"%s\",\"%s\"," TELCO_ID_REGION_CODE ")",
+    received_time_to_db(&received_date, &received_time);
+
+    return mm_sql_exec_stmt(db, sql_insert, "siissssiissSS",
         terminal_id,
-        received_time_to_db_string(received_time_str, sizeof(received_time_str)),
+        received_date, received_time,
         control_rom_edition,
         control_version,
         telephony_rom_edition,
@@ -773,10 +796,7 @@ int mm_acct_save_TSWVERS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
         dlog_mt_sw_version->term_type,
         validator_sw_ver,
         validator_hw_ver,
-        telco->id[0], telco->id[1],
-        telco->region_code[0], telco->region_code[1], telco->region_code[2]);
-
-    return mm_sql_exec(db, sql);
+        TELCO_ID_REGION_CODE_ARGS(telco));
 }
 
 int mm_acct_create_tables(void *db) {
@@ -0,0 +1,384 @@
+/*
+ * Accounting record writer, part of mm_manager.
+ *
+ * Lines queue decoded accounting tables into a bounded ring; one writer
+ * thread drains it into the database, in the order the records arrived.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mm_acct_writer.h"
+#include "mm_thread.h"
+
+#define ACCT_RING_SIZE      64  /* Records; several full uploads from every line. */
+
+#define ACCT_OP_SAVE        0   /* Save an accounting table */
+#define ACCT_OP_BEGIN       1   /* Hold the line's records until it commits */
+#define ACCT_OP_COMMIT      2   /* Write the line's records in one transaction, then signal the barrier */
+#define ACCT_OP_FLUSH       3   /* Write the line's records so far, then signal the barrier */
+
+typedef struct mm_acct_barrier {
+    int done;
+    int status;
+} mm_acct_barrier_t;
+
+typedef struct mm_acct_record {
+    uint8_t op;
+    uint8_t line;
+    uint8_t table_id;
+    char terminal_id[11];
+    mm_acct_barrier_t* barrier;
+    union {
+        dlog_mt_alarm_t alarm;
+        dlog_mt_maint_req_t maint;
+        dlog_mt_call_details_t cdr;
+        dlog_mt_cash_box_collection_t cash_box_collection;
+        dlog_mt_term_status_t term_status;
+        cashbox_status_univ_t cashbox_status;
+        dlog_mt_perf_stats_record_t perf_stats;
+        dlog_mt_summary_call_stats_t summary_call_stats;
+        dlog_mt_funf_card_auth_t auth_request;
+    } data;
+} mm_acct_record_t;
+
+/*
+ * Records a line saves between BEGIN and COMMIT are held here, and
+ * written in a transaction of their own when it commits, so one line's
+ * COMMIT never takes in another line's unfinished batch.
+ *
+ * status is the first error in saving the line's records since BEGIN,
+ * or outside a transaction, since the last barrier.  The barrier that
+ * ends the batch reports it, and the batch is rolled back.
+ */
+typedef struct mm_acct_line {
+    int in_trans;
+    int status;
+    size_t count;
+    size_t size;
+    mm_acct_record_t* pending;
+} mm_acct_line_t;
+
+struct mm_acct_writer {
+    void* db;
+    mm_telco_t* telco;
+    int threaded;
+    int running;
+    mm_thread_t thread;
+    mm_mutex_t lock;
+    mm_cond_t not_empty;
+    mm_cond_t not_full;
+    mm_cond_t barrier_done;
+    uint32_t head;              /* Next record to fill, owned by the lines */
+    uint32_t tail;              /* Next record to write, owned by the writer */
+    mm_acct_record_t ring[ACCT_RING_SIZE];
+    mm_acct_line_t lines[MM_MAX_LINES];  /* Owned by the writer */
+};
+
+static int acct_save_record(mm_acct_writer_t* writer, mm_acct_record_t* record) {
+    void* db = writer->db;
+
+    switch (record->table_id) {
+        case DLOG_MT_ALARM:
+            return mm_acct_save_TALARM(db, writer->telco, record->terminal_id, &record->data.alarm);
+        case DLOG_MT_MAINT_REQ:
+            return mm_acct_save_TOPCODE(db, writer->telco, record->terminal_id, &record->data.maint);
+        case DLOG_MT_CALL_DETAILS:
+            return mm_acct_save_TCDR(db, writer->telco, record->terminal_id, &record->data.cdr);
+        case DLOG_MT_CASH_BOX_COLLECTION:
+            return mm_acct_save_TCOLLST(db, writer->telco, record->terminal_id, &record->data.cash_box_collection);
+        case DLOG_MT_TERM_STATUS:
+            return mm_acct_save_TSTATUS(db, writer->telco, record->terminal_id, &record->data.term_status);
+        case DLOG_MT_CASH_BOX_STATUS:
+            return mm_acct_save_TCASHST(db, writer->telco, record->terminal_id, &record->data.cashbox_status);
+        case DLOG_MT_PERF_STATS_MSG:
+            return mm_acct_save_TPERFST(db, writer->telco, record->terminal_id, &record->data.perf_stats);
+        case DLOG_MT_SUMMARY_CALL_STATS:
+            return mm_acct_save_TCALLST(db, writer->telco, record->terminal_id, &record->data.summary_call_stats);
+        case DLOG_MT_FUNF_CARD_AUTH:
+            return mm_acct_save_TAUTH(db, writer->telco, record->terminal_id, &record->data.auth_request);
+        default:
+            fprintf(stderr, "%s: Unexpected table 0x%02x\n", __func__, record->table_id);
+            return -EINVAL;
+    }
+}
+
+/* Hold a record until the line commits. */
+static int acct_hold_record(mm_acct_line_t* line, const mm_acct_record_t* record) {
+    if (line->count == line->size) {
+        size_t size = (line->size == 0) ? 16 : line->size * 2;
+        mm_acct_record_t* pending = (mm_acct_record_t*)realloc(line->pending, size * sizeof(mm_acct_record_t));
+
+        if (pending == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, size * sizeof(mm_acct_record_t));
+            return -ENOMEM;
+        }
+
+        line->pending = pending;
+        line->size = size;
+    }
+
+    line->pending[line->count++] = *record;
+    return 0;
+}
+
+/* Write the records held for a line in one transaction; none of them if any fails. */
+static int acct_write_pending(mm_acct_writer_t* writer, mm_acct_line_t* line) {
+    size_t count = line->count;
+    size_t i;
+
+    line->count = 0;
+
+    if ((count == 0) || (line->status != 0)) {
+        return line->status;
+    }
+
+    if (mm_sql_begin_transaction(writer->db) != 0) {
+        return line->status = -EIO;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (acct_save_record(writer, &line->pending[i]) != 0) {
+            fprintf(stderr, "%s: Terminal %s: Failed to save table 0x%02x, rolling back %zu records.\n", __func__,
+                line->pending[i].terminal_id, line->pending[i].table_id, count);
+            mm_sql_rollback_transaction(writer->db);
+            return line->status = -EIO;
+        }
+    }
+
+    if (mm_sql_commit_transaction(writer->db) != 0) {
+        line->status = -EIO;
+    }
+
+    return line->status;
+}
+
+static void acct_write_record(mm_acct_writer_t* writer, mm_acct_record_t* record) {
+    mm_acct_line_t* line = &writer->lines[record->line];
+    int status = 0;
+
+    switch (record->op) {
+        case ACCT_OP_SAVE:
+            if (!line->in_trans) {
+                status = (acct_save_record(writer, record) == 0) ? 0 : -EIO;
+            } else {
+                status = acct_hold_record(line, record);
+            }
+            if (line->status == 0) {
+                line->status = status;
+            }
+            return;
+        case ACCT_OP_BEGIN:
+            line->in_trans = 1;
+            line->status = 0;
+            return;
+        case ACCT_OP_COMMIT:
+            status = acct_write_pending(writer, line);
+            line->in_trans = 0;
+            break;
+        case ACCT_OP_FLUSH:
+            status = acct_write_pending(writer, line);
+            break;
+    }
+
+    if (!line->in_trans) {
+        line->status = 0;
+    }
+
+    if (writer->threaded) {
+        mm_mutex_lock(&writer->lock);
+        record->barrier->status = status;
+        record->barrier->done = 1;
+        mm_cond_broadcast(&writer->barrier_done);
+        mm_mutex_unlock(&writer->lock);
+    } else {
+        record->barrier->status = status;
+        record->barrier->done = 1;
+    }
+}
+
+static void* acct_writer_thread(void* arg) {
+    mm_acct_writer_t* writer = (mm_acct_writer_t*)arg;
+
+    mm_mutex_lock(&writer->lock);
+
+    for (;;) {
+        uint32_t head;
+
+        while ((writer->tail == writer->head) && writer->running) {
+            mm_cond_wait(&writer->not_empty, &writer->lock);
+        }
+
+        /* Drain what is queued before exiting. */
+        if (writer->tail == writer->head) break;
+
+        head = writer->head;
+        mm_mutex_unlock(&writer->lock);
+
+        /* Records up to head cannot be reused until tail moves past them. */
+        for (uint32_t i = writer->tail; i != head; i++) {
+            acct_write_record(writer, &writer->ring[i % ACCT_RING_SIZE]);
+        }
+
+        mm_mutex_lock(&writer->lock);
+        writer->tail = head;
+        mm_cond_broadcast(&writer->not_full);
+    }
+
+    mm_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+mm_acct_writer_t* mm_acct_writer_start(void* db, mm_telco_t* telco, int threaded) {
+    mm_acct_writer_t* writer;
+
+    writer = (mm_acct_writer_t*)calloc(1, sizeof(mm_acct_writer_t));
+
+    if (writer == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_acct_writer_t));
+        return NULL;
+    }
+
+    writer->db = db;
+    writer->telco = telco;
+    writer->threaded = threaded;
+
+    if (!threaded) {
+        return writer;
+    }
+
+    mm_mutex_init(&writer->lock);
+    mm_cond_init(&writer->not_empty);
+    mm_cond_init(&writer->not_full);
+    mm_cond_init(&writer->barrier_done);
+    writer->running = 1;
+
+    if (mm_thread_create(&writer->thread, acct_writer_thread, writer) != 0) {
+        fprintf(stderr, "%s: Unable to start writer, saving records synchronously.\n", __func__);
+        mm_cond_destroy(&writer->barrier_done);
+        mm_cond_destroy(&writer->not_full);
+        mm_cond_destroy(&writer->not_empty);
+        mm_mutex_destroy(&writer->lock);
+        writer->running = 0;
+        writer->threaded = 0;
+    }
+
+    return writer;
+}
+
+/* Write out all queued records, and stop the writer thread.  Records never committed are dropped. */
+int mm_acct_writer_stop(mm_acct_writer_t* writer) {
+    int i;
+
+    if (writer == NULL) {
+        return 0;
+    }
+
+    if (writer->threaded) {
+        mm_mutex_lock(&writer->lock);
+        writer->running = 0;
+        mm_cond_signal(&writer->not_empty);
+        mm_mutex_unlock(&writer->lock);
+
+        mm_thread_join(writer->thread);
+
+        mm_cond_destroy(&writer->barrier_done);
+        mm_cond_destroy(&writer->not_full);
+        mm_cond_destroy(&writer->not_empty);
+        mm_mutex_destroy(&writer->lock);
+    }
+
+    for (i = 0; i < MM_MAX_LINES; i++) {
+        if (writer->lines[i].count > 0) {
+            fprintf(stderr, "%s: Line %d: %zu records not committed.\n", __func__, i, writer->lines[i].count);
+        }
+        free(writer->lines[i].pending);
+    }
+
+    free(writer);
+    return 0;
+}
+
+/*
+ * Add a record to the queue, waiting for space if the writer has fallen
+ * behind.  Commit and flush also wait until the writer has reached them.
+ */
+static int acct_writer_put(mm_acct_writer_t* writer, int line, uint8_t op, uint8_t table_id, const char* terminal_id, const void* data, size_t len) {
+    mm_acct_barrier_t barrier = { 0, 0 };
+    mm_acct_record_t  local;
+    mm_acct_record_t* record = &local;
+    int wait = (op == ACCT_OP_COMMIT) || (op == ACCT_OP_FLUSH);
+
+    if (len > sizeof(record->data)) {
+        fprintf(stderr, "%s: Table 0x%02x is too large (%zu bytes).\n", __func__, table_id, len);
+        return -EINVAL;
+    }
+
+    if ((line < 0) || (line >= MM_MAX_LINES)) {
+        fprintf(stderr, "%s: Invalid line %d.\n", __func__, line);
+        return -EINVAL;
+    }
+
+    if (writer->threaded) {
+        mm_mutex_lock(&writer->lock);
+
+        while (writer->head - writer->tail == ACCT_RING_SIZE) {
+            mm_cond_wait(&writer->not_full, &writer->lock);
+        }
+
+        record = &writer->ring[writer->head % ACCT_RING_SIZE];
+    }
+
+    record->op = op;
+    record->line = (uint8_t)line;
+    record->table_id = table_id;
+    record->barrier = wait ? &barrier : NULL;
+    if (terminal_id != NULL) {
+        snprintf(record->terminal_id, sizeof(record->terminal_id), "%s", terminal_id);
+    }
+    if (len > 0) {
+        memcpy(&record->data, data, len);
+    }
+
+    if (!writer->threaded) {
+        acct_write_record(writer, record);
+        return barrier.status;
+    }
+
+    writer->head++;
+    mm_cond_signal(&writer->not_empty);
+
+    while (wait && !barrier.done) {
+        mm_cond_wait(&writer->barrier_done, &writer->lock);
+    }
+
+    mm_mutex_unlock(&writer->lock);
+
+    return barrier.status;
+}
+
+int mm_acct_writer_queue(mm_acct_writer_t* writer, int line, uint8_t table_id, const char* terminal_id, const void* data, size_t len) {
+    return acct_writer_put(writer, line, ACCT_OP_SAVE, table_id, terminal_id, data, len);
+}
+
+int mm_acct_writer_begin(mm_acct_writer_t* writer, int line) {
+    return acct_writer_put(writer, line, ACCT_OP_BEGIN, 0, NULL, NULL, 0);
+}
+
+/* Returns 0 once every record the line queued so far is durable. */
+int mm_acct_writer_commit(mm_acct_writer_t* writer, int line) {
+    return acct_writer_put(writer, line, ACCT_OP_COMMIT, 0, NULL, NULL, 0);
+}
+
+/* Wait until the records the line queued so far are visible to database reads. */
+int mm_acct_writer_flush(mm_acct_writer_t* writer, int line) {
+    return acct_writer_put(writer, line, ACCT_OP_FLUSH, 0, NULL, NULL, 0);
+}
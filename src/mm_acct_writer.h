@@ -0,0 +1,40 @@
+/*
+ * Accounting record writer, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_ACCT_WRITER_H_
+#define MM_ACCT_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm_manager.h"
+
+/*
+ * Accounting records received from terminals are queued to a single
+ * database writer thread, so the serial lines never wait for the disk.
+ * The queue is bounded: when it is full, lines wait for the writer.
+ *
+ * Between mm_acct_writer_begin() and mm_acct_writer_commit(), the records
+ * a line queues are held, then written in one transaction at the commit.
+ * mm_acct_writer_commit() and mm_acct_writer_flush() are barriers: they
+ * return once every record the line queued before them has been written.
+ */
+typedef struct mm_acct_writer mm_acct_writer_t;
+
+/* With threaded = 0, records are written immediately by the caller (test mode). */
+mm_acct_writer_t* mm_acct_writer_start(void* db, mm_telco_t* telco, int threaded);
+int mm_acct_writer_stop(mm_acct_writer_t* writer);
+
+/* Queue one accounting table received from terminal_id on line; data is copied. */
+int mm_acct_writer_queue(mm_acct_writer_t* writer, int line, uint8_t table_id, const char* terminal_id, const void* data, size_t len);
+
+int mm_acct_writer_begin(mm_acct_writer_t* writer, int line);
+int mm_acct_writer_commit(mm_acct_writer_t* writer, int line);
+int mm_acct_writer_flush(mm_acct_writer_t* writer, int line);
+
+#endif  /* MM_ACCT_WRITER_H_ */
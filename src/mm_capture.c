@@ -0,0 +1,584 @@
+/*
+ * Packet capture writer, part of mm_manager.
+ *
+ * Each line has a single-producer, single-consumer ring: the thread
+ * running the line's call fills it, and the capture thread empties it.
+ * The producer only publishes head and the consumer only publishes tail,
+ * so neither side takes a lock.  The capture thread wakes every
+ * CAPTURE_FLUSH_MS (CAPTURE_MIRROR_MS when mirroring over UDP), or sooner
+ * when a ring is half full, and writes and sends the frames of all lines
+ * in timestamp order, a batch at a time.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mm_capture.h"
+#include "mm_pcap.h"
+#include "mm_thread.h"
+
+#define CAPTURE_RING_SIZE   256     /* Frames per line, a power of two; a full download is about 120. */
+#define CAPTURE_FLUSH_MS    200     /* Longest a frame waits to be written. */
+#define CAPTURE_MIRROR_MS   20      /* ...or to be mirrored, for a live view. */
+#define CAPTURE_BATCH       MM_UDP_BATCH_MAX
+#define CAPTURE_SNAPLEN     1024
+
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_NAME      2
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_EPB_FLAGS    2
+
+#define PCAPNG_EPB_INBOUND      1
+#define PCAPNG_EPB_OUTBOUND     2
+
+#ifdef _MSC_VER
+# include <windows.h>
+# define capture_load(p)        ((uint32_t)InterlockedCompareExchange((volatile LONG*)(p), 0, 0))
+# define capture_store(p, v)    InterlockedExchange((volatile LONG*)(p), (LONG)(v))
+#else  /* ifdef _MSC_VER */
+# define capture_load(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define capture_store(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif /* _MSC_VER */
+
+typedef struct mm_capture_rec {
+    uint64_t ts_ns;             /* UTC, in ns since 1970 */
+    uint16_t len;
+    uint8_t direction;
+    char terminal_id[11];
+    uint8_t data[256];
+} mm_capture_rec_t;
+
+typedef struct mm_capture_line {
+    uint32_t head;              /* Next record to fill, owned by the line */
+    uint32_t tail;              /* Next record to write, owned by the capture thread */
+    uint32_t dropped;
+    FILE* stream;               /* pcap: this line's file */
+    uint64_t bytes;
+    char name[64];
+    mm_capture_rec_t ring[CAPTURE_RING_SIZE];
+} mm_capture_line_t;
+
+struct mm_capture {
+    char filename[TABLE_PATH_MAX_LEN];   /* Empty to only mirror */
+    int pcapng;
+    int line_count;
+    uint64_t rotate_bytes;      /* 0 to never rotate on size */
+    uint32_t rotate_secs;       /* 0 to never rotate on age */
+    time_t opened;              /* When the current files were started */
+    FILE* stream;               /* pcapng: the file shared by all lines */
+    uint64_t bytes;
+    int running;
+    mm_thread_t thread;
+    mm_mutex_t lock;
+    mm_cond_t wake;
+    mm_udp_t* udp;              /* Mirror, or NULL */
+    mm_capture_line_t* lines;
+};
+
+static uint64_t capture_time_ns(void) {
+    struct timespec ts;
+
+    if (timespec_get(&ts, TIME_UTC) != TIME_UTC) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Name the file for line (-1 for pcapng), with the start time when files are rotated. */
+static void capture_filename(mm_capture_t* capture, int line, char* buf, size_t len) {
+    char name[TABLE_PATH_MAX_LEN];
+    char stamp[32];
+    const char* ext;
+    struct tm ptm = { 0 };
+
+    if (line < 0) {
+        snprintf(name, sizeof(name), "%s", capture->filename);
+    } else {
+        mm_line_filename(name, sizeof(name), capture->filename, line, capture->line_count);
+    }
+
+    if ((capture->rotate_bytes == 0) && (capture->rotate_secs == 0)) {
+        snprintf(buf, len, "%s", name);
+        return;
+    }
+
+    localtime_r(&capture->opened, &ptm);
+    strftime(stamp, sizeof(stamp), "-%Y%m%d-%H%M%S", &ptm);
+
+    ext = strrchr(name, '.');
+    if ((ext == NULL) || (strpbrk(ext, "/\\") != NULL)) {
+        ext = name + strlen(name);
+    }
+
+    snprintf(buf, len, "%.*s%s%s", (int)(ext - name), name, stamp, ext);
+}
+
+/* Append an option to a pcapng block, padded to 32 bits. */
+static size_t pcapng_option(uint8_t* block, size_t off, uint16_t code, const void* value, uint16_t len) {
+    memcpy(&block[off], &code, 2);
+    memcpy(&block[off + 2], &len, 2);
+    if (len > 0) {
+        memcpy(&block[off + 4], value, len);
+    }
+    off += 4 + len;
+
+    while (off & 3) {
+        block[off++] = 0;
+    }
+    return off;
+}
+
+/* Fill in the block type and both copies of the block length, and write the block. */
+static int pcapng_write_block(FILE* stream, uint8_t* block, uint32_t type, size_t len) {
+    uint32_t total = (uint32_t)len + 4;
+
+    memcpy(&block[0], &type, 4);
+    memcpy(&block[4], &total, 4);
+    memcpy(&block[len], &total, 4);
+
+    return (fwrite(block, total, 1, stream) == 1) ? (int)total : -1;
+}
+
+static int capture_write_headers(mm_capture_t* capture, FILE* stream) {
+    if (capture->pcapng) {
+        uint8_t  block[128];
+        uint32_t byte_order = PCAPNG_BYTE_ORDER;
+        uint16_t version[2] = { 1, 0 };
+        int64_t  section_len = -1;
+        uint16_t linktype = LINKTYPE_USER0;
+        uint16_t reserved = 0;
+        uint32_t snaplen = CAPTURE_SNAPLEN;
+        uint8_t  tsresol = 9;   /* 10^-9 s */
+        char     appl[64];
+        size_t   off;
+        int      written;
+        int      total;
+
+        snprintf(appl, sizeof(appl), "mm_manager %s", VERSION);
+
+        memcpy(&block[8], &byte_order, 4);
+        memcpy(&block[12], version, 4);
+        memcpy(&block[16], &section_len, 8);
+        off = pcapng_option(block, 24, PCAPNG_OPT_SHB_USERAPPL, appl, (uint16_t)strlen(appl));
+        off = pcapng_option(block, off, PCAPNG_OPT_END, NULL, 0);
+
+        if ((total = pcapng_write_block(stream, block, PCAPNG_SHB, off)) < 0) {
+            return -1;
+        }
+
+        for (int line = 0; line < capture->line_count; line++) {
+            memcpy(&block[8], &linktype, 2);
+            memcpy(&block[10], &reserved, 2);
+            memcpy(&block[12], &snaplen, 4);
+            off = pcapng_option(block, 16, PCAPNG_OPT_IF_NAME, capture->lines[line].name, (uint16_t)strlen(capture->lines[line].name));
+            off = pcapng_option(block, off, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+            off = pcapng_option(block, off, PCAPNG_OPT_END, NULL, 0);
+
+            if ((written = pcapng_write_block(stream, block, PCAPNG_IDB, off)) < 0) {
+                return -1;
+            }
+            total += written;
+        }
+        return total;
+    } else {
+        mm_pcap_hdr_t pcap_hdr = { 0 };
+
+        pcap_hdr.magic_number = 0xa1b2c3d4;
+        pcap_hdr.version_major = 2;
+        pcap_hdr.version_minor = 4;
+        pcap_hdr.snaplen       = CAPTURE_SNAPLEN;
+        pcap_hdr.network       = LINKTYPE_USER0;
+
+        if (fwrite(&pcap_hdr, sizeof(pcap_hdr), 1, stream) != 1) {
+            return -1;
+        }
+        return (int)sizeof(pcap_hdr);
+    }
+}
+
+static FILE* capture_create_file(mm_capture_t* capture, int line, uint64_t* bytes) {
+    char  fname[TABLE_PATH_MAX_LEN];
+    FILE* stream;
+    int   written;
+
+    capture_filename(capture, line, fname, sizeof(fname));
+
+    if ((stream = fopen(fname, "wb")) == NULL) {
+        fprintf(stderr, "%s: Can't write packet capture file '%s': %s\n", __func__, fname, strerror(errno));
+        return NULL;
+    }
+
+    if ((written = capture_write_headers(capture, stream)) < 0) {
+        fprintf(stderr, "%s: Error writing '%s'.\n", __func__, fname);
+        fclose(stream);
+        return NULL;
+    }
+
+    *bytes = (uint64_t)written;
+    return stream;
+}
+
+static void capture_close_files(mm_capture_t* capture) {
+    if (capture->stream != NULL) {
+        fclose(capture->stream);
+        capture->stream = NULL;
+    }
+
+    for (int line = 0; line < capture->line_count; line++) {
+        if (capture->lines[line].stream != NULL) {
+            fclose(capture->lines[line].stream);
+            capture->lines[line].stream = NULL;
+        }
+    }
+}
+
+static int capture_open_files(mm_capture_t* capture) {
+    capture->opened = time(NULL);
+
+    if (capture->filename[0] == '\0') {
+        return 0;
+    }
+
+    if (capture->pcapng) {
+        capture->stream = capture_create_file(capture, -1, &capture->bytes);
+        return (capture->stream != NULL) ? 0 : -EIO;
+    }
+
+    for (int line = 0; line < capture->line_count; line++) {
+        mm_capture_line_t* cline = &capture->lines[line];
+
+        if ((cline->stream = capture_create_file(capture, line, &cline->bytes)) == NULL) {
+            capture_close_files(capture);
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+/* Start new files once the current ones are too big or too old, but not twice in a second. */
+static void capture_rotate(mm_capture_t* capture) {
+    time_t   now = time(NULL);
+    uint64_t bytes = capture->bytes;
+
+    if (now == capture->opened) {
+        return;
+    }
+
+    for (int line = 0; line < capture->line_count; line++) {
+        if (capture->lines[line].bytes > bytes) {
+            bytes = capture->lines[line].bytes;
+        }
+    }
+
+    if (((capture->rotate_bytes != 0) && (bytes >= capture->rotate_bytes)) ||
+        ((capture->rotate_secs != 0) && ((uint64_t)(now - capture->opened) >= capture->rotate_secs))) {
+        capture_close_files(capture);
+
+        if (capture_open_files(capture) != 0) {
+            fprintf(stderr, "%s: Packet capture stopped.\n", __func__);
+        }
+    }
+}
+
+static void capture_write_rec(mm_capture_t* capture, int line, const mm_capture_rec_t* rec) {
+    uint8_t buf[sizeof(mm_pcaprec_hdr_t) + 64 + sizeof(rec->data)];
+    size_t  len;
+
+    if (capture->pcapng) {
+        uint32_t words[5];
+        uint32_t flags = (rec->direction == TX) ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND;
+        size_t   off;
+
+        if (capture->stream == NULL) return;
+
+        words[0] = (uint32_t)line;
+        words[1] = (uint32_t)(rec->ts_ns >> 32);
+        words[2] = (uint32_t)rec->ts_ns;
+        words[3] = rec->len;
+        words[4] = rec->len;
+        memcpy(&buf[8], words, sizeof(words));
+        memcpy(&buf[28], rec->data, rec->len);
+        off = 28 + rec->len;
+
+        while (off & 3) {
+            buf[off++] = 0;
+        }
+
+        off = pcapng_option(buf, off, PCAPNG_OPT_EPB_FLAGS, &flags, 4);
+        off = pcapng_option(buf, off, PCAPNG_OPT_END, NULL, 0);
+
+        if (pcapng_write_block(capture->stream, buf, PCAPNG_EPB, off) > 0) {
+            capture->bytes += off + 4;
+        }
+    } else {
+        mm_capture_line_t* cline = &capture->lines[line];
+        mm_pcaprec_hdr_t   pcap_rec;
+
+        if (cline->stream == NULL) return;
+
+        pcap_rec.ts_sec   = (uint32_t)(rec->ts_ns / 1000000000ULL);
+        pcap_rec.ts_usec  = (uint32_t)((rec->ts_ns % 1000000000ULL) / 1000);
+        pcap_rec.incl_len = rec->len;
+        pcap_rec.orig_len = rec->len;
+        memcpy(buf, &pcap_rec, sizeof(pcap_rec));
+        memcpy(&buf[sizeof(pcap_rec)], rec->data, rec->len);
+        len = sizeof(pcap_rec) + rec->len;
+
+        if (fwrite(buf, len, 1, cline->stream) == 1) {
+            cline->bytes += len;
+        }
+    }
+}
+
+/*
+ * Write and send everything queued so far, oldest first across all lines.
+ * A batch is taken without moving the tails, so the lines cannot reuse
+ * its records until both sinks are done with them.
+ */
+static int capture_drain(mm_capture_t* capture) {
+    uint32_t head[MM_MAX_LINES];
+    uint32_t tail[MM_MAX_LINES];
+    const mm_capture_rec_t* batch[CAPTURE_BATCH];
+    int      batch_line[CAPTURE_BATCH];
+    mm_udp_frame_t frames[CAPTURE_BATCH];
+    int      written = 0;
+
+    for (int line = 0; line < capture->line_count; line++) {
+        head[line] = capture_load(&capture->lines[line].head);
+        tail[line] = capture->lines[line].tail;
+    }
+
+    for (;;) {
+        int count = 0;
+
+        while (count < CAPTURE_BATCH) {
+            const mm_capture_rec_t* oldest = NULL;
+            int oldest_line = 0;
+
+            for (int line = 0; line < capture->line_count; line++) {
+                const mm_capture_rec_t* rec;
+
+                if (tail[line] == head[line]) continue;
+
+                rec = &capture->lines[line].ring[tail[line] % CAPTURE_RING_SIZE];
+                if ((oldest == NULL) || (rec->ts_ns < oldest->ts_ns)) {
+                    oldest = rec;
+                    oldest_line = line;
+                }
+            }
+
+            if (oldest == NULL) break;
+
+            batch[count] = oldest;
+            batch_line[count] = oldest_line;
+            tail[oldest_line]++;
+            count++;
+        }
+
+        if (count == 0) break;
+
+        for (int i = 0; i < count; i++) {
+            capture_write_rec(capture, batch_line[i], batch[i]);
+        }
+
+        if (capture->udp != NULL) {
+            for (int i = 0; i < count; i++) {
+                frames[i].line = (uint8_t)batch_line[i];
+                frames[i].direction = batch[i]->direction;
+                frames[i].terminal_id = batch[i]->terminal_id;
+                frames[i].data = batch[i]->data;
+                frames[i].len = batch[i]->len;
+            }
+            mm_udp_send_frames(capture->udp, frames, count);
+        }
+
+        for (int line = 0; line < capture->line_count; line++) {
+            if (capture->lines[line].tail != tail[line]) {
+                capture_store(&capture->lines[line].tail, tail[line]);
+            }
+        }
+        written += count;
+    }
+
+    if (written > 0) {
+        /* Flush so a capture is complete on disk, even if the manager is killed. */
+        if (capture->stream != NULL) {
+            fflush(capture->stream);
+        }
+        for (int line = 0; line < capture->line_count; line++) {
+            if (capture->lines[line].stream != NULL) {
+                fflush(capture->lines[line].stream);
+            }
+        }
+    }
+
+    return written;
+}
+
+static void* capture_thread(void* arg) {
+    mm_capture_t* capture = (mm_capture_t*)arg;
+    int running = 1;
+    int interval_ms = (capture->udp != NULL) ? CAPTURE_MIRROR_MS : CAPTURE_FLUSH_MS;
+
+    while (running) {
+        mm_mutex_lock(&capture->lock);
+        if (capture->running) {
+            mm_cond_timedwait(&capture->wake, &capture->lock, interval_ms);
+        }
+        running = capture->running;
+        mm_mutex_unlock(&capture->lock);
+
+        capture_drain(capture);
+
+        if ((capture->rotate_bytes != 0) || (capture->rotate_secs != 0)) {
+            capture_rotate(capture);
+        }
+    }
+
+    return NULL;
+}
+
+mm_capture_t* mm_capture_open(const char* filename, int line_count, const char* const* line_names,
+                              uint32_t rotate_mb, uint32_t rotate_min, mm_udp_t* udp) {
+    mm_capture_t* capture;
+    const char*   ext;
+
+    capture = (mm_capture_t*)calloc(1, sizeof(mm_capture_t));
+
+    if (capture == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_capture_t));
+        return NULL;
+    }
+
+    capture->lines = (mm_capture_line_t*)calloc((size_t)line_count, sizeof(mm_capture_line_t));
+
+    if (capture->lines == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %d lines.\n", __func__, line_count);
+        free(capture);
+        return NULL;
+    }
+
+    if (filename != NULL) {
+        snprintf(capture->filename, sizeof(capture->filename), "%s", filename);
+        ext = strrchr(filename, '.');
+        capture->pcapng = (ext != NULL) && (strcmp(ext, ".pcapng") == 0);
+    }
+    capture->udp = udp;
+    capture->line_count = line_count;
+    capture->rotate_bytes = (uint64_t)rotate_mb * 1024 * 1024;
+    capture->rotate_secs = rotate_min * 60;
+
+    for (int line = 0; line < line_count; line++) {
+        snprintf(capture->lines[line].name, sizeof(capture->lines[line].name), "%s", line_names[line]);
+    }
+
+    if (capture_open_files(capture) != 0) {
+        free(capture->lines);
+        free(capture);
+        return NULL;
+    }
+
+    mm_mutex_init(&capture->lock);
+    mm_cond_init(&capture->wake);
+    capture->running = 1;
+
+    if (mm_thread_create(&capture->thread, capture_thread, capture) != 0) {
+        fprintf(stderr, "%s: Unable to start capture thread.\n", __func__);
+        capture_close_files(capture);
+        mm_cond_destroy(&capture->wake);
+        mm_mutex_destroy(&capture->lock);
+        free(capture->lines);
+        free(capture);
+        return NULL;
+    }
+
+    return capture;
+}
+
+int mm_capture_close(mm_capture_t* capture) {
+    if (capture == NULL) {
+        return 0;
+    }
+
+    mm_mutex_lock(&capture->lock);
+    capture->running = 0;
+    mm_cond_signal(&capture->wake);
+    mm_mutex_unlock(&capture->lock);
+
+    mm_thread_join(capture->thread);
+    capture_drain(capture);
+
+    for (int line = 0; line < capture->line_count; line++) {
+        if (capture->lines[line].dropped) {
+            fprintf(stderr, "%s: Line %d: %u frames were not captured.\n", __func__, line, capture->lines[line].dropped);
+        }
+    }
+
+    capture_close_files(capture);
+    mm_cond_destroy(&capture->wake);
+    mm_mutex_destroy(&capture->lock);
+    free(capture->lines);
+    free(capture);
+
+    return 0;
+}
+
+void mm_capture_flush(mm_capture_t* capture) {
+    if (capture == NULL) {
+        return;
+    }
+
+    mm_mutex_lock(&capture->lock);
+    mm_cond_signal(&capture->wake);
+    mm_mutex_unlock(&capture->lock);
+}
+
+void mm_capture_frame(mm_capture_t* capture, int line, const char* terminal_id, int direction, const mm_packet_t* pkt) {
+    mm_capture_line_t* cline;
+    mm_capture_rec_t*  rec;
+    uint32_t head;
+    uint32_t used;
+
+    if ((capture == NULL) || (line < 0) || (line >= capture->line_count)) {
+        return;
+    }
+
+    cline = &capture->lines[line];
+    head = cline->head;
+    used = head - capture_load(&cline->tail);
+
+    if (used == CAPTURE_RING_SIZE) {
+        cline->dropped++;
+        return;
+    }
+
+    rec = &cline->ring[head % CAPTURE_RING_SIZE];
+    rec->ts_ns = capture_time_ns();
+    rec->direction = (uint8_t)direction;
+    snprintf(rec->terminal_id, sizeof(rec->terminal_id), "%s", (terminal_id != NULL) ? terminal_id : "");
+    rec->len = (uint16_t)pkt->hdr.pktlen + 1;
+    memcpy(rec->data, &pkt->hdr.start, rec->len);
+    /* The dissector takes the direction from the top bit of the start byte. */
+    rec->data[0] |= (direction == TX) ? 0x80 : 0;
+
+    capture_store(&cline->head, head + 1);
+
+    /* Wake the writer early rather than drop frames. */
+    if (used + 1 == CAPTURE_RING_SIZE / 2) {
+        mm_cond_signal(&capture->wake);
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Packet capture writer, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_CAPTURE_H_
+#define MM_CAPTURE_H_
+
+#include <stdint.h>
+
+#include "mm_manager.h"
+#include "mm_udp.h"
+
+/*
+ * Frames sent and received on each line are copied into a ring owned by
+ * that line, without taking a lock, and written to the capture file by a
+ * background thread.  A line never waits for the disk: if its ring is
+ * full, the frame is counted as dropped.
+ *
+ * A file name ending in .pcapng selects pcapng: one file with an
+ * interface for each line, and nanosecond timestamps.  Otherwise each
+ * line is captured in its own .pcap file, as mm_line_filename() names it.
+ *
+ * With rotate_mb or rotate_min set, a new file is started when the
+ * current one reaches that size or age, and the time each file was
+ * started is added to its name: install.pcapng -> install-20230101-120000.pcapng
+ *
+ * With udp set, the same thread also mirrors each frame to the UDP
+ * subscribers, tagged with its line and terminal.  filename may be NULL
+ * to only mirror.
+ */
+typedef struct mm_capture mm_capture_t;
+
+mm_capture_t* mm_capture_open(const char* filename, int line_count, const char* const* line_names,
+                              uint32_t rotate_mb, uint32_t rotate_min, mm_udp_t* udp);
+int mm_capture_close(mm_capture_t* capture);
+
+/* Queue a copy of pkt, as sent or received on line.  Safe to call with capture NULL. */
+void mm_capture_frame(mm_capture_t* capture, int line, const char* terminal_id, int direction, const mm_packet_t* pkt);
+
+/* Write and send what is queued without waiting for the next interval, at the end of a call. */
+void mm_capture_flush(mm_capture_t* capture);
+
+#endif  /* MM_CAPTURE_H_ */
@@ -25,54 +25,46 @@
 #define SQL_IGNORE      "IGNORE "
 #else
 #define AUTO_INCREMENT "AUTOINCREMENT"
-#define SQL_IGNORE      ""
+#define SQL_IGNORE      "OR IGNORE "
 #endif /* MYSQL */
 
 /* Declare function prototypes */
 int mm_config_add_TERMTYP_entry(void *db, uint8_t terminal_type, const char *control_rom_edition, const char *description);
 
+/*
+ * TERMTYP is only changed by mm_config_load_TERMTYP(), which refreshes this
+ * copy, so lookups never need to query the database.
+ */
+static mm_termtyp_map_t* termtyp_map;
+
 uint8_t mm_config_get_term_type_from_control_rom_edition(void* db, const char* control_rom_edition) {
-    char sql[256] = { 0 };
-    char db_control_rom_edition[8];
+    (void)db;
 
-    snprintf(db_control_rom_edition, sizeof(db_control_rom_edition), "%s", control_rom_edition);
+    if (termtyp_map == NULL) {
+        return 0;
+    }
 
-    snprintf(sql, sizeof(sql), "SELECT TERMINAL_TYPE from TERMTYP where (CONTROL_ROM_EDITION = \"%s\"); ",
-        db_control_rom_edition);
+    return mm_termtyp_map_lookup(termtyp_map, control_rom_edition);
+}
 
-    return mm_sql_read_uint8(db, sql);
+void mm_config_unload_TERMTYP(void) {
+    mm_termtyp_map_free(termtyp_map);
+    termtyp_map = NULL;
 }
 
 int mm_config_add_TERMTYP_entry(void *db, uint8_t terminal_type, const char *control_rom_edition, const char *description) {
-    char sql[256] = { 0 };
+    static const char sql_insert[] = "INSERT " SQL_IGNORE "INTO TERMTYP ( TERMINAL_TYPE, CONTROL_ROM_EDITION, DESCRIPTION ) VALUES ( ?,?,? );";
     char db_control_rom_edition[8];
     char db_description[41];
 
     snprintf(db_control_rom_edition, sizeof(db_control_rom_edition), "%s", control_rom_edition);
-    snprintf(db_description, sizeof(db_description), "%s", description);
-
-    snprintf(sql, sizeof(sql), "INSERT " SQL_IGNORE "INTO TERMTYP ( "
-        "TERMINAL_TYPE,"
-        "CONTROL_ROM_EDITION,"
-        "DESCRIPTION"
-        " ) VALUES ( "
-        "%d,\"%s\",\"%s\");",
-        terminal_type,
-        db_control_rom_edition,
-        db_description);
-
-    return mm_sql_exec(db, sql);
+    snprintf(db_description, sizeof(db_description), "%s", (description != NULL) ? description : "");
+
+    return mm_sql_exec_stmt(db, sql_insert, "iss", terminal_type, db_control_rom_edition, db_description);
 }
 
 int mm_config_create_tables(void *db) {
     int rc;
-    FILE* csvstream = NULL;
-    char csvline[255] = { 0 };
-    char* control_rom_edition = NULL;
-    uint8_t terminal_type = 0;
-    char* description = NULL;
-    int line = 0;
-    const char *tokens = ",";
 
     rc = mm_sql_exec(db, "CREATE TABLE IF NOT EXISTS TERMTYP ( "
         "ID INTEGER NOT NULL PRIMARY KEY " AUTO_INCREMENT ","
@@ -87,15 +79,84 @@ int mm_config_create_tables(void *db) {
         return -1;
     }
 
+    /* Hash of each configuration file, as last imported. */
+    rc = mm_sql_exec(db, "CREATE TABLE IF NOT EXISTS TCFGFILE ( "
+        "FILENAME VARCHAR(255) NOT NULL PRIMARY KEY,"
+        "HASH BIGINT NOT NULL"
+        ");");
+
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create table TCFGFILE.\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Hash the contents of stream, leaving it positioned at the start. */
+static uint64_t mm_config_hash_file(FILE* stream) {
+    uint8_t  buf[4096];
+    uint64_t hash = FNV1A64_INIT;
+    size_t   len;
+
+    while ((len = fread(buf, 1, sizeof(buf), stream)) > 0) {
+        hash = fnv1a64(hash, buf, len);
+    }
+
+    rewind(stream);
+
+    return hash;
+}
+
+/*
+ * Import the terminal types from TERMTYP_CSV_FNAME, replacing the table
+ * in one transaction.  The import is skipped when the file is unchanged
+ * since the last one; its hash is only saved once every row is imported.
+ */
+int mm_config_load_TERMTYP(void *db) {
+    static const char sql_save_hash[] = "INSERT OR REPLACE INTO TCFGFILE ( FILENAME, HASH ) VALUES ( ?,? );";
+    static const char sql_delete[] = "DELETE FROM TERMTYP;";
+    FILE* csvstream = NULL;
+    char csvline[255] = { 0 };
+    char* control_rom_edition = NULL;
+    uint8_t terminal_type = 0;
+    char* description = NULL;
+    uint64_t hash;
+    uint64_t last_hash;
+    int line = 0;
+    int rc;
+    const char *tokens = ",";
+
+    if ((termtyp_map == NULL) && ((termtyp_map = mm_termtyp_map_init()) == NULL)) {
+        return -ENOMEM;
+    }
+
     if (!(csvstream = fopen(TERMTYP_CSV_FNAME, "r"))) {
         fprintf(stderr, "Error opening csv stream: %s\n", TERMTYP_CSV_FNAME);
         return -EPERM;
     }
 
-    while (!feof(csvstream)) {
+    hash = mm_config_hash_file(csvstream);
+
+    if ((mm_sql_load_TCFGFILE(db, TERMTYP_CSV_FNAME, &last_hash) == 0) && (last_hash == hash)) {
+        fclose(csvstream);
+        return mm_sql_load_TERMTYP(db, termtyp_map);
+    }
+
+    if (mm_sql_begin_transaction(db) != 0) {
+        fclose(csvstream);
+        return -EIO;
+    }
+
+    rc = mm_sql_exec_stmt(db, sql_delete, "");
+
+    while (rc == 0) {
         char* tok;
         if (fgets(csvline, sizeof(csvline), csvstream) == NULL) {
-            fprintf(stderr, "Error reading csv stream, line=%d", line);
+            if (ferror(csvstream)) {
+                fprintf(stderr, "Error reading csv stream, line=%d", line);
+                rc = -EIO;
+            }
             break;
         }
         line++;
@@ -107,10 +168,32 @@ int mm_config_create_tables(void *db) {
         terminal_type = atoi(tok);
         description = strtok(NULL, tokens);
 
-        mm_config_add_TERMTYP_entry(db, terminal_type, control_rom_edition, description);
+        if (mm_config_add_TERMTYP_entry(db, terminal_type, control_rom_edition, description) != 0) {
+            fprintf(stderr, "%s: Failed to import %s, line %d.\n", __func__, TERMTYP_CSV_FNAME, line);
+            rc = -EIO;
+        }
     }
 
     fclose(csvstream);
 
-    return 0;
+    if (rc == 0) {
+        rc = mm_sql_exec_stmt(db, sql_save_hash, "sI", TERMTYP_CSV_FNAME, (int64_t)hash);
+    }
+
+    if (rc == 0) {
+        rc = (mm_sql_commit_transaction(db) == 0) ? 0 : -EIO;
+    } else {
+        mm_sql_rollback_transaction(db);
+        rc = -EIO;
+    }
+
+    if (rc == 0) {
+        printf("Imported terminal types from %s.\n", TERMTYP_CSV_FNAME);
+    }
+
+    if (mm_sql_load_TERMTYP(db, termtyp_map) != 0) {
+        rc = -EIO;
+    }
+
+    return rc;
 }
@@ -18,7 +18,7 @@
 
 #include "mm_manager.h"
 #include "mm_serial.h"
-#include "mm_udp.h"
+#include "mm_replay.h"
 
 extern int manager_running;
 extern const char* modem_responses[];
@@ -35,14 +35,13 @@ int mm_connection_open(mm_connection_t* connection, const char *modem_dev, int b
             return(-EINVAL);
         }
 
-        if (!(connection->bytestream = fopen(modem_dev, "r"))) {
-            fprintf(stderr, "Error opening input stream: %s\n", modem_dev);
+        if ((connection->replay = mm_replay_open(modem_dev)) == NULL) {
             mm_connection_close(connection);
             return(-EPERM);
         }
     }
     else {
-        connection->bytestream = NULL;
+        connection->replay = NULL;
         if (modem_dev == NULL) {
             (void)fprintf(stderr, "mm_manager: -f <modem_dev> must be specified.\n");
             mm_connection_close(connection);
@@ -50,7 +49,7 @@ int mm_connection_open(mm_connection_t* connection, const char *modem_dev, int b
         }
     }
 
-    connection->proto.serial_context = open_serial(modem_dev, connection->logstream, connection->bytestream);
+    connection->proto.serial_context = open_serial(modem_dev, connection->logstream, connection->dlog, connection->replay);
 
     if (connection->proto.serial_context == NULL) {
         fprintf(stderr, "Unable to open modem: %s.", modem_dev);
@@ -59,6 +58,7 @@ int mm_connection_open(mm_connection_t* connection, const char *modem_dev, int b
     }
 
     init_serial(connection->proto.serial_context, baudrate);
+    connection->proto.baudrate = baudrate;
     status = init_modem(connection->proto.serial_context, connection->modem_reset_string, connection->modem_init_string);
 
     if (status == 0) {
@@ -74,74 +74,82 @@ int mm_connection_open(mm_connection_t* connection, const char *modem_dev, int b
 
 int mm_connection_wait(mm_connection_t* connection)
 {
-    int   modem_response = 0;
+    int   status;
+
+    while (manager_running) {
+        status = mm_connection_modem_event(connection, wait_for_modem_response(connection->proto.serial_context, 1));
 
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    return (connection->proto.connected);
+}
+
+/*
+ * Handle a response from the modem while waiting for a call.
+ *
+ * Returns 1 when the terminal has connected, 0 to keep waiting,
+ * or -EIO if the line can no longer be used.
+ */
+int mm_connection_modem_event(mm_connection_t* connection, int modem_response)
+{
     time_t rawtime;
     struct tm ptm = { 0 };
 
-    while (manager_running) {
-        modem_response = wait_for_modem_response(connection->proto.serial_context, 1);
-
-        mm_time(connection->test_mode, &rawtime);
-        localtime_r(&rawtime, &ptm);
-
-        switch (modem_response) {
-        case MODEM_RSP_OK:
-            break;
-        case MODEM_RSP_RING:
-            printf("%04d-%02d-%02d %2d:%02d:%02d: Ringing...\n\n",
-                ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
-            continue;
-        case MODEM_RSP_CONNECT:
-            printf("%04d-%02d-%02d %2d:%02d:%02d: Connected!\n\n",
-                ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
-
-            proto_connect(&connection->proto);
-            break;
-        case MODEM_RSP_NO_CARRIER:
-            proto_disconnect(&connection->proto);
-            printf("%04d-%02d-%02d %2d:%02d:%02d: Carrier lost.\n\n",
-                ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
-
-            continue;
-        case MODEM_RSP_NULL:
-            break;
-        case MODEM_RSP_READ_ERROR:
-            manager_running = 0;
-            printf("%04d-%02d-%02d %2d:%02d:%02d: Error communicating with modem, shutting down.\n\n",
-                ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
-                break;
-        default:
-            printf("%04d-%02d-%02d %2d:%02d:%02d: Unhandled modem response = %d (%s)\n\n",
-                ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
-                modem_response, modem_response <= MODEM_RSP_NULL ? modem_responses[modem_response] : "Unknown");
-            continue;
-        }
+    mm_time(connection->test_mode, &rawtime);
+    localtime_r(&rawtime, &ptm);
+
+    switch (modem_response) {
+    case MODEM_RSP_OK:
+        break;
+    case MODEM_RSP_RING:
+        printf("%04d-%02d-%02d %2d:%02d:%02d: Ringing...\n\n",
+            ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
+        break;
+    case MODEM_RSP_CONNECT:
+        printf("%04d-%02d-%02d %2d:%02d:%02d: Connected!\n\n",
+            ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
+
+        proto_connect(&connection->proto);
+        return (1);
+    case MODEM_RSP_NO_CARRIER:
+        proto_disconnect(&connection->proto);
+        printf("%04d-%02d-%02d %2d:%02d:%02d: Carrier lost.\n\n",
+            ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
+        break;
+    case MODEM_RSP_NULL:
+        break;
+    case MODEM_RSP_READ_ERROR:
+        printf("%04d-%02d-%02d %2d:%02d:%02d: Line %d: Error communicating with modem, shutting down line.\n\n",
+            ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
+            connection->line);
+        return (-EIO);
+    default:
+        printf("%04d-%02d-%02d %2d:%02d:%02d: Unhandled modem response = %d (%s)\n\n",
+            ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
+            modem_response, modem_response <= MODEM_RSP_NULL ? modem_responses[modem_response] : "Unknown");
         break;
     }
 
-    return (connection->proto.connected);
+    return (0);
 }
 
 int mm_connection_close(mm_connection_t* connection) {
     close_serial(connection->proto.serial_context);
     connection->proto.serial_context = NULL;
 
-    if (connection->bytestream) {
-        fclose(connection->bytestream);
-    }
+    mm_replay_close(connection->replay);
+    connection->replay = NULL;
 
     if (connection->logstream) {
         fclose(connection->logstream);
+        connection->logstream = NULL;
     }
 
-    if (connection->proto.pcapstream) {
-        mm_close_pcap(connection->proto.pcapstream);
-    }
-
-    if (connection->proto.send_udp) {
-        mm_close_udp();
-    }
+    mm_dlog_writer_close(connection->dlog);
+    connection->dlog = NULL;
 
     return (0);
 }
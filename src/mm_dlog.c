@@ -0,0 +1,200 @@
+/*
+ * Binary session log, part of mm_manager.
+ *
+ * The writer belongs to one line, and is only used by the thread serving
+ * that line.  Chunks are collected in a buffer and written when it fills,
+ * and at the end of each call, so logging costs no libc call per byte.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm_dlog.h"
+#include "mm_timer.h"
+
+static void dlog_put16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void dlog_put64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint16_t dlog_get16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint64_t dlog_get64(const uint8_t* p) {
+    uint64_t v = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+mm_dlog_writer_t* mm_dlog_writer_open(const char* filename, int line) {
+    mm_dlog_writer_t* writer;
+    struct timespec   ts = { 0 };
+    uint8_t hdr[MM_DLOG_HDR_LEN];
+
+    writer = (mm_dlog_writer_t*)calloc(1, sizeof(mm_dlog_writer_t));
+
+    if (writer == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_dlog_writer_t));
+        return NULL;
+    }
+
+    if ((writer->stream = fopen(filename, "wb")) == NULL) {
+        fprintf(stderr, "%s: Can't write log file '%s': %s\n", __func__, filename, strerror(errno));
+        free(writer);
+        return NULL;
+    }
+
+    writer->line = (uint8_t)line;
+
+    timespec_get(&ts, TIME_UTC);
+    memcpy(hdr, MM_DLOG_MAGIC, 6);
+    hdr[6] = MM_DLOG_VERSION;
+    hdr[7] = writer->line;
+    dlog_put64(&hdr[8], (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000));
+    dlog_put64(&hdr[16], mm_clock_us());
+
+    if (fwrite(hdr, sizeof(hdr), 1, writer->stream) != 1) {
+        fprintf(stderr, "%s: Error writing '%s'.\n", __func__, filename);
+        fclose(writer->stream);
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+int mm_dlog_flush(mm_dlog_writer_t* writer) {
+    int status = 0;
+
+    if (writer == NULL) {
+        return 0;
+    }
+
+    if (writer->len > 0) {
+        if (fwrite(writer->buf, writer->len, 1, writer->stream) != 1) {
+            status = -EIO;
+        }
+        writer->len = 0;
+    }
+
+    if (fflush(writer->stream) != 0) {
+        status = -EIO;
+    }
+
+    return status;
+}
+
+int mm_dlog_write(mm_dlog_writer_t* writer, char direction, const uint8_t* data, size_t len) {
+    uint64_t ts_us = mm_clock_us();
+
+    while (len > 0) {
+        uint16_t chunk_len = (len > MM_DLOG_CHUNK_MAX) ? MM_DLOG_CHUNK_MAX : (uint16_t)len;
+        uint8_t  hdr[MM_DLOG_CHUNK_HDR_LEN];
+
+        dlog_put16(&hdr[0], chunk_len);
+        hdr[2] = (uint8_t)direction;
+        hdr[3] = writer->line;
+        dlog_put64(&hdr[4], ts_us);
+
+        if (writer->len + sizeof(hdr) + chunk_len > sizeof(writer->buf)) {
+            if (mm_dlog_flush(writer) != 0) {
+                return -EIO;
+            }
+        }
+
+        if (sizeof(hdr) + chunk_len > sizeof(writer->buf)) {
+            /* Too big to buffer: write it as it is. */
+            if ((fwrite(hdr, sizeof(hdr), 1, writer->stream) != 1) ||
+                (fwrite(data, chunk_len, 1, writer->stream) != 1)) {
+                return -EIO;
+            }
+        } else {
+            memcpy(&writer->buf[writer->len], hdr, sizeof(hdr));
+            memcpy(&writer->buf[writer->len + sizeof(hdr)], data, chunk_len);
+            writer->len += sizeof(hdr) + chunk_len;
+        }
+
+        data += chunk_len;
+        len -= chunk_len;
+    }
+
+    return 0;
+}
+
+int mm_dlog_writer_close(mm_dlog_writer_t* writer) {
+    int status;
+
+    if (writer == NULL) {
+        return 0;
+    }
+
+    status = mm_dlog_flush(writer);
+    fclose(writer->stream);
+    free(writer);
+
+    return status;
+}
+
+int mm_dlog_parse_header(const uint8_t* buf, size_t len, mm_dlog_hdr_t* hdr) {
+    if ((len < MM_DLOG_HDR_LEN) || (memcmp(buf, MM_DLOG_MAGIC, 6) != 0)) {
+        return 0;
+    }
+
+    hdr->version = buf[6];
+    hdr->line = buf[7];
+    hdr->wall_us = dlog_get64(&buf[8]);
+    hdr->mono_us = dlog_get64(&buf[16]);
+
+    return 1;
+}
+
+/* Decode a chunk header. */
+static void dlog_chunk_hdr(const uint8_t* hdr, mm_dlog_chunk_t* chunk) {
+    chunk->len = dlog_get16(&hdr[0]);
+    chunk->direction = (char)hdr[2];
+    chunk->line = hdr[3];
+    chunk->ts_us = dlog_get64(&hdr[4]);
+}
+
+int mm_dlog_parse(const uint8_t* buf, size_t len, size_t* off, mm_dlog_chunk_t* chunk) {
+    if (*off == len) {
+        return 0;
+    }
+
+    if (len - *off < MM_DLOG_CHUNK_HDR_LEN) {
+        return -EIO;
+    }
+
+    dlog_chunk_hdr(&buf[*off], chunk);
+
+    if (len - *off - MM_DLOG_CHUNK_HDR_LEN < chunk->len) {
+        return -EIO;
+    }
+
+    chunk->data = &buf[*off + MM_DLOG_CHUNK_HDR_LEN];
+    *off += MM_DLOG_CHUNK_HDR_LEN + chunk->len;
+
+    return 1;
+}
+
+uint64_t mm_dlog_wall_us(const mm_dlog_hdr_t* hdr, const mm_dlog_chunk_t* chunk) {
+    return hdr->wall_us + (chunk->ts_us - hdr->mono_us);
+}
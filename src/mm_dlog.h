@@ -0,0 +1,78 @@
+/*
+ * Binary session log, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_DLOG_H_
+#define MM_DLOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * A compact alternative to the text log written by -l, which takes a line
+ * of text for every byte.  All values are little-endian.
+ *
+ * The file starts with a header:
+ *
+ *   "MMDLOG", version (1), line, wall clock (us since 1970, UTC),
+ *   monotonic clock (us), both read when the log was opened
+ *
+ * followed by a chunk for each block of data sent or received:
+ *
+ *   length (2 bytes), direction ('R' received, 'T' sent by the manager),
+ *   line, monotonic clock (us, 8 bytes), then length bytes of data.
+ *
+ * The monotonic timestamps give the exact spacing of the data; the header
+ * maps them to the time of day.
+ */
+#define MM_DLOG_MAGIC           "MMDLOG"
+#define MM_DLOG_VERSION         1
+#define MM_DLOG_HDR_LEN         24
+#define MM_DLOG_CHUNK_HDR_LEN   12
+#define MM_DLOG_CHUNK_MAX       UINT16_MAX
+#define MM_DLOG_BUF_SIZE        16384   /* Chunks are collected here and written together. */
+
+typedef struct mm_dlog_writer {
+    FILE* stream;
+    uint8_t line;
+    size_t len;
+    uint8_t buf[MM_DLOG_BUF_SIZE];
+} mm_dlog_writer_t;
+
+typedef struct mm_dlog_chunk {
+    uint64_t ts_us;         /* Monotonic */
+    uint16_t len;
+    char direction;         /* 'R' or 'T' */
+    uint8_t line;
+    const uint8_t* data;
+} mm_dlog_chunk_t;
+
+typedef struct mm_dlog_hdr {
+    uint8_t version;
+    uint8_t line;
+    uint64_t wall_us;
+    uint64_t mono_us;
+} mm_dlog_hdr_t;
+
+mm_dlog_writer_t* mm_dlog_writer_open(const char* filename, int line);
+int mm_dlog_write(mm_dlog_writer_t* writer, char direction, const uint8_t* data, size_t len);
+int mm_dlog_flush(mm_dlog_writer_t* writer);
+int mm_dlog_writer_close(mm_dlog_writer_t* writer);
+
+/*
+ * Parse a log held in memory, such as a mapped file.  mm_dlog_parse_header()
+ * returns 1 if buf starts with a binary log header, and 0 if not.
+ * mm_dlog_parse() reads the chunk at *off, pointing chunk->data into buf.
+ * It returns 1, 0 at the end of the log, or -EIO if it is damaged.
+ */
+int mm_dlog_parse_header(const uint8_t* buf, size_t len, mm_dlog_hdr_t* hdr);
+int mm_dlog_parse(const uint8_t* buf, size_t len, size_t* off, mm_dlog_chunk_t* chunk);
+
+/* Time of day of a chunk, in us since 1970, UTC. */
+uint64_t mm_dlog_wall_us(const mm_dlog_hdr_t* hdr, const mm_dlog_chunk_t* chunk);
+
+#endif  /* MM_DLOG_H_ */
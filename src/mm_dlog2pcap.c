@@ -7,6 +7,15 @@
  *
  * This utility converts dialog transcripts from mm_manager into
  * packet capture files (.pcap) suitable for analysis in Wireshark.
+ * Both the text logs written with -l and the binary logs written with
+ * -L are read.
+ *
+ * The input is mapped into memory.  A text log is converted a round at a
+ * time: the next few MB are split at line ends into a piece for each
+ * worker thread, the workers decode their pieces into bytes, and the
+ * bytes are then framed and written in file order, so frames that span
+ * two pieces come out whole.  Given a directory, every log in it is
+ * converted, several files at a time.
  *
  */
 
@@ -15,210 +24,645 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>  /* String function definitions */
-#ifndef _WIN32
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
 #include <libgen.h>
-#endif /* ifndef _WIN32 */
+#include <unistd.h>
+#include <sys/mman.h>
+#endif /* _WIN32 */
 
 #include "mm_manager.h"
+#include "mm_dlog.h"
+#include "mm_l2.h"
+#include "mm_thread.h"
 
-#define L2_STATE_SEARCH_FOR_START   1
-#define L2_STATE_GET_FLAGS          2
-#define L2_STATE_GET_LENGTH         3
-#define L2_STATE_ACCUMULATE_DATA    4
-#define L2_STATE_GET_CRC0           5
-#define L2_STATE_GET_CRC1           6
-#define L2_STATE_SEARCH_FOR_STOP    7
+#define DLOG2PCAP_MAX_THREADS   16
+#define DLOG2PCAP_PIECE_SIZE    (4 * 1024 * 1024)   /* Text decoded by each worker per round */
 
 volatile int inject_comm_error = 0;
 
+/* Per-direction frame parser. */
 typedef struct mm_parser {
-    uint8_t      l2_state;
-    mm_packet_t  pkt;
-    pkt_status_t status;
+    mm_l2_parser_t l2;
+    mm_packet_t    pkt;
 } mm_parser_t;
 
-uint8_t mm_parse_byte(mm_parser_t* context, uint8_t databyte, uint32_t line);
-uint8_t mm_parser_reset(mm_parser_t* context);
-
-int  main(int argc, char *argv[]) {
-    FILE *instream   = NULL;
-    FILE *pcapstream = NULL;
-
-    char buf[100];  /* buffer to hold a line of data from the input byte stream */
+typedef struct mm_dlog2pcap {
+    const char* name;       /* Input file, for messages */
+    FILE* pcapstream;
+    mm_parser_t rxparser;
+    mm_parser_t txparser;
+    uint32_t packets_processed;
+} mm_dlog2pcap_t;
 
-    int count;
-    int line = 0;
-    uint32_t start_time, stop_time;
-    uint32_t ts_sec, ts_usec;
-    uint32_t packets_processed = 0;
+/* A byte decoded from a text log. */
+typedef struct mm_dlog_byte {
+    uint32_t line;          /* Counted from the start of the piece */
+    uint32_t stop_time;
     char direction;
-    uint8_t pkt_direction;
-
-    unsigned int databyte;
-    int status = 0;
+    uint8_t byte;
+} mm_dlog_byte_t;
+
+/* A worker's piece of a text log, and what it decoded. */
+typedef struct mm_dlog_piece {
+    const char* start;
+    const char* end;
+    mm_dlog_byte_t* bytes;
+    size_t count;
+    size_t capacity;
+    int lines;              /* Lines decoded, and... */
+    int error_line;         /* ...the line that could not be, counted from the start of the piece, or 0 */
+    int status;
+} mm_dlog_piece_t;
+
+/* A memory-mapped input file. */
+typedef struct mm_mapping {
+    const uint8_t* data;
+    size_t len;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif /* _WIN32 */
+} mm_mapping_t;
+
+/* Files of a directory, handed out to the workers one at a time. */
+typedef struct mm_dlog2pcap_dir {
+    char** inputs;
+    char** outputs;
+    int count;
+    int next;
+    int failed;
+    mm_mutex_t lock;
+} mm_dlog2pcap_dir_t;
 
-    mm_parser_t rxparser;
-    mm_parser_t txparser;
+static void mm_parser_reset(mm_parser_t* context);
+static int mm_dlog2pcap_file(const char* infile, const char* outfile, int threads);
+static int mm_dlog2pcap_dir(const char* indir, const char* outdir, int threads);
+static int mm_dlog2pcap_cpus(void);
 
-    mm_parser_t* parser = NULL;
+int  main(int argc, char *argv[]) {
+    struct stat st;
+    int threads = mm_dlog2pcap_cpus();
+    int status;
 
     printf("Nortel Millennium Dialog to .pcap Conversion Utility\n\n");
 
     if (argc <= 2) {
         printf("Usage: %s <filename.dlog> <filename.pcap>\n", basename(argv[0]));
-        status = -EINVAL;
-        goto done;
+        printf("       %s <dlog directory> <pcap directory>\n", basename(argv[0]));
+        return -EINVAL;
     }
 
-    if (!(instream = fopen(argv[1], "r"))) {
-        fprintf(stderr, "%s: Can't read '%s': %s\n",
-            basename(argv[0]), argv[1], strerror(errno));
-        status = -ENOENT;
-        goto done;
+    crc16_init();
+
+    if ((stat(argv[1], &st) == 0) && ((st.st_mode & S_IFMT) == S_IFDIR)) {
+        status = mm_dlog2pcap_dir(argv[1], argv[2], threads);
+    } else {
+        status = mm_dlog2pcap_file(argv[1], argv[2], threads);
     }
 
-    if (mm_create_pcap(argv[2], &pcapstream) != 0) {
-        fprintf(stderr, "%s: Can't write '%s': %s\n",
-            basename(argv[0]), argv[2], strerror(errno));
-        status = -ENOENT;
-        goto done;
+    return status;
+}
+
+static int mm_dlog2pcap_cpus(void) {
+    int cpus;
+
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    cpus = (int)info.dwNumberOfProcessors;
+#else
+    cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _WIN32 */
+
+    if (cpus < 1) {
+        cpus = 1;
     }
+    return (cpus > DLOG2PCAP_MAX_THREADS) ? DLOG2PCAP_MAX_THREADS : cpus;
+}
 
-    mm_parser_reset(&rxparser);
-    mm_parser_reset(&txparser);
+static int mm_map_file(const char* filename, mm_mapping_t* map) {
+    memset(map, 0, sizeof(*map));
 
-    while (!feof(instream)) {
-        line++;
-        if (fgets(buf, 80, instream) == NULL) {
-            fprintf(stderr, "Error reading input stream, line=%d", line);
-            break;
-        }
+#ifdef _WIN32
+    LARGE_INTEGER size;
 
-        /* TX/RX in file are from Terminal's perspective. */
-        count = sscanf(buf, "%u-%u UART: %cX: %2x", &start_time, &stop_time, &direction, &databyte);
+    map->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (map->file == INVALID_HANDLE_VALUE) {
+        return -ENOENT;
+    }
 
-        if (count == 4) {
-//            printf("Count=%d, Character start %d, stop %d, dir=%c, data=0x%02x\n", count, start_time, stop_time, direction, databyte);
-        } else {
-            count = sscanf(buf, "UART: %cX: %2x", &direction, &databyte);
-            if (count != 2) {
-                fprintf(stderr, "Error parsing input stream, line=%d", line);
-                goto done;
-            }
-            start_time = stop_time = 0;
-//            printf("Count=%d, dir=%c, data=0x%02x\n", count, direction, databyte);
-        }
+    if (!GetFileSizeEx(map->file, &size)) {
+        CloseHandle(map->file);
+        return -EIO;
+    }
 
-        if (direction == 'R') {
-            parser = &rxparser;
-            pkt_direction = RX;
-        } else {
-            parser = &txparser;
-            pkt_direction = TX;
-        }
+    map->len = (size_t)size.QuadPart;
+    if (map->len == 0) {
+        return 0;
+    }
+
+    if ((map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL) {
+        CloseHandle(map->file);
+        return -EIO;
+    }
+
+    if ((map->data = (const uint8_t*)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0)) == NULL) {
+        CloseHandle(map->mapping);
+        CloseHandle(map->file);
+        return -EIO;
+    }
+#else
+    struct stat st;
+    void* data;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        return -ENOENT;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -EIO;
+    }
+
+    map->len = (size_t)st.st_size;
+    if (map->len == 0) {
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return -EIO;
+    }
+
+    madvise(data, map->len, MADV_SEQUENTIAL);
+    map->data = (const uint8_t*)data;
+#endif /* _WIN32 */
+
+    return 0;
+}
 
-        status = mm_parse_byte(parser, databyte, line);
+static void mm_unmap_file(mm_mapping_t* map) {
+#ifdef _WIN32
+    if (map->data != NULL) {
+        UnmapViewOfFile(map->data);
+        CloseHandle(map->mapping);
+    }
+    CloseHandle(map->file);
+#else
+    if (map->data != NULL) {
+        munmap((void*)map->data, map->len);
+    }
+#endif /* _WIN32 */
+}
+
+/* Add bytes to the frames being received in direction, and capture each frame as it completes. */
+static void mm_dlog2pcap_feed(mm_dlog2pcap_t* conv, char direction, const uint8_t* buf, size_t len, int line, uint32_t ts_sec, uint32_t ts_usec) {
+    mm_parser_t* parser;
+    uint8_t pkt_direction;
+    int frame_done;
+
+    if (direction == 'R') {
+        parser = &conv->rxparser;
+        pkt_direction = RX;
+    } else {
+        parser = &conv->txparser;
+        pkt_direction = TX;
+    }
 
-        if (status == 1) {
-            ts_sec = stop_time / 20000;
-            ts_usec = (stop_time % 20000);
+    while (len > 0) {
+        size_t used = mm_l2_parser_feed(&parser->l2, &parser->pkt, buf, len, &frame_done);
 
-            packets_processed++;
-            mm_add_pcap_rec(pcapstream, pkt_direction, &parser->pkt, ts_sec, ts_usec);
-//            print_mm_packet(pkt_direction, &parser->pkt);
-            mm_parser_reset(parser);
+        buf += used;
+        len -= used;
+
+        if (!frame_done) {
+            continue;
+        }
+
+        if (parser->l2.status & PKT_ERROR_CRC) {
+            printf("%s: %s: CRC Error in line %d!\n", __func__, conv->name, line);
         }
+        if (parser->l2.status & PKT_ERROR_FRAMING) {
+            printf("%s: %s: Framing Error in line %d!\n", __func__, conv->name, line);
+        }
+
+        conv->packets_processed++;
+        mm_add_pcap_rec(conv->pcapstream, pkt_direction, &parser->pkt, ts_sec, ts_usec);
+//        print_mm_packet(pkt_direction, &parser->pkt);
+        mm_parser_reset(parser);
     }
+}
 
-    printf("Processed %u packets\n", packets_processed);
+static int dlog_hex(char c) {
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
 
-done:
-    if (instream != NULL) {
-        fclose(instream);
+static const char* dlog_skip_space(const char* p, const char* end) {
+    while ((p < end) && ((*p == ' ') || (*p == '\t'))) {
+        p++;
     }
+    return p;
+}
 
-    mm_close_pcap(pcapstream);
+static const char* dlog_scan_uint(const char* p, const char* end, uint32_t* value) {
+    const char* start = p;
 
-    return status;
+    *value = 0;
+    while ((p < end) && (*p >= '0') && (*p <= '9')) {
+        *value = *value * 10 + (uint32_t)(*p++ - '0');
+    }
+    return (p == start) ? NULL : p;
 }
 
 /*
- * Byte at a time parser for the Nortel Millennium Terminal.
+ * Decode one line of a text log, in either of the forms:
+ *
+ *   <start>-<stop> UART: RX: XX
+ *   UART: RX: XX
  *
- * Packets are formatted as follows:
- * +------+-------+--------+-----------+--------+-----+
- * |START | FLAGS | LENGTH | DATA .... | CRC-16 | END |
- * +------+-------+--------+-----------+--------+-----+
+ * Returns 1 for a byte, 0 for a blank line, or -1 if the line can't be read.
  */
-uint8_t mm_parse_byte(mm_parser_t* context, uint8_t databyte, uint32_t line) {
-    uint8_t status = 0;
-
-    switch (context->l2_state) {
-    case L2_STATE_SEARCH_FOR_START:
-        if (databyte == START_BYTE) {
-            context->l2_state = L2_STATE_GET_FLAGS;
-            context->pkt.payload_len = 0;
-            context->pkt.hdr.start = databyte;
+static int dlog_scan_line(const char* p, const char* end, mm_dlog_byte_t* out) {
+    uint32_t start_time;
+    int hi, lo;
+
+    p = dlog_skip_space(p, end);
+    if ((p == end) || (*p == '\r')) {
+        return 0;
+    }
+
+    out->stop_time = 0;
+    if ((*p >= '0') && (*p <= '9')) {
+        if (((p = dlog_scan_uint(p, end, &start_time)) == NULL) || (p == end) || (*p++ != '-') ||
+            ((p = dlog_scan_uint(p, end, &out->stop_time)) == NULL)) {
+            return -1;
         }
-        break;
-    case L2_STATE_GET_FLAGS:
-        context->l2_state = L2_STATE_GET_LENGTH;
-        context->pkt.hdr.flags = databyte;
-        break;
-    case L2_STATE_GET_LENGTH:
-        context->pkt.hdr.pktlen = databyte;
-
-        if (context->pkt.hdr.pktlen > 5) {
-            context->l2_state = L2_STATE_ACCUMULATE_DATA;
+        p = dlog_skip_space(p, end);
+    }
+
+    /* TX/RX in file are from Terminal's perspective. */
+    if ((end - p < 9) || (memcmp(p, "UART:", 5) != 0)) {
+        return -1;
+    }
+    p = dlog_skip_space(p + 5, end);
+
+    if ((end - p < 3) || (p[1] != 'X') || (p[2] != ':')) {
+        return -1;
+    }
+    out->direction = p[0];
+    p = dlog_skip_space(p + 3, end);
+
+    if ((p == end) || ((hi = dlog_hex(*p)) < 0)) {
+        return -1;
+    }
+    p++;
+
+    if ((p < end) && ((lo = dlog_hex(*p)) >= 0)) {
+        out->byte = (uint8_t)((hi << 4) | lo);
+    } else {
+        out->byte = (uint8_t)hi;
+    }
+
+    return 1;
+}
+
+/* Decode a worker's piece of a text log, stopping at the first line that can't be read. */
+static void* dlog_decode_piece(void* arg) {
+    mm_dlog_piece_t* piece = (mm_dlog_piece_t*)arg;
+    const char* p = piece->start;
+
+    piece->count = 0;
+    piece->lines = 0;
+    piece->error_line = 0;
+    piece->status = 0;
+
+    while (p < piece->end) {
+        const char* eol = memchr(p, '\n', (size_t)(piece->end - p));
+        int result;
+
+        if (eol == NULL) {
+            eol = piece->end;
         }
-        else {
-            context->l2_state = L2_STATE_GET_CRC0;
+
+        if (piece->count == piece->capacity) {
+            size_t capacity = piece->capacity ? piece->capacity * 2 : 65536;
+            mm_dlog_byte_t* bytes = (mm_dlog_byte_t*)realloc(piece->bytes, capacity * sizeof(mm_dlog_byte_t));
+
+            if (bytes == NULL) {
+                piece->status = -ENOMEM;
+                break;
+            }
+            piece->bytes = bytes;
+            piece->capacity = capacity;
         }
-        break;
-    case L2_STATE_ACCUMULATE_DATA:
-        context->pkt.payload[context->pkt.payload_len] = databyte;
-        context->pkt.payload_len++;
 
-        if (context->pkt.payload_len == context->pkt.hdr.pktlen - 5) {
-            context->l2_state = L2_STATE_GET_CRC0;
+        piece->lines++;
+        piece->bytes[piece->count].line = (uint32_t)piece->lines;
+        result = dlog_scan_line(p, eol, &piece->bytes[piece->count]);
+
+        if (result < 0) {
+            piece->error_line = piece->lines;
+            break;
         }
-        break;
-    case L2_STATE_GET_CRC0:
-        context->l2_state = L2_STATE_GET_CRC1;
-        context->pkt.trailer.crc = databyte;
-        break;
-    case L2_STATE_GET_CRC1:
-        context->l2_state = L2_STATE_SEARCH_FOR_STOP;
-        context->pkt.trailer.crc |= databyte << 8;
-        context->pkt.calculated_crc = crc16(0, &context->pkt.hdr.start, (size_t)context->pkt.payload_len + 3);
-
-        if (context->pkt.trailer.crc != context->pkt.calculated_crc) {
-            printf("%s: CRC Error in line %u!\n", __func__, line);
-            context->status |= PKT_ERROR_CRC;
+        piece->count += (size_t)result;
+
+        p = eol + 1;
+    }
+
+    return NULL;
+}
+
+static int mm_dlog2pcap_text(mm_dlog2pcap_t* conv, const char* text, size_t len, int threads) {
+    mm_dlog_piece_t pieces[DLOG2PCAP_MAX_THREADS] = { 0 };
+    mm_thread_t     workers[DLOG2PCAP_MAX_THREADS];
+    int             started[DLOG2PCAP_MAX_THREADS];
+    const char*     end = text + len;
+    const char*     pos = text;
+    int             line = 0;
+    int             status = 0;
+
+    while ((pos < end) && (status == 0)) {
+        int count = 0;
+
+        /* Split the round at line ends, so each piece holds whole lines. */
+        while ((count < threads) && (pos < end)) {
+            const char* stop = ((size_t)(end - pos) > DLOG2PCAP_PIECE_SIZE) ? pos + DLOG2PCAP_PIECE_SIZE : end;
+
+            if (stop < end) {
+                const char* eol = memchr(stop, '\n', (size_t)(end - stop));
+
+                stop = (eol != NULL) ? eol + 1 : end;
+            }
+
+            pieces[count].start = pos;
+            pieces[count].end = stop;
+            pos = stop;
+            count++;
+        }
+
+        for (int i = 1; i < count; i++) {
+            started[i] = (mm_thread_create(&workers[i], dlog_decode_piece, &pieces[i]) == 0);
+            if (!started[i]) {
+                dlog_decode_piece(&pieces[i]);
+            }
         }
-        break;
-    case L2_STATE_SEARCH_FOR_STOP:
-        if (databyte == STOP_BYTE) {
-            context->l2_state = L2_STATE_SEARCH_FOR_START;
+        dlog_decode_piece(&pieces[0]);
+        for (int i = 1; i < count; i++) {
+            if (started[i]) {
+                mm_thread_join(workers[i]);
+            }
         }
-        else {
-            printf("%s: Framing Error in line %u!\n", __func__, line);
-            context->status |= PKT_ERROR_FRAMING;
+
+        /* Frame the bytes in file order. */
+        for (int i = 0; (i < count) && (status == 0); i++) {
+            mm_dlog_piece_t* piece = &pieces[i];
+
+            for (size_t j = 0; j < piece->count; j++) {
+                mm_dlog_byte_t* b = &piece->bytes[j];
+
+                mm_dlog2pcap_feed(conv, b->direction, &b->byte, 1, line + (int)b->line, b->stop_time / 20000, b->stop_time % 20000);
+            }
+
+            if (piece->status != 0) {
+                status = piece->status;
+            } else if (piece->error_line != 0) {
+                fprintf(stderr, "%s: Error parsing input stream, line=%d\n", conv->name, line + piece->error_line);
+                status = -EINVAL;
+            }
+            line += piece->lines;
         }
-        context->pkt.trailer.end = databyte;
-        status = 1;
-        break;
     }
 
-    /* Copy the packet trailer (CRC-16, STOP) immediately following the data */
-    memcpy(&(context->pkt.payload[context->pkt.payload_len]), &context->pkt.trailer, sizeof(context->pkt.trailer));
+    for (int i = 0; i < threads; i++) {
+        free(pieces[i].bytes);
+    }
+
+    /* As before, a line that can't be read ends the conversion, but what was read is kept. */
+    return (status == -EINVAL) ? 0 : status;
+}
+
+/* Chunks of bytes, each stamped with the time it was sent or received. */
+static int mm_dlog2pcap_binary(mm_dlog2pcap_t* conv, const mm_dlog_hdr_t* hdr, const uint8_t* data, size_t len) {
+    mm_dlog_chunk_t chunk;
+    size_t off = MM_DLOG_HDR_LEN;
+    int chunk_count = 0;
+    int status;
+
+    if (hdr->version != MM_DLOG_VERSION) {
+        fprintf(stderr, "%s: Unsupported log version %u.\n", conv->name, hdr->version);
+        return -EINVAL;
+    }
+
+    while ((status = mm_dlog_parse(data, len, &off, &chunk)) > 0) {
+        uint64_t ts_us = mm_dlog_wall_us(hdr, &chunk);
+
+        chunk_count++;
+        mm_dlog2pcap_feed(conv, chunk.direction, chunk.data, chunk.len, chunk_count,
+                          (uint32_t)(ts_us / 1000000), (uint32_t)(ts_us % 1000000));
+    }
+
+    if (status < 0) {
+        fprintf(stderr, "%s: Log is truncated after chunk %d\n", conv->name, chunk_count);
+    }
+
     return status;
 }
 
-uint8_t mm_parser_reset(mm_parser_t* context) {
-    context->l2_state = L2_STATE_SEARCH_FOR_START;
-    context->status = 0;
-    memset(&context->pkt, 0, sizeof(mm_packet_t));
+static int mm_dlog2pcap_file(const char* infile, const char* outfile, int threads) {
+    mm_dlog2pcap_t conv = { 0 };
+    mm_mapping_t   map;
+    mm_dlog_hdr_t  hdr;
+    int status;
+
+    conv.name = infile;
+
+    if ((status = mm_map_file(infile, &map)) != 0) {
+        fprintf(stderr, "Can't read '%s': %s\n", infile, strerror(-status));
+        return status;
+    }
+
+    if (mm_create_pcap(outfile, &conv.pcapstream) != 0) {
+        fprintf(stderr, "Can't write '%s': %s\n", outfile, strerror(errno));
+        mm_unmap_file(&map);
+        return -ENOENT;
+    }
+
+    mm_parser_reset(&conv.rxparser);
+    mm_parser_reset(&conv.txparser);
+
+    if (mm_dlog_parse_header(map.data, map.len, &hdr)) {
+        status = mm_dlog2pcap_binary(&conv, &hdr, map.data, map.len);
+    } else {
+        status = mm_dlog2pcap_text(&conv, (const char*)map.data, map.len, threads);
+    }
+
+    printf("%s: Processed %u packets\n", infile, conv.packets_processed);
+
+    mm_close_pcap(conv.pcapstream);
+    mm_unmap_file(&map);
+
+    return status;
+}
+
+static void* mm_dlog2pcap_dir_worker(void* arg) {
+    mm_dlog2pcap_dir_t* dir = (mm_dlog2pcap_dir_t*)arg;
+
+    for (;;) {
+        int index;
+
+        mm_mutex_lock(&dir->lock);
+        index = dir->next++;
+        mm_mutex_unlock(&dir->lock);
+
+        if (index >= dir->count) {
+            break;
+        }
+
+        /* The files themselves keep the workers busy, so each is converted on one thread. */
+        if (mm_dlog2pcap_file(dir->inputs[index], dir->outputs[index], 1) != 0) {
+            mm_mutex_lock(&dir->lock);
+            dir->failed++;
+            mm_mutex_unlock(&dir->lock);
+        }
+    }
+
+    return NULL;
+}
+
+/* Add a file to convert: <indir>/<name> to <outdir>/<name without extension>.pcap */
+static int mm_dlog2pcap_dir_add(mm_dlog2pcap_dir_t* dir, const char* indir, const char* outdir, const char* name) {
+    const char* ext = strrchr(name, '.');
+    size_t in_len = strlen(indir) + strlen(name) + 2;
+    size_t out_len = strlen(outdir) + strlen(name) + 7;
+    char** inputs;
+    char** outputs;
+
+    if ((ext == NULL) || (ext == name)) {
+        ext = name + strlen(name);
+    }
+
+    inputs = (char**)realloc(dir->inputs, (size_t)(dir->count + 1) * sizeof(char*));
+    if (inputs == NULL) return -ENOMEM;
+    dir->inputs = inputs;
+
+    outputs = (char**)realloc(dir->outputs, (size_t)(dir->count + 1) * sizeof(char*));
+    if (outputs == NULL) return -ENOMEM;
+    dir->outputs = outputs;
+
+    dir->inputs[dir->count] = (char*)malloc(in_len);
+    dir->outputs[dir->count] = (char*)malloc(out_len);
+    if ((dir->inputs[dir->count] == NULL) || (dir->outputs[dir->count] == NULL)) {
+        free(dir->inputs[dir->count]);
+        free(dir->outputs[dir->count]);
+        return -ENOMEM;
+    }
+
+    snprintf(dir->inputs[dir->count], in_len, "%s/%s", indir, name);
+    snprintf(dir->outputs[dir->count], out_len, "%s/%.*s.pcap", outdir, (int)(ext - name), name);
+    dir->count++;
 
     return 0;
 }
+
+static int mm_dlog2pcap_dir(const char* indir, const char* outdir, int threads) {
+    mm_dlog2pcap_dir_t dir = { 0 };
+    mm_thread_t workers[DLOG2PCAP_MAX_THREADS];
+    int started[DLOG2PCAP_MAX_THREADS];
+    int status = 0;
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find;
+    char pattern[TABLE_PATH_MAX_LEN];
+
+    _mkdir(outdir);
+
+    snprintf(pattern, sizeof(pattern), "%s\\*", indir);
+    if ((find = FindFirstFileA(pattern, &entry)) == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Can't read directory '%s'\n", indir);
+        return -ENOENT;
+    }
+
+    do {
+        if ((entry.cFileName[0] == '.') || (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) continue;
+        if ((status = mm_dlog2pcap_dir_add(&dir, indir, outdir, entry.cFileName)) != 0) break;
+    } while (FindNextFileA(find, &entry));
+
+    FindClose(find);
+#else
+    DIR* dp;
+    struct dirent* entry;
+
+    mkdir(outdir, 0755);
+
+    if ((dp = opendir(indir)) == NULL) {
+        fprintf(stderr, "Can't read directory '%s': %s\n", indir, strerror(errno));
+        return -ENOENT;
+    }
+
+    while ((entry = readdir(dp)) != NULL) {
+        char path[TABLE_PATH_MAX_LEN];
+        struct stat st;
+
+        if (entry->d_name[0] == '.') continue;
+
+        snprintf(path, sizeof(path), "%s/%s", indir, entry->d_name);
+        if ((stat(path, &st) != 0) || ((st.st_mode & S_IFMT) != S_IFREG)) continue;
+
+        if ((status = mm_dlog2pcap_dir_add(&dir, indir, outdir, entry->d_name)) != 0) break;
+    }
+
+    closedir(dp);
+#endif /* _WIN32 */
+
+    if (status == 0) {
+        int count = (dir.count < threads) ? dir.count : threads;
+
+        mm_mutex_init(&dir.lock);
+
+        for (int i = 1; i < count; i++) {
+            started[i] = (mm_thread_create(&workers[i], mm_dlog2pcap_dir_worker, &dir) == 0);
+        }
+        mm_dlog2pcap_dir_worker(&dir);
+        for (int i = 1; i < count; i++) {
+            if (started[i]) {
+                mm_thread_join(workers[i]);
+            }
+        }
+
+        mm_mutex_destroy(&dir.lock);
+
+        printf("Converted %d of %d files\n", dir.count - dir.failed, dir.count);
+        status = (dir.failed != 0) ? -EIO : 0;
+    } else {
+        fprintf(stderr, "Error: out of memory listing '%s'\n", indir);
+    }
+
+    for (int i = 0; i < dir.count; i++) {
+        free(dir.inputs[i]);
+        free(dir.outputs[i]);
+    }
+    free(dir.inputs);
+    free(dir.outputs);
+
+    return status;
+}
+
+static void mm_parser_reset(mm_parser_t* context) {
+    mm_l2_parser_reset(&context->l2);
+    memset(&context->pkt, 0, sizeof(mm_packet_t));
+}
@@ -0,0 +1,119 @@
+/*
+ * Millennium L2 frame parser, part of mm_manager.
+ *
+ * Shared by the manager's receive path and mm_dlog2pcap.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mm_l2.h"
+
+/* Reset the parser to search for the start of the next frame. */
+void mm_l2_parser_reset(mm_l2_parser_t* parser) {
+    parser->state  = L2_STATE_SEARCH_FOR_START;
+    parser->status = PKT_SUCCESS;
+}
+
+/*
+ * Feed up to len received bytes through the L2 framing state machine.
+ *
+ * Parsing stops after the first complete frame, setting *frame_done; its
+ * CRC and framing status are left in parser->status, and the trailer is
+ * also copied immediately following the payload.
+ *
+ * Returns the number of bytes consumed from buf.
+ */
+size_t mm_l2_parser_feed(mm_l2_parser_t* parser, mm_packet_t* pkt, const uint8_t* buf, size_t len, int* frame_done) {
+    const uint8_t* p   = buf;
+    const uint8_t* end = buf + len;
+
+    *frame_done = 0;
+
+    while (p < end) {
+        switch (parser->state) {
+            case L2_STATE_SEARCH_FOR_START:
+                p = (const uint8_t*)memchr(p, START_BYTE, (size_t)(end - p));
+
+                if (p == NULL) {
+                    return len;
+                }
+
+                parser->state    = L2_STATE_GET_FLAGS;
+                parser->status   = PKT_SUCCESS;
+                pkt->payload_len = 0;
+                pkt->hdr.start   = *p++;
+                break;
+            case L2_STATE_GET_FLAGS:
+                parser->state  = L2_STATE_GET_LENGTH;
+                pkt->hdr.flags = *p++;
+                break;
+            case L2_STATE_GET_LENGTH:
+                pkt->hdr.pktlen = *p++;
+                parser->crc = crc16(0, &pkt->hdr.start, sizeof(pkt->hdr));
+
+                if (pkt->hdr.pktlen > 5) {
+                    parser->state = L2_STATE_ACCUMULATE_DATA;
+                } else {
+                    parser->state = L2_STATE_GET_CRC0;
+                }
+                break;
+            case L2_STATE_ACCUMULATE_DATA:
+            {
+                size_t remaining = (size_t)(pkt->hdr.pktlen - 5) - pkt->payload_len;
+                size_t count     = (size_t)(end - p);
+
+                if (count > remaining) {
+                    count = remaining;
+                }
+
+                memcpy(&pkt->payload[pkt->payload_len], p, count);
+                parser->crc = crc16(parser->crc, p, count);
+                pkt->payload_len += (uint8_t)count;
+                p += count;
+
+                if (count == remaining) {
+                    parser->state = L2_STATE_GET_CRC0;
+                }
+                break;
+            }
+            case L2_STATE_GET_CRC0:
+                parser->state    = L2_STATE_GET_CRC1;
+                pkt->trailer.crc = *p++;
+                break;
+            case L2_STATE_GET_CRC1:
+                parser->state       = L2_STATE_SEARCH_FOR_STOP;
+
+                pkt->trailer.crc   |= (uint16_t)(*p++ << 8);
+                pkt->trailer.crc    = LE16(pkt->trailer.crc);
+                pkt->calculated_crc = LE16(parser->crc);
+
+                if (pkt->trailer.crc != pkt->calculated_crc) {
+                    parser->status |= PKT_ERROR_CRC;
+                }
+                break;
+            case L2_STATE_SEARCH_FOR_STOP:
+                if (*p != STOP_BYTE) {
+                    parser->status |= PKT_ERROR_FRAMING;
+                }
+                parser->state    = L2_STATE_SEARCH_FOR_START;
+                pkt->trailer.end = *p++;
+
+                /* Copy the packet trailer (CRC-16, STOP) immediately following the data */
+                memcpy(&(pkt->payload[pkt->payload_len]), &pkt->trailer, sizeof(pkt->trailer));
+                *frame_done = 1;
+                return (size_t)(p - buf);
+            default:
+                parser->state = L2_STATE_SEARCH_FOR_START;
+                break;
+        }
+    }
+
+    return len;
+}
@@ -0,0 +1,43 @@
+/*
+ * Millennium L2 frame parser, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_L2_H_
+#define MM_L2_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm_manager.h"
+
+#define L2_STATE_SEARCH_FOR_START   1
+#define L2_STATE_GET_FLAGS          2
+#define L2_STATE_GET_LENGTH         3
+#define L2_STATE_ACCUMULATE_DATA    4
+#define L2_STATE_GET_CRC0           5
+#define L2_STATE_GET_CRC1           6
+#define L2_STATE_SEARCH_FOR_STOP    7
+
+/*
+ * Incremental parser for frames of the form:
+ * +------+-------+--------+-----------+--------+-----+
+ * |START | FLAGS | LENGTH | DATA .... | CRC-16 | END |
+ * +------+-------+--------+-----------+--------+-----+
+ *
+ * The parser keeps no buffer of its own: frames are assembled directly
+ * in the caller's mm_packet_t, so input may be split anywhere.
+ */
+typedef struct mm_l2_parser {
+    uint8_t      state;
+    pkt_status_t status;    /* PKT_ERROR_CRC / PKT_ERROR_FRAMING for the current frame. */
+    uint16_t     crc;       /* Running CRC-16 of the bytes received so far. */
+} mm_l2_parser_t;
+
+void   mm_l2_parser_reset(mm_l2_parser_t* parser);
+size_t mm_l2_parser_feed(mm_l2_parser_t* parser, mm_packet_t* pkt, const uint8_t* buf, size_t len, int* frame_done);
+
+#endif  /* MM_L2_H_ */
@@ -30,8 +30,17 @@
 #include <sys/stat.h>
 
 #include "mm_manager.h"
+#include "mm_acct_writer.h"
+#include "mm_capture.h"
+#include "mm_dlog.h"
+#include "mm_table_cache.h"
+#include "mm_plan.h"
 #include "mm_serial.h"
 #include "mm_udp.h"
+#include "mm_thread.h"
+#include "mm_timer.h"
+#include "mm_reactor.h"
+#include "mm_replay.h"
 
 #ifndef VERSION
 # define VERSION "Unknown"
@@ -42,9 +51,13 @@
 /* Function Prototypes */
 time_t mm_time(int test_mode, time_t* rawtime);
 
-static int mm_shutdown(mm_context_t* context);
+static int mm_shutdown(mm_manager_t* manager);
+static void *mm_line_thread(void *arg);
+static void mm_line_session(mm_context_t* context);
+static int mm_add_line(char line_devs[][256], int *line_count, const char *modem_dev);
+static int mm_read_line_file(const char *fname, char line_devs[][256], int *line_count);
 static int mm_download_tables(mm_context_t* context, char* terminal_id);
-static int load_mm_table(mm_context_t* context, char* terminal_id, uint8_t table_id, uint8_t** buffer, size_t* len);
+static int load_mm_table(mm_context_t* context, uint8_t table_id, const mm_table_image_t* image, uint8_t** buffer, size_t* len);
 static void generate_install_parameters(mm_context_t* context, uint8_t** buffer, size_t* len);
 static void generate_term_access_parameters(mm_context_t* context, char* terminal_id, uint8_t** buffer, size_t* len);
 static void generate_term_access_parameters_mtr1(mm_context_t* context, char* terminal_id, uint8_t** buffer, size_t* len);
@@ -54,10 +67,11 @@ static void generate_comm_stat_parameters(mm_context_t* context, uint8_t** buffe
 static void generate_user_if_parameters(mm_context_t* context, uint8_t** buffer, size_t* len);
 static void generate_dlog_mt_end_data(mm_context_t* context, uint8_t** buffer, size_t* len);
 static int process_mm_table(mm_context_t* context, mm_table_t* table);
+static int end_trans_data(mm_context_t *context);
 static int create_terminal_specific_directory(char* table_dir, char* terminal_id);
 static int update_terminal_download_time(mm_context_t* context, char* terminal_id);
-static int check_mm_table_is_newer(mm_context_t* context, char* terminal_id, uint8_t table_id);
 static void mm_display_help(const char* name, FILE* stream);
+static int mm_write_replay_result(mm_manager_t* manager, const char* filename, const mm_sql_table_rows_t* db_rows, int db_tables, int db_changes);
 #ifndef _WIN32
 void signal_handler(int sig);
 #endif
@@ -249,7 +263,7 @@ uint8_t table_list_mtr17_intl[] = {
     0                         /* End of table list */
 };
 
-const char cmdline_options[] = "a:b:cd:e:f:hi:k:l:mn:p:qrst:uvw";
+const char cmdline_options[] = "a:Ab:B:cd:D:e:f:F:hi:k:l:L:mn:p:P:qrR:sSt:T:uU:vw";
 
 /* Default communication parameters, may be overridden during compile. */
 #ifndef DEFAULT_BAUD_RATE
@@ -301,9 +315,25 @@ void signal_handler(int sig) {
 #endif /* _WIN32 */
 
 int main(int argc, char *argv[]) {
+    mm_manager_t *manager;
     mm_context_t *mm_context;
-    mm_table_t    mm_table;
-    char *modem_dev = NULL;
+    mm_connection_t line_template = { 0 };   /* Connection settings from the command line, applied to every line. */
+    mm_thread_t   line_threads[MM_MAX_LINES];
+    int           use_reactor = 0;
+    char  line_devs[MM_MAX_LINES][256];         /* Modem devices (or test files) from -f and -F. */
+    char *log_filename  = NULL;
+    char *dlog_filename = NULL;
+    char *pcap_filename = NULL;
+    char *result_filename = NULL;
+    mm_sql_table_rows_t db_rows[MM_SQL_MAX_TABLES];  /* Before a replay, for -R */
+    int   db_tables = 0;
+    int   db_changes = 0;
+    uint64_t replay_start_ms;
+    uint32_t capture_rotate_mb = 0;
+    uint32_t capture_rotate_min = 0;
+    char  line_filename[TABLE_PATH_MAX_LEN];
+    int   line_count = 0;
+    int   line;
     int   ncc_index = 0;
     int   c;
     int   baudrate      = DEFAULT_BAUD_RATE;
@@ -311,11 +341,8 @@ int main(int argc, char *argv[]) {
     char  key_card_number_str[11];
     int   quiet = 0;
     int   status;
-    int   retries;
     int   betest = 1;
-
-    time_t rawtime;
-    struct tm ptm = { 0 };
+    int   db_profile = MM_DB_PROFILE_DEFAULT;
 
 #ifdef _WIN32
     SetConsoleCtrlHandler(signal_handler, TRUE);
@@ -323,6 +350,8 @@ int main(int argc, char *argv[]) {
     signal(SIGINT, signal_handler);
 #endif /* _WIN32 */
 
+    crc16_init();
+
     opterr = 0;
 
     if (argc < 2) {
@@ -331,35 +360,37 @@ int main(int argc, char *argv[]) {
         exit (-EINVAL);
     }
 
-    mm_context = (mm_context_t *)calloc(1, sizeof(mm_context_t));
+    manager = (mm_manager_t *)calloc(1, sizeof(mm_manager_t));
 
-    if (mm_context == NULL) {
-        printf("Error: failed to allocate %d bytes.\n", (int)sizeof(mm_context_t));
+    if (manager == NULL) {
+        printf("Error: failed to allocate %d bytes.\n", (int)sizeof(mm_manager_t));
         exit (-ENOMEM);
     }
 
-    snprintf(mm_context->default_table_dir,  sizeof(mm_context->default_table_dir),  "tables/default");
-    snprintf(mm_context->term_table_dir,     sizeof(mm_context->term_table_dir),     "tables");
-    snprintf(mm_context->connection.modem_reset_string, sizeof(mm_context->connection.modem_reset_string), "%s", DEFAULT_MODEM_RESET_STRING);
-    snprintf(mm_context->connection.modem_init_string,  sizeof(mm_context->connection.modem_init_string), "%s",  DEFAULT_MODEM_INIT_STRING);
+    snprintf(manager->default_table_dir,  sizeof(manager->default_table_dir),  "tables/default");
+    snprintf(manager->term_table_dir,     sizeof(manager->term_table_dir),     "tables");
+    snprintf(line_template.modem_reset_string, sizeof(line_template.modem_reset_string), "%s", DEFAULT_MODEM_RESET_STRING);
+    snprintf(line_template.modem_init_string,  sizeof(line_template.modem_init_string), "%s",  DEFAULT_MODEM_INIT_STRING);
 
-    mm_context->connection.proto.rx_packet_gap = 10;
+    line_template.proto.rx_packet_gap = 10;
+    line_template.proto.max_retries = PKT_MAX_RETRIES;
+    line_template.proto.ack_timeout_ms = PKT_ACK_TIMEOUT_MS;
 
-    mm_context->access_code[0] = 0x27;
-    mm_context->access_code[1] = 0x27;
-    mm_context->access_code[2] = 0x37;
-    mm_context->access_code[3] = 0x8e;
+    manager->access_code[0] = 0x27;
+    manager->access_code[1] = 0x27;
+    manager->access_code[2] = 0x37;
+    manager->access_code[3] = 0x8e;
 
-    mm_context->key_card_number[0] = 0x40;
-    mm_context->key_card_number[1] = 0x12;
-    mm_context->key_card_number[2] = 0x88;
-    mm_context->key_card_number[3] = 0x88;
-    mm_context->key_card_number[4] = 0x88;
+    manager->key_card_number[0] = 0x40;
+    manager->key_card_number[1] = 0x12;
+    manager->key_card_number[2] = 0x88;
+    manager->key_card_number[3] = 0x88;
+    manager->key_card_number[4] = 0x88;
 
-    mm_context->complete_download = FALSE;
-    mm_context->connection.proto.monitor_carrier = TRUE;
+    manager->complete_download = FALSE;
+    line_template.proto.monitor_carrier = TRUE;
 
-    mm_context->test_mode = TRUE;
+    manager->test_mode = TRUE;
 
     /* Parse command line to get -q (quiet) option. */
     while ((c = getopt(argc, argv, cmdline_options)) != -1) {
@@ -385,149 +416,199 @@ int main(int argc, char *argv[]) {
             {
                 if (strnlen(optarg, 7) != 7) {
                     fprintf(stderr, "Option -a takes a 7-digit access code.\n");
-                    mm_shutdown(mm_context);
+                    mm_shutdown(manager);
                     return(-EINVAL);
                 }
 
                 /* Update Access Code */
                 for (int i = 0; i < ACCESS_CODE_LEN; i++) {
                     if (i % 2 == 0) {
-                        mm_context->access_code[i >> 1] = (optarg[i] - '0') << 4;
+                        manager->access_code[i >> 1] = (optarg[i] - '0') << 4;
                     }
                     else {
-                        mm_context->access_code[i >> 1] |= (optarg[i] - '0');
+                        manager->access_code[i >> 1] |= (optarg[i] - '0');
                     }
                 }
 
-                mm_context->access_code[3] |= 0x0e; /* Terminate the Access Code with 0xe */
+                manager->access_code[3] |= 0x0e; /* Terminate the Access Code with 0xe */
                 break;
             }
+            case 'A':
+                printf("NOTE: Learning the packet gap for each terminal.\n");
+                manager->adaptive_link = 1;
+                break;
             case 'b':
                 baudrate = atoi(optarg);
                 break;
+            case 'B':
+            {
+                int budget = atoi(optarg);
+
+                if ((budget <= 0) || (budget > (int)(UINT32_MAX / 1000))) {
+                    fprintf(stderr, "Option -B takes a positive number of seconds.\n");
+                    mm_shutdown(manager);
+                    return(-EINVAL);
+                }
+
+                manager->download_budget_ms = (uint32_t)budget * 1000;
+                printf("NOTE: Deferring optional tables that don't fit in a %d second download.\n", budget);
+                break;
+            }
             case 'c':
                 fprintf(stdout, "NOTE: Complete set of tables will be downloaded for every download request.\n");
-                mm_context->complete_download = TRUE;
+                manager->complete_download = TRUE;
                 break;
             case 'd':
-                snprintf(mm_context->default_table_dir, sizeof(mm_context->default_table_dir), "%s", optarg);
+                snprintf(manager->default_table_dir, sizeof(manager->default_table_dir), "%s", optarg);
+                break;
+            case 'D':
+                if (strcmp(optarg, "wal") == 0) {
+                    printf("NOTE: Using WAL database profile.\n");
+                    db_profile = MM_DB_PROFILE_WAL;
+                } else if (strcmp(optarg, "default") == 0) {
+                    db_profile = MM_DB_PROFILE_DEFAULT;
+                } else {
+                    fprintf(stderr, "Error: -D <profile> must be one of: default, wal\n");
+                    mm_shutdown(manager);
+                    exit(-EINVAL);
+                }
                 break;
             case 'e':
-                mm_context->connection.proto.error_inject_type = atoi(optarg);
-                if (mm_context->connection.proto.error_inject_type < 5) {
-                    printf("SIGBRK will inject %s.\n", error_inject_type_to_str(mm_context->connection.proto.error_inject_type));
+                line_template.proto.error_inject_type = atoi(optarg);
+                if (line_template.proto.error_inject_type < 5) {
+                    printf("SIGBRK will inject %s.\n", error_inject_type_to_str(line_template.proto.error_inject_type));
                 }
                 else {
                     fprintf(stderr, "Error: -e <inject_error_type> must be one of:\n");
                     for (int i = 0; i < 5; i++) {
                         fprintf(stderr, "\t%d - %s\n", i, error_inject_type_to_str(i));
                     }
-                    mm_shutdown(mm_context);
+                    mm_shutdown(manager);
                     return(-EINVAL);
                 }
                 break;
             case 'f':
-                modem_dev = optarg;
+                if (mm_add_line(line_devs, &line_count, optarg) != 0) {
+                    mm_shutdown(manager);
+                    return(-EINVAL);
+                }
+                break;
+            case 'F':
+                if (mm_read_line_file(optarg, line_devs, &line_count) != 0) {
+                    mm_shutdown(manager);
+                    return(-EINVAL);
+                }
                 break;
             case 'h':
                 mm_display_help(basename(argv[0]), stdout);
-                mm_shutdown(mm_context);
+                mm_shutdown(manager);
                 return(0);
                 break;
             case 'i':
-                snprintf(mm_context->connection.modem_init_string, sizeof(mm_context->connection.modem_init_string), "%s", optarg);
+                snprintf(line_template.modem_init_string, sizeof(line_template.modem_init_string), "%s", optarg);
                 break;
             case 'k':
             {
                 if (strnlen(optarg, 10) != 10) {
                     fprintf(stderr, "Option -k takes a 10-digit key code.\n");
-                    mm_shutdown(mm_context);
+                    mm_shutdown(manager);
                     return(-EINVAL);
                 }
 
                 /* Update Key Card Number */
                 for (int i = 0; i < KEY_CARD_LEN; i++) {
                     if (i % 2 == 0) {
-                        mm_context->key_card_number[i >> 1] = (optarg[i] - '0') << 4;
+                        manager->key_card_number[i >> 1] = (optarg[i] - '0') << 4;
                     }
                     else {
-                        mm_context->key_card_number[i >> 1] |= (optarg[i] - '0');
+                        manager->key_card_number[i >> 1] |= (optarg[i] - '0');
                     }
                 }
                 break;
             }
             case 'l':
-                if (!(mm_context->connection.logstream = fopen(optarg, "w"))) {
-                    fprintf(stderr, "mm_manager: Can't write log file '%s': %s\n", optarg, strerror(errno));
-                    mm_shutdown(mm_context);
-                    return(-ENOENT);
-                }
+                log_filename = optarg;
+                break;
+            case 'L':
+                dlog_filename = optarg;
                 break;
             case 'm':
-                mm_context->connection.proto.use_modem = TRUE;
-                mm_context->test_mode = FALSE;
+                line_template.proto.use_modem = TRUE;
+                manager->test_mode = FALSE;
                 break;
             case 'n':
                 if (ncc_index > 1) {
                     fprintf(stderr, "-n may only be specified twice.\n");
-                    mm_shutdown(mm_context);
+                    mm_shutdown(manager);
                     return(-EINVAL);
                 }
 
                 if ((strnlen(optarg, 16) < 1) || (strnlen(optarg, 16) > 15)) {
                     fprintf(stderr, "Option -n takes a 1- to 15-digit NCC number.\n");
-                    mm_shutdown(mm_context);
+                    mm_shutdown(manager);
                     return(-EINVAL);
                 }
                 else {
-                    snprintf(mm_context->ncc_number[ncc_index], sizeof(mm_context->ncc_number[0]), "%s", optarg);
+                    snprintf(manager->ncc_number[ncc_index], sizeof(manager->ncc_number[0]), "%s", optarg);
                     ncc_index++;
                 }
                 break;
             case 'p':
-                if (mm_create_pcap(optarg, &mm_context->connection.proto.pcapstream) != 0) {
-                    fprintf(stderr, "mm_manager: Can't write packet capture file '%s': %s\n", optarg, strerror(errno));
-                    mm_shutdown(mm_context);
-                    return(-EINVAL);
-                }
+                pcap_filename = optarg;
+                break;
+            case 'P':
+                capture_rotate_mb = (uint32_t)atoi(optarg);
                 break;
             case 'q':
                 break;
             case 'r':
                 printf("NOTE: Rating test mode enabled.\n");
-                mm_context->rating_test_mode = 1;
+                manager->rating_test_mode = 1;
+                break;
+            case 'R':
+                result_filename = optarg;
                 break;
             case 's':
                 printf("NOTE: Using minimum required table list for download.\n");
-                mm_context->minimal_table_set = 1;
+                manager->minimal_table_set = 1;
+                break;
+            case 'S':
+                printf("NOTE: Sending optional tables on the table update after a download.\n");
+                manager->split_download = 1;
                 break;
             case 't':
-                snprintf(mm_context->term_table_dir,    sizeof(mm_context->term_table_dir),    "%s", optarg);
+                snprintf(manager->term_table_dir,    sizeof(manager->term_table_dir),    "%s", optarg);
+                break;
+            case 'T':
+                capture_rotate_min = (uint32_t)atoi(optarg);
                 break;
             case 'u':
-                printf("Sending UDP packets to 127.0.0.1:%d\n", MM_UDP_PORT);
-                if (mm_create_udp("127.0.0.1", MM_UDP_PORT) != 0) {
-                    fprintf(stderr, "mm_create_udp() failed.\n");
-                    mm_shutdown(mm_context);
+            case 'U':
+                if ((manager->udp == NULL) && ((manager->udp = mm_udp_open()) == NULL)) {
+                    mm_shutdown(manager);
                     return(-EINVAL);
                 }
-                mm_context->connection.proto.send_udp = 1;
+                if (mm_udp_add_subscriber(manager->udp, (c == 'u') ? "127.0.0.1" : optarg) != 0) {
+                    mm_shutdown(manager);
+                    return(-EINVAL);
+                }
+                printf("Sending UDP packets to %s\n", (c == 'u') ? "127.0.0.1" : optarg);
                 break;
             case 'v':
-                mm_context->debuglevel++;
-                mm_context->connection.proto.debuglevel++;
+                manager->debuglevel++;
+                line_template.proto.debuglevel++;
                 break;
             case 'w':   /* Don't monitor carrier detect signal from modem. */
-                mm_context->connection.proto.monitor_carrier = FALSE;
+                line_template.proto.monitor_carrier = FALSE;
                 break;
             case '?':
             default:
-                if ((optopt == 'f') || (optopt == 'l') || (optopt == 'a') || (optopt == 'n') || (optopt == 'b')) {
+                if ((optopt == 'f') || (optopt == 'F') || (optopt == 'l') || (optopt == 'a') || (optopt == 'n') || (optopt == 'b') || (optopt == 'B') || (optopt == 'D') || (optopt == 'L') || (optopt == 'p') || (optopt == 'P') || (optopt == 'R') || (optopt == 'T') || (optopt == 'U')) {
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 } else {
                     fprintf(stderr, "Unknown option `-%c'.\n", optopt);
                 }
-                mm_shutdown(mm_context);
+                mm_shutdown(manager);
                 exit(-EINVAL);
                 break;
             }
@@ -537,33 +618,33 @@ int main(int argc, char *argv[]) {
         for (c = optind; c < argc; c++) {
             fprintf(stderr, "Error: superfluous non-option argument '%s'.\n", argv[c]);
         }
-        mm_shutdown(mm_context);
+        mm_shutdown(manager);
         return(-EINVAL);
     }
 
-    printf("Default Table directory: %s\n",                         mm_context->default_table_dir);
-    printf("Terminal-specific Table directory: %s/<terminal_id>\n", mm_context->term_table_dir);
+    printf("Default Table directory: %s\n",                         manager->default_table_dir);
+    printf("Terminal-specific Table directory: %s/<terminal_id>\n", manager->term_table_dir);
 
     printf("Using access code: %s\n",
-           phone_num_to_string(access_code_str, sizeof(access_code_str), mm_context->access_code,
-                               sizeof(mm_context->access_code)));
+           phone_num_to_string(access_code_str, sizeof(access_code_str), manager->access_code,
+                               sizeof(manager->access_code)));
     printf("Using key card number: %s\n",
-        phone_num_to_string(key_card_number_str, sizeof(key_card_number_str), mm_context->key_card_number,
-            sizeof(mm_context->key_card_number)));
+        phone_num_to_string(key_card_number_str, sizeof(key_card_number_str), manager->key_card_number,
+            sizeof(manager->key_card_number)));
 
-    printf("Manager Inter-packet Tx gap: %dms.\n", mm_context->connection.proto.rx_packet_gap * 10);
+    printf("Manager Inter-packet Tx gap: %dms.\n", line_template.proto.rx_packet_gap * 10);
 
-    if (strnlen(mm_context->ncc_number[0], sizeof(mm_context->ncc_number[0])) >= 1) {
-        printf("Using Primary NCC number: %s\n", mm_context->ncc_number[0]);
+    if (strnlen(manager->ncc_number[0], sizeof(manager->ncc_number[0])) >= 1) {
+        printf("Using Primary NCC number: %s\n", manager->ncc_number[0]);
 
-        if (strnlen(mm_context->ncc_number[1], sizeof(mm_context->ncc_number[0])) == 0) {
-            snprintf(mm_context->ncc_number[1], sizeof(mm_context->ncc_number[1]), "%s", mm_context->ncc_number[0]);
+        if (strnlen(manager->ncc_number[1], sizeof(manager->ncc_number[0])) == 0) {
+            snprintf(manager->ncc_number[1], sizeof(manager->ncc_number[1]), "%s", manager->ncc_number[0]);
         }
 
-        printf("Using Secondary NCC number: %s\n", mm_context->ncc_number[1]);
-    } else if (mm_context->connection.proto.use_modem == 1) {
+        printf("Using Secondary NCC number: %s\n", manager->ncc_number[1]);
+    } else if (line_template.proto.use_modem == 1) {
         fprintf(stderr, "Error: -n <NCC Number> must be specified.\n");
-        mm_shutdown(mm_context);
+        mm_shutdown(manager);
         return(-EINVAL);
     }
 
@@ -573,6 +654,18 @@ int main(int argc, char *argv[]) {
     }
     printf("Baud Rate: %d\n", baudrate);
 
+    if (line_count == 0) {
+        fprintf(stderr, "Error: at least -f <filename> must be specified.\n");
+        mm_shutdown(manager);
+        return(-EINVAL);
+    }
+
+    if ((result_filename != NULL) && !manager->test_mode) {
+        fprintf(stderr, "Error: -R <resultfile> is only for test mode, without -m.\n");
+        mm_shutdown(manager);
+        return(-EINVAL);
+    }
+
     if (*(char*)&betest != 1) {
         printf("Machine is BIG-ENDIAN.\n");
         if (LE16(0x1234) != 0x3412) {
@@ -580,65 +673,386 @@ int main(int argc, char *argv[]) {
             exit(0);
         }
     }
-    mm_context->telco.id[0] = 'V';
-    mm_context->telco.id[1] = 'Z';
-    mm_context->telco.region_code[0] = 'U';
-    mm_context->telco.region_code[1] = 'S';
-    mm_context->telco.region_code[2] = '.';
+    manager->telco.id[0] = 'V';
+    manager->telco.id[1] = 'Z';
+    manager->telco.region_code[0] = 'U';
+    manager->telco.region_code[1] = 'S';
+    manager->telco.region_code[2] = '.';
 
-    if ((mm_context->database = mm_open_database("mm_manager.db")) == 0) {
+    if ((manager->database = mm_open_database("mm_manager.db", db_profile)) == 0) {
         (void)fprintf(stderr, "mm_manager: error opening database.\n");
-        mm_shutdown(mm_context);
+        mm_shutdown(manager);
         return(-EINVAL);
     }
 
-    status = mm_connection_open(&mm_context->connection, modem_dev, baudrate, mm_context->test_mode);
-    if (status != 0) {
-        mm_shutdown(mm_context);
-        return(status);
+    if ((manager->table_cache = mm_table_cache_create(manager->default_table_dir, manager->term_table_dir)) == NULL) {
+        mm_shutdown(manager);
+        return(-ENOMEM);
     }
 
-    mm_context->cdr_ack_buffer_len = 0;
-    printf("Waiting for call from terminal...\n");
+    if ((manager->plan_cache = mm_plan_cache_create()) == NULL) {
+        mm_shutdown(manager);
+        return(-ENOMEM);
+    }
 
-    while (manager_running) {
+    /* Save accounting records from a writer thread, except in test mode, where output must stay in order. */
+    if ((manager->acct_writer = mm_acct_writer_start(manager->database, &manager->telco, !manager->test_mode)) == NULL) {
+        mm_shutdown(manager);
+        return(-ENOMEM);
+    }
 
-        retries = 0;
-        if (mm_connection_wait(&mm_context->connection)) {
-            while (proto_connected(&mm_context->connection.proto) && (manager_running) && (retries < 3)) {
-                retries++;
-                status = process_mm_table(mm_context, &mm_table);
-                if (status == PKT_SUCCESS) {
-                    retries = 0;
-                }
+    /* Open each line, with its own log file. */
+    for (line = 0; line < line_count; line++) {
+        mm_context = (mm_context_t *)calloc(1, sizeof(mm_context_t));
+
+        if (mm_context == NULL) {
+            printf("Error: failed to allocate %d bytes.\n", (int)sizeof(mm_context_t));
+            mm_shutdown(manager);
+            exit (-ENOMEM);
+        }
+
+        mm_context->manager = manager;
+        mm_context->connection = line_template;
+        mm_context->connection.line = line;
+        snprintf(mm_context->modem_dev, sizeof(mm_context->modem_dev), "%.*s", (int)sizeof(mm_context->modem_dev) - 1, line_devs[line]);
+        manager->lines[manager->line_count++] = mm_context;
+
+        if (log_filename != NULL) {
+            mm_line_filename(line_filename, sizeof(line_filename), log_filename, line, line_count);
+            if (!(mm_context->connection.logstream = fopen(line_filename, "w"))) {
+                fprintf(stderr, "mm_manager: Can't write log file '%s': %s\n", line_filename, strerror(errno));
+                mm_shutdown(manager);
+                return(-ENOENT);
             }
+        }
 
-            if (proto_connected(&mm_context->connection.proto)) {
-                proto_disconnect(&mm_context->connection.proto);
+        if (dlog_filename != NULL) {
+            mm_line_filename(line_filename, sizeof(line_filename), dlog_filename, line, line_count);
+            if ((mm_context->connection.dlog = mm_dlog_writer_open(line_filename, line)) == NULL) {
+                mm_shutdown(manager);
+                return(-ENOENT);
             }
+        }
+
+        if (line_count > 1) {
+            printf("Line %d: %s\n", line, mm_context->modem_dev);
+        }
+
+        status = mm_connection_open(&mm_context->connection, mm_context->modem_dev, baudrate, manager->test_mode);
+        if (status != 0) {
+            mm_shutdown(manager);
+            return(status);
+        }
+    }
 
-            mm_time(mm_context->test_mode, &rawtime);
-            localtime_r(&rawtime, &ptm);
+    /* Capture and mirror packets from a writer thread, so the lines never wait for the disk or network. */
+    if ((pcap_filename != NULL) || (manager->udp != NULL)) {
+        const char *line_names[MM_MAX_LINES];
+
+        for (line = 0; line < manager->line_count; line++) {
+            line_names[line] = manager->lines[line]->modem_dev;
+        }
 
-            printf("\n\n%04d-%02d-%02d %2d:%02d:%02d: Terminal %s: Disconnected.\n\n",
-                ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
-                mm_context->connection.proto.terminal_id);
+        if ((manager->capture = mm_capture_open(pcap_filename, manager->line_count, line_names, capture_rotate_mb, capture_rotate_min, manager->udp)) == NULL) {
+            mm_shutdown(manager);
+            return(-EINVAL);
+        }
+
+        for (line = 0; line < manager->line_count; line++) {
+            manager->lines[line]->connection.proto.capture = manager->capture;
+            manager->lines[line]->connection.proto.capture_line = line;
+        }
+    }
+
+#ifdef MM_HAVE_REACTOR
+    /* Test input files cannot be polled. */
+    use_reactor = !manager->test_mode;
+#endif /* MM_HAVE_REACTOR */
+
+    /* Note what is in the database, to report what the replay adds. */
+    if (result_filename != NULL) {
+        db_tables = mm_sql_count_rows(manager->database, db_rows, MM_SQL_MAX_TABLES);
+        db_changes = mm_sql_total_changes(manager->database);
+    }
+    replay_start_ms = mm_clock_ms();
+
+    if (use_reactor) {
+#ifdef MM_HAVE_REACTOR
+        mm_reactor_run(manager, mm_line_session);
+#endif /* MM_HAVE_REACTOR */
+    } else if (manager->test_mode) {
+        /* Replay one line after another, so each run writes the same records in the same order. */
+        for (line = 0; line < manager->line_count; line++) {
+            mm_line_thread(manager->lines[line]);
+        }
+
+        printf("mm_manager: Replayed %d line%s in %.3f seconds.\n", manager->line_count,
+               (manager->line_count == 1) ? "" : "s", (double)(mm_clock_ms() - replay_start_ms) / 1000.0);
+
+        if ((result_filename != NULL) &&
+            (mm_write_replay_result(manager, result_filename, db_rows, db_tables, db_changes) != 0)) {
+            mm_shutdown(manager);
+            return(-EIO);
+        }
+    } else {
+        /* Each line runs its own session loop; the database is shared. */
+        for (line = 0; line < manager->line_count; line++) {
+            if (mm_thread_create(&line_threads[line], mm_line_thread, manager->lines[line]) != 0) {
+                manager_running = 0;
+                break;
+            }
+        }
+
+        while (line-- > 0) {
+            mm_thread_join(line_threads[line]);
         }
     }
 
     printf("mm_manager: Shutting down.\n");
-    mm_shutdown(mm_context);
+    mm_shutdown(manager);
     return 0;
 }
 
-static int mm_shutdown(mm_context_t* context) {
-    mm_close_database(context->database);
-    mm_connection_close(&context->connection);
+/* Session loop for one line: wait for a call, then run it until the terminal disconnects. */
+static void *mm_line_thread(void *arg) {
+    mm_context_t *context = (mm_context_t *)arg;
+    int status;
+
+    context->cdr_ack_buffer_len = 0;
+
+    if (context->manager->line_count > 1) {
+        printf("Line %d: Waiting for call from terminal...\n", context->connection.line);
+    } else {
+        printf("Waiting for call from terminal...\n");
+    }
+
+    while (manager_running) {
+        status = mm_connection_wait(&context->connection);
+
+        if (status < 0) {
+            break;
+        }
+
+        if (status) {
+            mm_line_session(context);
+        }
+    }
+
+    return NULL;
+}
+
+#define LINK_GAP_MIN        1   /* Smallest inter-packet gap tried, in 10ms units. */
+#define LINK_CALL_PACKETS   4   /* Packets a call needs without errors to try a smaller gap. */
+
+/*
+ * With -A, use the packet gap learned for the terminal for the rest of the
+ * call.  It is sent to the terminal in DLOG_MT_INSTALL_PARAMS on its next
+ * download.
+ */
+static void link_tune_begin(mm_context_t *context, char *terminal_id) {
+    mm_proto_t *proto = &context->connection.proto;
+    mm_link_tune_t *tune = &context->link_tune;
+
+    context->line_packet_gap = proto->rx_packet_gap;
+    context->line_max_retries = proto->max_retries;
+    context->line_ack_timeout_ms = proto->ack_timeout_ms;
+
+    if (mm_sql_load_TLINKTUNE(context->manager->database, terminal_id, tune) != 0) {
+        memset(tune, 0, sizeof(mm_link_tune_t));
+        tune->rx_packet_gap = proto->rx_packet_gap;
+        tune->min_gap = LINK_GAP_MIN;
+    }
+
+    proto->rx_packet_gap = tune->rx_packet_gap;
+
+    /* Give a terminal with more than 5% of packets in error more tries per packet. */
+    if (tune->retries * 20 > tune->packets) {
+        proto->max_retries = PKT_MAX_RETRIES * 2;
+    }
+
+    /* Resend sooner to a terminal that is known to ACK quickly. */
+    if ((tune->ack_ms != 0) && (4 * (uint32_t)tune->ack_ms + 1000 < proto->ack_timeout_ms)) {
+        proto->ack_timeout_ms = 4 * (uint32_t)tune->ack_ms + 1000;
+    }
+
+    if ((proto->rx_packet_gap != context->line_packet_gap) || (proto->max_retries != context->line_max_retries) ||
+        (proto->ack_timeout_ms != context->line_ack_timeout_ms)) {
+        printf("\tTerminal %s: Using packet gap %dms, %d retries, ACK timeout %ums.\n", terminal_id,
+            proto->rx_packet_gap * 10, proto->max_retries, proto->ack_timeout_ms);
+    }
+
+    context->link_stats = proto->stats;
+    context->link_tuned = 1;
+}
+
+/*
+ * Learn from the call: after errors in 2% or more of the packets, double
+ * the gap and don't go back to the gap that failed.  Fewer errors are put
+ * down to line noise, and the gap is kept.  After a call without errors,
+ * try a smaller gap.
+ */
+static void link_tune_end(mm_context_t *context) {
+    mm_proto_t *proto = &context->connection.proto;
+    mm_link_tune_t *tune = &context->link_tune;
+    int      gap = tune->rx_packet_gap;
+    int      max_gap = (context->line_packet_gap * 4 < 255) ? context->line_packet_gap * 4 : 255;
+    uint32_t packets = (proto->stats.tx_packets - context->link_stats.tx_packets) +
+                       (proto->stats.rx_packets - context->link_stats.rx_packets);
+    uint32_t errors = (proto->stats.tx_retries - context->link_stats.tx_retries) +
+                      (proto->stats.rx_errors - context->link_stats.rx_errors);
+    uint32_t acks = proto->stats.ack_count - context->link_stats.ack_count;
+
+    if (!context->link_tuned) {
+        return;
+    }
+
+    if (acks > 0) {
+        uint32_t ack_ms = (proto->stats.ack_ms - context->link_stats.ack_ms) / acks;
+
+        tune->ack_ms = (uint16_t)((tune->ack_ms == 0) ? ack_ms : (3 * tune->ack_ms + ack_ms) / 4);
+    }
+
+    tune->packets += packets;
+    tune->retries += errors;
+
+    if (errors * 50 >= packets) {
+        if (tune->min_gap <= gap) {
+            tune->min_gap = (uint8_t)((gap + 1 < max_gap) ? gap + 1 : max_gap);
+        }
+        gap = (gap * 2 > gap + 1) ? gap * 2 : gap + 1;
+        gap = (gap < max_gap) ? gap : max_gap;
+    } else if ((errors == 0) && (packets >= LINK_CALL_PACKETS)) {
+        gap -= (gap / 4 > 1) ? gap / 4 : 1;
+        gap = (gap > tune->min_gap) ? gap : tune->min_gap;
+    }
+
+    printf("Terminal %s: %u packets, %u errors, ACK in %ums; packet gap %dms, next call %dms.\n",
+        proto->terminal_id, packets, errors, tune->ack_ms, tune->rx_packet_gap * 10, gap * 10);
+
+    tune->rx_packet_gap = (uint8_t)gap;
+
+    if (mm_sql_save_TLINKTUNE(context->manager->database, proto->terminal_id, tune) != 0) {
+        fprintf(stderr, "%s: Terminal %s: Failed to save link settings.\n", __func__, proto->terminal_id);
+    }
+
+    proto->rx_packet_gap = context->line_packet_gap;
+    proto->max_retries = context->line_max_retries;
+    proto->ack_timeout_ms = context->line_ack_timeout_ms;
+    context->link_tuned = 0;
+}
+
+/* Process tables on a connected line until the terminal disconnects. */
+static void mm_line_session(mm_context_t* context) {
+    mm_table_t mm_table;
+    int    retries = 0;
+    int    status;
+    time_t rawtime;
+    struct tm ptm = { 0 };
+
+    while (proto_connected(&context->connection.proto) && (manager_running) && (retries < 3)) {
+        retries++;
+        status = process_mm_table(context, &mm_table);
+        if (status == PKT_SUCCESS) {
+            retries = 0;
+        }
+    }
+
+    if (proto_connected(&context->connection.proto)) {
+        proto_disconnect(&context->connection.proto);
+    }
+
+    /* Keep what was received, though unacknowledged records will be sent again. */
+    end_trans_data(context);
+    context->cdr_ack_buffer_len = 0;
+
+    link_tune_end(context);
+
+    mm_capture_flush(context->manager->capture);
 
-    free(context);
+    mm_time(context->manager->test_mode, &rawtime);
+    localtime_r(&rawtime, &ptm);
+
+    printf("\n\n%04d-%02d-%02d %2d:%02d:%02d: Terminal %s: Disconnected.\n\n",
+        ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
+        context->connection.proto.terminal_id);
+}
+
+static int mm_shutdown(mm_manager_t* manager) {
+    int line;
+
+    for (line = 0; line < manager->line_count; line++) {
+        mm_connection_close(&manager->lines[line]->connection);
+        free(manager->lines[line]);
+        manager->lines[line] = NULL;
+    }
+    manager->line_count = 0;
+
+    mm_capture_close(manager->capture);
+    mm_udp_close(manager->udp);
+    mm_acct_writer_stop(manager->acct_writer);
+    mm_close_database(manager->database);
+    mm_plan_cache_destroy(manager->plan_cache);
+    mm_table_cache_destroy(manager->table_cache);
+
+    free(manager);
     return (0);
 }
 
+/* Add a modem device (or test file) to the list of lines served. */
+static int mm_add_line(char line_devs[][256], int *line_count, const char *modem_dev) {
+    if (*line_count >= MM_MAX_LINES) {
+        fprintf(stderr, "Error: at most %d lines may be specified.\n", MM_MAX_LINES);
+        return -EINVAL;
+    }
+
+    snprintf(line_devs[*line_count], 256, "%s", modem_dev);
+    (*line_count)++;
+
+    return 0;
+}
+
+/* Read a list of modem devices, one per line.  Blank lines and lines starting with '#' are ignored. */
+static int mm_read_line_file(const char *fname, char line_devs[][256], int *line_count) {
+    FILE *stream;
+    char  buf[256];
+    int   status = 0;
+
+    if (!(stream = fopen(fname, "r"))) {
+        fprintf(stderr, "mm_manager: Can't read line file '%s': %s\n", fname, strerror(errno));
+        return -ENOENT;
+    }
+
+    while ((status == 0) && (fgets(buf, sizeof(buf), stream) != NULL)) {
+        char *dev = buf + strspn(buf, " \t");
+
+        dev[strcspn(dev, "\r\n")] = '\0';
+
+        if ((dev[0] == '\0') || (dev[0] == '#')) continue;
+
+        status = mm_add_line(line_devs, line_count, dev);
+    }
+
+    fclose(stream);
+    return status;
+}
+
+/* With more than one line, insert the line number before the file extension: install.pcap -> install.1.pcap */
+void mm_line_filename(char *buf, size_t len, const char *fname, int line, int line_count) {
+    const char *ext;
+
+    if (line_count < 2) {
+        snprintf(buf, len, "%s", fname);
+        return;
+    }
+
+    ext = strrchr(fname, '.');
+    if ((ext == NULL) || (strpbrk(ext, "/\\") != NULL)) {
+        ext = fname + strlen(fname);
+    }
+
+    snprintf(buf, len, "%.*s.%d%s", (int)(ext - fname), fname, line, ext);
+}
+
 static int append_to_cdr_ack_buffer(mm_context_t *context, uint8_t *buffer, uint8_t length) {
     if ((size_t)context->cdr_ack_buffer_len + length > sizeof(context->cdr_ack_buffer)) {
         printf("ERROR: %s: cdr_ack_buffer_len exceeded.\n", __func__);
@@ -651,6 +1065,51 @@ static int append_to_cdr_ack_buffer(mm_context_t *context, uint8_t *buffer, uint
     return 0;
 }
 
+/*
+ * With -S or -B, check whether a terminal requesting a table update has
+ * tables left over from a split download.  If so, they are sent with this
+ * download.  Tables are never pushed into a call-in: after replying
+ * DLOG_MT_TRANS_DATA, the manager is waiting for the terminal's upload.
+ */
+static void check_deferred_tables(mm_context_t *context, char *terminal_id) {
+    uint8_t terminal_type;
+
+    if ((!context->manager->split_download && !context->manager->download_budget_ms) ||
+        (mm_sql_load_TDLPEND(context->manager->database, terminal_id, &terminal_type) != 0)) {
+        return;
+    }
+
+    printf("\tTerminal %s has deferred tables, sending them with this download.\n", terminal_id);
+
+    context->send_deferred_tables = 1;
+}
+
+/*
+ * The terminal is about to send a batch of tables, ending with DLOG_MT_END_DATA.
+ * Its accounting records are written in one transaction, committed before they
+ * are acknowledged.
+ */
+static void begin_trans_data(mm_context_t *context) {
+    if (context->trans_data_in_progress == 0) {
+        if (mm_acct_writer_begin(context->manager->acct_writer, context->connection.line) != 0) {
+            fprintf(stderr, "%s: Terminal %s: Failed to begin transaction.\n", __func__,
+                context->connection.proto.terminal_id);
+        }
+    }
+    context->trans_data_in_progress = 1;
+}
+
+/* Returns 0 once the accounting records of the batch are durable. */
+static int end_trans_data(mm_context_t *context) {
+    if (context->trans_data_in_progress == 0) {
+        return 0;
+    }
+
+    context->trans_data_in_progress = 0;
+
+    return mm_acct_writer_commit(context->manager->acct_writer, context->connection.line);
+}
+
 static int process_mm_table(mm_context_t* context, mm_table_t* table) {
     mm_packet_t* pkt = &table->pkt;
     uint8_t  ack_payload[PKT_TABLE_DATA_LEN_MAX] = { 0 };
@@ -670,10 +1129,14 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
     phone_num_to_string(terminal_id, sizeof(terminal_id), pkt->payload, PKT_TABLE_ID_OFFSET);
     ppayload = pkt->payload + PKT_TABLE_ID_OFFSET;
 
+    if (context->manager->adaptive_link && !context->link_tuned) {
+        link_tune_begin(context, terminal_id);
+    }
+
     while (ppayload < pkt->payload + pkt->payload_len) {
         table->table_id = *ppayload;
 
-        if (context->debuglevel > 1) {
+        if (context->manager->debuglevel > 1) {
             printf("\n\tTerminal ID %s: Processing Table ID %d (0x%02x) %s\n",
                    terminal_id,
                    table->table_id,
@@ -691,7 +1154,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
                 time_sync_response->id = DLOG_MT_TIME_SYNC;
 
-                mm_time(context->test_mode, &rawtime);
+                mm_time(context->manager->test_mode, &rawtime);
                 localtime_r(&rawtime, &ptm);
 
                 time_sync_response->year  = (ptm.tm_year & 0xff);      /* Fill current years since 1900 */
@@ -736,7 +1199,8 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                     cashbox_status_univ_t* cashbox_status = (cashbox_status_univ_t*)pack_payload;
                     printf("\tSend DLOG_MT_CASH_BOX_STATUS table as requested by terminal.\n\t");
 
-                    mm_acct_load_TCASHST(context->database, terminal_id, cashbox_status);
+                    mm_acct_writer_flush(context->manager->acct_writer, context->connection.line);
+                    mm_acct_load_TCASHST(context->manager->database, terminal_id, cashbox_status);
 
                     /* Perform endian conversion */
                     cashbox_status->currency_value = LE16(cashbox_status->currency_value);
@@ -746,6 +1210,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                     pack_payload += sizeof(cashbox_status_univ_t);
                 }
 
+                check_deferred_tables(context, terminal_id);
                 table_download_pending = 1;
                 break;
             }
@@ -757,7 +1222,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 *pack_payload++ = DLOG_MT_ALARM_ACK;
                 *pack_payload++ = alarm->alarm_id;
 
-                mm_acct_save_TALARM(context->database, &context->telco, terminal_id, alarm);
+                mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_ALARM, terminal_id, alarm, sizeof(*alarm));
 
                 break;
             }
@@ -772,7 +1237,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 *pack_payload++ = maint->type & 0xFF;
                 *pack_payload++ = (maint->type >> 8) & 0xFF;
 
-                mm_acct_save_TOPCODE(context->database, &context->telco, terminal_id, maint);
+                mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_MAINT_REQ, terminal_id, maint, sizeof(*maint));
                 break;
             }
             case DLOG_MT_CALL_DETAILS: {
@@ -790,15 +1255,18 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 cdr->call_cost[0] = LE16(cdr->call_cost[0]);
                 cdr->call_cost[1] = LE16(cdr->call_cost[1]);
 
-                mm_acct_save_TCDR(context->database, &context->telco, terminal_id, cdr);
-
-                /* If terminal is transferring multiple tables, queue the CDR response for later, after receiving DLOG_MT_END_DATA */
-                if (context->trans_data_in_progress == 1) {
+                /* Never ACK a CDR that was not saved; unacknowledged, the terminal sends it again. */
+                if (mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_CALL_DETAILS, terminal_id, cdr, sizeof(*cdr)) != 0) {
+                    fprintf(stderr, "%s: Terminal %s: Failed to queue CDR %d, not acknowledged.\n", __func__, terminal_id, cdr->seq);
+                } else if (context->trans_data_in_progress == 1) {
+                    /* If terminal is transferring multiple tables, queue the CDR response for later, after the commit at DLOG_MT_END_DATA */
                     append_to_cdr_ack_buffer(context, cdr_ack_buf, sizeof(cdr_ack_buf));
-                } else {
-                    /* If receiving a CDR as part of a credit card auth, etc, send the CDR ack immediately. */
+                } else if (mm_acct_writer_flush(context->manager->acct_writer, context->connection.line) == 0) {
+                    /* If receiving a CDR as part of a credit card auth, etc, send the CDR ack as soon as it is saved. */
                     memcpy(pack_payload, cdr_ack_buf, sizeof(cdr_ack_buf));
                     pack_payload += sizeof(cdr_ack_buf);
+                } else {
+                    fprintf(stderr, "%s: Terminal %s: Failed to save CDR %d, not acknowledged.\n", __func__, terminal_id, cdr->seq);
                 }
                 break;
             }
@@ -810,7 +1278,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 printf("\t\tDLOG_MT_ATN_REQ_CDR_UPL, cdr_req_type=%02x (0x%02x)\n", cdr_req_type, cdr_req_type);
 
                 *pack_payload++                 = DLOG_MT_TRANS_DATA;
-                context->trans_data_in_progress = 1;
+                begin_trans_data(context);
                 break;
             }
             case DLOG_MT_CASH_BOX_COLLECTION: {
@@ -825,7 +1293,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                     cash_box_collection->coin_count[i] = LE16(cash_box_collection->coin_count[i]);
                 }
 
-                mm_acct_save_TCOLLST(context->database, &context->telco, terminal_id, cash_box_collection);
+                mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_CASH_BOX_COLLECTION, terminal_id, cash_box_collection, sizeof(*cash_box_collection));
                 *pack_payload++ = DLOG_MT_END_DATA;
                 break;
             }
@@ -834,7 +1302,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
                 ppayload += sizeof(dlog_mt_term_status_t);
 
-                mm_acct_save_TSTATUS(context->database, &context->telco, terminal_id, dlog_mt_term_status);
+                mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_TERM_STATUS, terminal_id, dlog_mt_term_status, sizeof(*dlog_mt_term_status));
                 break;
             }
             case DLOG_MT_TERM_ERR_REP: {
@@ -848,7 +1316,8 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
                 ppayload += sizeof(dlog_mt_sw_version_t);
 
-                mm_acct_save_TSWVERS(context->database, &context->telco, terminal_id, dlog_mt_sw_version, &context->terminal_type);
+                /* Saved directly, as the terminal type is needed for the table download. */
+                mm_acct_save_TSWVERS(context->manager->database, &context->manager->telco, terminal_id, dlog_mt_sw_version, &context->terminal_type);
                 break;
             }
             case DLOG_MT_CASH_BOX_STATUS: {
@@ -861,7 +1330,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                     cashbox_status->coin_count[i] = LE16(cashbox_status->coin_count[i]);
                 }
 
-                mm_acct_save_TCASHST(context->database, &context->telco, terminal_id, cashbox_status);
+                mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_CASH_BOX_STATUS, terminal_id, cashbox_status, sizeof(*cashbox_status));
 
                 ppayload += sizeof(cashbox_status_univ_t);
                 break;
@@ -877,7 +1346,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                     perf_stats->stats[i] = LE16(perf_stats->stats[i]);
                 }
 
-                mm_acct_save_TPERFST(context->database, &context->telco, terminal_id, perf_stats);
+                mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_PERF_STATS_MSG, terminal_id, perf_stats, sizeof(*perf_stats));
                 break;
             }
             case DLOG_MT_CALL_IN: {
@@ -886,14 +1355,14 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 *pack_payload++                 = DLOG_MT_TRANS_DATA;
 //                context->terminal_upd_reason |= TTBLREQ_CRAFT_FORCE_DL;
 //                table_download_pending = 1;
-                context->trans_data_in_progress = 1;
+                begin_trans_data(context);
                 break;
             }
             case DLOG_MT_CALL_BACK: {
                 printf("\tDLOG_MT_CALL_BACK: Terminal: %s\n", terminal_id);
                 ppayload += sizeof(dlog_mt_call_back_t);
                 *pack_payload++                 = DLOG_MT_TRANS_DATA;
-                context->trans_data_in_progress = 1;
+                begin_trans_data(context);
                 break;
             }
             case DLOG_MT_CARRIER_CALL_STATS:
@@ -988,7 +1457,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 summary_call_stats->datajack_calls_attempt_count = LE16(summary_call_stats->datajack_calls_attempt_count);
                 summary_call_stats->datajack_calls_complete_count = LE16(summary_call_stats->datajack_calls_complete_count);
 
-                mm_acct_save_TCALLST(context->database, &context->telco, terminal_id, summary_call_stats);
+                mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_SUMMARY_CALL_STATS, terminal_id, summary_call_stats, sizeof(*summary_call_stats));
                 break;
             }
             case DLOG_MT_RATE_REQUEST: {
@@ -1018,7 +1487,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 rate_response.id = DLOG_MT_RATE_RESPONSE;
                 rate_response.rate.type = (uint8_t)mm_inter_lata;
 
-                if (context->rating_test_mode) {
+                if (context->manager->rating_test_mode) {
                     rate_response.rate.initial_period = 60;
                     rate_response.rate.initial_charge = ((phone_number[6] - '0') * 1000) + ((phone_number[7] - '0') * 100) + ((phone_number[8] - '0') * 10) + (phone_number[9] - '0');
                     rate_response.rate.additional_period = 0x00;
@@ -1055,7 +1524,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
                     call_back_req.id = DLOG_MT_CALL_BACK_REQ;
 
-                    mm_time(context->test_mode, &rawtime);
+                    mm_time(context->manager->test_mode, &rawtime);
                     localtime_r(&rawtime, &ptm);
 
                     call_back_req.year = (ptm.tm_year & 0xff);    /* Fill current years since 1900 */
@@ -1086,7 +1555,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 dlog_mt_funf_card_auth_t *auth_request  = (dlog_mt_funf_card_auth_t *)ppayload;
                 time_t rawtime;
 
-                mm_time(context->test_mode, &rawtime);
+                mm_time(context->manager->test_mode, &rawtime);
                 ppayload += sizeof(dlog_mt_funf_card_auth_t);
 
                 /* Perform endian conversion */
@@ -1096,7 +1565,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 auth_request->pin = LE16(auth_request->pin);
                 auth_request->seq = LE16(auth_request->seq);
 
-                mm_acct_save_TAUTH(context->database, &context->telco, terminal_id, auth_request);
+                mm_acct_writer_queue(context->manager->acct_writer, context->connection.line, DLOG_MT_FUNF_CARD_AUTH, terminal_id, auth_request, sizeof(*auth_request));
 
                 auth_response.resp_code = 0;
                 auth_response.auth_code = rawtime;
@@ -1118,7 +1587,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
                     call_back_req.id = DLOG_MT_CALL_BACK_REQ;
 
-                    mm_time(context->test_mode, &rawtime);
+                    mm_time(context->manager->test_mode, &rawtime);
                     localtime_r(&rawtime, &ptm);
 
                     call_back_req.year = (ptm.tm_year & 0xff);    /* Fill current years since 1900 */
@@ -1136,10 +1605,15 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
             }
             case DLOG_MT_END_DATA:
                 ppayload += sizeof(dlog_mt_end_data_t);
-                context->trans_data_in_progress = 0;
-
                 *pack_payload++ = DLOG_MT_END_DATA;
 
+                /* Never ACK a CDR that was not saved: the terminal deletes it. */
+                if (end_trans_data(context) != 0) {
+                    fprintf(stderr, "%s: Terminal %s: Failed to save records, CDRs not acknowledged.\n",
+                        __func__, terminal_id);
+                    context->cdr_ack_buffer_len = 0;
+                }
+
                 if (context->cdr_ack_buffer_len > 0) {
                     memcpy(pack_payload, context->cdr_ack_buffer, context->cdr_ack_buffer_len);
                     pack_payload += context->cdr_ack_buffer_len;
@@ -1170,19 +1644,47 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
     if (table_download_pending == 1) {
         mm_download_tables(context, terminal_id);
+        context->send_deferred_tables = 0;
     }
 
     return 0;
 }
 
-static int mm_download_tables(mm_context_t *context, char *terminal_id) {
+/* Tables the terminal needs to be in service; the only ones downloaded with -s. */
+static int table_is_mandatory(uint8_t table_id) {
+    switch (table_id) {
+    case DLOG_MT_NCC_TERM_PARAMS:
+    case DLOG_MT_CARD_TABLE:
+    case DLOG_MT_CARRIER_TABLE:
+    case DLOG_MT_CALLSCRN_UNIVERSAL:
+    case DLOG_MT_FCONFIG_OPTS:
+    case DLOG_MT_INSTALL_PARAMS:
+    case DLOG_MT_COIN_VAL_TABLE:
+    case DLOG_MT_NUM_PLAN_TABLE:
+    case DLOG_MT_SPARE_TABLE:
+    case DLOG_MT_RATE_TABLE:
+    case DLOG_MT_CALL_SCREEN_LIST:
+    case DLOG_MT_SCARD_PARM_TABLE:
+    case DLOG_MT_CARD_TABLE_EXP:
+    case DLOG_MT_CARRIER_TABLE_EXP:
+    case DLOG_MT_NPA_NXX_TABLE_1:
+    case DLOG_MT_COMP_LCD_TABLE_1:
+    case DLOG_MT_LCD_TABLE_1:
+    case DLOG_MT_END_DATA:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* List the tables to download to the terminal, for its model and the -s option. */
+static mm_plan_t *plan_download(mm_context_t *context, char *terminal_id) {
     int      table_index;
-    int      status = 0;
-    size_t   table_len;
-    uint8_t *table_buffer;
     uint8_t *table_list = table_list_mtr_2x;
     uint8_t  table_id;
     uint8_t  term_model = term_type_to_model(context->terminal_type);
+    uint8_t  source;
+    mm_plan_t *plan;
 
     switch (term_type_to_mtr(context->terminal_type)) {
     case MTR_2_X:
@@ -1210,11 +1712,17 @@ static int mm_download_tables(mm_context_t *context, char *terminal_id) {
         break;
     }
 
-    for (table_index = 0; (table_id = table_list[table_index]) > 0; table_index++) {
-        /* Abort table download if manager is shutting down. */
-        if (!manager_running) break;
-        if (!proto_connected(&context->connection.proto)) break;
+    for (table_index = 0; table_list[table_index] > 0; table_index++) {
+    }
+
+    plan = mm_plan_create(context->manager->table_cache, terminal_id, context->terminal_type,
+                          context->connection.proto.rx_packet_gap, table_index);
 
+    if (plan == NULL) {
+        return NULL;
+    }
+
+    for (table_index = 0; (table_id = table_list[table_index]) > 0; table_index++) {
         /* Skip DLOG_MT_CARD_TABLE, DLOG_MT_CARD_TABLE_EXP if the terminal is coin-only. */
         if (term_model == TERM_COIN_BASIC) {
             switch (table_id) {
@@ -1231,124 +1739,400 @@ static int mm_download_tables(mm_context_t *context, char *terminal_id) {
         }
 
         /* If -s was specified, only download mandatory tables */
-        if (context->minimal_table_set == 1) {
-            switch (table_id) {
-            case DLOG_MT_NCC_TERM_PARAMS:
-            case DLOG_MT_CARD_TABLE:
-            case DLOG_MT_CARRIER_TABLE:
-            case DLOG_MT_CALLSCRN_UNIVERSAL:
-            case DLOG_MT_FCONFIG_OPTS:
-            case DLOG_MT_INSTALL_PARAMS:
-            case DLOG_MT_COIN_VAL_TABLE:
-            case DLOG_MT_NUM_PLAN_TABLE:
-            case DLOG_MT_SPARE_TABLE:
-            case DLOG_MT_RATE_TABLE:
-            case DLOG_MT_CALL_SCREEN_LIST:
-            case DLOG_MT_SCARD_PARM_TABLE:
-            case DLOG_MT_CARD_TABLE_EXP:
-            case DLOG_MT_CARRIER_TABLE_EXP:
-            case DLOG_MT_NPA_NXX_TABLE_1:
-            case DLOG_MT_COMP_LCD_TABLE_1:
-            case DLOG_MT_LCD_TABLE_1:
-            case DLOG_MT_END_DATA:
-                break;
-            default: /* Skip tables that are not mandatory */
-                continue;
-            }
+        if ((context->manager->minimal_table_set == 1) && !table_is_mandatory(table_id)) {
+            continue;
         }
 
         switch (table_id) {
             case DLOG_MT_INSTALL_PARAMS:
-                generate_install_parameters(context, &table_buffer, &table_len);
-                break;
-            case DLOG_MT_CALL_IN_PARMS:
-                generate_call_in_parameters(context, &table_buffer, &table_len);
-                break;
             case DLOG_MT_NCC_TERM_PARAMS:
-                if (term_type_to_mtr(context->terminal_type) <= MTR_1_13) {
-                    generate_term_access_parameters_mtr1(context, terminal_id, &table_buffer, &table_len);
-                } else {
-                    generate_term_access_parameters(context, terminal_id, &table_buffer, &table_len);
-                }
-                break;
             case DLOG_MT_CALL_STAT_PARMS:
-                generate_call_stat_parameters(context, &table_buffer, &table_len);
-                break;
             case DLOG_MT_COMM_STAT_PARMS:
-                generate_comm_stat_parameters(context, &table_buffer, &table_len);
-                break;
             case DLOG_MT_END_DATA:
-                generate_dlog_mt_end_data(context, &table_buffer, &table_len);
+                source = MM_PLAN_GENERATED;
                 break;
-            case DLOG_MT_CASH_BOX_STATUS:
-            {
-                int i;
-                cashbox_status_univ_t *pcashbox_status = { 0 };
-                pcashbox_status = (cashbox_status_univ_t *)calloc(1, sizeof(cashbox_status_univ_t));
-                table_buffer = (uint8_t*)pcashbox_status;
-                if (table_buffer == NULL) {
-                    fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(cashbox_status_univ_t));
-                    return -ENOMEM;
-                }
-                mm_acct_load_TCASHST(context->database, terminal_id, (cashbox_status_univ_t *)table_buffer);
+            case DLOG_MT_CALL_IN_PARMS:     /* Call-in time is the time of the download. */
+            case DLOG_MT_CASH_BOX_STATUS:   /* From the database. */
+                source = MM_PLAN_DYNAMIC;
+                break;
+            default:
+                source = MM_PLAN_FILE;
+                break;
+        }
 
-                /* Perform endian conversion */
-                pcashbox_status->currency_value = LE16(pcashbox_status->currency_value);
-                for (i = 0; i < COIN_COUNT_MAX; i++) {
-                    pcashbox_status->coin_count[i] = LE16(pcashbox_status->coin_count[i]);
-                }
+        mm_plan_add_table(plan, table_id, source);
+    }
 
-                table_len = sizeof(cashbox_status_univ_t);
-                break;
+    return plan;
+}
+
+/* Generate a table that depends only on the manager configuration, and frame it. */
+static int plan_generated_table(mm_context_t *context, char *terminal_id, mm_plan_t *plan, int index) {
+    size_t   table_len = 0;
+    uint8_t *table_buffer = NULL;
+    int      status;
+
+    switch (plan->tables[index].table_id) {
+        case DLOG_MT_INSTALL_PARAMS:
+            generate_install_parameters(context, &table_buffer, &table_len);
+            break;
+        case DLOG_MT_NCC_TERM_PARAMS:
+            if (term_type_to_mtr(context->terminal_type) <= MTR_1_13) {
+                generate_term_access_parameters_mtr1(context, terminal_id, &table_buffer, &table_len);
+            } else {
+                generate_term_access_parameters(context, terminal_id, &table_buffer, &table_len);
             }
-            default:
-                printf("\t");
-                /* For Craft Force Download, only download tables that are newer,
-                 * unless the terminal lost its memory or the the "-c" option was
-                 * selected.
-                 */
-                if ((context->complete_download == FALSE) &&
-                    (context->terminal_upd_reason & TTBLREQ_CRAFT_FORCE_DL) &&
-                    !(context->terminal_upd_reason & TTBLREQ_LOST_MEMORY) &&
-                    !(context->terminal_upd_reason & TTBLREQ_PWR_LOST_ON_DL)) {
-                    if (check_mm_table_is_newer(context, terminal_id, table_id) != 0) {
-                        table_buffer = NULL;
-                        continue;
-                    }
-                }
+            break;
+        case DLOG_MT_CALL_STAT_PARMS:
+            generate_call_stat_parameters(context, &table_buffer, &table_len);
+            break;
+        case DLOG_MT_COMM_STAT_PARMS:
+            generate_comm_stat_parameters(context, &table_buffer, &table_len);
+            break;
+        case DLOG_MT_END_DATA:
+            generate_dlog_mt_end_data(context, &table_buffer, &table_len);
+            break;
+    }
 
-                status = load_mm_table(context, terminal_id, table_id, &table_buffer, &table_len);
+    status = mm_plan_set_table(plan, index, table_buffer, table_len, NULL);
+    free(table_buffer);
 
-                if (status != 0) {
-                    if (table_id == DLOG_MT_USER_IF_PARMS) { /* Can't load DLOG_MT_USER_IF_PARMS, generate it. */
-                        generate_user_if_parameters(context, &table_buffer, &table_len);
-                    }
-                    else { /* If table can't be loaded, continue to the next. */
-                        if (table_buffer != NULL) free(table_buffer);
-                        table_buffer = NULL;
-                        continue;
-                    }
-                }
+    return status;
+}
+
+/*
+ * Frame a table read from a file, unless the plan already holds the
+ * current version of it.  Returns 0 if there is a table to send.
+ */
+static int plan_file_table(mm_context_t *context, char *terminal_id, mm_plan_t *plan, int index) {
+    mm_plan_table_t *table = &plan->tables[index];
+    mm_table_cache_t *cache = context->manager->table_cache;
+    const mm_table_image_t *table_image;
+    size_t   table_len;
+    uint8_t *table_buffer = NULL;
+    uint8_t  table_id = table->table_id;
+    int      status;
+
+    status = mm_table_cache_get(cache, terminal_id, term_type_to_model(context->terminal_type), table_id, &table_image);
+
+    if (table->framed && (table_image == table->image)) {
+        mm_table_cache_release(cache, table_image);
+        return (table->frame_count > 0) ? 0 : -ENOENT;
+    }
+
+    /* The cache was flushed, but this table is unchanged: keep its frames. */
+    if (table->framed && (table_image != NULL) && (table->image != NULL) &&
+        (table_image->len == table->image->len) &&
+        (memcmp(table_image->data, table->image->data, table_image->len) == 0)) {
+        mm_table_cache_release(cache, table->image);
+        table->image = table_image;
+        return 0;
+    }
+
+    if (status == 0) {
+        status = load_mm_table(context, table_id, table_image, &table_buffer, &table_len);
+    }
+
+    if (status != 0) {
+        if ((table_id == DLOG_MT_USER_IF_PARMS) && (status == -ENOENT)) { /* Can't load DLOG_MT_USER_IF_PARMS, generate it. */
+            generate_user_if_parameters(context, &table_buffer, &table_len);
+        } else if (status == -ENOENT) { /* If table can't be loaded, continue to the next. */
+            mm_plan_set_table(plan, index, NULL, 0, NULL);
+            return status;
+        } else {
+            mm_table_cache_release(cache, table_image);
+            return status;
+        }
+    }
+
+    /* Update DLOG_MT_FCONFIG_OPTS based on terminal type. */
+    if (table_id == DLOG_MT_FCONFIG_OPTS) {
+        /* The cached table is shared, so update a copy. */
+        if ((table_image != NULL) && (table_buffer == table_image->data)) {
+            if ((table_buffer = (uint8_t *)malloc(table_len)) == NULL) {
+                fprintf(stderr, "%s: Error: failed to allocate %zu bytes for table %d\n", __func__, table_len, table_id);
+                mm_table_cache_release(cache, table_image);
+                return -ENOMEM;
+            }
+            memcpy(table_buffer, table_image->data, table_len);
+        }
+        ((dlog_mt_fconfig_opts_t*)table_buffer)->term_type = term_type_to_model(context->terminal_type) & 0x0F;
+    }
+
+    status = mm_plan_set_table(plan, index, table_buffer, table_len, table_image);
+
+    if ((table_image == NULL) || (table_buffer != table_image->data)) {
+        free(table_buffer);
+    }
+
+    return status;
+}
+
+/*
+ * Record a table the terminal acknowledged in its download journal, so
+ * the next download can skip it if it has not changed, even if this one
+ * is cut short.
+ */
+static void journal_table_ack(mm_context_t *context, char *terminal_id, uint8_t table_id, uint64_t hash) {
+    if (terminal_id[0] == '\0') {
+        return;
+    }
+
+    if (mm_sql_save_TDLJRNL(context->manager->database, terminal_id, table_id, hash) != 0) {
+        fprintf(stderr, "%s: Terminal %s: Failed to journal table %d.\n", __func__, terminal_id, table_id);
+    }
+}
+
+/*
+ * Find the tables the terminal already has.  After a power loss during a
+ * download, only the tables acknowledged in that download are trusted, so
+ * the download resumes from the first table not acknowledged.
+ */
+static void load_sent_tables(mm_context_t *context, char *terminal_id, uint64_t sent_hash[256]) {
+    void *db = context->manager->database;
+    int   journal_count;
+
+    memset(sent_hash, 0, 256 * sizeof(uint64_t));
+
+    if (context->terminal_upd_reason & TTBLREQ_LOST_MEMORY) {
+        mm_sql_clear_TTBLHASH(db, terminal_id);
+        mm_sql_clear_TDLJRNL(db, terminal_id);
+        return;
+    }
+
+    if (context->terminal_upd_reason & TTBLREQ_PWR_LOST_ON_DL) {
+        mm_sql_clear_TTBLHASH(db, terminal_id);
+    } else if (!context->manager->complete_download) {
+        mm_sql_load_TTBLHASH(db, terminal_id, sent_hash);
+    }
+
+    if (context->manager->complete_download) {
+        return;
+    }
+
+    /* Tables acknowledged in an unfinished download are newer than TTBLHASH. */
+    journal_count = mm_sql_load_TDLJRNL(db, terminal_id, sent_hash);
+
+    if (journal_count > 0) {
+        printf("Terminal %s: Resuming download, %d tables already acknowledged.\n", terminal_id, journal_count);
+    }
+}
+
+/* Generate a table that changes on every download, and frame it. */
+static int plan_dynamic_table(mm_context_t *context, char *terminal_id, mm_plan_t *plan, int index) {
+    size_t   table_len;
+    uint8_t *table_buffer = NULL;
+    int      status;
+
+    if (plan->tables[index].table_id == DLOG_MT_CALL_IN_PARMS) {
+        generate_call_in_parameters(context, &table_buffer, &table_len);
+    } else {
+        int i;
+        cashbox_status_univ_t *pcashbox_status = { 0 };
+        pcashbox_status = (cashbox_status_univ_t *)calloc(1, sizeof(cashbox_status_univ_t));
+        table_buffer = (uint8_t*)pcashbox_status;
+        if (table_buffer == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(cashbox_status_univ_t));
+            return -ENOMEM;
+        }
+        mm_acct_writer_flush(context->manager->acct_writer, context->connection.line);
+        mm_acct_load_TCASHST(context->manager->database, terminal_id, (cashbox_status_univ_t *)table_buffer);
+
+        /* Perform endian conversion */
+        pcashbox_status->currency_value = LE16(pcashbox_status->currency_value);
+        for (i = 0; i < COIN_COUNT_MAX; i++) {
+            pcashbox_status->coin_count[i] = LE16(pcashbox_status->coin_count[i]);
+        }
+
+        table_len = sizeof(cashbox_status_univ_t);
+    }
+
+    status = mm_plan_set_table(plan, index, table_buffer, table_len, NULL);
+    free(table_buffer);
+
+    return status;
+}
+
+/*
+ * Tables sent even when the rest are deferred: the mandatory set, the
+ * call-in parameters so the terminal keeps calling in, and END_DATA.
+ */
+static int table_is_required(uint8_t table_id) {
+    return table_is_mandatory(table_id) || (table_id == DLOG_MT_CALL_IN_PARMS);
+}
+
+/*
+ * Pick the tables to send, in plan order: those not yet sent, less the
+ * optional ones deferred by -S or that don't fit in the -B budget once the
+ * required tables are counted.  Returns the number of tables deferred, and
+ * the estimated time to send the rest in *predicted_ms.
+ */
+static int select_download_tables(mm_context_t *context, char *terminal_id, mm_plan_t *plan, uint64_t sent_hash[256], uint32_t *predicted_ms) {
+    mm_manager_t *manager = context->manager;
+    int      send_optional = !manager->split_download || context->send_deferred_tables;
+    uint32_t required_ms = 0;
+    uint32_t optional_ms = 0;
+    int      deferred_count = 0;
+
+    for (int i = 0; i < plan->table_count; i++) {
+        mm_plan_table_t *table = &plan->tables[i];
+        uint8_t table_id = table->table_id;
+        int     status;
+
+        table->send = 0;
+
+        switch (table->source) {
+            case MM_PLAN_DYNAMIC:
+                status = plan_dynamic_table(context, terminal_id, plan, i);
+                break;
+            case MM_PLAN_FILE:
+                status = plan_file_table(context, terminal_id, plan, i);
+                break;
+            default:
+                status = table->framed ? 0 : plan_generated_table(context, terminal_id, plan, i);
                 break;
         }
 
-        /* Update DLOG_MT_FCONFIG_OPTS based on terminal type. */
-        if (table_id == DLOG_MT_FCONFIG_OPTS) {
-            ((dlog_mt_fconfig_opts_t*)table_buffer)->term_type = term_model & 0x0F;
+        if ((status != 0) || (table->frame_count == 0)) {
+            continue;
+        }
+
+        /* END_DATA closes the download, so it is always sent. */
+        if ((table_id != DLOG_MT_END_DATA) && (table->hash == sent_hash[table_id])) {
+            printf("\tSkipping table %d (0x%02x) %s: unchanged.\n", table_id, table_id, table_to_string(table_id));
+            continue;
+        }
+
+        if (!send_optional && !table_is_required(table_id)) {
+            printf("\tDeferring table %d (0x%02x) %s to the next table update.\n", table_id, table_id, table_to_string(table_id));
+            deferred_count++;
+            continue;
+        }
+
+        table->send = 1;
+        table->cost_ms = estimate_mm_table_ms(&context->connection.proto, table->frames, table->frame_count);
+
+        if (table_is_required(table_id)) {
+            required_ms += table->cost_ms;
+        }
+    }
+
+    for (int i = 0; i < plan->table_count; i++) {
+        mm_plan_table_t *table = &plan->tables[i];
+        uint8_t table_id = table->table_id;
+
+        if (!table->send || table_is_required(table_id)) {
+            continue;
+        }
+
+        /* A download with deferred tables sends at least one, so a table longer than the budget is not deferred forever. */
+        if ((manager->download_budget_ms != 0) &&
+            (required_ms + optional_ms + table->cost_ms > manager->download_budget_ms) &&
+            !(context->send_deferred_tables && (optional_ms == 0))) {
+            printf("\tDeferring table %d (0x%02x) %s to the next table update: %u.%03us over budget.\n",
+                table_id, table_id, table_to_string(table_id),
+                (required_ms + optional_ms + table->cost_ms - manager->download_budget_ms) / 1000,
+                (required_ms + optional_ms + table->cost_ms - manager->download_budget_ms) % 1000);
+            table->send = 0;
+            deferred_count++;
+            continue;
         }
 
-        status = send_mm_table(&context->connection.proto, table_buffer, table_len);
+        optional_ms += table->cost_ms;
+    }
+
+    *predicted_ms = required_ms + optional_ms;
+
+    return deferred_count;
+}
+
+/*
+ * Download tables to the terminal.  Tables are framed when the terminal's
+ * plan is first made, or when they change; otherwise the packets in the
+ * plan are sent as they are.
+ *
+ * Tables whose contents are the same as the last time the terminal
+ * acknowledged them are skipped, unless the terminal lost its memory or
+ * the "-c" option was selected.  Each ACK is journaled as it arrives, so
+ * a download cut short by carrier loss resumes where it stopped.
+ *
+ * With "-S", a requested download sends only the mandatory tables and
+ * the call-in parameters; the rest are sent when the terminal next
+ * requests a table update.  With "-B", optional tables that would take
+ * the download over the budget are deferred the same way.
+ */
+static int mm_download_tables(mm_context_t *context, char *terminal_id) {
+    int      table_index;
+    int      status = 0;
+    uint8_t  table_id;
+    uint64_t sent_hash[256];    /* Hash of each table the terminal has, by table ID; 0 if unknown. */
+    int      complete = 0;
+    int      deferred_count;
+    int      sent_count = 0;
+    uint32_t predicted_ms;
+    uint64_t start_ms;
+    uint32_t elapsed_ms;
+    mm_plan_t *plan;
+    mm_plan_table_t *table;
+
+    plan = mm_plan_cache_take(context->manager->plan_cache, terminal_id, context->terminal_type,
+                              context->connection.proto.rx_packet_gap);
+
+    if ((plan == NULL) && ((plan = plan_download(context, terminal_id)) == NULL)) {
+        return -ENOMEM;
+    }
+
+    load_sent_tables(context, terminal_id, sent_hash);
+    deferred_count = select_download_tables(context, terminal_id, plan, sent_hash, &predicted_ms);
+    start_ms = mm_clock_ms();
+
+    for (table_index = 0; table_index < plan->table_count; table_index++) {
+        /* Abort table download if manager is shutting down. */
+        if (!manager_running) break;
+        if (!proto_connected(&context->connection.proto)) break;
+
+        table = &plan->tables[table_index];
+        table_id = table->table_id;
+
+        if (!table->send) {
+            continue;
+        }
+
+        status = send_mm_table_frames(&context->connection.proto, table->frames, table->frame_count);
 
         if (status == PKT_SUCCESS) {
             /* For all tables except END_OF_DATA, expect a table ACK. */
-            if (table_list[table_index] != DLOG_MT_END_DATA) {
-                status = wait_for_table_ack(&context->connection.proto, table_buffer[0]);
+            if (table_id != DLOG_MT_END_DATA) {
+                status = wait_for_table_ack(&context->connection.proto, table_id);
+
+                if (status == PKT_SUCCESS) {
+                    journal_table_ack(context, terminal_id, table_id, table->hash);
+                    sent_count++;
+                }
+            } else {
+                complete = 1;
             }
         }
+    }
 
-        free(table_buffer);
-        table_buffer = NULL;
+    elapsed_ms = (uint32_t)(mm_clock_ms() - start_ms);
+    printf("Terminal %s: Sent %d tables in %u.%03us, predicted %u.%03us.\n", terminal_id, sent_count,
+        elapsed_ms / 1000, elapsed_ms % 1000, predicted_ms / 1000, predicted_ms % 1000);
+
+    mm_plan_cache_put(context->manager->plan_cache, plan);
 
+    /* Keep the journal of an unfinished download, to resume it on the next call. */
+    if (complete && (terminal_id[0] != '\0')) {
+        if (mm_sql_commit_TDLJRNL(context->manager->database, terminal_id) != 0) {
+            fprintf(stderr, "%s: Terminal %s: Failed to save table hashes.\n", __func__, terminal_id);
+        }
+
+        if (deferred_count > 0) {
+            printf("Terminal %s: %d tables deferred to the next table update.\n", terminal_id, deferred_count);
+            mm_sql_save_TDLPEND(context->manager->database, terminal_id, context->terminal_type);
+        } else if (context->manager->split_download || context->manager->download_budget_ms) {
+            mm_sql_clear_TDLPEND(context->manager->database, terminal_id);
+        }
     }
 
     if (proto_connected(&context->connection.proto)) {
@@ -1369,14 +2153,14 @@ static int update_terminal_download_time(mm_context_t *context, char *terminal_i
     struct tm ptm = { 0 };
 
     if (terminal_id[0] != '\0') {
-        snprintf(fname, sizeof(fname), "%s/%s/table_update.log", context->term_table_dir, terminal_id);
+        snprintf(fname, sizeof(fname), "%s/%s/table_update.log", context->manager->term_table_dir, terminal_id);
     } else {
         return -EINVAL;
     }
 
-    create_terminal_specific_directory(context->term_table_dir, terminal_id);
+    create_terminal_specific_directory(context->manager->term_table_dir, terminal_id);
 
-    mm_time(context->test_mode, &rawtime);
+    mm_time(context->manager->test_mode, &rawtime);
     localtime_r(&rawtime, &ptm);
     strftime(date, 99, "%Y-%m-%d %H:%M:%S", &ptm);
 
@@ -1392,104 +2176,13 @@ static int update_terminal_download_time(mm_context_t *context, char *terminal_i
     return 0;
 }
 
-static int check_mm_table_is_newer(mm_context_t *context, char *terminal_id, uint8_t table_id) {
-    char  fname[TABLE_PATH_MAX_LEN];
-    char  download_time_fname[TABLE_PATH_MAX_LEN + 1];
-    struct stat table_mtime_attr;
-    struct stat last_download_time_attr;
-
-    char  last_download_date[100];
-    char  table_mtime_date[100];
-
-    struct tm ptm = { 0 };
-
-    if (terminal_id[0] != '\0') {
-        snprintf(fname, sizeof(fname), "%s/%s/mm_table_%02x.bin", context->term_table_dir, terminal_id, table_id);
-        snprintf(download_time_fname, sizeof(download_time_fname), "%s/%s/table_update.log", context->term_table_dir, terminal_id);
-        if (stat(fname, &table_mtime_attr) == -1) {
-            snprintf(fname, sizeof(fname), "%s/mm_table_%02x.bin", context->default_table_dir, table_id);
-            if (stat(fname, &table_mtime_attr) == -1) {
-                table_mtime_attr.st_mtime = 0;
-            }
-        }
-
-        if (stat(download_time_fname, &last_download_time_attr) == -1) {
-            last_download_time_attr.st_mtime = 0;
-        }
-    } else {
-        table_mtime_attr.st_mtime = 0;
-        last_download_time_attr.st_mtime = 0;
-    }
-
-    localtime_r(&last_download_time_attr.st_mtime, &ptm);
-    strftime(last_download_date, 99, "%Y-%m-%d %H:%M:%S", &ptm);
-
-    localtime_r(&table_mtime_attr.st_mtime, &ptm);
-    strftime(table_mtime_date, 99, "%Y-%m-%d %H:%M:%S", &ptm);
-
-    if (table_mtime_attr.st_mtime < last_download_time_attr.st_mtime) {
-        printf("Skipping download of table %d: last downloaded: %s, mtime: %s.\n",
-            table_id,
-            last_download_date,
-            table_mtime_date);
-            return -1;
-    }
-    return 0;
-}
-
-static int load_mm_table(mm_context_t *context, char *terminal_id, uint8_t table_id, uint8_t **buffer, size_t *len) {
-    FILE *stream;
-    char  fname[TABLE_PATH_MAX_LEN];
-    uint32_t size;
-    uint8_t *bufp;
-    uint8_t  term_model = term_type_to_model(context->terminal_type);
-
-    if (terminal_id[0] != '\0') {
-        snprintf(fname, sizeof(fname), "%s/%s/mm_table_%02x.bin", context->term_table_dir, terminal_id, table_id);
-    } else {
-        snprintf(fname, sizeof(fname), "%s/mm_table_%02x.bin", context->default_table_dir, table_id);
-    }
-
-    /* Try to load terminal-specific table first. */
-    if (!(stream = fopen(fname, "rb"))) {
-
-        /* No terminal-specific table, try based on model. */
-        switch (term_model) {
-        case TERM_CARD:
-            snprintf(fname, sizeof(fname), "%s/card_only/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        case TERM_DESK:
-            snprintf(fname, sizeof(fname), "%s/desk/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        case TERM_COIN_BASIC:
-            snprintf(fname, sizeof(fname), "%s/coin/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        case TERM_INMATE:
-            snprintf(fname, sizeof(fname), "%s/inmate/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        case TERM_MULTIPAY:
-        default:
-            snprintf(fname, sizeof(fname), "%s/multipay/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        }
-
-        if (!(stream = fopen(fname, "rb"))) {
-            /* No model-specific table, fall back to default table directory. */
-            snprintf(fname, sizeof(fname), "%s/mm_table_%02x.bin", context->default_table_dir, table_id);
-
-            if (!(stream = fopen(fname, "rb"))) {
-                printf("Could not load table %d from %s.\n", table_id, fname);
-                *buffer = NULL;
-                return -1;
-            }
-        }
-    }
-
-    fseek(stream, 0, SEEK_END);
-    size = ftell(stream);
-    fseek(stream, 0, SEEK_SET);
-
-    size++;  // Make room for table ID.
+/*
+ * Prepare a cached table for sending.  Unless it needs padding, *buffer
+ * points into the image, which is shared with other downloads and
+ * read-only.  Otherwise *buffer is allocated.
+ */
+static int load_mm_table(mm_context_t *context, uint8_t table_id, const mm_table_image_t *image, uint8_t **buffer, size_t *len) {
+    size_t   size = image->len;
 
     if ((table_id == DLOG_MT_CALL_SCREEN_LIST) &&
         ((term_type_to_mtr(context->terminal_type) >= MTR_1_9) && (term_type_to_mtr(context->terminal_type) < MTR_1_20))) {
@@ -1498,42 +2191,23 @@ static int load_mm_table(mm_context_t *context, char *terminal_id, uint8_t table
         }
     }
 
-    *buffer = (uint8_t *)calloc(size, sizeof(uint8_t));
-    fflush(stdout);
-
-    if (*buffer == NULL) {
-        fprintf(stderr, "%s: Error: failed to allocate %u bytes for table %d\n", __func__, size, table_id);
-        fclose(stream);
-        return -ENOMEM;
-    }
-
-    bufp    = *buffer;
-    *bufp++ = table_id;
+    printf("\tLoaded table ID %d (0x%02x) from %s (%zu bytes).\n", table_id, table_id, image->fname, size - 1);
 
-    *len = 1;
-
-    while (1) {
-        uint8_t c = (uint8_t)fgetc(stream);
+    if (size == image->len) {
+        *buffer = (uint8_t *)image->data;
+    } else {
+        *buffer = (uint8_t *)calloc(size, sizeof(uint8_t));
 
-        if (feof(stream)) {
-            break;
-        }
-        *bufp++ = c;
-        *len    = *len + 1;
-
-        if (*len > size) {
-            fclose(stream);
-            free(*buffer);
-            *buffer = NULL;
-            return -1;
+        if (*buffer == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes for table %d\n", __func__, size, table_id);
+            return -ENOMEM;
         }
+
+        memcpy(*buffer, image->data, image->len);
     }
 
     *len = size;
 
-    printf("Loaded table ID %d (0x%02x) from %s (%zu bytes).\n", table_id, table_id, fname, *len - 1);
-    fclose(stream);
-
     return 0;
 }
 
@@ -1547,7 +2221,7 @@ static void generate_install_parameters(mm_context_t* context, uint8_t** buffer,
 
     if (pbuffer == NULL) {
         fprintf(stderr, "%s: Error allocating %zu bytes of memory\n", __func__, *len);
-        mm_shutdown(context);
+        mm_shutdown(context->manager);
         exit(-ENOMEM);
     }
 
@@ -1557,8 +2231,8 @@ static void generate_install_parameters(mm_context_t* context, uint8_t** buffer,
 
     pinstall_params->id = DLOG_MT_INSTALL_PARAMS;
 
-    memcpy(pinstall_params->access_code, context->access_code, sizeof(pinstall_params->access_code));
-    memcpy(pinstall_params->key_card_number, context->key_card_number, sizeof(pinstall_params->key_card_number));
+    memcpy(pinstall_params->access_code, context->manager->access_code, sizeof(pinstall_params->access_code));
+    memcpy(pinstall_params->key_card_number, context->manager->key_card_number, sizeof(pinstall_params->key_card_number));
     pinstall_params->tx_packet_delay = 10;
     pinstall_params->rx_packet_gap   = context->connection.proto.rx_packet_gap;
     pinstall_params->retries_until_oos = 40;
@@ -1580,7 +2254,7 @@ static void generate_term_access_parameters(mm_context_t *context, char *termina
 
     if (pncc_term_params == NULL) {
         fprintf(stderr, "%s: Error allocating %zu bytes of memory\n", __func__, *len);
-        mm_shutdown(context);
+        mm_shutdown(context->manager);
         exit(-ENOMEM);
     }
 
@@ -1596,13 +2270,13 @@ static void generate_term_access_parameters(mm_context_t *context, char *termina
     }
 
     // Rewrite table with Primary NCC phone number
-    printf("\t  Primary NCC: %s\n", context->ncc_number[0]);
-    string_to_bcd_a(context->ncc_number[0], pncc_term_params->pri_ncc_number, sizeof(pncc_term_params->pri_ncc_number));
+    printf("\t  Primary NCC: %s\n", context->manager->ncc_number[0]);
+    string_to_bcd_a(context->manager->ncc_number[0], pncc_term_params->pri_ncc_number, sizeof(pncc_term_params->pri_ncc_number));
 
     // Rewrite table with Secondary NCC phone number, if provided.
-    if (strnlen(context->ncc_number[1], sizeof(context->ncc_number[1])) > 0) {
-        printf("\tSecondary NCC: %s\n", context->ncc_number[1]);
-        string_to_bcd_a(context->ncc_number[1], pncc_term_params->sec_ncc_number, sizeof(pncc_term_params->sec_ncc_number));
+    if (strnlen(context->manager->ncc_number[1], sizeof(context->manager->ncc_number[1])) > 0) {
+        printf("\tSecondary NCC: %s\n", context->manager->ncc_number[1]);
+        string_to_bcd_a(context->manager->ncc_number[1], pncc_term_params->sec_ncc_number, sizeof(pncc_term_params->sec_ncc_number));
     }
 
     *buffer = (uint8_t *)pncc_term_params;
@@ -1618,7 +2292,7 @@ static void generate_term_access_parameters_mtr1(mm_context_t *context, char *te
 
     if (pbuffer == NULL) {
         fprintf(stderr, "%s: Error allocating %zu bytes of memory\n", __func__, *len);
-        mm_shutdown(context);
+        mm_shutdown(context->manager);
         exit(-ENOMEM);
     }
 
@@ -1635,13 +2309,13 @@ static void generate_term_access_parameters_mtr1(mm_context_t *context, char *te
     }
 
     // Rewrite table with Primary NCC phone number
-    printf("\t  Primary NCC: %s\n", context->ncc_number[0]);
-    string_to_bcd_a(context->ncc_number[0], pncc_term_params->pri_ncc_number, sizeof(pncc_term_params->pri_ncc_number));
+    printf("\t  Primary NCC: %s\n", context->manager->ncc_number[0]);
+    string_to_bcd_a(context->manager->ncc_number[0], pncc_term_params->pri_ncc_number, sizeof(pncc_term_params->pri_ncc_number));
 
     // Rewrite table with Secondary NCC phone number, if provided.
-    if (strnlen(context->ncc_number[1], sizeof(context->ncc_number[1])) > 0) {
-        printf("\tSecondary NCC: %s\n", context->ncc_number[1]);
-        string_to_bcd_a(context->ncc_number[1], pncc_term_params->sec_ncc_number, sizeof(pncc_term_params->sec_ncc_number));
+    if (strnlen(context->manager->ncc_number[1], sizeof(context->manager->ncc_number[1])) > 0) {
+        printf("\tSecondary NCC: %s\n", context->manager->ncc_number[1]);
+        string_to_bcd_a(context->manager->ncc_number[1], pncc_term_params->sec_ncc_number, sizeof(pncc_term_params->sec_ncc_number));
     }
 
     *buffer = pbuffer;
@@ -1659,7 +2333,7 @@ static void generate_call_in_parameters(mm_context_t *context, uint8_t **buffer,
 
     if (pbuffer == NULL) {
         fprintf(stderr, "%s: Error allocating %zu bytes of memory\n", __func__, *len);
-        mm_shutdown(context);
+        mm_shutdown(context->manager);
         exit(-ENOMEM);
     }
 
@@ -1669,7 +2343,7 @@ static void generate_call_in_parameters(mm_context_t *context, uint8_t **buffer,
 
     pcall_in_params->id = DLOG_MT_CALL_IN_PARMS;
 
-    mm_time(context->test_mode, &rawtime);
+    mm_time(context->manager->test_mode, &rawtime);
     localtime_r(&rawtime, &ptm);
 
     /* Interestingly, the terminal will call in starting at the call-in time, and continue
@@ -1719,7 +2393,7 @@ static void generate_call_stat_parameters(mm_context_t *context, uint8_t **buffe
 
     if (pbuffer == NULL) {
         fprintf(stderr, "%s: Error allocating %zu bytes of memory\n", __func__, *len);
-        mm_shutdown(context);
+        mm_shutdown(context->manager);
         exit(-ENOMEM);
     }
 
@@ -1760,7 +2434,7 @@ static void generate_comm_stat_parameters(mm_context_t *context, uint8_t **buffe
 
     if (pbuffer == NULL) {
         fprintf(stderr, "%s: Error allocating %zu bytes of memory\n", __func__, *len);
-        mm_shutdown(context);
+        mm_shutdown(context->manager);
         exit(-ENOMEM);
     }
 
@@ -1802,7 +2476,7 @@ static void generate_user_if_parameters(mm_context_t *context, uint8_t **buffer,
 
     if (pbuffer == NULL) {
         fprintf(stderr, "%s: Error allocating %zu bytes of memory\n", __func__, *len);
-        mm_shutdown(context);
+        mm_shutdown(context->manager);
         exit(-ENOMEM);
     }
 
@@ -1854,7 +2528,7 @@ static void generate_dlog_mt_end_data(mm_context_t *context, uint8_t **buffer, s
     *buffer = (uint8_t *)calloc(1, *len);
     if (*buffer == NULL) {
         fprintf(stderr, "%s: Error allocating %zu bytes of memory\n", __func__, *len);
-        mm_shutdown(context);
+        mm_shutdown(context->manager);
         exit(-ENOMEM);
     }
 
@@ -1885,8 +2559,10 @@ static int create_terminal_specific_directory(char *table_dir, char *terminal_id
 
 time_t mm_time(int test_mode, time_t *rawtime) {
     if (test_mode) {
-        /* When in test mode, use a static time, so that results are consistent. */
-        *rawtime = JAN12020;
+        /* When in test mode, use the time the replayed data was received, or a static time, so that results are consistent. */
+        if ((*rawtime = mm_replay_time()) == 0) {
+            *rawtime = JAN12020;
+        }
     }
     else {
         time(rawtime);
@@ -1895,30 +2571,92 @@ time_t mm_time(int test_mode, time_t *rawtime) {
     return *rawtime;
 }
 
+/*
+ * Write what a test mode replay did as JSON: the frames sent on each line,
+ * and the rows added to each table of the database.
+ */
+static int mm_write_replay_result(mm_manager_t* manager, const char* filename, const mm_sql_table_rows_t* db_rows, int db_tables, int db_changes) {
+    mm_sql_table_rows_t tables[MM_SQL_MAX_TABLES];
+    int   table_count;
+    int   first = 1;
+    int   status = 0;
+    FILE* stream;
+
+    if ((stream = fopen(filename, "w")) == NULL) {
+        fprintf(stderr, "%s: Can't write result file '%s': %s\n", __func__, filename, strerror(errno));
+        return -EIO;
+    }
+
+    fprintf(stream, "{\n  \"lines\": [\n");
+    for (int line = 0; line < manager->line_count; line++) {
+        status |= mm_replay_write_result(stream, manager->lines[line]->connection.replay, line, 4);
+        fprintf(stream, (line < manager->line_count - 1) ? ",\n" : "\n");
+    }
+    fprintf(stream, "  ],\n  \"db_rows\": {");
+
+    table_count = mm_sql_count_rows(manager->database, tables, MM_SQL_MAX_TABLES);
+    for (int i = 0; i < table_count; i++) {
+        uint64_t before = 0;
+
+        for (int j = 0; j < db_tables; j++) {
+            if (strcmp(db_rows[j].name, tables[i].name) == 0) {
+                before = db_rows[j].rows;
+                break;
+            }
+        }
+
+        if (tables[i].rows != before) {
+            fprintf(stream, "%s\n    \"%s\": %" PRId64, first ? "" : ",", tables[i].name, (int64_t)(tables[i].rows - before));
+            first = 0;
+        }
+    }
+
+    fprintf(stream, "%s},\n  \"db_changes\": %d\n}\n", first ? "" : "\n  ", mm_sql_total_changes(manager->database) - db_changes);
+
+    if ((fclose(stream) != 0) || (status != 0)) {
+        fprintf(stderr, "%s: Error writing '%s'.\n", __func__, filename);
+        return -EIO;
+    }
+
+    printf("Replay results written to %s\n", filename);
+    return 0;
+}
+
 static void mm_display_help(const char *name, FILE *stream) {
-    /* "a:b:cd:e:f:hi:k:l:mn:p:qrst:uvw" */
+    /* "a:Ab:B:cd:D:e:f:F:hi:k:l:L:mn:p:P:qrR:sSt:T:uU:vw" */
     fprintf(stream,
-        "usage: %s [-vhmq] [-f <filename>] [-i \"modem init string\"] [-l <logfile>] [-p <pcapfile>] [-a <access_code>] [-k <key_code>] [-n <ncc_number>] [-d <default_table_dir] [-t <term_table_dir>] [-u <port>]\n",
+        "usage: %s [-vhmq] [-f <filename>] [-F <linefile>] [-i \"modem init string\"] [-l <logfile>] [-L <logfile>] [-p <pcapfile>] [-P <MB>] [-T <minutes>] [-R <resultfile>] [-a <access_code>] [-k <key_code>] [-n <ncc_number>] [-d <default_table_dir] [-t <term_table_dir>] [-u] [-U <address>[:<port>]] [-D <profile>]\n",
         name);
     fprintf(stream,
             "\t-a <access_code> - Craft 7-digit access code (default: CRASERV)\n" \
+            "\t-A - Adapt the inter-packet gap to each terminal, and send it in the INSTALL_PARAMS table.\n" \
             "\t-b <baudrate> - Modem baud rate, in bps.  Defaults to 19200.\n" \
+            "\t-B <seconds> - Download budget: defer optional tables that don't fit to the next table update.\n" \
             "\t-c - Always download complete table set.\n" \
             "\t-d <default_table_dir> - default table directory.\n" \
+            "\t-D <profile> - database storage profile: default, or wal to allow reports while running.\n" \
             "\t-e <error_inject_type> - Inject error on SIGBRK.\n" \
-            "\t-f <filename> modem device or file\n" \
+            "\t-f <filename> modem device, or in test mode a log (-l or -L) or .pcap capture to replay.  May be repeated to serve multiple lines.\n" \
+            "\t-F <linefile> - file listing modem devices, one per line.\n" \
             "\t-h this help.\n" \
             "\t-i \"modem init string\" - Modem initialization string.\n" \
             "\t-k <key_code> - Desk Terminal 10-digit key card code (default: 4012888888)\n" \
             "\t-l <logfile> - log bytes transmitted to and received from the terminal.  Useful for debugging.\n" \
+            "\t-L <logfile> - log the same in a compact binary format, with timestamps.  Read by mm_dlog2pcap and test mode.\n" \
+            "\t   With multiple lines, the line number is added to the log and pcap file names.\n" \
             "\t-m use serial modem (specify device with -f)\n" \
             "\t-n <Primary NCC Number> [-n <Secondary NCC Number>] - specify primary and optionally secondary NCC number.\n" \
-            "\t-p <pcapfile> - Save packets in a .pcap file.\n" \
+            "\t-p <pcapfile> - Save packets in a .pcap file, or a .pcapng file with one interface per line.\n" \
+            "\t-P <MB> - Start a new capture file when the current one reaches <MB> megabytes.\n" \
             "\t-q - Don't display sign-on banner.\n" \
             "\t-r - Rating test mode: Amount charged determined by last 4 digits of dialed number.\n" \
+            "\t-R <resultfile> - Test mode: write the frames sent and the database rows added, as JSON.\n" \
             "\t-s - Download only minimum required tables to terminal.\n" \
+            "\t-S - Download only minimum required tables, and the rest on the next table update.\n" \
             "\t-t <term_table_dir> - terminal-specific table directory.\n" \
-            "\t-u <port> - Send packets as UDP to <port>.\n" \
+            "\t-T <minutes> - Start a new capture file every <minutes> minutes.\n" \
+            "\t-u - Send packets as UDP to 127.0.0.1:27273, for a live Wireshark capture.\n" \
+            "\t-U <address>[:<port>] - Also send packets as UDP to <address>; may be given up to 8 times.\n" \
             "\t-v verbose (multiple v's increase verbosity.\n" \
             "\t-w - don't monitor the modem for carrier loss.\n");
     return;
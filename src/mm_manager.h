@@ -15,6 +15,9 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "mm_timer.h"
+#include "mm_termtyp.h"
+
 #ifdef _WIN32
 #define PACKED
 #else
@@ -44,6 +47,9 @@
 #define MODEM_RSP_NO_CARRIER        (4)
 #define MODEM_RSP_NULL              (5)
 
+#define MODEM_HANGUP_MS             (1000)  // Time DTR is held low to hang up
+#define MODEM_REARM_MS              (2000)  // Time to wait for OK once DTR is raised again
+
 /* Packet Error Flags */
 #define PKT_SUCCESS                 (0)
 #define PKT_ERROR_RETRY             (1 << 0)
@@ -56,7 +62,10 @@
 #define PKT_ERROR_NO_CARRIER        (1 << 8)
 #define PKT_ERROR_FAILURE           (1 << 9)
 
-#define PKT_TIMEOUT_MAX             (10)    // Maximum time to wait for modem character
+#define PKT_TIMEOUT_MS              (10000) // Maximum time to wait for a packet
+#define PKT_ACK_TIMEOUT_MS          (10000) // Maximum time to wait for an ACK, unless learned with -A
+#define PKT_BYTE_TIMEOUT_MS         (1000)  // Maximum time between bytes of a packet
+#define PKT_SESSION_TIMEOUT_MS      (30 * 60 * 1000)    // Longest call before hanging up
 #define PKT_MAX_RETRIES             (5)     // Maximum number of time to retry an errored packet
 
 #define PKT_TABLE_ID_OFFSET         (0x05)
@@ -260,6 +269,16 @@ typedef struct mm_table {
     mm_packet_t pkt;
 } PACKED mm_table_t;
 
+/*
+ * A data packet, encoded ahead of time with sequence number 0.  Only the
+ * sequence bits and the CRC change when it is sent, so the CRC for each
+ * sequence number is precomputed.
+ */
+typedef struct mm_frame {
+    mm_packet_t pkt;
+    uint16_t crc[FLAG_SEQUENCE + 1];
+} mm_frame_t;
+
 /*
  * These data structures match the ones generated and
  * consumed by the terminal.
@@ -1295,9 +1314,20 @@ typedef struct dlog_mt_npa_nxx_table {
 
 #define TABLE_PATH_MAX_LEN   283
 
+/* Counts kept by the protocol for a line, to tune and estimate downloads. */
+typedef struct mm_proto_stats {
+    uint32_t tx_packets;    /* Data packets sent, including retries. */
+    uint32_t tx_retries;    /* Data packets sent again after a NACK or timeout. */
+    uint32_t rx_packets;    /* Data packets received. */
+    uint32_t rx_errors;     /* Packets received with CRC or framing errors. */
+    uint32_t ack_count;     /* ACKs received for data packets... */
+    uint32_t ack_ms;        /* ...and the total time waited for them. */
+} mm_proto_stats_t;
+
 typedef struct mm_proto_ctx {
     struct mm_serial_context* serial_context;
-    FILE* pcapstream;
+    struct mm_capture* capture;     /* Packet capture, or NULL */
+    int capture_line;               /* This line's interface in the capture */
     char terminal_id[11];   /* The terminal's phone number */
     int connected;
     uint8_t rx_seq;
@@ -1308,7 +1338,13 @@ typedef struct mm_proto_ctx {
     uint8_t rx_packet_gap;
     uint8_t error_inject_type;
     uint8_t debuglevel;
-    uint8_t send_udp;
+    uint8_t max_retries;    /* Times to send a data packet before giving up. */
+    uint32_t ack_timeout_ms;
+    mm_deadline_t session_deadline; /* Hang up if the call is still going. */
+    uint8_t async_hangup;   /* Leave DTR low on disconnect; the line's owner finishes the hangup. */
+    mm_deadline_t hangup_deadline;  /* With async_hangup: when DTR may be raised again. */
+    int baudrate;           /* Line rate, for estimating download time. */
+    mm_proto_stats_t stats;
 } mm_proto_t;
 
 typedef struct mm_telco {
@@ -1318,17 +1354,35 @@ typedef struct mm_telco {
 
 typedef struct mm_connection {
     FILE* logstream;
-    FILE* bytestream;
+    struct mm_dlog_writer* dlog;    /* Binary log, or NULL */
+    struct mm_replay* replay;       /* Test mode input */
     char modem_reset_string[256];
     char modem_init_string[256];
     int test_mode;
+    int line;               /* Line number, for multi-line managers. */
     /* Terminal Communication */
     mm_proto_t proto;
 } mm_connection_t;
 
-typedef struct mm_context {
+#define MM_MAX_LINES    32  /* Maximum number of modem lines served concurrently. */
+
+/* Link settings learned for a terminal with -A. */
+typedef struct mm_link_tune {
+    uint8_t rx_packet_gap;  /* Inter-packet gap, in 10ms units. */
+    uint8_t min_gap;        /* Smallest gap not seen to cause errors. */
+    uint16_t ack_ms;        /* Average time for the terminal to ACK a packet. */
+    uint32_t packets;       /* Data packets sent to the terminal, over all calls... */
+    uint32_t retries;       /* ...and how many were resent or received with errors. */
+} mm_link_tune_t;
+
+/* Manager-wide state, shared by all lines. */
+typedef struct mm_manager {
     void* database;
-    mm_connection_t connection;
+    struct mm_acct_writer* acct_writer;
+    struct mm_table_cache* table_cache;
+    struct mm_plan_cache* plan_cache;
+    struct mm_capture* capture;
+    struct mm_udp* udp;         /* UDP mirror, or NULL */
     /* Configuration */
     mm_telco_t telco;
     char ncc_number[2][21];
@@ -1337,25 +1391,47 @@ typedef struct mm_context {
     uint8_t access_code[4];
     uint8_t key_card_number[5];
     uint8_t minimal_table_set;
-    /* Manager-wide */
+    uint8_t split_download;     /* Send optional tables on the next table update. */
+    uint32_t download_budget_ms;    /* Longest download, 0 for no limit; optional tables over it are deferred. */
+    uint8_t adaptive_link;      /* Learn the packet gap for each terminal. */
+    uint8_t complete_download;
+    uint8_t rating_test_mode;
+    uint8_t debuglevel;
+    uint8_t test_mode;
+    /* Lines */
+    int line_count;
+    struct mm_context* lines[MM_MAX_LINES];
+} mm_manager_t;
+
+/* Per-line session state. */
+typedef struct mm_context {
+    mm_manager_t* manager;
+    mm_connection_t connection;
+    char modem_dev[256];
+    /* Session State */
     uint8_t cdr_ack_buffer[PKT_TABLE_DATA_LEN_MAX];
     uint8_t cdr_ack_buffer_len;
     uint8_t trans_data_in_progress;
-    uint8_t debuglevel;
     /* Terminal State */
     uint8_t terminal_type;
     uint8_t terminal_upd_reason;
-    uint8_t complete_download;
+    uint8_t send_deferred_tables;
     cashbox_status_univ_t cashbox_status;
-    uint8_t rating_test_mode;
-    uint8_t test_mode;
+    /* Link Tuning (-A) */
+    uint8_t link_tuned;             /* The terminal's settings are in use for this call. */
+    uint8_t line_packet_gap;        /* The line's own settings, restored after the call. */
+    uint8_t line_max_retries;
+    uint32_t line_ack_timeout_ms;
+    mm_link_tune_t link_tune;
+    mm_proto_stats_t link_stats;    /* Protocol counts at the start of the call. */
 } mm_context_t;
 
 typedef uint32_t pkt_status_t;  /* Packet status flags. */
 
 /* MM Connection */
 int mm_connection_open(mm_connection_t* connection, const char* modem_dev, int baudrate, int test_mode);
-int mm_connection_wait(mm_connection_t* connection);
+int mm_connection_wait(mm_connection_t* connection);  /* Returns 1 when connected, 0 if not, or < 0 on line failure. */
+int mm_connection_modem_event(mm_connection_t* connection, int modem_response);
 int mm_connection_close(mm_connection_t* connection);
 
 /* MM Protocol */
@@ -1364,12 +1440,18 @@ extern int proto_disconnect(mm_proto_t* proto);
 extern int proto_connected(mm_proto_t* proto);
 extern int receive_mm_table(mm_proto_t* proto, mm_table_t* table);
 extern int send_mm_table(mm_proto_t* proto, uint8_t* payload, size_t len);
+extern int frame_mm_table(const char* terminal_id, const uint8_t* payload, size_t len, mm_frame_t** frames);
+extern int send_mm_table_frames(mm_proto_t* proto, const mm_frame_t* frames, int frame_count);
 extern int wait_for_table_ack(mm_proto_t* proto, uint8_t table_id);
+extern uint32_t estimate_mm_table_ms(const mm_proto_t* proto, const mm_frame_t* frames, int frame_count);
 
 /* modem functions */
 extern int init_modem(struct mm_serial_context *pserial_context, const char *modem_reset_string, const char *modem_init_string);
+extern int modem_response_from_string(const char *buffer);
 extern int wait_for_modem_response(struct mm_serial_context *pserial_context, int max_tries);
 extern int hangup_modem(struct mm_serial_context *pserial_context);
+extern int hangup_modem_begin(struct mm_serial_context *pserial_context);
+extern int hangup_modem_end(struct mm_serial_context *pserial_context);
 
 /* accounting functions */
 extern int mm_acct_create_tables(void *db);
@@ -1392,21 +1474,58 @@ int    mm_table_save(mm_context_t* context, uint8_t table_id, uint64_t version_t
 
 /* Manager Configuration Database */
 int mm_config_create_tables(void* db);
+int mm_config_load_TERMTYP(void* db);
+void mm_config_unload_TERMTYP(void);
 uint8_t mm_config_get_term_type_from_control_rom_edition(void* db, const char* control_rom_edition);
 
 /* database functions */
-extern void *mm_open_database(const char *db_filename);
+/* Database storage profiles */
+#define MM_DB_PROFILE_DEFAULT   0   /* SQLite defaults: rollback journal, synchronous=FULL */
+#define MM_DB_PROFILE_WAL       1   /* WAL journal, synchronous=FULL, background checkpoints */
+
+/* Rows in each table, from mm_sql_count_rows(). */
+#define MM_SQL_MAX_TABLES       64
+
+typedef struct mm_sql_table_rows {
+    char name[32];
+    uint64_t rows;
+} mm_sql_table_rows_t;
+
+extern void *mm_open_database(const char *db_filename, int profile);
 extern int mm_close_database(void *db);
 extern int mm_sql_exec(void *db, const char *sql);
+extern int mm_sql_exec_stmt(void *db, const char *sql, const char *types, ...);
+extern int mm_sql_begin_transaction(void *db);
+extern int mm_sql_commit_transaction(void *db);
+extern int mm_sql_rollback_transaction(void *db);
 extern uint8_t mm_sql_read_uint8(void* db, const char* sql);
 extern uint64_t mm_sql_read_uint64(void* db, const char* sql);
 extern int mm_sql_read_blob(void* db, const char* sql, uint8_t* buffer, size_t buflen);
+extern int mm_sql_count_rows(void* db, mm_sql_table_rows_t* tables, int max_tables);
+extern int mm_sql_total_changes(void* db);
 extern int mm_sql_write_blob(void* db, const char* sql, uint8_t* buffer, size_t buflen);
 extern int mm_sql_load_TCASHST(void* db, const char* terminal_id, cashbox_status_univ_t* cashbox_status);
+extern int mm_sql_load_TERMTYP(void* db, mm_termtyp_map_t* map);
+extern int mm_sql_load_TCFGFILE(void* db, const char* filename, uint64_t* hash);
+extern int mm_sql_load_TTBLHASH(void* db, const char* terminal_id, uint64_t hashes[256]);
+extern int mm_sql_load_TDLJRNL(void* db, const char* terminal_id, uint64_t hashes[256]);
+extern int mm_sql_save_TDLJRNL(void* db, const char* terminal_id, uint8_t table_id, uint64_t hash);
+extern int mm_sql_commit_TDLJRNL(void* db, const char* terminal_id);
+extern int mm_sql_clear_TTBLHASH(void* db, const char* terminal_id);
+extern int mm_sql_clear_TDLJRNL(void* db, const char* terminal_id);
+extern int mm_sql_load_TLINKTUNE(void* db, const char* terminal_id, mm_link_tune_t* tune);
+extern int mm_sql_save_TLINKTUNE(void* db, const char* terminal_id, const mm_link_tune_t* tune);
+extern int mm_sql_load_TDLPEND(void* db, const char* terminal_id, uint8_t* terminal_type);
+extern int mm_sql_save_TDLPEND(void* db, const char* terminal_id, uint8_t terminal_type);
+extern int mm_sql_clear_TDLPEND(void* db, const char* terminal_id);
 
 /* mm_util */
-extern uint16_t crc16(uint16_t crc, uint8_t *buf, size_t len);
+extern void crc16_init(void);
+extern uint16_t crc16(uint16_t crc, const uint8_t *buf, size_t len);
+#define FNV1A64_INIT    0xcbf29ce484222325ULL
+extern uint64_t fnv1a64(uint64_t hash, const uint8_t *buf, size_t len);
 extern void dump_hex(const uint8_t *data, size_t len);
+
 extern char *phone_num_to_string(char *string_buf, size_t string_len, uint8_t* num_buf, size_t num_buf_len);
 extern uint8_t string_to_bcd_a(char* number_string, uint8_t* buffer, uint8_t buff_len);
 extern char *callscrn_num_to_string(char *string_buf, size_t string_buf_len, uint8_t* num_buf, size_t num_buf_len);
@@ -1436,9 +1555,12 @@ extern void print_comm_stat_table(dlog_mt_comm_stat_params_t* comm_stat_table);
 extern void print_fconfig_table(dlog_mt_fconfig_opts_t* fconfig_table);
 extern int mm_validate_table_fsize(uint8_t table_id, FILE *stream, unsigned long expected_size);
 
+/* With more than one line, insert the line number before the file extension. */
+void mm_line_filename(char* buf, size_t len, const char* fname, int line, int line_count);
+
 /* mm_pcap */
 int mm_create_pcap(const char* capfilename, FILE** pcapstream);
-int mm_add_pcap_rec(FILE* pcapstream, int direction, mm_packet_t* pkt, uint32_t ts_sec, uint32_t ts_usec);
+int mm_add_pcap_rec(FILE* pcapstream, int direction, const mm_packet_t* pkt, uint32_t ts_sec, uint32_t ts_usec);
 int mm_close_pcap(FILE* pcapstream);
 
 #ifdef _WIN32
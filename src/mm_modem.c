@@ -61,11 +61,24 @@ int init_modem(mm_serial_context_t *pserial_context, const char *modem_reset_str
     return status;
 }
 
+/* Match a line received from the modem against the known responses. */
+int modem_response_from_string(const char *buffer) {
+    int i;
+
+    for (i = 0; i < (int)(sizeof(modem_responses) / sizeof(char*)); i++) {
+        if (strstr(buffer, modem_responses[i]) != 0) {
+            return i;
+        }
+    }
+
+    return MODEM_RSP_NULL;
+}
+
 /* Wait for modem to connect */
 int wait_for_modem_response(mm_serial_context_t *pserial_context, int max_tries) {
     char buffer[255] = { 0 }; /* Input buffer */
     uint8_t bufindex = 0;
-    uint8_t i;
+    int     i;
     int     tries = 0;     /* Number of tries so far */
 
     drain_serial(pserial_context);
@@ -88,10 +101,8 @@ int wait_for_modem_response(mm_serial_context_t *pserial_context, int max_tries)
         }
 
         /* See if we got the expected response */
-        for (i = 0; i < (sizeof(modem_responses) / sizeof(char*)); i++) {
-            if (strstr(buffer, modem_responses[i]) != 0) {
-                return i;
-            }
+        if ((i = modem_response_from_string(buffer)) != MODEM_RSP_NULL) {
+            return i;
         }
         tries++;
     } while (tries < max_tries);
@@ -102,12 +113,8 @@ int wait_for_modem_response(mm_serial_context_t *pserial_context, int max_tries)
 #define USE_MODEM_DTR
 int hangup_modem(mm_serial_context_t *pserial_context) {
 #ifdef USE_MODEM_DTR
-    serial_set_dtr(pserial_context, 0);
-#ifdef _WIN32
-    Sleep(1000);
-#else
-    sleep(1);
-#endif /* _WIN32 */
+    hangup_modem_begin(pserial_context);
+    serial_delay(pserial_context, MODEM_HANGUP_MS);
     serial_set_dtr(pserial_context, 1);
     return 0;
 #else
@@ -118,21 +125,11 @@ int hangup_modem(mm_serial_context_t *pserial_context) {
 
         for (int i = 0; i < 3; i++) {
             write_serial(pserial_context, "+", 1);
-#ifdef _WIN32
-            Sleep(100);
-#else  /* ifdef _WIN32 */
-            nanosleep((const struct timespec[]) { { 0, 100 * 1000000L } }, NULL);
-#endif /* ifdef _WIN32 */
+            serial_delay(pserial_context, 100);
         }
 
-        /* Sleep only if using a real modem. */
-        if (pserial_context->fd != -1) {
-#ifdef _WIN32
-            Sleep(1000);
-#else  /* ifdef _WIN32 */
-            sleep(1); /* Some modems need time to process the AT command. */
-#endif /* ifdef _WIN32 */
-        }
+        /* Some modems need time to process the AT command. */
+        serial_delay(pserial_context, 1000);
 
         if (wait_for_modem_response(pserial_context, 1) == MODEM_RSP_OK) {
             return send_at_command(pserial_context, "ATH0");
@@ -142,6 +139,33 @@ int hangup_modem(mm_serial_context_t *pserial_context) {
 #endif /* USE_MODEM_DTR */
 }
 
+/*
+ * Hang up without waiting: drop DTR, and after MODEM_HANGUP_MS call
+ * hangup_modem_end().  Without DTR control this is the whole blocking
+ * hangup.
+ */
+int hangup_modem_begin(mm_serial_context_t *pserial_context) {
+#ifdef USE_MODEM_DTR
+    drain_serial(pserial_context);  /* Let the last packet go out first. */
+    return serial_set_dtr(pserial_context, 0);
+#else
+    return hangup_modem(pserial_context);
+#endif /* USE_MODEM_DTR */
+}
+
+/* Raise DTR again and ask the modem for an OK, to confirm it is ready for the next call. */
+int hangup_modem_end(mm_serial_context_t *pserial_context) {
+#ifdef USE_MODEM_DTR
+    serial_set_dtr(pserial_context, 1);
+#endif /* USE_MODEM_DTR */
+    flush_serial(pserial_context);
+
+    if (write_serial(pserial_context, "AT\r", 3) != 3) {
+        return -EIO;
+    }
+    return 0;
+}
+
 /* Send AT Command to Modem */
 static int send_at_command(mm_serial_context_t *pserial_context, const char *command) {
     char buffer[80]; /* Input buffer */
@@ -158,11 +182,7 @@ static int send_at_command(mm_serial_context_t *pserial_context, const char *com
         }
 
         /* Some modems need time to process the AT command. */
-#ifdef _WIN32
-        Sleep(100);
-#else  /* ifdef _WIN32 */
-        nanosleep((const struct timespec[]) { { 0, 100 * 1000000L } }, NULL);
-#endif /* _WIN32 */
+        serial_delay(pserial_context, 100);
 
         if ((modem_response = wait_for_modem_response(pserial_context, 5)) == MODEM_RSP_OK) break;
     }
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 
 #include "mm_manager.h"
@@ -39,9 +40,11 @@ int mm_create_pcap(const char* capfilename, FILE **pcapstream) {
     return 0;
 }
 
-int mm_add_pcap_rec(FILE* pcapstream, int direction, mm_packet_t *pkt, uint32_t ts_sec, uint32_t ts_usec) {
+int mm_add_pcap_rec(FILE* pcapstream, int direction, const mm_packet_t *pkt, uint32_t ts_sec, uint32_t ts_usec) {
     mm_pcaprec_hdr_t pcap_rec = { 0 };
     struct timespec ts;
+    uint8_t rec[sizeof(mm_pcaprec_hdr_t) + 256];
+    size_t len = (size_t)pkt->hdr.pktlen + 1;
 
     if (pcapstream == NULL) {
         return -1;
@@ -60,24 +63,19 @@ int mm_add_pcap_rec(FILE* pcapstream, int direction, mm_packet_t *pkt, uint32_t
 
     pcap_rec.ts_sec   = ts_sec;
     pcap_rec.ts_usec  = ts_usec;
-    pcap_rec.incl_len = pkt->hdr.pktlen + 1;
-    pcap_rec.orig_len = pkt->hdr.pktlen + 1;
+    pcap_rec.incl_len = (uint32_t)len;
+    pcap_rec.orig_len = (uint32_t)len;
 
-    /* Write PCAP record header */
-    if (fwrite(&pcap_rec, sizeof(mm_pcaprec_hdr_t), 1, pcapstream) != 1) {
-        fprintf(stderr, "%s: Error writing.\n", __func__);
-        return -1;
-    }
-    pkt->hdr.start |= (direction == TX) ? 0x80 : 0;
+    /* Write the record header and packet together; the top bit of the start byte gives the direction. */
+    memcpy(rec, &pcap_rec, sizeof(mm_pcaprec_hdr_t));
+    memcpy(&rec[sizeof(mm_pcaprec_hdr_t)], &pkt->hdr.start, len);
+    rec[sizeof(mm_pcaprec_hdr_t)] |= (direction == TX) ? 0x80 : 0;
 
-    /* Write Payload */
-    if (fwrite(&pkt->hdr.start, (size_t)pkt->hdr.pktlen + 1, 1, pcapstream) != 1) {
+    if (fwrite(rec, sizeof(mm_pcaprec_hdr_t) + len, 1, pcapstream) != 1) {
         fprintf(stderr, "%s: Error writing.\n", __func__);
-        pkt->hdr.start &= 0x7F;
         return -1;
     }
 
-    pkt->hdr.start &= 0x7F;
     return 0;
 }
 
@@ -9,6 +9,8 @@
 #ifndef MM_PCAP_H_
 #define MM_PCAP_H_
 
+#define LINKTYPE_USER0      147
+
 typedef struct mm_pcap_hdr_s {
           uint32_t magic_number;   /* 0xa1b2c3d4 magic number */
           uint16_t version_major;  /* 2: major version number */
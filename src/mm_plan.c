@@ -0,0 +1,204 @@
+/*
+ * Download plans, part of mm_manager.
+ *
+ * Plans are cached per terminal, most recently used first.  A line takes
+ * its terminal's plan out of the cache for the length of the download, so
+ * a plan is never used by two lines at once.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mm_plan.h"
+#include "mm_thread.h"
+
+#define PLAN_CACHE_MAX      64  /* Plans kept; each is about 30KB for a full download. */
+
+struct mm_plan_cache {
+    mm_mutex_t lock;
+    int count;
+    mm_plan_t* head;
+};
+
+mm_plan_t* mm_plan_create(mm_table_cache_t* table_cache, const char* terminal_id, uint8_t terminal_type, uint8_t rx_packet_gap, int table_max) {
+    mm_plan_t* plan;
+
+    plan = (mm_plan_t*)calloc(1, sizeof(mm_plan_t));
+
+    if (plan == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_plan_t));
+        return NULL;
+    }
+
+    plan->tables = (mm_plan_table_t*)calloc((size_t)table_max, sizeof(mm_plan_table_t));
+
+    if (plan->tables == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %d tables.\n", __func__, table_max);
+        free(plan);
+        return NULL;
+    }
+
+    plan->table_cache = table_cache;
+    snprintf(plan->terminal_id, sizeof(plan->terminal_id), "%s", terminal_id);
+    plan->terminal_type = terminal_type;
+    plan->rx_packet_gap = rx_packet_gap;
+    plan->table_max = table_max;
+
+    return plan;
+}
+
+void mm_plan_free(mm_plan_t* plan) {
+    if (plan == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < plan->table_count; i++) {
+        mm_table_cache_release(plan->table_cache, plan->tables[i].image);
+        free(plan->tables[i].frames);
+    }
+
+    free(plan->tables);
+    free(plan);
+}
+
+int mm_plan_add_table(mm_plan_t* plan, uint8_t table_id, uint8_t source) {
+    mm_plan_table_t* table;
+
+    if (plan->table_count == plan->table_max) {
+        return -ENOSPC;
+    }
+
+    table = &plan->tables[plan->table_count++];
+    table->table_id = table_id;
+    table->source = source;
+
+    return 0;
+}
+
+int mm_plan_set_table(mm_plan_t* plan, int index, const uint8_t* data, size_t len, const mm_table_image_t* image) {
+    mm_plan_table_t* table = &plan->tables[index];
+    int frame_count = 0;
+
+    mm_table_cache_release(plan->table_cache, table->image);
+    free(table->frames);
+    table->frames = NULL;
+    table->frame_count = 0;
+    table->image = image;
+    table->hash = 0;
+
+    if (data != NULL) {
+        frame_count = frame_mm_table(plan->terminal_id, data, len, &table->frames);
+
+        if (frame_count < 0) {
+            /* Try again on the next download. */
+            mm_table_cache_release(plan->table_cache, table->image);
+            table->image = NULL;
+            table->framed = 0;
+            return frame_count;
+        }
+
+        table->hash = fnv1a64(FNV1A64_INIT, data, len);
+    }
+
+    table->frame_count = frame_count;
+    table->framed = 1;
+
+    return 0;
+}
+
+mm_plan_cache_t* mm_plan_cache_create(void) {
+    mm_plan_cache_t* cache;
+
+    cache = (mm_plan_cache_t*)calloc(1, sizeof(mm_plan_cache_t));
+
+    if (cache == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_plan_cache_t));
+        return NULL;
+    }
+
+    mm_mutex_init(&cache->lock);
+
+    return cache;
+}
+
+void mm_plan_cache_destroy(mm_plan_cache_t* cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    while (cache->head != NULL) {
+        mm_plan_t* plan = cache->head;
+
+        cache->head = plan->next;
+        mm_plan_free(plan);
+    }
+
+    mm_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+mm_plan_t* mm_plan_cache_take(mm_plan_cache_t* cache, const char* terminal_id, uint8_t terminal_type, uint8_t rx_packet_gap) {
+    mm_plan_t** link;
+    mm_plan_t*  plan;
+
+    mm_mutex_lock(&cache->lock);
+
+    for (link = &cache->head; (plan = *link) != NULL; link = &plan->next) {
+        if (strcmp(plan->terminal_id, terminal_id) == 0) {
+            *link = plan->next;
+            plan->next = NULL;
+            cache->count--;
+            break;
+        }
+    }
+
+    mm_mutex_unlock(&cache->lock);
+
+    /* The terminal was replaced by another model. */
+    if ((plan != NULL) && (plan->terminal_type != terminal_type)) {
+        mm_plan_free(plan);
+        plan = NULL;
+    }
+
+    /* The packet gap changed: only DLOG_MT_INSTALL_PARAMS has to be framed again. */
+    if ((plan != NULL) && (plan->rx_packet_gap != rx_packet_gap)) {
+        plan->rx_packet_gap = rx_packet_gap;
+        for (int i = 0; i < plan->table_count; i++) {
+            if (plan->tables[i].table_id == DLOG_MT_INSTALL_PARAMS) {
+                plan->tables[i].framed = 0;
+            }
+        }
+    }
+
+    return plan;
+}
+
+void mm_plan_cache_put(mm_plan_cache_t* cache, mm_plan_t* plan) {
+    mm_plan_t*  evict = NULL;
+    mm_plan_t** link;
+
+    mm_mutex_lock(&cache->lock);
+
+    plan->next = cache->head;
+    cache->head = plan;
+    cache->count++;
+
+    if (cache->count > PLAN_CACHE_MAX) {
+        for (link = &cache->head; (*link)->next != NULL; link = &(*link)->next) {
+        }
+        evict = *link;
+        *link = NULL;
+        cache->count--;
+    }
+
+    mm_mutex_unlock(&cache->lock);
+
+    mm_plan_free(evict);
+}
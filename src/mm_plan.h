@@ -0,0 +1,78 @@
+/*
+ * Download plans, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_PLAN_H_
+#define MM_PLAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm_manager.h"
+#include "mm_table_cache.h"
+
+/*
+ * A download plan is the ordered list of tables downloaded to one terminal,
+ * each already split into packets and encoded for that terminal.  Plans
+ * are kept between calls, so a download only sets sequence numbers.
+ *
+ * Tables read from files keep a reference to the image they were framed
+ * from; the manager compares it with the table cache before each use and
+ * reframes a table that has changed.  Tables that differ on every call
+ * (the call-in time, cash box status) are framed again for each download.
+ */
+#define MM_PLAN_GENERATED   0   /* Generated from the manager configuration */
+#define MM_PLAN_FILE        1   /* Read through the table cache */
+#define MM_PLAN_DYNAMIC     2   /* Generated for each download */
+
+typedef struct mm_plan_table {
+    uint8_t table_id;
+    uint8_t source;                     /* MM_PLAN_GENERATED, MM_PLAN_FILE or MM_PLAN_DYNAMIC */
+    uint8_t framed;                     /* frames hold the current table, or it has none to send */
+    const mm_table_image_t* image;      /* MM_PLAN_FILE: the image framed, NULL if not found */
+    uint64_t hash;                      /* fnv1a64 of the table as framed */
+    uint8_t send;                       /* Set for each download: the table is to be sent */
+    uint32_t cost_ms;                   /* Set for each download: estimated time to send */
+    int frame_count;
+    mm_frame_t* frames;
+} mm_plan_table_t;
+
+typedef struct mm_plan {
+    struct mm_plan* next;
+    mm_table_cache_t* table_cache;
+    char terminal_id[11];
+    uint8_t terminal_type;
+    uint8_t rx_packet_gap;              /* Sent in DLOG_MT_INSTALL_PARAMS */
+    int table_count;
+    int table_max;
+    mm_plan_table_t* tables;
+} mm_plan_t;
+
+typedef struct mm_plan_cache mm_plan_cache_t;
+
+mm_plan_t* mm_plan_create(mm_table_cache_t* table_cache, const char* terminal_id, uint8_t terminal_type, uint8_t rx_packet_gap, int table_max);
+void mm_plan_free(mm_plan_t* plan);
+int mm_plan_add_table(mm_plan_t* plan, uint8_t table_id, uint8_t source);
+
+/*
+ * Frame data as the contents of table index, replacing any previous frames.
+ * The plan takes over the reference to image, which may be NULL.  With
+ * data NULL, the table is marked as having nothing to send.
+ */
+int mm_plan_set_table(mm_plan_t* plan, int index, const uint8_t* data, size_t len, const mm_table_image_t* image);
+
+mm_plan_cache_t* mm_plan_cache_create(void);
+void mm_plan_cache_destroy(mm_plan_cache_t* cache);
+
+/*
+ * Remove the plan for a terminal from the cache, or return NULL if there
+ * is none.  The caller owns the plan until it is put back.
+ */
+mm_plan_t* mm_plan_cache_take(mm_plan_cache_t* cache, const char* terminal_id, uint8_t terminal_type, uint8_t rx_packet_gap);
+void mm_plan_cache_put(mm_plan_cache_t* cache, mm_plan_t* plan);
+
+#endif  /* MM_PLAN_H_ */
@@ -16,6 +16,7 @@
 #include <string.h> /* String function definitions */
 #include <time.h>
 #include <stddef.h>
+#include <errno.h>
 #ifdef _WIN32
 # include <windows.h>
 #else  /* ifdef _WIN32 */
@@ -25,34 +26,37 @@
 #endif /* _WIN32 */
 
 #include "mm_manager.h"
+#include "mm_l2.h"
 #include "mm_serial.h"
-#include "mm_udp.h"
+#include "mm_timer.h"
+#include "mm_capture.h"
+#include "mm_replay.h"
 
 static pkt_status_t receive_mm_packet(mm_proto_t* proto, mm_packet_t* pkt);
+static void encode_mm_packet(mm_packet_t* pkt, const char* terminal_id, const uint8_t* payload, size_t len, uint8_t flags);
+static pkt_status_t transmit_mm_packet(mm_proto_t* proto, mm_packet_t* pkt);
 static pkt_status_t send_mm_packet(mm_proto_t* proto, uint8_t* payload, size_t len, uint8_t flags);
 static pkt_status_t wait_for_mm_ack(mm_proto_t* proto);
 static pkt_status_t send_mm_ack(mm_proto_t* proto, uint8_t flags);
 
 extern volatile int inject_comm_error;
 
-#define L2_STATE_SEARCH_FOR_START   1
-#define L2_STATE_GET_FLAGS          2
-#define L2_STATE_GET_LENGTH         3
-#define L2_STATE_ACCUMULATE_DATA    4
-#define L2_STATE_GET_CRC0           5
-#define L2_STATE_GET_CRC1           6
-#define L2_STATE_SEARCH_FOR_STOP    7
-
 
 int proto_connect(mm_proto_t* proto) {
     proto->tx_seq = 0;
     proto->connected = 1;
+    mm_deadline_start(&proto->session_deadline, PKT_SESSION_TIMEOUT_MS);
 
     return (0);
 }
 
 int proto_disconnect(mm_proto_t *proto) {
-    hangup_modem(proto->serial_context);
+    if (proto->async_hangup) {
+        hangup_modem_begin(proto->serial_context);
+        mm_deadline_start(&proto->hangup_deadline, MODEM_HANGUP_MS);
+    } else {
+        hangup_modem(proto->serial_context);
+    }
     proto->tx_seq = 0;
     proto->connected = 0;
 
@@ -136,6 +140,115 @@ int send_mm_table(mm_proto_t* proto, uint8_t* payload, size_t len) {
     return status;
 }
 
+/*
+ * Split a table into the packets that carry it, encoded for terminal_id.
+ * Returns the number of packets, allocated in *frames, or -ENOMEM.
+ */
+int frame_mm_table(const char* terminal_id, const uint8_t* payload, size_t len, mm_frame_t** frames) {
+    int frame_count = (int)((len + PKT_TABLE_DATA_LEN_MAX - 1) / PKT_TABLE_DATA_LEN_MAX);
+    mm_frame_t* frame;
+
+    *frames = (mm_frame_t*)calloc((size_t)frame_count, sizeof(mm_frame_t));
+
+    if (*frames == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %d packets.\n", __func__, frame_count);
+        return -ENOMEM;
+    }
+
+    for (frame = *frames; len > 0; frame++) {
+        size_t chunk_len = (len > PKT_TABLE_DATA_LEN_MAX) ? PKT_TABLE_DATA_LEN_MAX : len;
+        size_t crc_len;
+
+        encode_mm_packet(&frame->pkt, terminal_id, payload, chunk_len, 0);
+        crc_len = sizeof(frame->pkt.hdr) + (size_t)frame->pkt.payload_len;
+
+        for (uint8_t seq = 0; seq <= FLAG_SEQUENCE; seq++) {
+            frame->pkt.hdr.flags = seq;
+            frame->crc[seq] = LE16(crc16(0, &frame->pkt.hdr.start, crc_len));
+        }
+        frame->pkt.hdr.flags = 0;
+
+        payload += chunk_len;
+        len -= chunk_len;
+    }
+
+    return frame_count;
+}
+
+/* Send a table framed by frame_mm_table(), setting the sequence number of each packet. */
+int send_mm_table_frames(mm_proto_t* proto, const mm_frame_t* frames, int frame_count) {
+    pkt_status_t status = PKT_SUCCESS;
+    mm_packet_t pkt;
+    uint8_t table_id = frames[0].pkt.payload[PKT_TABLE_ID_OFFSET];
+    size_t  len = 0;
+    size_t  sent = 0;
+    int i;
+
+    for (i = 0; i < frame_count; i++) {
+        len += (size_t)frames[i].pkt.payload_len - PKT_TABLE_ID_OFFSET;
+    }
+
+    printf("\tSending Table ID %d (0x%02x) %s...\n", table_id, table_id, table_to_string(table_id));
+
+    for (i = 0; i < frame_count; i++) {
+        uint8_t seq = proto->tx_seq & FLAG_SEQUENCE;
+
+        pkt = frames[i].pkt;
+        pkt.hdr.flags |= seq;
+        pkt.trailer.crc = frames[i].crc[seq];
+
+        status = transmit_mm_packet(proto, &pkt);
+
+        if (status != PKT_SUCCESS) break;
+
+        sent += (size_t)pkt.payload_len - PKT_TABLE_ID_OFFSET;
+        printf("\tTable %d (0x%02x) %s progress: (%3d%%) - %4d / %4zu\n",
+            table_id, table_id, table_to_string(table_id),
+            (uint16_t)((sent * 100) / len), (uint16_t)sent, len);
+    }
+
+    return status;
+}
+
+/*
+ * Estimate the time to send a framed table, in ms.  Each packet costs its
+ * length in 10-bit characters at the line rate, plus the inter-packet gap
+ * on a modem.  The terminal ACKs each packet, then acknowledges the table
+ * with DLOG_MT_TABLE_UPD_ACK, which the manager ACKs in turn.  Data packets
+ * are scaled up by the fraction of packets this line has had to resend.
+ */
+uint32_t estimate_mm_table_ms(const mm_proto_t* proto, const mm_frame_t* frames, int frame_count) {
+    const uint64_t ack_len = sizeof(mm_packet_header_t) + sizeof(mm_packet_trailer_t);
+    const uint64_t table_ack_len = ack_len + PKT_TABLE_ID_OFFSET + 2;  /* DLOG_MT_TABLE_UPD_ACK, table ID */
+    uint64_t char_us = (10 * 1000000ULL) / (uint64_t)((proto->baudrate > 0) ? proto->baudrate : 1200);
+    uint64_t gap_us = proto->use_modem ? (uint64_t)proto->rx_packet_gap * 10000 : 0;
+    uint64_t data_us = 0;
+    uint64_t total_us;
+
+    if (frame_count == 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < frame_count; i++) {
+        data_us += ((uint64_t)frames[i].pkt.hdr.pktlen + 1) * char_us + gap_us;
+    }
+
+    /* Expected sends per packet are 1 / (1 - retry rate), at most 2. */
+    if ((proto->stats.tx_retries > 0) && (proto->stats.tx_retries * 2 < proto->stats.tx_packets)) {
+        data_us = data_us * proto->stats.tx_packets / (proto->stats.tx_packets - proto->stats.tx_retries);
+    } else if (proto->stats.tx_retries > 0) {
+        data_us *= 2;
+    }
+
+    total_us = data_us + (uint64_t)frame_count * (ack_len * char_us + gap_us);
+
+    if (frames[0].pkt.payload[PKT_TABLE_ID_OFFSET] != DLOG_MT_END_DATA) {
+        total_us += table_ack_len * char_us + ack_len * char_us + 2 * gap_us;
+    }
+
+    return (uint32_t)((total_us + 999) / 1000);
+}
+
 int wait_for_table_ack(mm_proto_t* proto, uint8_t table_id) {
     mm_packet_t  packet = { { 0 }, { 0 }, { 0 }, 0, 0 };
     mm_packet_t* pkt = &packet;
@@ -211,14 +324,14 @@ int wait_for_table_ack(mm_proto_t* proto, uint8_t table_id) {
  * +------+-------+--------+-----------+--------+-----+
  */
 static pkt_status_t receive_mm_packet(mm_proto_t *proto, mm_packet_t *pkt) {
-    uint8_t pkt_received = 0;
-    uint8_t databyte     = 0;
-    uint8_t l2_state     = L2_STATE_SEARCH_FOR_START;
+    mm_l2_parser_t parser;
     pkt_status_t status  = PKT_SUCCESS;
-    uint8_t timeout      = 0;
+    mm_deadline_t deadline;         /* For the whole packet */
+    mm_deadline_t byte_deadline;    /* For the next byte, once the packet has started */
 
     pkt->payload_len = 0;
     memset(pkt, 0, sizeof(mm_packet_t));
+    mm_l2_parser_reset(&parser);
 
     if (proto->monitor_carrier) {
         if ((serial_get_modem_status(proto->serial_context) & (MS_RING_ON | MS_RLSD_ON)) == 0) {
@@ -233,118 +346,122 @@ static pkt_status_t receive_mm_packet(mm_proto_t *proto, mm_packet_t *pkt) {
         return PKT_ERROR_DISCONNECT;
     }
 
-    while (pkt_received == 0) {
-        int inject_error = 0;
-        ssize_t bytes_read;
-        if (inject_comm_error == 1) {
-            if (((proto->error_inject_type == ERROR_INJECT_CRC_DLOG_RX) && (proto->waiting_for_ack == 0)) ||
-                ((proto->error_inject_type == ERROR_INJECT_CRC_ACK_RX)  && (proto->waiting_for_ack == 1))) {
-                inject_error = (l2_state == L2_STATE_GET_CRC0) ? 1 : 0;
-            }
-        }
-        if (inject_error == 1) {
-            printf("Inject error type %d: Injecting error on READ now.\n", proto->error_inject_type);
-            inject_comm_error = 0;
-        }
-        while ((bytes_read = read_serial(proto->serial_context, &databyte, 1, inject_error)) == 0) {
-            if (!proto->connected) {
-                return PKT_ERROR_DISCONNECT;
-            }
-            putchar('.');
-            if (proto->monitor_carrier) {
-                if ((serial_get_modem_status(proto->serial_context) & (MS_RING_ON | MS_RLSD_ON)) == 0) {
-                    fprintf(stderr, "%s: Carrier lost, bailing.\n", __func__);
-                    proto_disconnect(proto);
-                    return PKT_ERROR_NO_CARRIER;
-                }
-            }
+    mm_deadline_start(&deadline, proto->waiting_for_ack ? proto->ack_timeout_ms : PKT_TIMEOUT_MS);
+    mm_deadline_clear(&byte_deadline);
 
-            fflush(stdout);
-            timeout++;
+    for (;;) {
+        uint8_t* data;
+        size_t   count;
+        int      frame_done;
 
-            if (timeout > PKT_TIMEOUT_MAX) {
-                printf("%s: Timeout waiting for packet error.\n", __func__);
-                status = PKT_ERROR_TIMEOUT;
-                return status;
-            }
-        }
+        if (serial_rx_peek(proto->serial_context, &data) == 0) {
+            ssize_t bytes_read = 0;
 
-        if (bytes_read == MODEM_RSP_READ_ERROR) {
-            fprintf(stderr, "%s: Error reading from modem, bailing.\n", __func__);
-            proto_disconnect(proto);
-            return PKT_ERROR_FAILURE;
-        }
+            while (bytes_read == 0) {
+                int wait_ms;
+                int ready;
 
-        timeout = 0;
+                if (!proto->connected) {
+                    return PKT_ERROR_DISCONNECT;
+                }
 
-        switch (l2_state) {
-            case L2_STATE_SEARCH_FOR_START:
-                if (databyte == START_BYTE) {
-                    l2_state         = L2_STATE_GET_FLAGS;
-                    pkt->payload_len = 0;
-                    pkt->hdr.start   = databyte;
+                if (mm_deadline_expired(&proto->session_deadline)) {
+                    printf("%s: Call time limit reached, hanging up.\n", __func__);
+                    proto_disconnect(proto);
+                    return PKT_ERROR_DISCONNECT | PKT_ERROR_TIMEOUT;
                 }
-                break;
-            case L2_STATE_GET_FLAGS:
-                l2_state       = L2_STATE_GET_LENGTH;
-                pkt->hdr.flags = databyte;
-                break;
-            case L2_STATE_GET_LENGTH:
-                pkt->hdr.pktlen = databyte;
 
-                if (pkt->hdr.pktlen > 5) {
-                    l2_state = L2_STATE_ACCUMULATE_DATA;
-                } else {
-                    l2_state = L2_STATE_GET_CRC0;
+                if (mm_deadline_expired(&deadline) || mm_deadline_expired(&byte_deadline)) {
+                    printf("%s: Timeout waiting for packet error.\n", __func__);
+                    return PKT_ERROR_TIMEOUT;
                 }
-                break;
-            case L2_STATE_ACCUMULATE_DATA:
-                pkt->payload[pkt->payload_len] = databyte;
-                pkt->payload_len++;
 
-                if (pkt->payload_len == pkt->hdr.pktlen - 5) {
-                    l2_state = L2_STATE_GET_CRC0;
+                /* Wake at least once a second to check for carrier. */
+                wait_ms = mm_deadline_remaining_ms(&deadline, 1000);
+                wait_ms = mm_deadline_remaining_ms(&byte_deadline, wait_ms);
+                wait_ms = mm_deadline_remaining_ms(&proto->session_deadline, wait_ms);
+
+                ready = wait_serial(proto->serial_context, wait_ms);
+
+                if (ready > 0) {
+                    bytes_read = serial_rx_fill(proto->serial_context);
+#ifndef _WIN32
+                    /* Readable with nothing to read: the other end hung up. */
+                    if ((bytes_read == 0) && (proto->serial_context->replay == NULL)) {
+                        fprintf(stderr, "%s: Line hung up, bailing.\n", __func__);
+                        proto_disconnect(proto);
+                        return PKT_ERROR_DISCONNECT;
+                    }
+#endif /* _WIN32 */
+                } else if (ready < 0) {
+                    bytes_read = -1;
                 }
-                break;
-            case L2_STATE_GET_CRC0:
-                l2_state         = L2_STATE_GET_CRC1;
-                pkt->trailer.crc = databyte;
-                break;
-            case L2_STATE_GET_CRC1:
-                l2_state            = L2_STATE_SEARCH_FOR_STOP;
-
-                pkt->trailer.crc   |= (uint16_t)(databyte << 8);
-                pkt->trailer.crc    = LE16(pkt->trailer.crc);
-                pkt->calculated_crc = crc16(0, &pkt->hdr.start, 3);
-                pkt->calculated_crc = crc16(pkt->calculated_crc, pkt->payload, (size_t)pkt->payload_len);
-                pkt->calculated_crc = LE16(pkt->calculated_crc);
-
-                if (pkt->trailer.crc != pkt->calculated_crc) {
-                    printf("%s: CRC Error!\n", __func__);
-                    status |= PKT_ERROR_CRC;
+
+                if ((bytes_read == 0) && (wait_ms == 1000)) {
+                    putchar('.');
+                    fflush(stdout);
+
+                    if (proto->monitor_carrier) {
+                        if ((serial_get_modem_status(proto->serial_context) & (MS_RING_ON | MS_RLSD_ON)) == 0) {
+                            fprintf(stderr, "%s: Carrier lost, bailing.\n", __func__);
+                            proto_disconnect(proto);
+                            return PKT_ERROR_NO_CARRIER;
+                        }
+                    }
                 }
-                break;
-            case L2_STATE_SEARCH_FOR_STOP:
-                if (databyte == STOP_BYTE) {
-                    l2_state = L2_STATE_SEARCH_FOR_START;
-                } else {
-                    printf("%s: Framing Error!\n", __func__);
-                    status |= PKT_ERROR_FRAMING;
+            }
+
+            if (bytes_read < 0) {
+                fprintf(stderr, "%s: Error reading from modem, bailing.\n", __func__);
+                proto_disconnect(proto);
+                return PKT_ERROR_FAILURE;
+            }
+        }
+
+        count = serial_rx_peek(proto->serial_context, &data);
+
+        if (inject_comm_error == 1) {
+            if (((proto->error_inject_type == ERROR_INJECT_CRC_DLOG_RX) && (proto->waiting_for_ack == 0)) ||
+                ((proto->error_inject_type == ERROR_INJECT_CRC_ACK_RX)  && (proto->waiting_for_ack == 1))) {
+                if (parser.state == L2_STATE_GET_CRC0) {
+                    printf("Inject error type %d: Injecting error on READ now.\n", proto->error_inject_type);
+                    inject_comm_error = 0;
+                    /* Force an error by inverting the received CRC byte. */
+                    data[0] = ~data[0];
                 }
-                pkt->trailer.end = databyte;
-                pkt_received     = 1;
-                break;
+                count = 1;  /* Step until the CRC is reached. */
+            }
+        }
+
+        serial_rx_consume(proto->serial_context, mm_l2_parser_feed(&parser, pkt, data, count, &frame_done));
+
+        if (frame_done) break;
+
+        /* Line noise between packets doesn't extend the wait; a packet that stalls part way times out sooner. */
+        if (parser.state != L2_STATE_SEARCH_FOR_START) {
+            mm_deadline_start(&byte_deadline, PKT_BYTE_TIMEOUT_MS);
         }
     }
 
-    /* Copy the packet trailer (CRC-16, STOP) immediately following the data */
-    memcpy(&(pkt->payload[pkt->payload_len]), &pkt->trailer, sizeof(pkt->trailer));
+    if (parser.status & PKT_ERROR_CRC) {
+        printf("%s: CRC Error!\n", __func__);
+    }
+
+    if (parser.status & PKT_ERROR_FRAMING) {
+        printf("%s: Framing Error!\n", __func__);
+    }
+
+    status |= parser.status;
 
-    mm_add_pcap_rec(proto->pcapstream, RX, pkt, 0, 0);
-    if (proto->send_udp) {
-        mm_udp_send_pkt(RX, pkt);
+    if (parser.status & (PKT_ERROR_CRC | PKT_ERROR_FRAMING)) {
+        proto->stats.rx_errors++;
+    } else if ((status == PKT_SUCCESS) && (pkt->payload_len != 0)) {
+        proto->stats.rx_packets++;
     }
 
+    mm_capture_frame(proto->capture, proto->capture_line, proto->terminal_id, RX, pkt);
+    mm_replay_frame(proto->serial_context->replay, RX, &pkt->hdr.start, (size_t)pkt->hdr.pktlen + 1);
+
     if (pkt->hdr.flags & FLAG_RETRY) {
         if (proto->debuglevel > 0) print_mm_packet(RX, pkt);
         status |= PKT_ERROR_RETRY;
@@ -370,130 +487,125 @@ static pkt_status_t receive_mm_packet(mm_proto_t *proto, mm_packet_t *pkt) {
     return status;
 }
 
-/* Send manager packet to the terminal.
- *
- * If payload is NULL, an ACK packet will be sent.
- * If payload is not NULL, and the length is 0, a NULL packet will be sent.
- * If payload is not NULL, and length is > 0, then the terminal's phone number
- * will be prepended to the payload and sent.
+/* Encode a packet: header, BCD terminal ID and payload, then CRC and STOP_BYTE. */
+static void encode_mm_packet(mm_packet_t* pkt, const char* terminal_id, const uint8_t* payload, size_t len, uint8_t flags) {
+    memset(pkt, 0, sizeof(mm_packet_t));
+    pkt->hdr.start = START_BYTE;
+    pkt->hdr.flags = flags;
+
+    if (payload != NULL) {
+        pkt->payload_len = (uint8_t)len + PKT_TABLE_ID_OFFSET; /* add room for the phone number. */
+
+        for (int i = 0; i < PKT_TABLE_ID_OFFSET; i++) {
+            pkt->payload[i] = (terminal_id[i * 2] - '0') << 4;
+            pkt->payload[i] |= (terminal_id[i * 2 + 1] - '0');
+        }
+
+        if (len > 0) {
+            memcpy(&pkt->payload[PKT_TABLE_ID_OFFSET], payload, len);
+        }
+    }
+
+    pkt->hdr.pktlen = pkt->payload_len + 5;
+    /* The payload immediately follows the header, so one pass covers both. */
+    pkt->trailer.crc = crc16(0, &pkt->hdr.start, sizeof(pkt->hdr) + (size_t)pkt->payload_len);
+    pkt->trailer.crc = LE16(pkt->trailer.crc);
+    pkt->trailer.end = STOP_BYTE;
+    pkt->calculated_crc = pkt->trailer.crc;
+
+    /* Copy the CRC and STOP_BYTE to be adjacent to the filled portion of the payload */
+    memcpy(&(pkt->payload[pkt->payload_len]), &pkt->trailer.crc, 3);
+}
+
+/* Send an encoded packet, and for data packets, wait for the ACK, retrying on NACK.
  *
  * Returns PKT_SUCCESS on success, otherwise PKT_ERROR_ code flags.
  */
-static pkt_status_t send_mm_packet(mm_proto_t* proto, uint8_t* payload, size_t len, uint8_t flags) {
-    mm_packet_t pkt;
+static pkt_status_t transmit_mm_packet(mm_proto_t* proto, mm_packet_t* pkt) {
     pkt_status_t status = PKT_SUCCESS;
+    uint16_t crc = pkt->trailer.crc;
+    uint64_t sent_ms;
     int retries;
 
-    for (retries = 0; retries < PKT_MAX_RETRIES; retries++) {
+    for (retries = 0; retries < proto->max_retries; retries++) {
         /* Bail out if not connected. */
         if (!proto->connected) {
             return PKT_ERROR_DISCONNECT;
         }
 
         if (proto->debuglevel > 3) {
-            if (payload != NULL) {
+            if (pkt->payload_len != 0) {
                 printf("T<--M Sending packet: Terminal: %s, tx_seq=%d\n", proto->terminal_id, proto->tx_seq);
             }
             else {
-                printf("T<--M Sending %s: rx_seq=%d\n", (flags & FLAG_ACK) ? "ACK" : "NACK", proto->rx_seq);
+                printf("T<--M Sending %s: rx_seq=%d\n", (pkt->hdr.flags & FLAG_ACK) ? "ACK" : "NACK", proto->rx_seq);
             }
         }
 
-        /* Insert Tx packet delay when using a modem, in 10ms increments. */
+        /* Insert Tx packet delay when using a modem, in 10ms increments, after the last packet has gone out. */
         if (proto->use_modem) {
-#ifdef _WIN32
-            Sleep(proto->rx_packet_gap * 10);
-#else  /* ifdef _WIN32 */
-            struct timespec tim;
-            tim.tv_sec = 0;
-            tim.tv_nsec = proto->rx_packet_gap * 10000000L;
-            nanosleep(&tim, NULL);
-#endif /* _WIN32 */
+            drain_serial(proto->serial_context);
+            serial_delay(proto->serial_context, proto->rx_packet_gap * 10);
         }
 
-        memset(&pkt, 0, sizeof(pkt));
-        pkt.hdr.start = START_BYTE;
-
-        if (payload != NULL) {
-            /* Flags for regular TX packet use tx_seq. */
-            pkt.hdr.flags = (proto->tx_seq & FLAG_SEQUENCE);
-            pkt.payload_len = (uint8_t)len + PKT_TABLE_ID_OFFSET; /* add room for the phone number. */
-
-            for (int i = 0; i < PKT_TABLE_ID_OFFSET; i++) {
-                pkt.payload[i] = (proto->terminal_id[i * 2] - '0') << 4;
-                pkt.payload[i] |= (proto->terminal_id[i * 2 + 1] - '0');
-            }
-
-            if (len > 0) {
-                memcpy(&pkt.payload[PKT_TABLE_ID_OFFSET], payload, len);
-            }
-        } else {
-            pkt.payload_len = 0;
-
-            /* If payload is NULL, send an ACK packet instead, using rx_seq. */
-            pkt.hdr.flags = flags | (proto->rx_seq & FLAG_SEQUENCE);
-        }
-
-        if (flags & FLAG_RETRY) {
-            pkt.hdr.flags |= FLAG_RETRY;
-        }
-
-        pkt.hdr.pktlen = pkt.payload_len + 5;
-        pkt.trailer.crc = crc16(0, &pkt.hdr.start, 3);
-        pkt.trailer.crc = crc16(pkt.trailer.crc, pkt.payload, (size_t)(pkt.payload_len));
-        pkt.trailer.crc = LE16(pkt.trailer.crc);
+        pkt->trailer.crc = crc;
         if (inject_comm_error == 1) {
-            if (((proto->error_inject_type == ERROR_INJECT_CRC_DLOG_TX) && (pkt.payload_len != 0)) ||
-                ((proto->error_inject_type == ERROR_INJECT_CRC_ACK_TX) && (pkt.payload_len == 0))) {
+            if (((proto->error_inject_type == ERROR_INJECT_CRC_DLOG_TX) && (pkt->payload_len != 0)) ||
+                ((proto->error_inject_type == ERROR_INJECT_CRC_ACK_TX) && (pkt->payload_len == 0))) {
                 printf("Injecting %s (Correct CRC=0x%02x).\n",
                     error_inject_type_to_str(proto->error_inject_type),
-                    pkt.trailer.crc);
+                    pkt->trailer.crc);
                 inject_comm_error = 0;
-                pkt.trailer.crc = ~pkt.trailer.crc;
+                pkt->trailer.crc = ~pkt->trailer.crc;
             }
         }
-        pkt.trailer.end = STOP_BYTE;
-        pkt.calculated_crc = pkt.trailer.crc;
+        pkt->calculated_crc = pkt->trailer.crc;
+        memcpy(&(pkt->payload[pkt->payload_len]), &pkt->trailer.crc, sizeof(pkt->trailer.crc));
 
-        /* Copy the CRC and STOP_BYTE to be adjacent to the filled portion of the payload */
-        memcpy(&(pkt.payload[pkt.payload_len]), &pkt.trailer.crc, 3);
-
-        mm_add_pcap_rec(proto->pcapstream, TX, &pkt, 0, 0);
-        if (proto->send_udp) {
-            mm_udp_send_pkt(TX, &pkt);
-        }
+        mm_capture_frame(proto->capture, proto->capture_line, proto->terminal_id, TX, pkt);
+        mm_replay_frame(proto->serial_context->replay, TX, &pkt->hdr.start, (size_t)pkt->hdr.pktlen + 1);
 
         if (proto->debuglevel > 0) {
-            print_mm_packet(TX, &pkt);
+            print_mm_packet(TX, pkt);
         }
 
         if (proto->debuglevel > 3) {
             printf("\nRaw Packet transmitted: ");
-            dump_hex(&pkt.hdr.start, (size_t)pkt.hdr.pktlen + 1);
+            dump_hex(&pkt->hdr.start, (size_t)pkt->hdr.pktlen + 1);
         }
 
-        write_serial(proto->serial_context, &pkt, (size_t)pkt.hdr.pktlen + 1);
-        drain_serial(proto->serial_context);
+        write_serial(proto->serial_context, pkt, (size_t)pkt->hdr.pktlen + 1);
 
         /* Don't wait for ACK if sending an ACK. */
-        if (payload == NULL) {
+        if (pkt->payload_len == 0) {
             break;
         }
 
+        /* Time the ACK from the end of the packet. */
+        drain_serial(proto->serial_context);
+
+        proto->stats.tx_packets++;
+        if (retries > 0) {
+            proto->stats.tx_retries++;
+        }
+
+        sent_ms = mm_clock_ms();
         status = wait_for_mm_ack(proto);
         if (status == PKT_SUCCESS) {
+            proto->stats.ack_count++;
+            proto->stats.ack_ms += (uint32_t)(mm_clock_ms() - sent_ms);
             break;
         }
 
         printf("%s: Received NACK, retrying %d.\n", __func__, retries);
     }
 
-    if (retries == PKT_MAX_RETRIES) {
+    if (retries == proto->max_retries) {
         printf("%s: Error: Gave up after %d retries.\n", __func__, retries);
         status |= PKT_ERROR_FAILURE;
     }
 
-    if (payload != NULL) {
+    if (pkt->payload_len != 0) {
         proto->tx_seq++;
     } else {
         proto->rx_seq++;
@@ -501,6 +613,36 @@ static pkt_status_t send_mm_packet(mm_proto_t* proto, uint8_t* payload, size_t l
     return status;
 }
 
+/* Send manager packet to the terminal.
+ *
+ * If payload is NULL, an ACK packet will be sent.
+ * If payload is not NULL, and the length is 0, a NULL packet will be sent.
+ * If payload is not NULL, and length is > 0, then the terminal's phone number
+ * will be prepended to the payload and sent.
+ *
+ * Returns PKT_SUCCESS on success, otherwise PKT_ERROR_ code flags.
+ */
+static pkt_status_t send_mm_packet(mm_proto_t* proto, uint8_t* payload, size_t len, uint8_t flags) {
+    mm_packet_t pkt;
+    uint8_t hdr_flags;
+
+    if (payload != NULL) {
+        /* Flags for regular TX packet use tx_seq. */
+        hdr_flags = (proto->tx_seq & FLAG_SEQUENCE);
+    } else {
+        /* If payload is NULL, send an ACK packet instead, using rx_seq. */
+        hdr_flags = flags | (proto->rx_seq & FLAG_SEQUENCE);
+    }
+
+    if (flags & FLAG_RETRY) {
+        hdr_flags |= FLAG_RETRY;
+    }
+
+    encode_mm_packet(&pkt, proto->terminal_id, payload, len, hdr_flags);
+
+    return transmit_mm_packet(proto, &pkt);
+}
+
 static pkt_status_t send_mm_ack(mm_proto_t *proto, uint8_t flags) {
     return send_mm_packet(proto, NULL, 0, flags);
 }
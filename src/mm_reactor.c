@@ -0,0 +1,449 @@
+/*
+ * Serial line reactor, part of mm_manager.
+ *
+ * A single thread waits on all idle lines for modem responses.  When a
+ * terminal connects, the line is removed from the wait set and its call
+ * is run by a session worker.  When the call ends the worker wakes the
+ * reactor through a pipe.
+ *
+ * A worker that hangs up only drops DTR.  The reactor raises it again
+ * MODEM_HANGUP_MS later and watches the line for the modem's OK, so no
+ * thread sleeps through a hangup and the line takes calls again as soon
+ * as the modem is ready.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mm_reactor.h"
+
+#ifdef MM_HAVE_REACTOR
+
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+# include <sys/epoll.h>
+#else  /* ifdef __linux__ */
+# include <poll.h>
+#endif /* __linux__ */
+
+#include "mm_serial.h"
+#include "mm_thread.h"
+#include "mm_timer.h"
+
+extern int manager_running;
+
+#define REACTOR_LINE_IDLE       0   /* Waiting for RING/CONNECT */
+#define REACTOR_LINE_IN_CALL    1   /* Owned by a session worker */
+#define REACTOR_LINE_FAILED     2   /* Line can no longer be used */
+#define REACTOR_LINE_HANGUP     3   /* DTR held low after a call */
+#define REACTOR_LINE_REARM      4   /* DTR raised, waiting for the modem's OK */
+
+#define REACTOR_REARM_TRIES     3
+
+#define REACTOR_WAKE_ID         MM_MAX_LINES
+
+typedef struct mm_reactor mm_reactor_t;
+
+typedef struct mm_reactor_line {
+    mm_reactor_t* reactor;
+    mm_context_t* context;
+    int fd;
+    int state;
+    mm_thread_t session_thread;
+    mm_deadline_t rearm_deadline;
+    int rearm_tries;
+    char response[255];
+    uint8_t response_len;
+} mm_reactor_line_t;
+
+struct mm_reactor {
+    mm_manager_t* manager;
+    mm_session_func_t session;
+    int wake_fd[2];
+#ifdef __linux__
+    int epoll_fd;
+#endif /* __linux__ */
+    mm_reactor_line_t lines[MM_MAX_LINES];
+};
+
+/* Add or remove a line from the set of descriptors being waited on. */
+static int reactor_watch(mm_reactor_t* reactor, int id, int fd, int enable) {
+#ifdef __linux__
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)id;
+
+    if (epoll_ctl(reactor->epoll_fd, enable ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &ev) != 0) {
+        fprintf(stderr, "%s: epoll_ctl() failed: %s\n", __func__, strerror(errno));
+        return -errno;
+    }
+#else  /* ifdef __linux__ */
+    /* The poll() set is rebuilt from the line states on every pass. */
+    (void)reactor;
+    (void)id;
+    (void)fd;
+    (void)enable;
+#endif /* __linux__ */
+    return 0;
+}
+
+/* Lines in these states are read by the reactor. */
+static int reactor_line_watched(int state) {
+    return (state == REACTOR_LINE_IDLE) || (state == REACTOR_LINE_REARM);
+}
+
+static void reactor_set_state(mm_reactor_line_t* line, int state) {
+    int watched = reactor_line_watched(line->state);
+
+    line->state = state;
+
+    if (reactor_line_watched(state) == watched) {
+        return;
+    }
+
+    if ((reactor_watch(line->reactor, line->context->connection.line, line->fd, !watched) != 0) && !watched) {
+        line->state = REACTOR_LINE_FAILED;
+    }
+}
+
+static void reactor_line_failed(mm_reactor_line_t* line) {
+    reactor_set_state(line, REACTOR_LINE_FAILED);
+}
+
+/* Wait for a call, or for the hangup started on the line to finish. */
+static void reactor_line_idle(mm_reactor_line_t* line) {
+    if (mm_deadline_armed(&line->context->connection.proto.hangup_deadline)) {
+        reactor_set_state(line, REACTOR_LINE_HANGUP);
+    } else {
+        reactor_set_state(line, REACTOR_LINE_IDLE);
+    }
+}
+
+/* Raise DTR and ask the modem for an OK. */
+static void reactor_line_rearm(mm_reactor_line_t* line) {
+    mm_connection_t* connection = &line->context->connection;
+
+    mm_deadline_clear(&connection->proto.hangup_deadline);
+    line->response_len = 0;
+    line->rearm_tries++;
+
+    if (hangup_modem_end(connection->proto.serial_context) != 0) {
+        mm_connection_modem_event(connection, MODEM_RSP_READ_ERROR);
+        reactor_line_failed(line);
+        return;
+    }
+
+    mm_deadline_start(&line->rearm_deadline, MODEM_REARM_MS);
+    reactor_set_state(line, REACTOR_LINE_REARM);
+}
+
+static void* reactor_session_thread(void* arg) {
+    mm_reactor_line_t* line = (mm_reactor_line_t*)arg;
+    uint8_t id = (uint8_t)line->context->connection.line;
+
+    line->reactor->session(line->context);
+
+    /* Hand the line back to the reactor. */
+    if (write(line->reactor->wake_fd[1], &id, 1) != 1) {
+        fprintf(stderr, "%s: Failed to wake reactor: %s\n", __func__, strerror(errno));
+    }
+
+    return NULL;
+}
+
+/*
+ * A call runs on a worker, not on the reactor.  The session is written as
+ * blocking code: it reads frames with timeouts, waits for the accounting
+ * writer to commit before ACKing, and reads table files.  On the reactor
+ * thread any of these would stall every other line, so only idle lines
+ * are multiplexed until the session is rewritten as a state machine.
+ */
+static void reactor_start_session(mm_reactor_line_t* line) {
+    reactor_set_state(line, REACTOR_LINE_IN_CALL);
+
+    if (mm_thread_create(&line->session_thread, reactor_session_thread, line) != 0) {
+        fprintf(stderr, "%s: Line %d: Unable to start session.\n", __func__, line->context->connection.line);
+        proto_disconnect(&line->context->connection.proto);
+        reactor_line_idle(line);
+    }
+}
+
+static void reactor_end_session(mm_reactor_line_t* line) {
+    mm_thread_join(line->session_thread);
+
+    line->response_len = 0;
+    reactor_line_idle(line);
+}
+
+/* Consume modem responses that have arrived on an idle line. */
+static void reactor_line_readable(mm_reactor_line_t* line) {
+    mm_connection_t* connection = &line->context->connection;
+
+    while (reactor_line_watched(line->state)) {
+        ssize_t bytes_read;
+        char    c;
+        int     modem_response;
+
+        /* One byte at a time from the line's buffer, so bytes following CONNECT are left there for the session. */
+        bytes_read = read_serial_nowait(connection->proto.serial_context, &c, 1);
+
+        if (bytes_read == 0) {
+            break;
+        }
+
+        if (bytes_read < 0) {
+            mm_connection_modem_event(connection, MODEM_RSP_READ_ERROR);
+            reactor_line_failed(line);
+            break;
+        }
+
+        line->response[line->response_len++] = c;
+        line->response[line->response_len] = '\0';
+
+        if ((c != '\n') && (c != '\r') && (line->response_len < sizeof(line->response) - 1)) {
+            continue;
+        }
+
+        modem_response = modem_response_from_string(line->response);
+        line->response_len = 0;
+
+        if (modem_response == MODEM_RSP_NULL) {
+            continue;
+        }
+
+        if ((line->state == REACTOR_LINE_REARM) && (modem_response == MODEM_RSP_OK)) {
+            reactor_set_state(line, REACTOR_LINE_IDLE);
+            continue;
+        }
+
+        if (mm_connection_modem_event(connection, modem_response) > 0) {
+            reactor_start_session(line);
+        } else {
+            /* NO CARRIER hangs up. */
+            reactor_line_idle(line);
+        }
+    }
+}
+
+/* Advance hangups whose time is up. */
+static void reactor_timers(mm_reactor_t* reactor) {
+    for (int i = 0; i < reactor->manager->line_count; i++) {
+        mm_reactor_line_t* line = &reactor->lines[i];
+
+        if ((line->state == REACTOR_LINE_HANGUP) && mm_deadline_expired(&line->context->connection.proto.hangup_deadline)) {
+            line->rearm_tries = 0;
+            reactor_line_rearm(line);
+        } else if ((line->state == REACTOR_LINE_REARM) && mm_deadline_expired(&line->rearm_deadline)) {
+            if (line->rearm_tries < REACTOR_REARM_TRIES) {
+                reactor_line_rearm(line);
+            } else {
+                /* Take calls anyway, as before hangups were checked. */
+                fprintf(stderr, "%s: Line %d: No response from modem after hangup.\n", __func__, line->context->connection.line);
+                reactor_set_state(line, REACTOR_LINE_IDLE);
+            }
+        }
+    }
+}
+
+/* Time until the next hangup step is due, but no more than max_ms. */
+static int reactor_timeout_ms(mm_reactor_t* reactor, int max_ms) {
+    int timeout_ms = max_ms;
+
+    for (int i = 0; i < reactor->manager->line_count; i++) {
+        mm_reactor_line_t* line = &reactor->lines[i];
+
+        if (line->state == REACTOR_LINE_HANGUP) {
+            timeout_ms = mm_deadline_remaining_ms(&line->context->connection.proto.hangup_deadline, timeout_ms);
+        } else if (line->state == REACTOR_LINE_REARM) {
+            timeout_ms = mm_deadline_remaining_ms(&line->rearm_deadline, timeout_ms);
+        }
+    }
+
+    return timeout_ms;
+}
+
+static void reactor_wakeup(mm_reactor_t* reactor) {
+    uint8_t ids[MM_MAX_LINES];
+    ssize_t count;
+
+    while ((count = read(reactor->wake_fd[0], ids, sizeof(ids))) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            if (ids[i] < MM_MAX_LINES) {
+                reactor_end_session(&reactor->lines[ids[i]]);
+            }
+        }
+    }
+}
+
+/* Wait up to timeout_ms for events, then dispatch them. */
+static int reactor_poll(mm_reactor_t* reactor, int timeout_ms) {
+#ifdef __linux__
+    struct epoll_event events[MM_MAX_LINES + 1];
+    int count;
+
+    count = epoll_wait(reactor->epoll_fd, events, MM_MAX_LINES + 1, timeout_ms);
+
+    if (count < 0) {
+        return (errno == EINTR) ? 0 : -errno;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (events[i].data.u32 == REACTOR_WAKE_ID) {
+            reactor_wakeup(reactor);
+        } else {
+            mm_reactor_line_t* line = &reactor->lines[events[i].data.u32];
+
+            if (!reactor_line_watched(line->state)) continue;
+
+            reactor_line_readable(line);
+
+            /* Hangup once pending input is drained: the device is gone. */
+            if (reactor_line_watched(line->state) && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                mm_connection_modem_event(&line->context->connection, MODEM_RSP_READ_ERROR);
+                reactor_line_failed(line);
+            }
+        }
+    }
+#else  /* ifdef __linux__ */
+    struct pollfd pfds[MM_MAX_LINES + 1];
+    int ids[MM_MAX_LINES + 1];
+    int nfds = 0;
+    int count;
+
+    pfds[nfds].fd = reactor->wake_fd[0];
+    pfds[nfds].events = POLLIN;
+    ids[nfds++] = REACTOR_WAKE_ID;
+
+    for (int i = 0; i < reactor->manager->line_count; i++) {
+        if (!reactor_line_watched(reactor->lines[i].state)) continue;
+        pfds[nfds].fd = reactor->lines[i].fd;
+        pfds[nfds].events = POLLIN;
+        ids[nfds++] = i;
+    }
+
+    count = poll(pfds, nfds, timeout_ms);
+
+    if (count < 0) {
+        return (errno == EINTR) ? 0 : -errno;
+    }
+
+    for (int i = 0; (i < nfds) && (count > 0); i++) {
+        if (pfds[i].revents == 0) continue;
+        count--;
+
+        if (ids[i] == REACTOR_WAKE_ID) {
+            reactor_wakeup(reactor);
+        } else {
+            mm_reactor_line_t* line = &reactor->lines[ids[i]];
+
+            if (!reactor_line_watched(line->state)) continue;
+
+            reactor_line_readable(line);
+
+            if (reactor_line_watched(line->state) && (pfds[i].revents & (POLLHUP | POLLERR | POLLNVAL))) {
+                mm_connection_modem_event(&line->context->connection, MODEM_RSP_READ_ERROR);
+                reactor_line_failed(line);
+            }
+        }
+    }
+#endif /* __linux__ */
+    return 0;
+}
+
+/*
+ * Serve all lines of the manager until shutdown, or until every line has failed.
+ */
+int mm_reactor_run(mm_manager_t* manager, mm_session_func_t session) {
+    mm_reactor_t* reactor;
+    int status = 0;
+    int line;
+
+    reactor = (mm_reactor_t*)calloc(1, sizeof(mm_reactor_t));
+
+    if (reactor == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_reactor_t));
+        return -ENOMEM;
+    }
+
+    reactor->manager = manager;
+    reactor->session = session;
+
+    if (pipe(reactor->wake_fd) != 0) {
+        fprintf(stderr, "%s: pipe() failed: %s\n", __func__, strerror(errno));
+        free(reactor);
+        return -errno;
+    }
+    fcntl(reactor->wake_fd[0], F_SETFL, O_NONBLOCK);
+
+#ifdef __linux__
+    if ((reactor->epoll_fd = epoll_create1(0)) < 0) {
+        fprintf(stderr, "%s: epoll_create1() failed: %s\n", __func__, strerror(errno));
+        close(reactor->wake_fd[0]);
+        close(reactor->wake_fd[1]);
+        free(reactor);
+        return -errno;
+    }
+    reactor_watch(reactor, REACTOR_WAKE_ID, reactor->wake_fd[0], 1);
+#endif /* __linux__ */
+
+    for (line = 0; line < manager->line_count; line++) {
+        mm_reactor_line_t* pline = &reactor->lines[line];
+
+        pline->reactor = reactor;
+        pline->context = manager->lines[line];
+        pline->fd = pline->context->connection.proto.serial_context->fd;
+        pline->state = REACTOR_LINE_IDLE;
+        pline->context->connection.proto.async_hangup = 1;
+
+        if (reactor_watch(reactor, line, pline->fd, 1) != 0) {
+            pline->state = REACTOR_LINE_FAILED;
+        }
+
+        if (manager->line_count > 1) {
+            printf("Line %d: Waiting for call from terminal...\n", line);
+        } else {
+            printf("Waiting for call from terminal...\n");
+        }
+    }
+
+    while (manager_running && (status == 0)) {
+        int lines_in_service = 0;
+
+        for (line = 0; line < manager->line_count; line++) {
+            if (reactor->lines[line].state != REACTOR_LINE_FAILED) lines_in_service++;
+        }
+
+        if (lines_in_service == 0) break;
+
+        status = reactor_poll(reactor, reactor_timeout_ms(reactor, 1000));
+        reactor_timers(reactor);
+    }
+
+    /* Let calls in progress finish. */
+    for (line = 0; line < manager->line_count; line++) {
+        if (reactor->lines[line].state == REACTOR_LINE_IN_CALL) {
+            mm_thread_join(reactor->lines[line].session_thread);
+        }
+    }
+
+#ifdef __linux__
+    close(reactor->epoll_fd);
+#endif /* __linux__ */
+    close(reactor->wake_fd[0]);
+    close(reactor->wake_fd[1]);
+    free(reactor);
+
+    return status;
+}
+
+#endif /* MM_HAVE_REACTOR */
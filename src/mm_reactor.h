@@ -0,0 +1,29 @@
+/*
+ * Serial line reactor, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_REACTOR_H_
+#define MM_REACTOR_H_
+
+#include "mm_manager.h"
+
+/*
+ * The reactor watches every idle line from a single thread (epoll on
+ * Linux, poll() on other POSIX systems) and hands a line to a session
+ * worker once its modem reports CONNECT.  Win32 serial handles cannot
+ * be polled, so there each line keeps its own thread.
+ */
+#ifndef _WIN32
+#define MM_HAVE_REACTOR
+#endif /* _WIN32 */
+
+/* Runs one call on a connected line, returning when the terminal has disconnected. */
+typedef void (*mm_session_func_t)(mm_context_t* context);
+
+int mm_reactor_run(mm_manager_t* manager, mm_session_func_t session);
+
+#endif  /* MM_REACTOR_H_ */
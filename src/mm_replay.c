@@ -0,0 +1,423 @@
+/*
+ * Test mode replay of recorded sessions, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm_manager.h"
+#include "mm_dlog.h"
+#include "mm_pcap.h"
+#include "mm_replay.h"
+#include "mm_thread.h"
+
+#define REPLAY_READ_SIZE    65536
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAPNG_MAGIC        0x0a0d0d0a
+
+/* Modem responses supplied when replaying a capture. */
+static const char replay_modem_ok[] = "\r\nOK\r\n";
+static const char replay_modem_connect[] = "\r\nRING\r\n\r\nCONNECT 1200\r\n";
+
+/* A block of data received from the terminal, as it was read from the line. */
+typedef struct mm_replay_block {
+    uint64_t wall_us;       /* Time received, in us since 1970, UTC, or 0 if not known. */
+    size_t off;             /* ...in rx[] */
+    size_t len;
+} mm_replay_block_t;
+
+struct mm_replay {
+    char* input;
+    uint8_t* rx;            /* Received data, all blocks together */
+    size_t rx_len;
+    size_t rx_size;
+    mm_replay_block_t* blocks;
+    size_t block_count;
+    size_t block_size;
+    size_t block;           /* Block being read */
+    size_t pos;             /* ...and the next byte in it */
+    uint64_t clock_us;      /* Time the block was received */
+    int bytewise;           /* Text logs: hand out one byte per read, as the log was read before. */
+    uint32_t rx_frames;
+    uint32_t tx_frames;
+    uint8_t* tx;            /* Frames sent, each preceded by its length (2 bytes, little-endian) */
+    size_t tx_len;
+    size_t tx_size;
+};
+
+/*
+ * The replay whose clock mm_time() returns: the one this thread read last.
+ * mm_time() has no line to go by, so a line's replay must be read on one
+ * thread, and lines sharing a thread must take turns by whole sessions,
+ * as test mode does in replaying one line after another.
+ */
+static MM_THREAD_LOCAL const mm_replay_t* replay_current;
+
+/* Make room for need elements of elem_size bytes in *buf. */
+static int replay_grow(void** buf, size_t* size, size_t need, size_t elem_size) {
+    size_t new_size = (*size != 0) ? *size : 64;
+    void*  new_buf;
+
+    if (need <= *size) {
+        return 0;
+    }
+
+    while (new_size < need) {
+        new_size *= 2;
+    }
+
+    if ((new_buf = realloc(*buf, new_size * elem_size)) == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, new_size * elem_size);
+        return -ENOMEM;
+    }
+
+    *buf = new_buf;
+    *size = new_size;
+    return 0;
+}
+
+static int replay_add(mm_replay_t* replay, uint64_t wall_us, const void* data, size_t len) {
+    mm_replay_block_t* block;
+
+    if ((replay_grow((void**)&replay->rx, &replay->rx_size, replay->rx_len + len, 1) != 0) ||
+        (replay_grow((void**)&replay->blocks, &replay->block_size, replay->block_count + 1, sizeof(mm_replay_block_t)) != 0)) {
+        return -ENOMEM;
+    }
+
+    block = &replay->blocks[replay->block_count++];
+    block->wall_us = wall_us;
+    block->off = replay->rx_len;
+    block->len = len;
+
+    memcpy(&replay->rx[replay->rx_len], data, len);
+    replay->rx_len += len;
+    return 0;
+}
+
+static int replay_load_dlog(mm_replay_t* replay, const uint8_t* buf, size_t len, const mm_dlog_hdr_t* hdr) {
+    mm_dlog_chunk_t chunk;
+    size_t off = MM_DLOG_HDR_LEN;
+    int    status;
+
+    if (hdr->version != MM_DLOG_VERSION) {
+        fprintf(stderr, "%s: Unsupported log version %u.\n", __func__, hdr->version);
+        return -EINVAL;
+    }
+
+    while ((status = mm_dlog_parse(buf, len, &off, &chunk)) > 0) {
+        if ((chunk.direction == 'R') && (chunk.len > 0) &&
+            (replay_add(replay, mm_dlog_wall_us(hdr, &chunk), chunk.data, chunk.len) != 0)) {
+            return -ENOMEM;
+        }
+    }
+
+    if (status < 0) {
+        fprintf(stderr, "%s: '%s' is damaged after %zu bytes, replaying what comes before.\n", __func__, replay->input, off);
+    }
+
+    return 0;
+}
+
+/* A text log, read as fgets() into an 80 byte buffer would. */
+static int replay_load_text(mm_replay_t* replay, const uint8_t* buf, size_t len) {
+    size_t off = 0;
+
+    replay->bytewise = 1;
+
+    while (off < len) {
+        char   text[80];
+        char*  bytep;
+        size_t n = 0;
+        unsigned int filebyte;
+
+        while ((off < len) && (n < sizeof(text) - 1)) {
+            text[n++] = (char)buf[off++];
+            if (text[n - 1] == '\n') break;
+        }
+        text[n] = '\0';
+
+        /* Data that came from the Millennium Terminal. */
+        if ((bytep = strstr(text, "RX: ")) == NULL) {
+            continue;
+        }
+
+        if (sscanf(bytep, "RX: %x", &filebyte) != 1) {
+            fprintf(stderr, "%s: Error parsing '%s'\n", __func__, replay->input);
+            continue;
+        }
+
+        if (replay_grow((void**)&replay->rx, &replay->rx_size, replay->rx_len + 1, 1) != 0) {
+            return -ENOMEM;
+        }
+        replay->rx[replay->rx_len++] = filebyte & 0xFF;
+    }
+
+    /* No timestamps, so the received data is a single block. */
+    if (replay->rx_len > 0) {
+        if (replay_grow((void**)&replay->blocks, &replay->block_size, 1, sizeof(mm_replay_block_t)) != 0) {
+            return -ENOMEM;
+        }
+        replay->blocks[0].wall_us = 0;
+        replay->blocks[0].off = 0;
+        replay->blocks[0].len = replay->rx_len;
+        replay->block_count = 1;
+    }
+
+    return 0;
+}
+
+/* A capture written by -p: the top bit of the start byte is set in frames sent by the manager. */
+static int replay_load_pcap(mm_replay_t* replay, const uint8_t* buf, size_t len) {
+    mm_pcap_hdr_t pcap_hdr;
+    size_t off = sizeof(mm_pcap_hdr_t);
+    int    in_call = 0;
+
+    memcpy(&pcap_hdr, buf, sizeof(pcap_hdr));
+
+    if (pcap_hdr.network != LINKTYPE_USER0) {
+        fprintf(stderr, "%s: '%s' is not a Millennium capture.\n", __func__, replay->input);
+        return -EINVAL;
+    }
+
+    while (len - off >= sizeof(mm_pcaprec_hdr_t)) {
+        mm_pcaprec_hdr_t rec;
+        const uint8_t*   data = &buf[off + sizeof(mm_pcaprec_hdr_t)];
+        uint64_t wall_us;
+
+        memcpy(&rec, &buf[off], sizeof(rec));
+        off += sizeof(rec);
+
+        if (rec.incl_len > len - off) {
+            fprintf(stderr, "%s: '%s' is damaged after %zu bytes, replaying what comes before.\n", __func__, replay->input, off);
+            break;
+        }
+        off += rec.incl_len;
+
+        if (rec.incl_len < 2) {
+            continue;
+        }
+
+        wall_us = (uint64_t)rec.ts_sec * 1000000 + rec.ts_usec;
+
+        /* The modem answered the initialization commands before the first frame. */
+        if ((replay->block_count == 0) &&
+            ((replay_add(replay, wall_us, replay_modem_ok, strlen(replay_modem_ok)) != 0) ||
+             (replay_add(replay, wall_us, replay_modem_ok, strlen(replay_modem_ok)) != 0))) {
+            return -ENOMEM;
+        }
+
+        if ((data[0] & 0x80) == 0) {
+            if (!in_call && (replay_add(replay, wall_us, replay_modem_connect, strlen(replay_modem_connect)) != 0)) {
+                return -ENOMEM;
+            }
+            in_call = 1;
+
+            if (replay_add(replay, wall_us, data, rec.incl_len) != 0) {
+                return -ENOMEM;
+            }
+        }
+
+        if (data[1] & FLAG_DISCONNECT) {
+            in_call = 0;
+        }
+    }
+
+    return 0;
+}
+
+/* Read the whole of filename into memory. */
+static uint8_t* replay_read_file(const char* filename, size_t* len) {
+    FILE*    stream;
+    uint8_t* buf = NULL;
+    size_t   size = 0;
+    size_t   count;
+
+    *len = 0;
+
+    if ((stream = fopen(filename, "rb")) == NULL) {
+        fprintf(stderr, "Error opening input stream: %s\n", filename);
+        return NULL;
+    }
+
+    do {
+        if (replay_grow((void**)&buf, &size, *len + REPLAY_READ_SIZE, 1) != 0) {
+            free(buf);
+            fclose(stream);
+            return NULL;
+        }
+        count = fread(&buf[*len], 1, REPLAY_READ_SIZE, stream);
+        *len += count;
+    } while (count == REPLAY_READ_SIZE);
+
+    if (ferror(stream)) {
+        fprintf(stderr, "%s: Error reading '%s'.\n", __func__, filename);
+        free(buf);
+        buf = NULL;
+    }
+
+    fclose(stream);
+    return buf;
+}
+
+mm_replay_t* mm_replay_open(const char* filename) {
+    mm_replay_t*  replay;
+    mm_dlog_hdr_t hdr;
+    uint8_t* buf;
+    size_t   len;
+    uint32_t magic = 0;
+    int      status;
+
+    if ((buf = replay_read_file(filename, &len)) == NULL) {
+        return NULL;
+    }
+
+    replay = (mm_replay_t*)calloc(1, sizeof(mm_replay_t));
+
+    if ((replay == NULL) || ((replay->input = (char*)malloc(strlen(filename) + 1)) == NULL)) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_replay_t));
+        free(replay);
+        free(buf);
+        return NULL;
+    }
+    memcpy(replay->input, filename, strlen(filename) + 1);
+
+    if (len >= sizeof(magic)) {
+        memcpy(&magic, buf, sizeof(magic));
+    }
+
+    if (mm_dlog_parse_header(buf, len, &hdr)) {
+        status = replay_load_dlog(replay, buf, len, &hdr);
+    } else if ((magic == PCAP_MAGIC) && (len >= sizeof(mm_pcap_hdr_t))) {
+        status = replay_load_pcap(replay, buf, len);
+    } else if (magic == PCAPNG_MAGIC) {
+        fprintf(stderr, "%s: '%s' is a pcapng capture; only .pcap captures can be replayed.\n", __func__, filename);
+        status = -EINVAL;
+    } else {
+        status = replay_load_text(replay, buf, len);
+    }
+
+    free(buf);
+
+    if (status != 0) {
+        mm_replay_close(replay);
+        return NULL;
+    }
+
+    return replay;
+}
+
+void mm_replay_close(mm_replay_t* replay) {
+    if (replay == NULL) {
+        return;
+    }
+
+    if (replay_current == replay) {
+        replay_current = NULL;
+    }
+
+    free(replay->input);
+    free(replay->rx);
+    free(replay->blocks);
+    free(replay->tx);
+    free(replay);
+}
+
+ssize_t mm_replay_read(mm_replay_t* replay, uint8_t* buf, size_t count) {
+    replay_current = replay;
+
+    while (replay->block < replay->block_count) {
+        const mm_replay_block_t* block = &replay->blocks[replay->block];
+
+        if (replay->pos < block->len) {
+            size_t len = replay->bytewise ? 1 : block->len - replay->pos;
+
+            if (replay->pos == 0) {
+                replay->clock_us = block->wall_us;
+            }
+
+            if (len > count) {
+                len = count;
+            }
+
+            memcpy(buf, &replay->rx[block->off + replay->pos], len);
+            replay->pos += len;
+            return (ssize_t)len;
+        }
+
+        replay->block++;
+        replay->pos = 0;
+    }
+
+    /* End of this line's test input; report a read error so only this line shuts down. */
+    printf("%s: Terminating due to EOF.\n", __func__);
+    fflush(stdout);
+    return -1;
+}
+
+void mm_replay_frame(mm_replay_t* replay, int direction, const uint8_t* data, size_t len) {
+    if (replay == NULL) {
+        return;
+    }
+
+    if (direction == RX) {
+        replay->rx_frames++;
+        return;
+    }
+
+    if (replay_grow((void**)&replay->tx, &replay->tx_size, replay->tx_len + 2 + len, 1) != 0) {
+        return;
+    }
+
+    replay->tx[replay->tx_len] = (uint8_t)len;
+    replay->tx[replay->tx_len + 1] = (uint8_t)(len >> 8);
+    memcpy(&replay->tx[replay->tx_len + 2], data, len);
+    replay->tx_len += 2 + len;
+    replay->tx_frames++;
+}
+
+time_t mm_replay_time(void) {
+    return (replay_current != NULL) ? (time_t)(replay_current->clock_us / 1000000) : 0;
+}
+
+int mm_replay_write_result(FILE* stream, const mm_replay_t* replay, int line, int indent) {
+    static const char hex[] = "0123456789abcdef";
+    size_t off = 0;
+
+    fprintf(stream, "%*s{\n%*s  \"line\": %d,\n%*s  \"input\": \"", indent, "", indent, "", line, indent, "");
+
+    for (const char* p = replay->input; *p != '\0'; p++) {
+        if ((*p == '"') || (*p == '\\')) {
+            fputc('\\', stream);
+        }
+        fputc(*p, stream);
+    }
+
+    fprintf(stream, "\",\n%*s  \"rx_frames\": %u,\n%*s  \"tx_frames\": [", indent, "", replay->rx_frames, indent, "");
+
+    while (off < replay->tx_len) {
+        size_t len = replay->tx[off] | ((size_t)replay->tx[off + 1] << 8);
+
+        fprintf(stream, "%s\n%*s    \"", (off == 0) ? "" : ",", indent, "");
+        for (size_t i = 0; i < len; i++) {
+            fputc(hex[replay->tx[off + 2 + i] >> 4], stream);
+            fputc(hex[replay->tx[off + 2 + i] & 0x0F], stream);
+        }
+        fputc('"', stream);
+        off += 2 + len;
+    }
+
+    if (replay->tx_len > 0) {
+        fprintf(stream, "\n%*s  ", indent, "");
+    }
+    fprintf(stream, "]\n%*s}", indent, "");
+
+    return ferror(stream) ? -EIO : 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Test mode replay of recorded sessions, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_REPLAY_H_
+#define MM_REPLAY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mm_serial.h"
+
+/*
+ * In test mode each line reads its input from a recorded session: a text
+ * log (-l), a binary log (-L) or a .pcap capture (-p).  The whole file is
+ * loaded when the line is opened, and the data received from the terminal
+ * is handed out from memory, so replay never waits on the disk.
+ *
+ * A capture has no modem responses in it, so the replay supplies them:
+ * an OK for each modem initialization command, and a RING and CONNECT
+ * before each call.  A call ends with a disconnect from either side.
+ *
+ * Binary logs and captures carry timestamps.  As each block of data is
+ * handed out, the replay clock is set to the time it was received, and
+ * mm_time() returns that instead of the time of day, so records written
+ * during the replay carry the times of the original session.
+ *
+ * The frames the manager sends are collected, to be compared against
+ * a previous run with mm_replay_write_result().
+ */
+typedef struct mm_replay mm_replay_t;
+
+mm_replay_t* mm_replay_open(const char* filename);
+void mm_replay_close(mm_replay_t* replay);
+
+/* Read the next block of received data, up to count bytes.  Returns -1 at the end of the session. */
+ssize_t mm_replay_read(mm_replay_t* replay, uint8_t* buf, size_t count);
+
+/* Note a frame received from (RX) or sent to (TX) the terminal; sent frames are kept. */
+void mm_replay_frame(mm_replay_t* replay, int direction, const uint8_t* data, size_t len);
+
+/*
+ * The clock of the replay last read on this thread, or 0 if its data has
+ * no timestamps.  Each line must be replayed on a single thread.
+ */
+time_t mm_replay_time(void);
+
+/* Write a JSON object giving the line's input and the frames it sent, indented by indent spaces. */
+int mm_replay_write_result(FILE* stream, const mm_replay_t* replay, int line, int indent);
+
+#endif  /* MM_REPLAY_H_ */
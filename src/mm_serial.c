@@ -13,17 +13,19 @@
 #include <string.h> /* String function definitions */
 
 #include "mm_serial.h"
+#include "mm_replay.h"
+#include "mm_timer.h"
 
 /*
  * Open serial port specified in modem_dev.
  *
  * Returns the file descriptor on success or -1 on error.
  */
-mm_serial_context_t* open_serial(const char *modem_dev, FILE *logstream, FILE *bytestream) {
+mm_serial_context_t* open_serial(const char *modem_dev, FILE *logstream, mm_dlog_writer_t *dlog, struct mm_replay *replay) {
     int fd = -1;
     mm_serial_context_t *pserial_context;
 
-    if (bytestream == NULL) {
+    if (replay == NULL) {
         fd = platform_open_serial(modem_dev);
     }
 
@@ -36,7 +38,8 @@ mm_serial_context_t* open_serial(const char *modem_dev, FILE *logstream, FILE *b
 
     pserial_context->fd = fd;
     pserial_context->logstream  = logstream;
-    pserial_context->bytestream = bytestream;
+    pserial_context->dlog       = dlog;
+    pserial_context->replay     = replay;
 
     return pserial_context;
 }
@@ -55,97 +58,228 @@ int close_serial(mm_serial_context_t *pserial_context) {
 int init_serial(mm_serial_context_t *pserial_context, int baudrate) {
     int status = 0;
 
-    if (pserial_context->bytestream == NULL) {
+    if (pserial_context->replay == NULL) {
         status = platform_init_serial(pserial_context->fd, baudrate);
     }
 
     return status;
 }
 
-ssize_t read_serial(mm_serial_context_t *pserial_context, void *buf, size_t count, int inject_error) {
-    ssize_t bytes_read = -1;
-
-    if (pserial_context->bytestream == NULL) {
-        bytes_read = platform_read_serial(pserial_context->fd, buf, count);
-        if (inject_error) {
-            printf("Invert RX data\n");
-            /* Force an error by inverting the recevied data */
-            ((uint8_t *)buf)[0] = ~((uint8_t*)buf)[0];
+#define SERIAL_RX_RING_MASK     (SERIAL_RX_RING_SIZE - 1)
+
+/*
+ * Log data to the binary log, and as one "UART: RX: XX" line per byte to
+ * the text log, in a single write.  Test mode reads back either one.
+ */
+static void serial_log(mm_serial_context_t *pserial_context, char dir, const uint8_t *buf, size_t count) {
+    static const char hex[] = "0123456789ABCDEF";
+    char   text[64 * 14];
+    size_t len = 0;
+
+    if (pserial_context->dlog != NULL) {
+        mm_dlog_write(pserial_context->dlog, dir, buf, count);
+    }
+
+    if (pserial_context->logstream == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        memcpy(&text[len], "UART: RX: ", 10);
+        text[len + 6] = dir;
+        text[len + 10] = hex[buf[i] >> 4];
+        text[len + 11] = hex[buf[i] & 0x0F];
+        text[len + 12] = '\n';
+        len += 13;
+
+        if ((len + 13 > sizeof(text)) || (i == count - 1)) {
+            fwrite(text, 1, len, pserial_context->logstream);
+            len = 0;
         }
     }
-    else {
-        for (size_t i = 0; i < count; i++) {
-            if (feof(pserial_context->bytestream)) {
-                printf("%s: Terminating due to EOF.\n", __func__);
-                fflush(stdout);
-                fclose(pserial_context->bytestream);
-                exit(0);
-            }
-            else {
-                char* bytep;
-                char testbuf[80];
-
-                if (fgets(testbuf, 80, pserial_context->bytestream) == NULL) {
-                    break;
-                }
-
-                /* Data that came from the Millennium Terminal. */
-                if ((bytep = strstr(testbuf, "RX: ")) != NULL) {
-                    uint32_t filebyte;
-                    if (sscanf(bytep, "RX: %x", &filebyte) != 1) {
-                        fprintf(stderr, "%s: Error parsing bytestream\n", __func__);
-                    }
-                    ((uint8_t*)buf)[i] = filebyte & 0xFF;;
-                }
-            }
+}
+
+/*
+ * Read whatever has arrived into the receive ring, without waiting.
+ *
+ * Returns the number of bytes added (0 if none are available or the ring
+ * is full) or -1 on error.
+ */
+ssize_t serial_rx_fill(mm_serial_context_t *pserial_context) {
+    size_t  used = (uint16_t)(pserial_context->rx_tail - pserial_context->rx_head);
+    size_t  offset = pserial_context->rx_tail & SERIAL_RX_RING_MASK;
+    size_t  room = SERIAL_RX_RING_SIZE - offset;
+    ssize_t bytes_read;
+
+    if (used == SERIAL_RX_RING_SIZE) {
+        return 0;
+    }
+
+    /* One read, up to the end of the ring or the unread data, whichever comes first. */
+    if (room > SERIAL_RX_RING_SIZE - used) {
+        room = SERIAL_RX_RING_SIZE - used;
+    }
+
+    if (pserial_context->replay != NULL) {
+        bytes_read = mm_replay_read(pserial_context->replay, &pserial_context->rx_ring[offset], room);
+    } else {
+        bytes_read = platform_read_serial_nowait(pserial_context->fd, &pserial_context->rx_ring[offset], room);
+    }
+
+    if (bytes_read > 0) {
+        if ((pserial_context->logstream != NULL) || (pserial_context->dlog != NULL)) {
+            serial_log(pserial_context, 'R', &pserial_context->rx_ring[offset], (size_t)bytes_read);
+        }
+        pserial_context->rx_tail += (uint16_t)bytes_read;
+    }
+
+    return bytes_read;
+}
+
+/* Point data at the unread bytes, returning how many can be read there in one piece. */
+size_t serial_rx_peek(mm_serial_context_t *pserial_context, uint8_t **data) {
+    size_t count = (uint16_t)(pserial_context->rx_tail - pserial_context->rx_head);
+    size_t offset = pserial_context->rx_head & SERIAL_RX_RING_MASK;
+
+    if (count > SERIAL_RX_RING_SIZE - offset) {
+        count = SERIAL_RX_RING_SIZE - offset;
+    }
+
+    *data = &pserial_context->rx_ring[offset];
+    return count;
+}
+
+void serial_rx_consume(mm_serial_context_t *pserial_context, size_t count) {
+    pserial_context->rx_head += (uint16_t)count;
+}
+
+/* Copy up to count unread bytes out of the ring. */
+static size_t serial_rx_take(mm_serial_context_t *pserial_context, uint8_t *buf, size_t count) {
+    size_t taken = 0;
+
+    while (taken < count) {
+        uint8_t *data;
+        size_t   len = serial_rx_peek(pserial_context, &data);
+
+        if (len == 0) {
+            break;
+        }
+        if (len > count - taken) {
+            len = count - taken;
         }
-        bytes_read = count;
+        memcpy(&buf[taken], data, len);
+        serial_rx_consume(pserial_context, len);
+        taken += len;
     }
 
-    if (pserial_context->logstream != NULL) {
-        for (size_t i = 0; i < count; i++) {
-            fprintf(pserial_context->logstream, "UART: RX: %02X\n", ((uint8_t*)buf)[i]);
+    return taken;
+}
+
+/* Wait up to one second for data. */
+ssize_t read_serial(mm_serial_context_t *pserial_context, void *buf, size_t count, int inject_error) {
+    ssize_t bytes_read;
+
+    if (pserial_context->rx_head == pserial_context->rx_tail) {
+        if (pserial_context->replay == NULL) {
+            int status = platform_wait_serial(pserial_context->fd, 1000);
+
+            if (status <= 0) {
+                return status;
+            }
+        }
+
+        if ((bytes_read = serial_rx_fill(pserial_context)) <= 0) {
+            return bytes_read;
         }
     }
+
+    bytes_read = (ssize_t)serial_rx_take(pserial_context, (uint8_t *)buf, count);
+
+    if (inject_error) {
+        printf("Invert RX data\n");
+        /* Force an error by inverting the recevied data */
+        ((uint8_t *)buf)[0] = ~((uint8_t*)buf)[0];
+    }
     return bytes_read;
 }
 
+/*
+ * Read whatever is already available, without waiting.
+ *
+ * Returns the number of bytes read (0 if none are available) or -1 on error.
+ */
+ssize_t read_serial_nowait(mm_serial_context_t *pserial_context, void *buf, size_t count) {
+    if (pserial_context->rx_head == pserial_context->rx_tail) {
+        ssize_t bytes_read = serial_rx_fill(pserial_context);
+
+        if (bytes_read <= 0) {
+            return bytes_read;
+        }
+    }
+
+    return (ssize_t)serial_rx_take(pserial_context, (uint8_t *)buf, count);
+}
+
+/*
+ * Wait up to timeout_ms for received data.
+ *
+ * Returns > 0 if data is available, 0 on timeout, or -1 on error.
+ */
+int wait_serial(mm_serial_context_t *pserial_context, int timeout_ms) {
+    if ((pserial_context->replay != NULL) || (pserial_context->rx_head != pserial_context->rx_tail)) {
+        return 1;
+    }
+
+    return platform_wait_serial(pserial_context->fd, timeout_ms);
+}
+
+/* Write all of buf in one go, leaving it to drain_serial() to wait until it has been sent. */
 ssize_t write_serial(mm_serial_context_t *pserial_context, const void *buf, size_t count) {
     ssize_t bytes_written = count;
 
-    if (pserial_context->logstream != NULL) {
-        for (size_t i = 0; i < count; i++) {
-            fprintf(pserial_context->logstream, "UART: TX: %02X\n", ((uint8_t*)buf)[i]);
-        }
+    if ((pserial_context->logstream != NULL) || (pserial_context->dlog != NULL)) {
+        serial_log(pserial_context, 'T', (const uint8_t *)buf, count);
     }
 
     /* If we are using a serial port, send the data */
-    if (pserial_context->bytestream == NULL) {
+    if (pserial_context->replay == NULL) {
         bytes_written = platform_write_serial(pserial_context->fd, buf, count);
+        pserial_context->tx_pending = 1;
     }
 
     return bytes_written;
 }
 
+/* Wait until written data has been sent.  Nothing to wait for costs no system call. */
 int drain_serial(mm_serial_context_t *pserial_context) {
     int status = -1;
-    if (pserial_context->bytestream == NULL) {
-        status = platform_drain_serial(pserial_context->fd);
+    if (pserial_context->replay == NULL) {
+        status = 0;
+        if (pserial_context->tx_pending) {
+            status = platform_drain_serial(pserial_context->fd);
+            pserial_context->tx_pending = 0;
+        }
     }
     return status;
 }
 
+/* Discard data not yet read or sent.  This is also where a call's binary log is written out. */
 int flush_serial(mm_serial_context_t *pserial_context) {
     int status = -1;
-    if (pserial_context->bytestream == NULL) {
+
+    pserial_context->rx_head = pserial_context->rx_tail;
+    mm_dlog_flush(pserial_context->dlog);
+
+    if (pserial_context->replay == NULL) {
         status = platform_flush_serial(pserial_context->fd);
+        pserial_context->tx_pending = 0;
     }
     return status;
 }
 
 int serial_set_dtr(mm_serial_context_t *pserial_context, int set) {
     int status = -1;
-    if (pserial_context->bytestream == NULL) {
+    if (pserial_context->replay == NULL) {
         status = platform_serial_set_dtr(pserial_context->fd, set);
     }
     return status;
@@ -153,8 +287,15 @@ int serial_set_dtr(mm_serial_context_t *pserial_context, int set) {
 
 int serial_get_modem_status(mm_serial_context_t* pserial_context) {
     int status = -1;
-    if (pserial_context->bytestream == NULL) {
+    if (pserial_context->replay == NULL) {
         status = platform_serial_get_modem_status(pserial_context->fd);
     }
     return status;
 }
+
+/* Give the modem time to act.  A replayed session has nothing to wait for. */
+void serial_delay(mm_serial_context_t* pserial_context, uint32_t ms) {
+    if (pserial_context->replay == NULL) {
+        mm_sleep_ms(ms);
+    }
+}
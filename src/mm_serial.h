@@ -18,26 +18,50 @@ typedef SSIZE_T ssize_t;
 #define MS_RLSD_ON      0x0080
 #endif /* if defined(_MSC_VER) */
 
+#include <stdint.h>
+
+#include "mm_dlog.h"
+
+#define SERIAL_RX_RING_SIZE     1024    /* Power of two */
+
+/*
+ * Received data is read in blocks into a ring buffer, and handed out from
+ * there, so the modem and protocol code can consume it a byte at a time
+ * without a system call for each byte.
+ */
 typedef struct mm_serial_context {
     int fd;
     FILE *logstream;
-    FILE *bytestream;
+    mm_dlog_writer_t *dlog;         /* Binary log, or NULL */
+    struct mm_replay *replay;       /* Test mode input, instead of a serial port */
+    uint8_t tx_pending;     /* Written data may not have been sent yet. */
+    uint16_t rx_head;       /* Unread: rx_ring[rx_head..rx_tail), both modulo SERIAL_RX_RING_SIZE */
+    uint16_t rx_tail;
+    uint8_t rx_ring[SERIAL_RX_RING_SIZE];
 } mm_serial_context_t;
 
-mm_serial_context_t* open_serial(const char *modem_dev, FILE *logstream, FILE *bytestream);
+mm_serial_context_t* open_serial(const char *modem_dev, FILE *logstream, mm_dlog_writer_t *dlog, struct mm_replay *replay);
 extern int init_serial(mm_serial_context_t *pserial_context, int baudrate);
 extern int close_serial(mm_serial_context_t *pserial_context);
 ssize_t    read_serial(mm_serial_context_t *pserial_context, void *buf, size_t count, int inject_error);
+ssize_t    read_serial_nowait(mm_serial_context_t *pserial_context, void *buf, size_t count);
+int        wait_serial(mm_serial_context_t *pserial_context, int timeout_ms);
+ssize_t    serial_rx_fill(mm_serial_context_t *pserial_context);
+size_t     serial_rx_peek(mm_serial_context_t *pserial_context, uint8_t **data);
+void       serial_rx_consume(mm_serial_context_t *pserial_context, size_t count);
 ssize_t    write_serial(mm_serial_context_t *pserial_context, const void *buf, size_t count);
 int        drain_serial(mm_serial_context_t *pserial_context);
 int        flush_serial(mm_serial_context_t *pserial_context);
 int        serial_set_dtr(mm_serial_context_t* pserial_context, int set);
 int        serial_get_modem_status(mm_serial_context_t* pserial_context);
+void       serial_delay(mm_serial_context_t* pserial_context, uint32_t ms);
 
 extern int platform_open_serial(const char *modem_dev);
 extern int platform_init_serial(int fd, int baudrate);
 extern int platform_close_serial(int fd);
 ssize_t    platform_read_serial(int fd, void *buf, size_t count);
+ssize_t    platform_read_serial_nowait(int fd, void *buf, size_t count);
+int        platform_wait_serial(int fd, int timeout_ms);
 ssize_t    platform_write_serial(int fd, const void *buf, size_t count);
 int        platform_drain_serial(int fd);
 int        platform_flush_serial(int fd);
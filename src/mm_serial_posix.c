@@ -14,11 +14,15 @@
 #include <errno.h>  /* Error number definitions */
 #include <termios.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 
 /*
  * Open serial port specified in modem_dev.
  *
+ * The descriptor is left non-blocking so it can be multiplexed; blocking
+ * reads wait for data with poll() instead.
+ *
  * Returns the file descriptor on success or -1 on error.
  */
 int platform_open_serial(const char *modem_dev) {
@@ -27,7 +31,7 @@ int platform_open_serial(const char *modem_dev) {
     fd = open(modem_dev, O_RDWR | O_NOCTTY | O_NDELAY | O_SYNC);
 
     if (fd != -1) {
-        if (fcntl(fd, F_SETFL, 0) != 0) {
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
             close(fd);
             return -1;
         }
@@ -102,12 +106,71 @@ int platform_close_serial(int fd) {
     return close(fd);
 }
 
+ssize_t platform_read_serial_nowait(int fd, void *buf, size_t count) {
+    ssize_t bytes_read = read(fd, buf, count);
+
+    if ((bytes_read < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+        return 0;
+    }
+
+    return bytes_read;
+}
+
+int platform_wait_serial(int fd, int timeout_ms) {
+    struct pollfd pfd;
+    int status;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    status = poll(&pfd, 1, timeout_ms);
+
+    if ((status < 0) && (errno == EINTR)) {
+        return 0;
+    }
+
+    return status;
+}
+
+/* Wait up to one second for data, like a blocking read with VTIME=10. */
 ssize_t platform_read_serial(int fd, void *buf, size_t count) {
-    return read(fd, buf, count);
+    int status = platform_wait_serial(fd, 1000);
+
+    if (status <= 0) {
+        return status;
+    }
+
+    return platform_read_serial_nowait(fd, buf, count);
 }
 
 ssize_t platform_write_serial(int fd, const void *buf, size_t count) {
-    return write(fd, buf, count);
+    const uint8_t *p = (const uint8_t *)buf;
+    size_t remaining = count;
+
+    /* The descriptor is non-blocking, so wait for room in the output queue as needed. */
+    while (remaining > 0) {
+        ssize_t bytes_written = write(fd, p, remaining);
+
+        if (bytes_written < 0) {
+            struct pollfd pfd;
+
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                return -1;
+            }
+
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            poll(&pfd, 1, 1000);
+            continue;
+        }
+
+        p += bytes_written;
+        remaining -= (size_t)bytes_written;
+    }
+
+    return (ssize_t)count;
 }
 
 int platform_drain_serial(int fd) {
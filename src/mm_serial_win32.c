@@ -12,25 +12,43 @@
 
 typedef SSIZE_T ssize_t;
 
-static HANDLE hHandleTable[10] = { 0 };
+#define MAX_SERIAL_HANDLES  32
+
+static HANDLE hHandleTable[MAX_SERIAL_HANDLES] = { 0 };
 
 int platform_open_serial(const char *modem_dev) {
     HANDLE hComm;
-    int    fd = 0; /* FIXME: only one serial connection allowed. */
+    int    fd;
 
-    hComm = CreateFileA(modem_dev, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    /* Find a free slot, one per open line. */
+    for (fd = 0; fd < MAX_SERIAL_HANDLES; fd++) {
+        if (hHandleTable[fd] == NULL) break;
+    }
 
-    hHandleTable[0] = hComm;
+    if (fd == MAX_SERIAL_HANDLES) {
+        return -1;
+    }
+
+    hComm = CreateFileA(modem_dev, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
 
     if (hComm == INVALID_HANDLE_VALUE) {
         return -1;
     }
 
+    hHandleTable[fd] = hComm;
+
     return fd;
 }
 
 int platform_close_serial(int fd) {
-    HANDLE hComm = hHandleTable[fd];
+    HANDLE hComm;
+
+    if ((fd < 0) || (fd >= MAX_SERIAL_HANDLES)) {
+        return -1;
+    }
+
+    hComm = hHandleTable[fd];
+    hHandleTable[fd] = NULL;
 
     return CloseHandle(hComm);
 }
@@ -92,6 +110,17 @@ ssize_t platform_read_serial(int fd, void *buf, size_t count) {
     return (ssize_t)bytes_read;
 }
 
+/* Reads are bounded by the COMMTIMEOUTS set in platform_init_serial(). */
+ssize_t platform_read_serial_nowait(int fd, void *buf, size_t count) {
+    return platform_read_serial(fd, buf, count);
+}
+
+int platform_wait_serial(int fd, int timeout_ms) {
+    (void)fd;
+    (void)timeout_ms;
+    return 1;
+}
+
 ssize_t platform_write_serial(int fd, const void *buf, size_t count) {
     HANDLE   hComm         = hHandleTable[fd];
     uint32_t bytes_written = 0;
@@ -11,33 +11,271 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <errno.h>
 
 #include "mm_manager.h"
+#include "mm_thread.h"
 
 #define AUTO_INCREMENT "AUTOINCREMENT"
 
-int mm_sql_exec(void *db, const char *sql) {
+#define MM_SQL_STMT_CACHE_SIZE  32
+
+/* MM_DB_PROFILE_WAL settings */
+#define MM_SQL_WAL_CACHE_KB             8192                /* Page cache, per connection */
+#define MM_SQL_WAL_MMAP_SIZE            (64 * 1024 * 1024)  /* Bytes of the database to memory-map */
+#define MM_SQL_WAL_BUSY_TIMEOUT_MS      5000                /* Wait for report queries holding a lock */
+#define MM_SQL_CHECKPOINT_INTERVAL_MS   30000
+
+/* Database handle passed around as void *db. */
+typedef struct mm_db {
+    sqlite3* sqlite;
+    mm_mutex_t stmt_lock;   /* Cached statements may only be used by one thread at a time. */
+    mm_mutex_t txn_lock;    /* Held from BEGIN to COMMIT: one transaction at a time, and no other writes. */
+    int stmt_count;
+    struct {
+        const char* sql;    /* Statement text; identified by address, so must be a constant. */
+        sqlite3_stmt* stmt;
+    } stmt_cache[MM_SQL_STMT_CACHE_SIZE];
+    /* WAL checkpointing, on its own connection so it never holds up the manager. */
+    sqlite3* checkpoint_sqlite;
+    mm_thread_t checkpoint_thread;
+    mm_mutex_t checkpoint_lock;
+    mm_cond_t checkpoint_stop;
+    int checkpoint_running;
+} mm_db_t;
+
+#define SQLITE_DB(db) (((mm_db_t *)(db))->sqlite)
+
+/* The database whose transaction this thread has open, if any. */
+static MM_THREAD_LOCAL mm_db_t* txn_db;
+
+/*
+ * Writes made outside a transaction wait for the open one to end,
+ * so they are never committed, or rolled back, along with it.
+ * Returns nonzero if txn_lock was taken.
+ */
+static int mm_sql_write_lock(mm_db_t* mm_db) {
+    if (txn_db == mm_db) {
+        return 0;
+    }
+
+    mm_mutex_lock(&mm_db->txn_lock);
+    return 1;
+}
+
+static void mm_sql_write_unlock(mm_db_t* mm_db, int locked) {
+    if (locked) {
+        mm_mutex_unlock(&mm_db->txn_lock);
+    }
+}
+
+static int mm_sql_run(void *db, const char *sql) {
     int rc;
 
 //    printf("SQL:\n%s\n", sql);
-    rc = sqlite3_exec((sqlite3 *)db, sql, NULL, 0, NULL);
+    rc = sqlite3_exec(SQLITE_DB(db), sql, NULL, 0, NULL);
 
     if (rc != SQLITE_OK && rc != SQLITE_CONSTRAINT) {
-        fprintf(stderr, "%s: Failed to execute: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg((sqlite3 *)db));
+        fprintf(stderr, "%s: Failed to execute: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg(SQLITE_DB(db)));
+        return -1;
+    }
+
+    return 0;
+}
+
+int mm_sql_exec(void *db, const char *sql) {
+    int locked = mm_sql_write_lock((mm_db_t*)db);
+    int status = mm_sql_run(db, sql);
+
+    mm_sql_write_unlock((mm_db_t*)db, locked);
+
+    return status;
+}
+
+/* Return the cached statement for sql, preparing it on first use.  Called with stmt_lock held. */
+static sqlite3_stmt* mm_sql_get_stmt(mm_db_t* mm_db, const char* sql, int* cached) {
+    sqlite3_stmt* stmt = NULL;
+    int i;
+
+    for (i = 0; i < mm_db->stmt_count; i++) {
+        if (mm_db->stmt_cache[i].sql == sql) {
+            *cached = 1;
+            return mm_db->stmt_cache[i].stmt;
+        }
+    }
+
+    if (sqlite3_prepare_v3(mm_db->sqlite, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s\n", __func__, sql, sqlite3_errmsg(mm_db->sqlite));
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
+
+    *cached = 0;
+    if (mm_db->stmt_count < MM_SQL_STMT_CACHE_SIZE) {
+        mm_db->stmt_cache[mm_db->stmt_count].sql = sql;
+        mm_db->stmt_cache[mm_db->stmt_count].stmt = stmt;
+        mm_db->stmt_count++;
+        *cached = 1;
+    }
+
+    return stmt;
+}
+
+/*
+ * Execute a statement with bound parameters, caching the prepared
+ * statement for the next call with the same sql.
+ *
+ * types has one character per parameter:
+ *   'i' int, 'I' int64_t, 'd' double, 's' NUL-terminated string,
+ *   'S' string and length (const void *, int).
+ *
+ * Returns 0 on success, or -1 on failure.
+ */
+int mm_sql_exec_stmt(void *db, const char *sql, const char *types, ...) {
+    mm_db_t* mm_db = (mm_db_t*)db;
+    sqlite3_stmt* stmt;
+    va_list args;
+    int cached;
+    int locked;
+    int rc = SQLITE_OK;
+    int i;
+
+    locked = mm_sql_write_lock(mm_db);
+    mm_mutex_lock(&mm_db->stmt_lock);
+
+    if ((stmt = mm_sql_get_stmt(mm_db, sql, &cached)) == NULL) {
+        mm_mutex_unlock(&mm_db->stmt_lock);
+        mm_sql_write_unlock(mm_db, locked);
+        return -1;
+    }
+
+    if ((int)strlen(types) != sqlite3_bind_parameter_count(stmt)) {
+        fprintf(stderr, "%s: %d parameters given for %d in SQL: '%s'\n", __func__,
+            (int)strlen(types), sqlite3_bind_parameter_count(stmt), sql);
+        rc = SQLITE_RANGE;
+    }
+
+    va_start(args, types);
+    for (i = 0; (rc == SQLITE_OK) && (types[i] != '\0'); i++) {
+        switch (types[i]) {
+            case 'i':
+                rc = sqlite3_bind_int(stmt, i + 1, va_arg(args, int));
+                break;
+            case 'I':
+                rc = sqlite3_bind_int64(stmt, i + 1, va_arg(args, int64_t));
+                break;
+            case 'd':
+                rc = sqlite3_bind_double(stmt, i + 1, va_arg(args, double));
+                break;
+            case 's':
+                rc = sqlite3_bind_text(stmt, i + 1, va_arg(args, const char*), -1, SQLITE_TRANSIENT);
+                break;
+            case 'S':
+            {
+                const char* str = va_arg(args, const char*);
+                rc = sqlite3_bind_text(stmt, i + 1, str, va_arg(args, int), SQLITE_TRANSIENT);
+                break;
+            }
+            default:
+                fprintf(stderr, "%s: Unknown parameter type '%c'\n", __func__, types[i]);
+                rc = SQLITE_MISUSE;
+                break;
+        }
+    }
+    va_end(args);
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_step(stmt);
+
+        /* Duplicates are left out with INSERT OR IGNORE; a constraint error means the row was not stored. */
+        if (rc == SQLITE_DONE || rc == SQLITE_ROW) {
+            rc = SQLITE_OK;
+        } else {
+            fprintf(stderr, "%s: Failed to execute: \nSQL: '%s'\nError: %s\n", __func__, sql, sqlite3_errmsg(mm_db->sqlite));
+        }
+    }
+
+    if (cached) {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    } else {
+        sqlite3_finalize(stmt);
+    }
+
+    mm_mutex_unlock(&mm_db->stmt_lock);
+    mm_sql_write_unlock(mm_db, locked);
+
+    return (rc == SQLITE_OK) ? 0 : -1;
+}
+
+/*
+ * Group writes into one transaction, so they are synced to disk once,
+ * rather than once per row.
+ *
+ * All lines share the database connection, and SQLite allows only one
+ * transaction on it, so a transaction is held exclusively by the thread
+ * that began it until it commits or rolls back.  Writes from other
+ * threads wait meanwhile, so keep transactions short.
+ */
+int mm_sql_begin_transaction(void *db) {
+    mm_db_t* mm_db = (mm_db_t*)db;
+
+    if (txn_db == mm_db) {
+        fprintf(stderr, "%s: Transaction already open.\n", __func__);
+        return -1;
+    }
+
+    mm_mutex_lock(&mm_db->txn_lock);
+    txn_db = mm_db;
+
+    if (mm_sql_run(db, "BEGIN;") != 0) {
+        txn_db = NULL;
+        mm_mutex_unlock(&mm_db->txn_lock);
         return -1;
     }
 
     return 0;
 }
 
+/* End the transaction begun by mm_sql_begin_transaction(). */
+static int mm_sql_end_transaction(mm_db_t* mm_db, const char* sql) {
+    int status;
+
+    if (txn_db != mm_db) {
+        fprintf(stderr, "%s: No transaction open.\n", __func__);
+        return -1;
+    }
+
+    status = mm_sql_run(mm_db, sql);
+
+    /* A failed COMMIT may leave the transaction open. */
+    if (!sqlite3_get_autocommit(mm_db->sqlite)) {
+        sqlite3_exec(mm_db->sqlite, "ROLLBACK;", NULL, 0, NULL);
+    }
+
+    txn_db = NULL;
+    mm_mutex_unlock(&mm_db->txn_lock);
+
+    return status;
+}
+
+/* The writes are durable when this returns 0; otherwise they are rolled back. */
+int mm_sql_commit_transaction(void *db) {
+    return mm_sql_end_transaction((mm_db_t*)db, "COMMIT;");
+}
+
+int mm_sql_rollback_transaction(void *db) {
+    return mm_sql_end_transaction((mm_db_t*)db, "ROLLBACK;");
+}
+
 uint8_t mm_sql_read_uint8(void* db, const char* sql) {
     sqlite3_stmt* res = NULL;
     uint8_t val = 0;
-    int rc = sqlite3_prepare_v2((sqlite3*)db, sql, -1, &res, 0);
+    int rc = sqlite3_prepare_v2(SQLITE_DB(db), sql, -1, &res, 0);
 
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg((sqlite3*)(db)));
+        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg(SQLITE_DB(db)));
         return 0xFF;
     }
 
@@ -53,10 +291,10 @@ uint8_t mm_sql_read_uint8(void* db, const char* sql) {
 uint64_t mm_sql_read_uint64(void* db, const char* sql) {
     sqlite3_stmt* res = NULL;
     uint64_t val = 0L;
-    int rc = sqlite3_prepare_v2((sqlite3*)db, sql, -1, &res, 0);
+    int rc = sqlite3_prepare_v2(SQLITE_DB(db), sql, -1, &res, 0);
 
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg((sqlite3 *)(db)));
+        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg(SQLITE_DB(db)));
         sqlite3_finalize(res);
         return 0xFFFFFFFFFFFFFFFFLL;
     }
@@ -70,29 +308,64 @@ uint64_t mm_sql_read_uint64(void* db, const char* sql) {
     return (val);
 }
 
+/* Count the rows in each table, by name.  Returns the number of tables, or -1 on error. */
+int mm_sql_count_rows(void* db, mm_sql_table_rows_t* tables, int max_tables) {
+    sqlite3_stmt* res = NULL;
+    char sql[80];
+    int  count = 0;
+    int  rc = sqlite3_prepare_v2(SQLITE_DB(db), "SELECT name FROM sqlite_master WHERE type = 'table' AND name NOT LIKE 'sqlite_%' ORDER BY name;", -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(SQLITE_DB(db)));
+        sqlite3_finalize(res);
+        return -1;
+    }
+
+    while ((count < max_tables) && (sqlite3_step(res) == SQLITE_ROW)) {
+        snprintf(tables[count].name, sizeof(tables[count].name), "%s", (const char*)sqlite3_column_text(res, 0));
+        count++;
+    }
+
+    sqlite3_finalize(res);
+
+    for (int i = 0; i < count; i++) {
+        snprintf(sql, sizeof(sql), "SELECT COUNT(*) FROM %s;", tables[i].name);
+        tables[i].rows = mm_sql_read_uint64(db, sql);
+    }
+
+    return count;
+}
+
+/* Rows inserted, updated or deleted since the database was opened. */
+int mm_sql_total_changes(void* db) {
+    return sqlite3_total_changes(SQLITE_DB(db));
+}
+
 int mm_sql_write_blob(void* db, const char* sql, uint8_t *buffer, size_t buflen) {
     sqlite3_stmt* res = NULL;
+    int locked = mm_sql_write_lock((mm_db_t*)db);
     int rc;
 
     printf("SQL:\n%s\n", sql);
-    rc = sqlite3_prepare_v2((sqlite3 *)db, sql, -1, &res, NULL);
+    rc = sqlite3_prepare_v2(SQLITE_DB(db), sql, -1, &res, NULL);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "prepare failed: %s\n", sqlite3_errmsg((sqlite3 *)db));
+        fprintf(stderr, "prepare failed: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
     }
     else {
         rc = sqlite3_bind_blob(res, 1, buffer, (int)buflen, SQLITE_STATIC);
         if (rc != SQLITE_OK) {
-            fprintf(stderr, "bind failed: %s\n", sqlite3_errmsg((sqlite3*)db));
+            fprintf(stderr, "bind failed: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
         }
         else {
             rc = sqlite3_step(res);
             if (rc != SQLITE_DONE) {
-                fprintf(stderr, "execution failed: %s\n", sqlite3_errmsg((sqlite3*)db));
+                fprintf(stderr, "execution failed: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
             }
         }
     }
 
     sqlite3_finalize(res);
+    mm_sql_write_unlock((mm_db_t*)db, locked);
 
     return (rc == SQLITE_DONE) ? 0 : rc;
 }
@@ -101,10 +374,10 @@ int mm_sql_read_blob(void* db, const char* sql, uint8_t* buffer, size_t buflen)
     sqlite3_stmt* res = NULL;
     int rc;
     printf("SQL:\n%s\n", sql);
-    rc = sqlite3_prepare_v2((sqlite3*)db, sql, -1, &res, NULL);
+    rc = sqlite3_prepare_v2(SQLITE_DB(db), sql, -1, &res, NULL);
 
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg((sqlite3*)(db)));
+        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg(SQLITE_DB(db)));
         return rc;
     }
 
@@ -138,10 +411,10 @@ int mm_sql_load_TCASHST(void* db, const char* terminal_id, cashbox_status_univ_t
         "from TCASHST where (TERMINAL_ID = \"%s\" )",
         terminal_id);
 
-    rc = sqlite3_prepare_v2((sqlite3 *)db, sql, -1, &res, 0);
+    rc = sqlite3_prepare_v2(SQLITE_DB(db), sql, -1, &res, 0);
 
     if (rc != SQLITE_OK && rc != SQLITE_CONSTRAINT) {
-        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg((sqlite3 *)db));
+        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s", __func__, sql, sqlite3_errmsg(SQLITE_DB(db)));
         sqlite3_finalize(res);
         return 1;
     }
@@ -195,32 +468,529 @@ int mm_sql_load_TCASHST(void* db, const char* terminal_id, cashbox_status_univ_t
     return 0;
 }
 
-void *mm_open_database(const char *database_filename) {
-    sqlite3 *db = { 0 };
+/*
+ * Copy frames from the WAL back into the database periodically.  Automatic
+ * checkpoints are disabled in the WAL profile, as they would run inside a
+ * commit on the manager's connection.  A passive checkpoint never waits for
+ * readers or writers, so report queries and sessions are not held up.
+ */
+static void* mm_sql_checkpoint_thread(void* arg) {
+    mm_db_t* mm_db = (mm_db_t*)arg;
+
+    mm_mutex_lock(&mm_db->checkpoint_lock);
+
+    while (mm_db->checkpoint_running) {
+        if (mm_cond_timedwait(&mm_db->checkpoint_stop, &mm_db->checkpoint_lock, MM_SQL_CHECKPOINT_INTERVAL_MS) != -ETIMEDOUT) {
+            continue;
+        }
+
+        mm_mutex_unlock(&mm_db->checkpoint_lock);
+
+        int rc = sqlite3_wal_checkpoint_v2(mm_db->checkpoint_sqlite, NULL, SQLITE_CHECKPOINT_PASSIVE, NULL, NULL);
+
+        if ((rc != SQLITE_OK) && (rc != SQLITE_BUSY)) {
+            fprintf(stderr, "%s: Checkpoint failed: %s\n", __func__, sqlite3_errmsg(mm_db->checkpoint_sqlite));
+        }
+
+        mm_mutex_lock(&mm_db->checkpoint_lock);
+    }
+
+    mm_mutex_unlock(&mm_db->checkpoint_lock);
+
+    return NULL;
+}
+
+static int mm_sql_start_checkpoint(mm_db_t* mm_db, const char* database_filename) {
+    if (sqlite3_open(database_filename, &mm_db->checkpoint_sqlite) != SQLITE_OK) {
+        fprintf(stderr, "%s: Cannot open database: %s\n", __func__, sqlite3_errmsg(mm_db->checkpoint_sqlite));
+        sqlite3_close(mm_db->checkpoint_sqlite);
+        mm_db->checkpoint_sqlite = NULL;
+        return -EIO;
+    }
+
+    mm_mutex_init(&mm_db->checkpoint_lock);
+    mm_cond_init(&mm_db->checkpoint_stop);
+    mm_db->checkpoint_running = 1;
+
+    if (mm_thread_create(&mm_db->checkpoint_thread, mm_sql_checkpoint_thread, mm_db) != 0) {
+        mm_db->checkpoint_running = 0;
+        mm_cond_destroy(&mm_db->checkpoint_stop);
+        mm_mutex_destroy(&mm_db->checkpoint_lock);
+        sqlite3_close(mm_db->checkpoint_sqlite);
+        mm_db->checkpoint_sqlite = NULL;
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+static void mm_sql_stop_checkpoint(mm_db_t* mm_db) {
+    if (mm_db->checkpoint_sqlite == NULL) {
+        return;
+    }
+
+    mm_mutex_lock(&mm_db->checkpoint_lock);
+    mm_db->checkpoint_running = 0;
+    mm_cond_signal(&mm_db->checkpoint_stop);
+    mm_mutex_unlock(&mm_db->checkpoint_lock);
+
+    mm_thread_join(mm_db->checkpoint_thread);
+
+    mm_cond_destroy(&mm_db->checkpoint_stop);
+    mm_mutex_destroy(&mm_db->checkpoint_lock);
+    sqlite3_close(mm_db->checkpoint_sqlite);
+    mm_db->checkpoint_sqlite = NULL;
+}
+
+/*
+ * Apply a storage profile.  MM_DB_PROFILE_WAL lets report queries read the
+ * database while the manager writes to it.  It keeps synchronous=FULL, so
+ * the log is synced at every COMMIT: CDRs are ACKed, and then deleted by
+ * the terminal, as soon as their commit returns.
+ */
+static int mm_sql_set_profile(mm_db_t* mm_db, const char* database_filename, int profile) {
+    char sql[256];
+
+    if (profile != MM_DB_PROFILE_WAL) {
+        return 0;
+    }
+
+    snprintf(sql, sizeof(sql),
+        "PRAGMA journal_mode=WAL;"
+        "PRAGMA synchronous=FULL;"
+        "PRAGMA wal_autocheckpoint=0;"
+        "PRAGMA cache_size=-%d;"
+        "PRAGMA mmap_size=%d;",
+        MM_SQL_WAL_CACHE_KB, MM_SQL_WAL_MMAP_SIZE);
+
+    if (mm_sql_exec(mm_db, sql) != 0) {
+        return -EIO;
+    }
+
+    sqlite3_busy_timeout(mm_db->sqlite, MM_SQL_WAL_BUSY_TIMEOUT_MS);
+
+    return mm_sql_start_checkpoint(mm_db, database_filename);
+}
+
+/* Version 1: accounting, table data and configuration tables. */
+static int mm_sql_migrate_v1(void* db) {
+    if (mm_acct_create_tables(db) != 0) {
+        fprintf(stderr, "Failure creating accounting tables: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
+        return -1;
+    }
+
+    if (mm_table_create_tables(db) != 0) {
+        fprintf(stderr, "Failure creating data tables: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
+        return -1;
+    }
+
+    if (mm_config_create_tables(db) != 0) {
+        fprintf(stderr, "Failure creating configuration tables: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Version 2: hash of each table last acknowledged by each terminal. */
+static int mm_sql_migrate_v2(void* db) {
+    if (mm_sql_exec(db, "CREATE TABLE IF NOT EXISTS TTBLHASH ( "
+        "TERMINAL_ID VARCHAR(10) NOT NULL,"
+        "TABLE_ID TINYINT NOT NULL,"
+        "HASH BIGINT NOT NULL,"
+        "PRIMARY KEY(TERMINAL_ID, TABLE_ID)"
+        ");") != 0) {
+        fprintf(stderr, "Failure creating table TTBLHASH: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Version 3: tables acknowledged in each terminal's unfinished download. */
+static int mm_sql_migrate_v3(void* db) {
+    if (mm_sql_exec(db, "CREATE TABLE IF NOT EXISTS TDLJRNL ( "
+        "TERMINAL_ID VARCHAR(10) NOT NULL,"
+        "TABLE_ID TINYINT NOT NULL,"
+        "HASH BIGINT NOT NULL,"
+        "PRIMARY KEY(TERMINAL_ID, TABLE_ID)"
+        ");") != 0) {
+        fprintf(stderr, "Failure creating table TDLJRNL: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Version 4: terminals with optional tables left to send on the next table update (-S). */
+static int mm_sql_migrate_v4(void* db) {
+    if (mm_sql_exec(db, "CREATE TABLE IF NOT EXISTS TDLPEND ( "
+        "TERMINAL_ID VARCHAR(10) NOT NULL PRIMARY KEY,"
+        "TERMINAL_TYPE SMALLINT NOT NULL"
+        ");") != 0) {
+        fprintf(stderr, "Failure creating table TDLPEND: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Version 5: packet gap and link history learned for each terminal (-A). */
+static int mm_sql_migrate_v5(void* db) {
+    if (mm_sql_exec(db, "CREATE TABLE IF NOT EXISTS TLINKTUNE ( "
+        "TERMINAL_ID VARCHAR(10) NOT NULL PRIMARY KEY,"
+        "RX_PACKET_GAP SMALLINT NOT NULL,"
+        "MIN_GAP SMALLINT NOT NULL,"
+        "ACK_MS INTEGER NOT NULL,"
+        "PACKETS INTEGER NOT NULL,"
+        "RETRIES INTEGER NOT NULL"
+        ");") != 0) {
+        fprintf(stderr, "Failure creating table TLINKTUNE: %s\n", sqlite3_errmsg(SQLITE_DB(db)));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Schema migrations, in order: entry n upgrades the database from
+ * user_version n to n + 1.  Add new entries to the end; never change
+ * one that has been released.
+ */
+static int (* const mm_sql_migrations[])(void* db) = {
+    mm_sql_migrate_v1,
+    mm_sql_migrate_v2,
+    mm_sql_migrate_v3,
+    mm_sql_migrate_v4,
+    mm_sql_migrate_v5,
+};
+
+#define MM_SQL_SCHEMA_VERSION   (int)(sizeof(mm_sql_migrations) / sizeof(mm_sql_migrations[0]))
+
+/*
+ * Bring the schema up to date, using PRAGMA user_version to record the
+ * version.  An up to date database needs no DDL at startup.  Databases
+ * created before versioning have version 0; the first migration only
+ * creates missing tables, so it is safe to run on them.
+ */
+static int mm_sql_migrate(mm_db_t* mm_db) {
+    char sql[64];
+    int version;
+    int status = 0;
+
+    version = (int)mm_sql_read_uint64(mm_db, "PRAGMA user_version;");
+
+    if (version == MM_SQL_SCHEMA_VERSION) {
+        return 0;
+    }
+
+    if (version > MM_SQL_SCHEMA_VERSION) {
+        fprintf(stderr, "%s: Database schema version %d is newer than supported version %d.\n",
+            __func__, version, MM_SQL_SCHEMA_VERSION);
+        return -EINVAL;
+    }
+
+    if (mm_sql_begin_transaction(mm_db) != 0) {
+        return -EIO;
+    }
+
+    for (; (version < MM_SQL_SCHEMA_VERSION) && (status == 0); version++) {
+        status = mm_sql_migrations[version](mm_db);
+    }
+
+    if (status == 0) {
+        snprintf(sql, sizeof(sql), "PRAGMA user_version=%d;", version);
+        status = mm_sql_exec(mm_db, sql);
+    }
+
+    if (status == 0) {
+        status = mm_sql_commit_transaction(mm_db);
+    } else {
+        mm_sql_rollback_transaction(mm_db);
+    }
+
+    if (status == 0) {
+        printf("Database schema upgraded to version %d.\n", version);
+    }
+
+    return status;
+}
+
+/* Read all of TERMTYP into map. */
+int mm_sql_load_TERMTYP(void* db, mm_termtyp_map_t* map) {
+    sqlite3_stmt* res = NULL;
+    int rc;
+
+    rc = sqlite3_prepare_v2(SQLITE_DB(db), "SELECT CONTROL_ROM_EDITION, TERMINAL_TYPE FROM TERMTYP;", -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(SQLITE_DB(db)));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    mm_termtyp_map_clear(map);
+
+    while ((rc = sqlite3_step(res)) == SQLITE_ROW) {
+        const char* control_rom_edition = (const char*)sqlite3_column_text(res, 0);
+
+        if (control_rom_edition == NULL) continue;
+
+        if (mm_termtyp_map_add(map, control_rom_edition, (uint8_t)sqlite3_column_int(res, 1)) != 0) {
+            fprintf(stderr, "%s: Too many terminal types, increase TERMTYP_MAP_SIZE.\n", __func__);
+            break;
+        }
+    }
+
+    sqlite3_finalize(res);
+
+    return (rc == SQLITE_DONE) ? 0 : -EIO;
+}
+
+/* Read the hash of filename as last imported.  Returns -ENOENT if it never was. */
+int mm_sql_load_TCFGFILE(void* db, const char* filename, uint64_t* hash) {
+    sqlite3_stmt* res = NULL;
+    int rc;
+
+    rc = sqlite3_prepare_v2(SQLITE_DB(db), "SELECT HASH FROM TCFGFILE WHERE (FILENAME = ?);", -1, &res, 0);
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_bind_text(res, 1, filename, -1, SQLITE_TRANSIENT);
+    }
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(SQLITE_DB(db)));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    rc = sqlite3_step(res);
+
+    if (rc == SQLITE_ROW) {
+        *hash = (uint64_t)sqlite3_column_int64(res, 0);
+    }
+
+    sqlite3_finalize(res);
+
+    return (rc == SQLITE_ROW) ? 0 : (rc == SQLITE_DONE) ? -ENOENT : -EIO;
+}
+
+/*
+ * Read (TABLE_ID, HASH) rows for terminal_id into hashes, indexed by table ID.
+ * Returns the number of rows read, or -EIO on error.
+ */
+static int mm_sql_load_hashes(void* db, const char* sql, const char* terminal_id, uint64_t hashes[256]) {
+    sqlite3_stmt* res = NULL;
+    int count = 0;
+    int rc;
+
+    rc = sqlite3_prepare_v2(SQLITE_DB(db), sql, -1, &res, 0);
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_bind_text(res, 1, terminal_id, -1, SQLITE_TRANSIENT);
+    }
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(SQLITE_DB(db)));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    while ((rc = sqlite3_step(res)) == SQLITE_ROW) {
+        hashes[sqlite3_column_int(res, 0) & 0xff] = (uint64_t)sqlite3_column_int64(res, 1);
+        count++;
+    }
+
+    sqlite3_finalize(res);
+
+    return (rc == SQLITE_DONE) ? count : -EIO;
+}
+
+/*
+ * Read the hashes of the tables terminal_id has acknowledged, indexed by
+ * table ID.  Tables never acknowledged have hash 0.  Returns the number
+ * of tables, or < 0 on error.
+ */
+int mm_sql_load_TTBLHASH(void* db, const char* terminal_id, uint64_t hashes[256]) {
+    memset(hashes, 0, 256 * sizeof(uint64_t));
+
+    return mm_sql_load_hashes(db, "SELECT TABLE_ID, HASH FROM TTBLHASH WHERE (TERMINAL_ID = ?);", terminal_id, hashes);
+}
+
+/*
+ * Read the tables acknowledged in an unfinished download to terminal_id
+ * over hashes.  Returns the number of tables, or < 0 on error.
+ */
+int mm_sql_load_TDLJRNL(void* db, const char* terminal_id, uint64_t hashes[256]) {
+    return mm_sql_load_hashes(db, "SELECT TABLE_ID, HASH FROM TDLJRNL WHERE (TERMINAL_ID = ?);", terminal_id, hashes);
+}
+
+/* Record a table acknowledged by terminal_id as soon as the ACK arrives. */
+int mm_sql_save_TDLJRNL(void* db, const char* terminal_id, uint8_t table_id, uint64_t hash) {
+    static const char sql_insert[] = "INSERT OR REPLACE INTO TDLJRNL ( TERMINAL_ID, TABLE_ID, HASH ) VALUES ( ?,?,? );";
+
+    return mm_sql_exec_stmt(db, sql_insert, "siI", terminal_id, table_id, (int64_t)hash);
+}
+
+/* The download finished: move its journal into TTBLHASH. */
+int mm_sql_commit_TDLJRNL(void* db, const char* terminal_id) {
+    static const char sql_merge[] = "INSERT OR REPLACE INTO TTBLHASH ( TERMINAL_ID, TABLE_ID, HASH ) "
+        "SELECT TERMINAL_ID, TABLE_ID, HASH FROM TDLJRNL WHERE (TERMINAL_ID = ?);";
+    static const char sql_delete[] = "DELETE FROM TDLJRNL WHERE (TERMINAL_ID = ?);";
+    int status;
+
+    if (mm_sql_begin_transaction(db) != 0) {
+        return -1;
+    }
+
+    status = mm_sql_exec_stmt(db, sql_merge, "s", terminal_id);
+
+    if (status == 0) {
+        status = mm_sql_exec_stmt(db, sql_delete, "s", terminal_id);
+    }
+
+    if (status == 0) {
+        status = mm_sql_commit_transaction(db);
+    } else {
+        mm_sql_rollback_transaction(db);
+    }
+
+    return status;
+}
+
+/* Forget every table sent to terminal_id, after it has lost its memory. */
+int mm_sql_clear_TTBLHASH(void* db, const char* terminal_id) {
+    static const char sql_delete[] = "DELETE FROM TTBLHASH WHERE (TERMINAL_ID = ?);";
+
+    return mm_sql_exec_stmt(db, sql_delete, "s", terminal_id);
+}
+
+int mm_sql_clear_TDLJRNL(void* db, const char* terminal_id) {
+    static const char sql_delete[] = "DELETE FROM TDLJRNL WHERE (TERMINAL_ID = ?);";
+
+    return mm_sql_exec_stmt(db, sql_delete, "s", terminal_id);
+}
+
+/* Read the link settings learned for terminal_id.  Returns -ENOENT if there are none yet. */
+int mm_sql_load_TLINKTUNE(void* db, const char* terminal_id, mm_link_tune_t* tune) {
+    sqlite3_stmt* res = NULL;
+    int rc;
+
+    rc = sqlite3_prepare_v2(SQLITE_DB(db),
+        "SELECT RX_PACKET_GAP, MIN_GAP, ACK_MS, PACKETS, RETRIES FROM TLINKTUNE WHERE (TERMINAL_ID = ?);", -1, &res, 0);
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_bind_text(res, 1, terminal_id, -1, SQLITE_TRANSIENT);
+    }
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(SQLITE_DB(db)));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    rc = sqlite3_step(res);
+
+    if (rc == SQLITE_ROW) {
+        tune->rx_packet_gap = (uint8_t)sqlite3_column_int(res, 0);
+        tune->min_gap       = (uint8_t)sqlite3_column_int(res, 1);
+        tune->ack_ms        = (uint16_t)sqlite3_column_int(res, 2);
+        tune->packets       = (uint32_t)sqlite3_column_int64(res, 3);
+        tune->retries       = (uint32_t)sqlite3_column_int64(res, 4);
+    }
+
+    sqlite3_finalize(res);
+
+    return (rc == SQLITE_ROW) ? 0 : -ENOENT;
+}
+
+int mm_sql_save_TLINKTUNE(void* db, const char* terminal_id, const mm_link_tune_t* tune) {
+    static const char sql_insert[] = "INSERT OR REPLACE INTO TLINKTUNE "
+        "( TERMINAL_ID, RX_PACKET_GAP, MIN_GAP, ACK_MS, PACKETS, RETRIES ) VALUES ( ?,?,?,?,?,? );";
+
+    return mm_sql_exec_stmt(db, sql_insert, "siiiII", terminal_id, tune->rx_packet_gap, tune->min_gap,
+        tune->ack_ms, (int64_t)tune->packets, (int64_t)tune->retries);
+}
 
-    int rc = sqlite3_open(database_filename, &db);
+/*
+ * Look up whether terminal_id has tables deferred to its next table update, and
+ * the terminal type they were planned for.  Returns -ENOENT if it has none.
+ */
+int mm_sql_load_TDLPEND(void* db, const char* terminal_id, uint8_t* terminal_type) {
+    sqlite3_stmt* res = NULL;
+    int rc;
+
+    rc = sqlite3_prepare_v2(SQLITE_DB(db), "SELECT TERMINAL_TYPE FROM TDLPEND WHERE (TERMINAL_ID = ?);", -1, &res, 0);
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_bind_text(res, 1, terminal_id, -1, SQLITE_TRANSIENT);
+    }
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(SQLITE_DB(db)));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    rc = sqlite3_step(res);
+
+    if (rc == SQLITE_ROW) {
+        *terminal_type = (uint8_t)sqlite3_column_int(res, 0);
+    }
+
+    sqlite3_finalize(res);
+
+    return (rc == SQLITE_ROW) ? 0 : -ENOENT;
+}
+
+int mm_sql_save_TDLPEND(void* db, const char* terminal_id, uint8_t terminal_type) {
+    static const char sql_insert[] = "INSERT OR REPLACE INTO TDLPEND ( TERMINAL_ID, TERMINAL_TYPE ) VALUES ( ?,? );";
+
+    return mm_sql_exec_stmt(db, sql_insert, "si", terminal_id, terminal_type);
+}
+
+int mm_sql_clear_TDLPEND(void* db, const char* terminal_id) {
+    static const char sql_delete[] = "DELETE FROM TDLPEND WHERE (TERMINAL_ID = ?);";
+
+    return mm_sql_exec_stmt(db, sql_delete, "s", terminal_id);
+}
+
+void *mm_open_database(const char *database_filename, int profile) {
+    mm_db_t *db;
+
+    db = (mm_db_t *)calloc(1, sizeof(mm_db_t));
+
+    if (db == NULL) {
+        fprintf(stderr, "%s: Error allocating memory.\n", __func__);
+        return NULL;
+    }
+
+    int rc = sqlite3_open(database_filename, &db->sqlite);
 
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db->sqlite));
+        sqlite3_close(db->sqlite);
+        free(db);
         return NULL;
     }
 
-    if (mm_acct_create_tables(db) != 0) {
-        fprintf(stderr, "Failure creating accounting tables: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+    mm_mutex_init(&db->stmt_lock);
+    mm_mutex_init(&db->txn_lock);
+
+    if (mm_sql_set_profile(db, database_filename, profile) != 0) {
+        fprintf(stderr, "Failure setting database profile: %s\n", sqlite3_errmsg(db->sqlite));
+        mm_close_database(db);
         return NULL;
     }
 
-    if (mm_table_create_tables(db) != 0) {
-        fprintf(stderr, "Failure creating data tables: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+    if (mm_sql_migrate(db) != 0) {
+        mm_close_database(db);
         return NULL;
     }
 
-    if (mm_config_create_tables(db) != 0) {
-        fprintf(stderr, "Failure creating configuration tables: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+    if (mm_config_load_TERMTYP(db) != 0) {
+        fprintf(stderr, "Failure loading terminal types: %s\n", sqlite3_errmsg(db->sqlite));
+        mm_close_database(db);
         return NULL;
     }
 
@@ -228,5 +998,31 @@ void *mm_open_database(const char *database_filename) {
 }
 
 int mm_close_database(void *db) {
-    return ((db != NULL) ? sqlite3_close((sqlite3 *)db) : 0);
+    mm_db_t *mm_db = (mm_db_t *)db;
+    int rc;
+    int i;
+
+    if (mm_db == NULL) {
+        return 0;
+    }
+
+    /* A transaction still open was never confirmed to its caller. */
+    if (!sqlite3_get_autocommit(mm_db->sqlite)) {
+        fprintf(stderr, "%s: Rolling back unfinished transaction.\n", __func__);
+        sqlite3_exec(mm_db->sqlite, "ROLLBACK;", NULL, 0, NULL);
+    }
+
+    mm_sql_stop_checkpoint(mm_db);
+    mm_config_unload_TERMTYP();
+
+    for (i = 0; i < mm_db->stmt_count; i++) {
+        sqlite3_finalize(mm_db->stmt_cache[i].stmt);
+    }
+
+    rc = sqlite3_close(mm_db->sqlite);
+    mm_mutex_destroy(&mm_db->stmt_lock);
+    mm_mutex_destroy(&mm_db->txn_lock);
+    free(mm_db);
+
+    return rc;
 }
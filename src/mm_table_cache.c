@@ -0,0 +1,379 @@
+/*
+ * Table image cache, part of mm_manager.
+ *
+ * Resolved table files are kept in memory, indexed by terminal ID, model
+ * and table ID, and handed out by reference.  Any change to a table file
+ * or table directory drops the whole cache; tables change rarely, and a
+ * download after a change simply reads the files again.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mm_table_cache.h"
+#include "mm_thread.h"
+
+#ifdef __linux__
+# define TABLE_CACHE_INOTIFY
+# include <unistd.h>
+# include <sys/inotify.h>
+#endif /* __linux__ */
+
+#define TABLE_CACHE_BUCKETS     256     /* A power of two */
+#define TABLE_CANDIDATES_MAX    3       /* Terminal, model and default directories */
+
+typedef struct table_entry {
+    mm_table_image_t image;             /* First, so an image can be converted back to its entry. */
+    struct table_entry* next;
+    int refs;                           /* One for the cache while indexed, plus one per user. */
+    int found;                          /* 0 if the table is in none of the directories. */
+    char terminal_id[11];
+    uint8_t term_model;
+    uint8_t table_id;
+    /* Without inotify: the paths tried before the file was found, and its size and mtime. */
+    int candidate_count;
+    char candidates[TABLE_CANDIDATES_MAX][TABLE_PATH_MAX_LEN];
+    time_t mtime;
+    off_t size;
+} table_entry_t;
+
+struct mm_table_cache {
+    char default_table_dir[256];
+    char term_table_dir[256];
+    mm_mutex_t lock;
+    int inotify_fd;                     /* -1 if changes are detected with stat() */
+    table_entry_t* buckets[TABLE_CACHE_BUCKETS];
+};
+
+static const char* model_table_dir(uint8_t term_model) {
+    switch (term_model) {
+    case TERM_CARD:
+        return "card_only";
+    case TERM_DESK:
+        return "desk";
+    case TERM_COIN_BASIC:
+        return "coin";
+    case TERM_INMATE:
+        return "inmate";
+    case TERM_MULTIPAY:
+    default:
+        return "multipay";
+    }
+}
+
+/* The paths to try for a table, in order of preference. */
+static int table_candidates(mm_table_cache_t* cache, const char* terminal_id, uint8_t term_model, uint8_t table_id,
+                            char candidates[TABLE_CANDIDATES_MAX][TABLE_PATH_MAX_LEN]) {
+    int count = 0;
+
+    if (terminal_id[0] != '\0') {
+        snprintf(candidates[count++], TABLE_PATH_MAX_LEN, "%s/%s/mm_table_%02x.bin", cache->term_table_dir, terminal_id, table_id);
+    } else {
+        snprintf(candidates[count++], TABLE_PATH_MAX_LEN, "%s/mm_table_%02x.bin", cache->default_table_dir, table_id);
+    }
+    snprintf(candidates[count++], TABLE_PATH_MAX_LEN, "%s/%s/mm_table_%02x.bin", cache->term_table_dir, model_table_dir(term_model), table_id);
+    snprintf(candidates[count++], TABLE_PATH_MAX_LEN, "%s/mm_table_%02x.bin", cache->default_table_dir, table_id);
+
+    return count;
+}
+
+static unsigned int table_bucket(const char* terminal_id, uint8_t term_model, uint8_t table_id) {
+    uint64_t hash = fnv1a64(FNV1A64_INIT, (const uint8_t*)terminal_id, strlen(terminal_id));
+
+    hash = fnv1a64(hash, &term_model, 1);
+    hash = fnv1a64(hash, &table_id, 1);
+
+    return (unsigned int)hash & (TABLE_CACHE_BUCKETS - 1);
+}
+
+static void table_entry_put(table_entry_t* entry) {
+    if (--entry->refs == 0) {
+        free((void*)entry->image.data);
+        free(entry);
+    }
+}
+
+/* Drop every entry.  Entries still in use are freed when released. */
+static void table_cache_flush(mm_table_cache_t* cache) {
+    for (int i = 0; i < TABLE_CACHE_BUCKETS; i++) {
+        while (cache->buckets[i] != NULL) {
+            table_entry_t* entry = cache->buckets[i];
+
+            cache->buckets[i] = entry->next;
+            table_entry_put(entry);
+        }
+    }
+}
+
+#ifdef TABLE_CACHE_INOTIFY
+static void table_cache_watch(mm_table_cache_t* cache, const char* dir) {
+    /* Missing directories are picked up when they are created in a watched parent. */
+    inotify_add_watch(cache->inotify_fd, dir,
+        IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+}
+
+/* Flush the cache if anything has changed since the last call. */
+static void table_cache_poll(mm_table_cache_t* cache) {
+    union {
+        struct inotify_event event;
+        char buf[4096];
+    } events;
+    ssize_t len;
+    int     changed = 0;
+
+    while ((len = read(cache->inotify_fd, events.buf, sizeof(events.buf))) > 0) {
+        char* p = events.buf;
+
+        while (p < events.buf + len) {
+            struct inotify_event* event = (struct inotify_event*)p;
+
+            /* Ignore other files, such as table_update.log, written after each download. */
+            if ((event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF | IN_ISDIR)) ||
+                ((event->len > 0) && (strncmp(event->name, "mm_table_", 9) == 0))) {
+                changed = 1;
+            }
+
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if (changed) {
+        table_cache_flush(cache);
+    }
+}
+#endif /* TABLE_CACHE_INOTIFY */
+
+/* Without inotify, check that the files an entry was resolved from are unchanged. */
+static int table_entry_valid(mm_table_cache_t* cache, table_entry_t* entry) {
+    struct stat st;
+
+    if (cache->inotify_fd >= 0) {
+        return 1;
+    }
+
+    for (int i = 0; i < entry->candidate_count; i++) {
+        if (stat(entry->candidates[i], &st) == 0) {
+            return 0;
+        }
+    }
+
+    if (entry->found) {
+        if ((stat(entry->image.fname, &st) != 0) || (st.st_mtime != entry->mtime) || (st.st_size != entry->size)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Resolve and read a table into a new entry. */
+static table_entry_t* table_entry_load(mm_table_cache_t* cache, const char* terminal_id, uint8_t term_model, uint8_t table_id) {
+    char candidates[TABLE_CANDIDATES_MAX][TABLE_PATH_MAX_LEN];
+    table_entry_t* entry;
+    FILE*    stream = NULL;
+    uint8_t* data;
+    long     size;
+    int      count;
+    int      i;
+
+    entry = (table_entry_t*)calloc(1, sizeof(table_entry_t));
+
+    if (entry == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(table_entry_t));
+        return NULL;
+    }
+
+    snprintf(entry->terminal_id, sizeof(entry->terminal_id), "%s", terminal_id);
+    entry->term_model = term_model;
+    entry->table_id = table_id;
+    entry->refs = 1;
+
+    count = table_candidates(cache, terminal_id, term_model, table_id, candidates);
+
+    for (i = 0; i < count; i++) {
+        if ((stream = fopen(candidates[i], "rb")) != NULL) break;
+    }
+
+    memcpy(entry->candidates, candidates, sizeof(candidates));
+    snprintf(entry->image.fname, sizeof(entry->image.fname), "%s", candidates[(i < count) ? i : count - 1]);
+    entry->candidate_count = i;
+
+    if (stream == NULL) {
+        return entry;
+    }
+
+    fseek(stream, 0, SEEK_END);
+    size = ftell(stream);
+    fseek(stream, 0, SEEK_SET);
+
+    data = (uint8_t*)malloc((size_t)size + 1);
+
+    if (data == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %ld bytes for table %d\n", __func__, size + 1, table_id);
+        fclose(stream);
+        free(entry);
+        return NULL;
+    }
+
+    data[0] = table_id;
+
+    if (fread(&data[1], 1, (size_t)size, stream) != (size_t)size) {
+        fprintf(stderr, "%s: Error reading %s\n", __func__, entry->image.fname);
+        fclose(stream);
+        free(data);
+        free(entry);
+        return NULL;
+    }
+
+    fclose(stream);
+
+    if (cache->inotify_fd < 0) {
+        struct stat st;
+
+        if (stat(entry->image.fname, &st) == 0) {
+            entry->mtime = st.st_mtime;
+            entry->size  = st.st_size;
+        }
+    }
+
+    entry->image.data = data;
+    entry->image.len  = (size_t)size + 1;
+    entry->found = 1;
+
+    return entry;
+}
+
+mm_table_cache_t* mm_table_cache_create(const char* default_table_dir, const char* term_table_dir) {
+    mm_table_cache_t* cache;
+
+    cache = (mm_table_cache_t*)calloc(1, sizeof(mm_table_cache_t));
+
+    if (cache == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_table_cache_t));
+        return NULL;
+    }
+
+    snprintf(cache->default_table_dir, sizeof(cache->default_table_dir), "%s", default_table_dir);
+    snprintf(cache->term_table_dir, sizeof(cache->term_table_dir), "%s", term_table_dir);
+    mm_mutex_init(&cache->lock);
+    cache->inotify_fd = -1;
+
+#ifdef TABLE_CACHE_INOTIFY
+    if ((cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0) {
+        static const uint8_t models[] = { TERM_CARD, TERM_DESK, TERM_COIN_BASIC, TERM_INMATE, TERM_MULTIPAY };
+        char dir[TABLE_PATH_MAX_LEN];
+
+        table_cache_watch(cache, cache->default_table_dir);
+        table_cache_watch(cache, cache->term_table_dir);
+
+        for (size_t i = 0; i < sizeof(models); i++) {
+            snprintf(dir, sizeof(dir), "%s/%s", cache->term_table_dir, model_table_dir(models[i]));
+            table_cache_watch(cache, dir);
+        }
+    } else {
+        fprintf(stderr, "%s: inotify unavailable, checking table files on each use.\n", __func__);
+    }
+#endif /* TABLE_CACHE_INOTIFY */
+
+    return cache;
+}
+
+void mm_table_cache_destroy(mm_table_cache_t* cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    table_cache_flush(cache);
+
+#ifdef TABLE_CACHE_INOTIFY
+    if (cache->inotify_fd >= 0) {
+        close(cache->inotify_fd);
+    }
+#endif /* TABLE_CACHE_INOTIFY */
+
+    mm_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+int mm_table_cache_get(mm_table_cache_t* cache, const char* terminal_id, uint8_t term_model, uint8_t table_id, const mm_table_image_t** image) {
+    unsigned int    bucket = table_bucket(terminal_id, term_model, table_id);
+    table_entry_t** link;
+    table_entry_t*  entry;
+    int status = 0;
+
+    *image = NULL;
+
+    mm_mutex_lock(&cache->lock);
+
+#ifdef TABLE_CACHE_INOTIFY
+    if (cache->inotify_fd >= 0) {
+        table_cache_poll(cache);
+    }
+#endif /* TABLE_CACHE_INOTIFY */
+
+    for (link = &cache->buckets[bucket]; (entry = *link) != NULL; link = &entry->next) {
+        if ((entry->table_id == table_id) && (entry->term_model == term_model) &&
+            (strcmp(entry->terminal_id, terminal_id) == 0)) {
+            break;
+        }
+    }
+
+    if ((entry != NULL) && !table_entry_valid(cache, entry)) {
+        *link = entry->next;
+        table_entry_put(entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+#ifdef TABLE_CACHE_INOTIFY
+        if ((cache->inotify_fd >= 0) && (terminal_id[0] != '\0')) {
+            char dir[TABLE_PATH_MAX_LEN];
+
+            /* Watch before reading, so a change made while reading is not missed. */
+            snprintf(dir, sizeof(dir), "%s/%s", cache->term_table_dir, terminal_id);
+            table_cache_watch(cache, dir);
+        }
+#endif /* TABLE_CACHE_INOTIFY */
+
+        entry = table_entry_load(cache, terminal_id, term_model, table_id);
+
+        if (entry == NULL) {
+            mm_mutex_unlock(&cache->lock);
+            return -ENOMEM;
+        }
+
+        entry->next = cache->buckets[bucket];
+        cache->buckets[bucket] = entry;
+    }
+
+    if (entry->found) {
+        entry->refs++;
+        *image = &entry->image;
+    } else {
+        printf("Could not load table %d from %s.\n", table_id, entry->image.fname);
+        status = -ENOENT;
+    }
+
+    mm_mutex_unlock(&cache->lock);
+
+    return status;
+}
+
+void mm_table_cache_release(mm_table_cache_t* cache, const mm_table_image_t* image) {
+    if (image == NULL) {
+        return;
+    }
+
+    mm_mutex_lock(&cache->lock);
+    table_entry_put((table_entry_t*)image);
+    mm_mutex_unlock(&cache->lock);
+}
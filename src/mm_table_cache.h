@@ -0,0 +1,44 @@
+/*
+ * Table image cache, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_TABLE_CACHE_H_
+#define MM_TABLE_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm_manager.h"
+
+/*
+ * Table files are resolved (terminal directory, then model directory,
+ * then default directory) and read once, then shared by all downloads
+ * until a file in one of the table directories changes.  On Linux,
+ * changes are reported by inotify; elsewhere, each use of a cached
+ * table checks the files it was resolved from with stat().
+ */
+typedef struct mm_table_cache mm_table_cache_t;
+
+/* A table as sent to the terminal: table ID followed by the file contents.  Read-only. */
+typedef struct mm_table_image {
+    const uint8_t* data;
+    size_t len;
+    char fname[TABLE_PATH_MAX_LEN];
+} mm_table_image_t;
+
+mm_table_cache_t* mm_table_cache_create(const char* default_table_dir, const char* term_table_dir);
+void mm_table_cache_destroy(mm_table_cache_t* cache);
+
+/*
+ * Find the table for a terminal, reading it on first use.  The image stays
+ * valid until released, even if the cache is invalidated meanwhile.
+ * Returns -ENOENT if the table exists in none of the directories.
+ */
+int mm_table_cache_get(mm_table_cache_t* cache, const char* terminal_id, uint8_t term_model, uint8_t table_id, const mm_table_image_t** image);
+void mm_table_cache_release(mm_table_cache_t* cache, const mm_table_image_t* image);
+
+#endif  /* MM_TABLE_CACHE_H_ */
@@ -33,7 +33,7 @@ size_t mm_table_load(mm_context_t *context, uint8_t table_id, uint64_t version_t
     snprintf(sql, sizeof(sql), "SELECT TABLE_DATA from TERMDAT where (TABLE_ID = %d and VERSION_TIMESTAMP = %" PRIu64 ");",
         table_id, version_timestamp);
 
-    blob_len = mm_sql_read_blob(context->database, sql, buffer, buflen);
+    blob_len = mm_sql_read_blob(context->manager->database, sql, buffer, buflen);
 
     return blob_len;
 }
@@ -50,7 +50,7 @@ int mm_table_save(mm_context_t* context, uint8_t table_id, uint64_t version_time
 
     buffer[0] = table_id;
 
-    rc = mm_sql_write_blob(context->database, sql, buffer, buflen);
+    rc = mm_sql_write_blob(context->manager->database, sql, buffer, buflen);
 
     if (rc != 0) {
         fprintf(stderr, "%s: Error writing table %d, version %" PRIu64 "\n", __func__, table_id, version_timestamp);
@@ -0,0 +1,90 @@
+/*
+ * Terminal type lookup by control ROM edition, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mm_manager.h"
+#include "mm_termtyp.h"
+
+#define TERMTYP_MAP_SIZE    512     /* Slots, a power of two; about twice the known editions. */
+
+struct mm_termtyp_map {
+    int count;
+    struct {
+        char control_rom_edition[8];    /* Empty slot if control_rom_edition[0] == '\0' */
+        uint8_t terminal_type;
+    } slot[TERMTYP_MAP_SIZE];
+};
+
+static unsigned int termtyp_map_slot(const char *control_rom_edition) {
+    char key[8] = { 0 };
+
+    strncpy(key, control_rom_edition, sizeof(key) - 1);
+
+    return (unsigned int)fnv1a64(FNV1A64_INIT, (const uint8_t *)key, sizeof(key)) & (TERMTYP_MAP_SIZE - 1);
+}
+
+mm_termtyp_map_t* mm_termtyp_map_init(void) {
+    mm_termtyp_map_t* map = (mm_termtyp_map_t*)calloc(1, sizeof(mm_termtyp_map_t));
+
+    if (map == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_termtyp_map_t));
+    }
+
+    return map;
+}
+
+void mm_termtyp_map_free(mm_termtyp_map_t* map) {
+    free(map);
+}
+
+void mm_termtyp_map_clear(mm_termtyp_map_t *map) {
+    memset(map, 0, sizeof(mm_termtyp_map_t));
+}
+
+int mm_termtyp_map_add(mm_termtyp_map_t *map, const char *control_rom_edition, uint8_t terminal_type) {
+    unsigned int i = termtyp_map_slot(control_rom_edition);
+
+    /* Keep at least one slot empty, so lookups always terminate. */
+    for (;;) {
+        if (map->slot[i].control_rom_edition[0] == '\0') {
+            if (map->count >= TERMTYP_MAP_SIZE - 1) {
+                return -ENOSPC;
+            }
+            snprintf(map->slot[i].control_rom_edition, sizeof(map->slot[i].control_rom_edition), "%s", control_rom_edition);
+            map->count++;
+            break;
+        }
+
+        if (strncmp(map->slot[i].control_rom_edition, control_rom_edition, sizeof(map->slot[i].control_rom_edition) - 1) == 0) {
+            break;
+        }
+
+        i = (i + 1) & (TERMTYP_MAP_SIZE - 1);
+    }
+
+    map->slot[i].terminal_type = terminal_type;
+    return 0;
+}
+
+uint8_t mm_termtyp_map_lookup(const mm_termtyp_map_t *map, const char *control_rom_edition) {
+    unsigned int i = termtyp_map_slot(control_rom_edition);
+
+    while (map->slot[i].control_rom_edition[0] != '\0') {
+        if (strncmp(map->slot[i].control_rom_edition, control_rom_edition, sizeof(map->slot[i].control_rom_edition) - 1) == 0) {
+            return map->slot[i].terminal_type;
+        }
+        i = (i + 1) & (TERMTYP_MAP_SIZE - 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Terminal type lookup by control ROM edition, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_TERMTYP_H_
+#define MM_TERMTYP_H_
+
+#include <stdint.h>
+
+/*
+ * An open-addressed hash table of control ROM editions, so the terminal
+ * type of a SW version message is found without querying the database.
+ * The manager fills it from TERMTYP; it needs nothing but mm_util, so
+ * the table tools can fill one from any other source.
+ */
+typedef struct mm_termtyp_map mm_termtyp_map_t;
+
+mm_termtyp_map_t* mm_termtyp_map_init(void);
+void mm_termtyp_map_free(mm_termtyp_map_t* map);
+
+void mm_termtyp_map_clear(mm_termtyp_map_t* map);
+
+/* Add or replace a control ROM edition.  Returns -ENOSPC if the map is full. */
+int mm_termtyp_map_add(mm_termtyp_map_t* map, const char* control_rom_edition, uint8_t terminal_type);
+
+/* Returns the terminal type, or 0 (MTR_UNKNOWN) if the edition is not known. */
+uint8_t mm_termtyp_map_lookup(const mm_termtyp_map_t* map, const char* control_rom_edition);
+
+#endif  /* MM_TERMTYP_H_ */
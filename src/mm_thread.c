@@ -0,0 +1,169 @@
+/*
+ * POSIX/Win32 thread wrappers, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mm_thread.h"
+
+#ifdef _WIN32
+typedef struct mm_thread_start {
+    mm_thread_func_t func;
+    void* arg;
+} mm_thread_start_t;
+
+static DWORD WINAPI mm_thread_trampoline(LPVOID param) {
+    mm_thread_start_t start = *(mm_thread_start_t*)param;
+
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+int mm_thread_create(mm_thread_t* thread, mm_thread_func_t func, void* arg) {
+    mm_thread_start_t* start;
+
+    start = (mm_thread_start_t*)calloc(1, sizeof(mm_thread_start_t));
+    if (start == NULL) {
+        return -ENOMEM;
+    }
+
+    start->func = func;
+    start->arg = arg;
+
+    *thread = CreateThread(NULL, 0, mm_thread_trampoline, start, 0, NULL);
+    if (*thread == NULL) {
+        fprintf(stderr, "%s: CreateThread() failed: %lu\n", __func__, GetLastError());
+        free(start);
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+int mm_thread_join(mm_thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    return 0;
+}
+
+int mm_mutex_init(mm_mutex_t* mutex) {
+    InitializeCriticalSection(mutex);
+    return 0;
+}
+
+void mm_mutex_destroy(mm_mutex_t* mutex) {
+    DeleteCriticalSection(mutex);
+}
+
+void mm_mutex_lock(mm_mutex_t* mutex) {
+    EnterCriticalSection(mutex);
+}
+
+void mm_mutex_unlock(mm_mutex_t* mutex) {
+    LeaveCriticalSection(mutex);
+}
+
+int mm_cond_init(mm_cond_t* cond) {
+    InitializeConditionVariable(cond);
+    return 0;
+}
+
+void mm_cond_destroy(mm_cond_t* cond) {
+    (void)cond;
+}
+
+void mm_cond_wait(mm_cond_t* cond, mm_mutex_t* mutex) {
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+/* Returns -ETIMEDOUT if not signalled within timeout_ms. */
+int mm_cond_timedwait(mm_cond_t* cond, mm_mutex_t* mutex, unsigned int timeout_ms) {
+    if (!SleepConditionVariableCS(cond, mutex, timeout_ms)) {
+        return (GetLastError() == ERROR_TIMEOUT) ? -ETIMEDOUT : -EINVAL;
+    }
+    return 0;
+}
+
+void mm_cond_signal(mm_cond_t* cond) {
+    WakeConditionVariable(cond);
+}
+
+void mm_cond_broadcast(mm_cond_t* cond) {
+    WakeAllConditionVariable(cond);
+}
+#else  /* ifdef _WIN32 */
+int mm_thread_create(mm_thread_t* thread, mm_thread_func_t func, void* arg) {
+    int status;
+
+    status = pthread_create(thread, NULL, func, arg);
+    if (status != 0) {
+        fprintf(stderr, "%s: pthread_create() failed: %d\n", __func__, status);
+        return -status;
+    }
+
+    return 0;
+}
+
+int mm_thread_join(mm_thread_t thread) {
+    return -pthread_join(thread, NULL);
+}
+
+int mm_mutex_init(mm_mutex_t* mutex) {
+    return -pthread_mutex_init(mutex, NULL);
+}
+
+void mm_mutex_destroy(mm_mutex_t* mutex) {
+    pthread_mutex_destroy(mutex);
+}
+
+void mm_mutex_lock(mm_mutex_t* mutex) {
+    pthread_mutex_lock(mutex);
+}
+
+void mm_mutex_unlock(mm_mutex_t* mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+int mm_cond_init(mm_cond_t* cond) {
+    return -pthread_cond_init(cond, NULL);
+}
+
+void mm_cond_destroy(mm_cond_t* cond) {
+    pthread_cond_destroy(cond);
+}
+
+void mm_cond_wait(mm_cond_t* cond, mm_mutex_t* mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+/* Returns -ETIMEDOUT if not signalled within timeout_ms. */
+int mm_cond_timedwait(mm_cond_t* cond, mm_mutex_t* mutex, unsigned int timeout_ms) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    return -pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
+void mm_cond_signal(mm_cond_t* cond) {
+    pthread_cond_signal(cond);
+}
+
+void mm_cond_broadcast(mm_cond_t* cond) {
+    pthread_cond_broadcast(cond);
+}
+#endif /* _WIN32 */
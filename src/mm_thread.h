@@ -0,0 +1,47 @@
+/*
+ * POSIX/Win32 thread wrappers, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_THREAD_H_
+#define MM_THREAD_H_
+
+#ifdef _WIN32
+# include <windows.h>
+typedef HANDLE mm_thread_t;
+typedef CRITICAL_SECTION mm_mutex_t;
+typedef CONDITION_VARIABLE mm_cond_t;
+#else  /* ifdef _WIN32 */
+# include <pthread.h>
+typedef pthread_t mm_thread_t;
+typedef pthread_mutex_t mm_mutex_t;
+typedef pthread_cond_t mm_cond_t;
+#endif /* _WIN32 */
+
+#ifdef _MSC_VER
+# define MM_THREAD_LOCAL __declspec(thread)
+#else
+# define MM_THREAD_LOCAL __thread
+#endif /* _MSC_VER */
+
+typedef void* (*mm_thread_func_t)(void* arg);
+
+int mm_thread_create(mm_thread_t* thread, mm_thread_func_t func, void* arg);
+int mm_thread_join(mm_thread_t thread);
+
+int mm_mutex_init(mm_mutex_t* mutex);
+void mm_mutex_destroy(mm_mutex_t* mutex);
+void mm_mutex_lock(mm_mutex_t* mutex);
+void mm_mutex_unlock(mm_mutex_t* mutex);
+
+int mm_cond_init(mm_cond_t* cond);
+void mm_cond_destroy(mm_cond_t* cond);
+void mm_cond_wait(mm_cond_t* cond, mm_mutex_t* mutex);
+int mm_cond_timedwait(mm_cond_t* cond, mm_mutex_t* mutex, unsigned int timeout_ms);
+void mm_cond_signal(mm_cond_t* cond);
+void mm_cond_broadcast(mm_cond_t* cond);
+
+#endif  /* MM_THREAD_H_ */
@@ -0,0 +1,91 @@
+/*
+ * Monotonic clock and deadlines, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#endif /* _WIN32 */
+
+#include "mm_timer.h"
+
+uint64_t mm_clock_ms(void) {
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else  /* ifdef _WIN32 */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000) + (uint64_t)(now.tv_nsec / 1000000L);
+#endif /* _WIN32 */
+}
+
+uint64_t mm_clock_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER count;
+    LARGE_INTEGER freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000 / (uint64_t)freq.QuadPart;
+#else  /* ifdef _WIN32 */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000) + (uint64_t)(now.tv_nsec / 1000L);
+#endif /* _WIN32 */
+}
+
+void mm_sleep_ms(uint32_t ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else  /* ifdef _WIN32 */
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+#endif /* _WIN32 */
+}
+
+void mm_deadline_start(mm_deadline_t* deadline, uint32_t timeout_ms) {
+    deadline->expires_ms = mm_clock_ms() + timeout_ms;
+}
+
+void mm_deadline_clear(mm_deadline_t* deadline) {
+    deadline->expires_ms = 0;
+}
+
+int mm_deadline_expired(const mm_deadline_t* deadline) {
+    return (deadline->expires_ms != 0) && (mm_clock_ms() >= deadline->expires_ms);
+}
+
+int mm_deadline_armed(const mm_deadline_t* deadline) {
+    return (deadline->expires_ms != 0);
+}
+
+int mm_deadline_remaining_ms(const mm_deadline_t* deadline, int max_ms) {
+    uint64_t now;
+
+    if (deadline->expires_ms == 0) {
+        return max_ms;
+    }
+
+    now = mm_clock_ms();
+
+    if (now >= deadline->expires_ms) {
+        return 0;
+    }
+
+    return (deadline->expires_ms - now < (uint64_t)max_ms) ? (int)(deadline->expires_ms - now) : max_ms;
+}
@@ -0,0 +1,41 @@
+/*
+ * Monotonic clock and deadlines, part of mm_manager.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#ifndef MM_TIMER_H_
+#define MM_TIMER_H_
+
+#include <stdint.h>
+
+/*
+ * Protocol timeouts are deadlines: absolute times in ms on a clock that is
+ * never set back (CLOCK_MONOTONIC on POSIX), fixed when the wait begins.
+ * A wait made of several shorter waits, or interrupted by stray bytes,
+ * still ends on time.  The same clock backs a timerfd armed with
+ * TFD_TIMER_ABSTIME, should an event loop need to wait on one.
+ */
+typedef struct mm_deadline {
+    uint64_t expires_ms;    /* 0 if the deadline is not set. */
+} mm_deadline_t;
+
+/* Milliseconds since an arbitrary point, from a clock that is never set back. */
+uint64_t mm_clock_ms(void);
+
+/* The same clock in microseconds, for timestamps. */
+uint64_t mm_clock_us(void);
+
+void mm_sleep_ms(uint32_t ms);
+
+void mm_deadline_start(mm_deadline_t* deadline, uint32_t timeout_ms);
+void mm_deadline_clear(mm_deadline_t* deadline);
+int mm_deadline_expired(const mm_deadline_t* deadline);
+int mm_deadline_armed(const mm_deadline_t* deadline);
+
+/* Time left until the deadline, in ms, but no more than max_ms.  An unset deadline leaves max_ms. */
+int mm_deadline_remaining_ms(const mm_deadline_t* deadline, int max_ms);
+
+#endif  /* MM_TIMER_H_ */
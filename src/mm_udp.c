@@ -1,21 +1,32 @@
 /*
- * UDP Packed Send, part of mm_manager.
+ * UDP Packet Mirror, part of mm_manager.
+ *
+ * Frames are sent to every subscriber from the capture thread, a batch at
+ * a time: on Linux with one sendmmsg() per subscriber, elsewhere with a
+ * sendto() per frame.  The socket is non-blocking, so a slow subscriber
+ * loses frames rather than holding up the others.
  *
  * www.github.com/hharte/mm_manager
  *
  * Copyright (c) 2022-2023, Howard M. Harte
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE     /* sendmmsg() */
+#endif  /* __linux__ */
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 
 #ifdef _WIN32
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #include <winsock2.h>
 #pragma comment(lib, "ws2_32.lib")
 #else
-#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
@@ -24,81 +35,233 @@
 #include "mm_manager.h"
 #include "mm_udp.h"
 
-struct sockaddr_in si_src, si_dst;
-SOCKET sock;
+#define MM_UDP_DGRAM_MAX    (MM_UDP_TAG_LEN + 256)
+
+typedef struct mm_udp_subscriber {
+    struct sockaddr_in addr;
+    uint32_t sent;
+    uint32_t dropped;
+} mm_udp_subscriber_t;
+
+struct mm_udp {
+    SOCKET sock;
+    int subscriber_count;
+    mm_udp_subscriber_t subscribers[MM_UDP_MAX_SUBSCRIBERS];
+    uint8_t dgram[MM_UDP_BATCH_MAX][MM_UDP_DGRAM_MAX];
+    size_t dgram_len[MM_UDP_BATCH_MAX];
+};
+
+static int mm_udp_would_block(void) {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS);
+#endif /* _WIN32 */
+}
+
+static void mm_udp_error(const char* func, const char* what) {
+#ifdef _WIN32
+    fprintf(stderr, "%s: %s failed: %d\n", func, what, WSAGetLastError());
+#else
+    fprintf(stderr, "%s: %s failed: %s\n", func, what, strerror(errno));
+#endif /* _WIN32 */
+}
+
+mm_udp_t* mm_udp_open(void) {
+    mm_udp_t* udp;
 
-int mm_create_udp(const char* ip_addr, uint16_t port) {
 #ifdef _WIN32
     WSADATA wsa;
-    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
-    {
+    u_long  nonblocking = 1;
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
         fprintf(stderr, "%s: WSAStartup() Failed. Error Code : %d", __func__, WSAGetLastError());
-        return -1;
+        return NULL;
     }
 #endif /* _WIN32 */
 
-    /* Crate a UDP socket to facilitate live Wireshark capture. */
-    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
-    {
+    udp = (mm_udp_t*)calloc(1, sizeof(mm_udp_t));
+
+    if (udp == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_udp_t));
 #ifdef _WIN32
-        fprintf(stderr, "%s: Failed to create socket: %d\n", __func__, WSAGetLastError());
-#else
-        fprintf(stderr, "%s: Failed to create socket: %s\n", __func__, strerror(errno));
+        WSACleanup();
 #endif /* _WIN32 */
-        mm_close_udp();
-        return -2;
+        return NULL;
     }
 
-    memset((char *) &si_src, 0, sizeof(si_src));
-    si_src.sin_family = AF_INET;
-    si_src.sin_port = htons(port);
-    si_src.sin_addr.s_addr = INADDR_ANY;
-
-    memset((char *) &si_dst, 0, sizeof(si_dst));
-    si_dst.sin_family = AF_INET;
-    si_dst.sin_port = htons(port);
-    si_dst.sin_addr.s_addr = inet_addr(ip_addr);
+    /* Create a UDP socket to facilitate live Wireshark capture. */
+    if ((udp->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+        mm_udp_error(__func__, "socket()");
+        free(udp);
+#ifdef _WIN32
+        WSACleanup();
+#endif /* _WIN32 */
+        return NULL;
+    }
 
-    /* Bind socket to port 27273 "CRASE" */
-    if( bind(sock , (struct sockaddr*)&si_src, sizeof(si_src) ) == SOCKET_ERROR)
-    {
 #ifdef _WIN32
-        fprintf(stderr, "%s: Failed to bind socket: %d\n", __func__, WSAGetLastError());
+    if (ioctlsocket(udp->sock, FIONBIO, &nonblocking) == SOCKET_ERROR) {
 #else
-        fprintf(stderr, "%s: Failed to bind socket: %s\n", __func__, strerror(errno));
+    if (fcntl(udp->sock, F_SETFL, fcntl(udp->sock, F_GETFL, 0) | O_NONBLOCK) < 0) {
 #endif /* _WIN32 */
-        mm_close_udp();
-        return -3;
+        mm_udp_error(__func__, "Setting non-blocking");
+        mm_udp_close(udp);
+        return NULL;
+    }
+
+    return udp;
+}
+
+int mm_udp_add_subscriber(mm_udp_t* udp, const char* address) {
+    mm_udp_subscriber_t* sub;
+    char     host[64];
+    const char* colon;
+    unsigned long port = MM_UDP_PORT;
+
+    if (udp->subscriber_count == MM_UDP_MAX_SUBSCRIBERS) {
+        fprintf(stderr, "%s: At most %d UDP subscribers are supported.\n", __func__, MM_UDP_MAX_SUBSCRIBERS);
+        return -ENOSPC;
+    }
+
+    colon = strrchr(address, ':');
+    if (colon != NULL) {
+        char* end;
+
+        port = strtoul(colon + 1, &end, 10);
+        if ((*end != '\0') || (port == 0) || (port > 65535)) {
+            fprintf(stderr, "%s: Invalid UDP port in '%s'.\n", __func__, address);
+            return -EINVAL;
+        }
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+    } else {
+        snprintf(host, sizeof(host), "%s", address);
+    }
+
+    sub = &udp->subscribers[udp->subscriber_count];
+    memset(sub, 0, sizeof(*sub));
+    sub->addr.sin_family = AF_INET;
+    sub->addr.sin_port = htons((uint16_t)port);
+    sub->addr.sin_addr.s_addr = inet_addr(host);
+
+    if (sub->addr.sin_addr.s_addr == INADDR_NONE) {
+        fprintf(stderr, "%s: Invalid UDP address '%s'.\n", __func__, host);
+        return -EINVAL;
     }
 
+    udp->subscriber_count++;
     return 0;
 }
 
-int mm_udp_send_pkt(int direction, mm_packet_t *pkt) {
-    pkt->hdr.start |= (direction == TX) ? 0x80 : 0;
+/* Send the first count datagrams to sub, returning how many were sent. */
+static int mm_udp_send_batch(mm_udp_t* udp, mm_udp_subscriber_t* sub, int count) {
+    int sent = 0;
 
-    /* Send payload over UDP to 127.0.0.1:27273 to facilitate live Wireshark capture. */
-    if (sendto(sock, (const char *)&pkt->hdr.start, (size_t)pkt->hdr.pktlen + 1, 0, (struct sockaddr *)&si_dst, sizeof(si_dst)) == SOCKET_ERROR)
-    {
-#ifdef _WIN32
-        fprintf(stderr, "%s: sendto() failed: %d\n", __func__, WSAGetLastError());
+#ifdef __linux__
+    struct mmsghdr msgs[MM_UDP_BATCH_MAX];
+    struct iovec   iov[MM_UDP_BATCH_MAX];
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * (size_t)count);
+
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = udp->dgram[i];
+        iov[i].iov_len = udp->dgram_len[i];
+        msgs[i].msg_hdr.msg_name = &sub->addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(sub->addr);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (sent < count) {
+        int result = sendmmsg(udp->sock, &msgs[sent], (unsigned int)(count - sent), 0);
+
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            if (!mm_udp_would_block()) {
+                mm_udp_error(__func__, "sendmmsg()");
+            }
+            break;
+        }
+        sent += result;
+    }
 #else
-        fprintf(stderr, "%s: sendto() failed: %s\n", __func__, strerror(errno));
-#endif /* _WIN32 */
+    for (; sent < count; sent++) {
+        if (sendto(udp->sock, (const char*)udp->dgram[sent], (int)udp->dgram_len[sent], 0,
+                   (struct sockaddr*)&sub->addr, sizeof(sub->addr)) == SOCKET_ERROR) {
+            if (!mm_udp_would_block()) {
+                mm_udp_error(__func__, "sendto()");
+            }
+            break;
+        }
+    }
+#endif /* __linux__ */
+
+    return sent;
+}
+
+int mm_udp_send_frames(mm_udp_t* udp, const mm_udp_frame_t* frames, int count) {
+    if ((udp == NULL) || (udp->subscriber_count == 0)) {
+        return 0;
     }
-    pkt->hdr.start &= 0x7F;
+
+    while (count > 0) {
+        int batch = (count > MM_UDP_BATCH_MAX) ? MM_UDP_BATCH_MAX : count;
+
+        /* Tag each frame once, then send the same datagrams to every subscriber. */
+        for (int i = 0; i < batch; i++) {
+            const mm_udp_frame_t* frame = &frames[i];
+            uint8_t* dgram = udp->dgram[i];
+            uint16_t len = (frame->len > MM_UDP_DGRAM_MAX - MM_UDP_TAG_LEN) ? MM_UDP_DGRAM_MAX - MM_UDP_TAG_LEN : frame->len;
+
+            memset(dgram, 0, MM_UDP_TAG_LEN);
+            dgram[0] = MM_UDP_TAG_MAGIC;
+            dgram[1] = MM_UDP_TAG_VERSION;
+            dgram[2] = frame->line;
+            dgram[3] = (frame->direction == TX) ? MM_UDP_TAG_TX : 0;
+            if (frame->terminal_id != NULL) {
+                memcpy(&dgram[4], frame->terminal_id, strnlen(frame->terminal_id, MM_UDP_TAG_LEN - 4));
+            }
+            memcpy(&dgram[MM_UDP_TAG_LEN], frame->data, len);
+            udp->dgram_len[i] = MM_UDP_TAG_LEN + (size_t)len;
+        }
+
+        for (int s = 0; s < udp->subscriber_count; s++) {
+            mm_udp_subscriber_t* sub = &udp->subscribers[s];
+            int sent = mm_udp_send_batch(udp, sub, batch);
+
+            sub->sent += (uint32_t)sent;
+            sub->dropped += (uint32_t)(batch - sent);
+        }
+
+        frames += batch;
+        count -= batch;
+    }
+
     return 0;
 }
 
-int mm_close_udp(void) {
+void mm_udp_close(mm_udp_t* udp) {
+    if (udp == NULL) {
+        return;
+    }
+
+    for (int s = 0; s < udp->subscriber_count; s++) {
+        mm_udp_subscriber_t* sub = &udp->subscribers[s];
+
+        if (sub->dropped) {
+            fprintf(stderr, "%s: %s:%d: %u of %u frames were dropped.\n", __func__,
+                    inet_ntoa(sub->addr.sin_addr), ntohs(sub->addr.sin_port),
+                    sub->dropped, sub->sent + sub->dropped);
+        }
+    }
+
     /* close UDP socket */
 #ifdef _WIN32
-    closesocket(sock);
+    closesocket(udp->sock);
     WSACleanup();
 #else
-    close(sock);
+    close(udp->sock);
 #endif /* _WIN32 */
 
-    return 0;
+    free(udp);
 }
-
@@ -9,6 +9,8 @@
 #ifndef MM_UDP_H_
 #define MM_UDP_H_
 
+#include <stdint.h>
+
 #ifndef _WIN32
 #define SOCKET          int
 #define INVALID_SOCKET  (-1)
@@ -17,9 +19,40 @@
 
 #define MM_UDP_PORT 27273	/* UDP port to send Millennium packets */
 
-int mm_create_udp(const char* ip_addr, uint16_t port);
-int mm_udp_send_pkt(int direction, mm_packet_t* pkt);
-int mm_close_udp(void);
+#define MM_UDP_MAX_SUBSCRIBERS  8
+#define MM_UDP_BATCH_MAX        64  /* Frames sent in one call */
 
-#endif /* MM_UDP_H_ */
+/*
+ * Each datagram is a tag followed by the frame, with the direction in the
+ * top bit of the start byte:
+ *
+ *   'M', version (1), line, flags (bit 0: sent by the manager), terminal ID (10 digits)
+ */
+#define MM_UDP_TAG_MAGIC        'M'
+#define MM_UDP_TAG_VERSION      1
+#define MM_UDP_TAG_LEN          14
+#define MM_UDP_TAG_TX           0x01
+
+typedef struct mm_udp_frame {
+    uint8_t line;
+    uint8_t direction;
+    const char* terminal_id;
+    const uint8_t* data;
+    uint16_t len;
+} mm_udp_frame_t;
+
+typedef struct mm_udp mm_udp_t;
 
+mm_udp_t* mm_udp_open(void);
+void mm_udp_close(mm_udp_t* udp);
+
+/* Add a subscriber as "<ip address>[:<port>]", MM_UDP_PORT if no port is given. */
+int mm_udp_add_subscriber(mm_udp_t* udp, const char* address);
+
+/*
+ * Send frames to every subscriber, without waiting: frames a subscriber
+ * has no room for are dropped and counted.
+ */
+int mm_udp_send_frames(mm_udp_t* udp, const mm_udp_frame_t* frames, int count);
+
+#endif /* MM_UDP_H_ */
@@ -14,14 +14,51 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h> /* String function definitions */
+#include <errno.h>
 #include <time.h>
 
 #include "mm_manager.h"
 
 #define POLY 0xa001 /* Polynomial to use for CRC-16 calculation */
 
-/* Calculate CRC-16 checksum using 0xA001 polynomial. */
-uint16_t crc16(uint16_t crc, uint8_t *buf, size_t len) {
+typedef uint16_t (*crc16_func_t)(uint16_t crc, const uint8_t *buf, size_t len);
+
+static uint16_t crc16_bitwise(uint16_t crc, const uint8_t *buf, size_t len);
+static uint16_t crc16_slice8(uint16_t crc, const uint8_t *buf, size_t len);
+
+static uint16_t crc16_table[8][256];
+static crc16_func_t crc16_kernel = crc16_bitwise;
+
+/*
+ * Build the CRC-16 lookup tables and switch to the slice-by-8 kernel.
+ *
+ * Call once at startup, before any threads are created.  Until then,
+ * crc16() uses the bit-serial implementation.
+ */
+void crc16_init(void) {
+    int i, slice;
+
+    for (i = 0; i < 256; i++) {
+        uint8_t byte = (uint8_t)i;
+        crc16_table[0][i] = crc16_bitwise(0, &byte, 1);
+    }
+
+    for (slice = 1; slice < 8; slice++) {
+        for (i = 0; i < 256; i++) {
+            uint16_t crc = crc16_table[slice - 1][i];
+            crc16_table[slice][i] = (crc >> 8) ^ crc16_table[0][crc & 0xff];
+        }
+    }
+
+    crc16_kernel = crc16_slice8;
+}
+
+/* Calculate CRC-16 checksum using 0xA001 polynomial.  May be called incrementally. */
+uint16_t crc16(uint16_t crc, const uint8_t *buf, size_t len) {
+    return crc16_kernel(crc, buf, len);
+}
+
+static uint16_t crc16_bitwise(uint16_t crc, const uint8_t *buf, size_t len) {
     while (len--) {
         crc ^= *buf++;
         crc  = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
@@ -36,6 +73,36 @@ uint16_t crc16(uint16_t crc, uint8_t *buf, size_t len) {
     return crc;
 }
 
+/* Eight bytes per step using eight lookup tables, then one table lookup per remaining byte. */
+static uint16_t crc16_slice8(uint16_t crc, const uint8_t *buf, size_t len) {
+    while (len >= 8) {
+        crc = crc16_table[7][(crc ^ buf[0]) & 0xff] ^
+              crc16_table[6][((crc >> 8) ^ buf[1]) & 0xff] ^
+              crc16_table[5][buf[2]] ^
+              crc16_table[4][buf[3]] ^
+              crc16_table[3][buf[4]] ^
+              crc16_table[2][buf[5]] ^
+              crc16_table[1][buf[6]] ^
+              crc16_table[0][buf[7]];
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = (crc >> 8) ^ crc16_table[0][(crc ^ *buf++) & 0xff];
+    }
+    return crc;
+}
+
+/* FNV-1a 64-bit hash, used to detect changes in files and tables.  Start with FNV1A64_INIT. */
+uint64_t fnv1a64(uint64_t hash, const uint8_t *buf, size_t len) {
+    while (len--) {
+        hash ^= *buf++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
 void dump_hex(const uint8_t *data, size_t len) {
     uint8_t  ascii[32] = { 0 };
     uint8_t *pascii    = ascii;
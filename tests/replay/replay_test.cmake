@@ -0,0 +1,42 @@
+# Replay a recorded session through mm_manager in test mode, and compare
+# the -R result with the expected one.
+#
+# cmake -DMM_MANAGER=<mm_manager> -DSOURCE_DIR=<repo> -DSESSION=<name>
+#       -DWORK_DIR=<dir> -P replay_test.cmake
+#
+# tests/replay/<name>.dlog is the session and <name>.json its result.
+# After an intended change in the frames sent, regenerate the result by
+# running the test and copying <dir>/<name>.json over it.
+
+foreach(var MM_MANAGER SOURCE_DIR SESSION WORK_DIR)
+    if(NOT DEFINED ${var})
+        message(FATAL_ERROR "${var} is not set.")
+    endif()
+endforeach()
+
+set(REPLAY_DIR "${SOURCE_DIR}/tests/replay")
+
+# Start from an empty database; the manager reads config/ from its working directory.
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+file(COPY "${SOURCE_DIR}/config" DESTINATION "${WORK_DIR}")
+file(COPY "${REPLAY_DIR}/${SESSION}.dlog" DESTINATION "${WORK_DIR}")
+
+execute_process(
+    COMMAND "${MM_MANAGER}" -q -f "${SESSION}.dlog" -R "${SESSION}.json"
+    WORKING_DIRECTORY "${WORK_DIR}"
+    RESULT_VARIABLE status
+    OUTPUT_FILE "${WORK_DIR}/${SESSION}.out"
+    ERROR_FILE "${WORK_DIR}/${SESSION}.err")
+
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "mm_manager exited with ${status}, see ${WORK_DIR}/${SESSION}.err")
+endif()
+
+execute_process(
+    COMMAND "${CMAKE_COMMAND}" -E compare_files --ignore-eol "${REPLAY_DIR}/${SESSION}.json" "${WORK_DIR}/${SESSION}.json"
+    RESULT_VARIABLE status)
+
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${WORK_DIR}/${SESSION}.json differs from ${REPLAY_DIR}/${SESSION}.json")
+endif()
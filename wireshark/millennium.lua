@@ -376,8 +376,43 @@ end
 
 wtap_encap_table = DissectorTable.get("wtap_encap")
 wtap_encap_table:add(wtap.USER0, millennium_proto)
+
+-- mm_manager tags each packet it sends over UDP with the line and terminal:
+-- 'M', version, line, flags (bit 0: sent by the manager), terminal ID (10 bytes)
+millennium_mirror_proto = Proto("millennium_mirror", "Millennium Mirror")
+
+local vs_mirror_direction = {
+    [0] = "Received",
+    [1] = "Sent"
+}
+
+local f_mirror_version = ProtoField.uint8("millennium_mirror.version", "Version", base.DEC)
+local f_mirror_line = ProtoField.uint8("millennium_mirror.line", "Line", base.DEC)
+local f_mirror_direction = ProtoField.uint8("millennium_mirror.direction", "Direction", base.DEC, vs_mirror_direction, 0x01)
+local f_mirror_termid = ProtoField.string("millennium_mirror.terminal_id", "Terminal ID")
+
+millennium_mirror_proto.fields = { f_mirror_version, f_mirror_line, f_mirror_direction, f_mirror_termid }
+
+local MIRROR_TAG_LEN = 14
+
+function millennium_mirror_proto.dissector(buffer, pinfo, tree)
+    -- Untagged packets are from older versions of mm_manager.
+    if buffer:len() <= MIRROR_TAG_LEN or buffer(0, 1):uint() ~= 0x4D then
+        millennium_proto.dissector(buffer, pinfo, tree)
+        return
+    end
+
+    local t_mirror = tree:add(millennium_mirror_proto, buffer(0, MIRROR_TAG_LEN))
+    t_mirror:add(f_mirror_version, buffer(1, 1))
+    t_mirror:add(f_mirror_line, buffer(2, 1))
+    t_mirror:add(f_mirror_direction, buffer(3, 1))
+    t_mirror:add(f_mirror_termid, buffer(4, 10))
+
+    millennium_proto.dissector(buffer(MIRROR_TAG_LEN):tvb(), pinfo, tree)
+end
+
 udp_table = DissectorTable.get("udp.port")
-udp_table:add(27273, millennium_proto)
+udp_table:add(27273, millennium_mirror_proto)
 
 function crc16(data, length)
     sum = 0x0